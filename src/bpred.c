@@ -18,9 +18,73 @@
  */
 
 #include <m2s.h>
+#include <math.h>
 
 #define BTB_ENTRY(SET, WAY) (&bpred->btb[(SET) * bpred_btb_assoc + (WAY)])
 
+/* Longest global history, and size of the ring of global history bits */
+#define BPRED_HIST_MAX  2048
+#define BPRED_GHIST_WORDS  (BPRED_HIST_MAX * 2 / 64)
+#define BPRED_GHIST_BIT(POS)  ((bpred->ghist[((POS) >> 6) & (BPRED_GHIST_WORDS - 1)] >> ((POS) & 63)) & 1)
+
+/* Folded histories of all tables */
+#define BPRED_FOLD_MAX  (BPRED_TABLE_MAX * 7 + BPRED_SC_TABLES)
+
+/* Field of WIDTH bits at bit SHIFT of a table entry */
+#define BPRED_FIELD(ENTRY, SHIFT, WIDTH)  (((ENTRY) >> (SHIFT)) & ((1ULL << (WIDTH)) - 1))
+#define BPRED_FIELD_SET(ENTRY, SHIFT, WIDTH, VALUE)  ((ENTRY) = ((ENTRY) & \
+	~(((1ULL << (WIDTH)) - 1) << (SHIFT))) | ((uint64_t) (VALUE) << (SHIFT)))
+
+/* TAGE entry: 3-bit counter (taken if >= 4), 2-bit useful counter, and tag */
+#define TAGE_CTR(ENTRY)  BPRED_FIELD(ENTRY, 0, 3)
+#define TAGE_U(ENTRY)  BPRED_FIELD(ENTRY, 3, 2)
+#define TAGE_SET_CTR(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 0, 3, VALUE)
+#define TAGE_SET_U(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 3, 2, VALUE)
+
+/* ITTAGE entry: 2-bit confidence counter, useful bit, target, and tag */
+#define ITTAGE_CTR(ENTRY)  BPRED_FIELD(ENTRY, 0, 2)
+#define ITTAGE_U(ENTRY)  BPRED_FIELD(ENTRY, 2, 1)
+#define ITTAGE_TARGET(ENTRY)  BPRED_FIELD(ENTRY, 3, 32)
+#define ITTAGE_SET_CTR(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 0, 2, VALUE)
+#define ITTAGE_SET_U(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 2, 1, VALUE)
+#define ITTAGE_SET_TARGET(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 3, 32, VALUE)
+
+/* Loop predictor entry. A loop branch goes 'past' times in direction 'dir',
+ * and then once the other way. 'cur' counts the iterations of the current
+ * run, and the entry predicts once 'conf' saturates. Entries with age 0 are
+ * free. */
+#define LOOP_TAG(ENTRY)  BPRED_FIELD(ENTRY, 0, 14)
+#define LOOP_PAST(ENTRY)  BPRED_FIELD(ENTRY, 14, 14)
+#define LOOP_CUR(ENTRY)  BPRED_FIELD(ENTRY, 28, 14)
+#define LOOP_CONF(ENTRY)  BPRED_FIELD(ENTRY, 42, 3)
+#define LOOP_AGE(ENTRY)  BPRED_FIELD(ENTRY, 45, 4)
+#define LOOP_DIR(ENTRY)  BPRED_FIELD(ENTRY, 49, 1)
+#define LOOP_SET_TAG(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 0, 14, VALUE)
+#define LOOP_SET_PAST(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 14, 14, VALUE)
+#define LOOP_SET_CUR(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 28, 14, VALUE)
+#define LOOP_SET_CONF(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 42, 3, VALUE)
+#define LOOP_SET_AGE(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 45, 4, VALUE)
+#define LOOP_SET_DIR(ENTRY, VALUE)  BPRED_FIELD_SET(ENTRY, 49, 1, VALUE)
+#define LOOP_BITS  50
+#define LOOP_ASSOC  4
+#define LOOP_ITER_MAX  ((1 << 14) - 1)
+#define LOOP_CONF_MAX  7
+#define LOOP_AGE_MAX  15
+
+/* Statistical corrector: tables of 6-bit signed counters */
+#define BPRED_SC_LOG_SIZE  10
+#define BPRED_SC_BITS  6
+
+/* Perceptron weights are 8-bit signed */
+#define BPRED_WEIGHT_BITS  8
+
+/* Updates between two agings of the useful counters of TAGE and ITTAGE */
+#define BPRED_U_RESET  (1 << 18)
+
+/* Indirect jumps and calls, whose targets ITTAGE predicts */
+#define BPRED_INDIRECT(UOP)  ((UOP)->mop_opcode == op_jmp_rm32 || \
+	(UOP)->mop_opcode == op_call_rm32)
+
 /* BTB Entry */
 struct btb_entry_t {
 	uint32_t source;  /* eip */
@@ -55,6 +119,33 @@ struct bpred_t {
 	 *   2,3 - Use two-level adaptive predictor */
 	char *choice;
 
+	/* Global history for TAGE-SC-L, the perceptron and ITTAGE. It is a ring
+	 * of bits, with 'ghist_head' the position of the next one, plus a path
+	 * history and the folded histories of all tables. */
+	uint64_t ghist[BPRED_GHIST_WORDS];
+	uint32_t ghist_head;
+	uint32_t phist;
+	uint32_t *fold;
+	uint32_t seed;  /* For allocations */
+
+	/* TAGE-SC-L. The base predictor has bpred_bimod_size 2-bit counters. */
+	uint64_t *tage_base;
+	uint64_t *tage[BPRED_TABLE_MAX];
+	int tage_use_alt;  /* Use the alternate prediction for new entries if >= 0 */
+	uint32_t tage_tick;
+	uint64_t *sc[BPRED_SC_TABLES];
+	int sc_theta, sc_tc;  /* Threshold, and counter to adapt it */
+	uint64_t *loop;
+	int loop_use;  /* Use the loop prediction if >= 0 */
+
+	/* Hashed perceptron */
+	uint64_t *perceptron[BPRED_TABLE_MAX];
+	int perceptron_theta, perceptron_tc;
+
+	/* ITTAGE, with the BTB as base predictor */
+	uint64_t *ittage[BPRED_TABLE_MAX];
+	uint32_t ittage_tick;
+
 	/* Stats */
 	char name[20];
 	uint64_t accesses;
@@ -69,9 +160,16 @@ static enum bpred_kind_enum {
 	bpred_kind_nottaken,
 	bpred_kind_bimod,
 	bpred_kind_twolevel,
-	bpred_kind_comb
+	bpred_kind_comb,
+	bpred_kind_tage,
+	bpred_kind_perceptron
 } bpred_kind = bpred_kind_twolevel;
 
+static enum bpred_indirect_enum {
+	bpred_indirect_btb = 0,
+	bpred_indirect_ittage
+} bpred_indirect = bpred_indirect_btb;
+
 
 static char *bpred_btb = "256:4";
 static uint32_t bpred_btb_sets;
@@ -86,24 +184,240 @@ static uint32_t bpred_level1_size;
 static uint32_t bpred_level2_size;
 static uint32_t bpred_level2_height;
 
+/* Tagged tables of TAGE and ITTAGE (<tables> <log_size> <min_hist> <max_hist> <tag_bits>) */
+struct bpred_tagged_t {
+	int tables;
+	int log_size;
+	int tag_bits;
+	int hist[BPRED_TABLE_MAX];
+	int entry_bits, tag_shift, u_shift, u_bits;
+	int fold;  /* First folded history, three per table (index and tag) */
+};
+
+static uint32_t bpred_tage_param[5] = {12, 10, 4, 640, 12};
+static uint32_t bpred_ittage_param[5] = {8, 9, 4, 300, 11};
+static uint32_t bpred_loop_size = 64;
+static struct bpred_tagged_t bpred_tage_cfg;
+static struct bpred_tagged_t bpred_ittage_cfg;
+
+/* Statistical corrector, with a bias table and tables with global history */
+static int bpred_sc_hist[BPRED_SC_TABLES] = {0, 4, 10, 16};
+static int bpred_sc_fold;
+
+/* Hashed perceptron (<tables> <log_size> <min_hist> <max_hist>). Table 0
+ * is indexed by address only. */
+static uint32_t bpred_perceptron_param[4] = {16, 10, 3, 256};
+static int bpred_perceptron_tables;
+static int bpred_perceptron_log_size;
+static int bpred_perceptron_hist[BPRED_TABLE_MAX];
+static int bpred_perceptron_fold;
+
+/* Folded histories, and whether there is a global history at all */
+static int bpred_history;
+static int bpred_fold_count;
+static int bpred_fold_length[BPRED_FOLD_MAX];
+static int bpred_fold_width[BPRED_FOLD_MAX];
+
+/* Storage budget in bits */
+static uint64_t bpred_direction_bits;
+static uint64_t bpred_tage_bits, bpred_sc_bits, bpred_loop_bits;
+static uint64_t bpred_indirect_bits;
+static uint64_t bpred_btb_bits;
+static uint64_t bpred_ras_bits;
+
+
+/* Bit-packed tables. Entries of up to 63 bits are stored one after the other
+ * in 64-bit words, so an entry may span two words. */
+static uint64_t *bpred_table_create(uint32_t count, int width)
+{
+	return calloc(((uint64_t) count * width + 63) / 64 + 1, sizeof(uint64_t));
+}
+
+
+static uint64_t bpred_table_get(uint64_t *table, uint32_t index, int width)
+{
+	uint64_t bit = (uint64_t) index * width;
+	uint64_t *word = table + (bit >> 6);
+	int shift = bit & 63;
+	uint64_t value;
+
+	value = word[0] >> shift;
+	if (shift + width > 64)
+		value |= word[1] << (64 - shift);
+	return value & ((1ULL << width) - 1);
+}
+
+
+static void bpred_table_set(uint64_t *table, uint32_t index, int width, uint64_t value)
+{
+	uint64_t bit = (uint64_t) index * width;
+	uint64_t *word = table + (bit >> 6);
+	uint64_t mask = (1ULL << width) - 1;
+	int shift = bit & 63;
+
+	value &= mask;
+	word[0] = (word[0] & ~(mask << shift)) | (value << shift);
+	if (shift + width > 64)
+		word[1] = (word[1] & ~(mask >> (64 - shift))) | (value >> (64 - shift));
+}
+
+
+/* Signed counters are stored in two's complement */
+static int bpred_table_get_signed(uint64_t *table, uint32_t index, int width)
+{
+	return (int64_t) (bpred_table_get(table, index, width) << (64 - width)) >> (64 - width);
+}
+
+
+/* Move a signed counter one step towards 'up' or down, saturating */
+static void bpred_table_count(uint64_t *table, uint32_t index, int width, int up)
+{
+	int value = bpred_table_get_signed(table, index, width);
+
+	if (up && value < (1 << (width - 1)) - 1)
+		bpred_table_set(table, index, width, value + 1);
+	if (!up && value > -(1 << (width - 1)))
+		bpred_table_set(table, index, width, value - 1);
+}
+
 
 void bpred_reg_options()
 {
-	static char *bpred_kind_map[] = { "perfect", "taken", "nottaken", "bimod", "twolevel", "comb" };
-	opt_reg_enum("-bpred", "Branch predictor kind {perfect|taken|nottaken|bimod|twolevel|comb}",
-		(int *) &bpred_kind, bpred_kind_map, 6);
+	static char *bpred_kind_map[] = { "perfect", "taken", "nottaken", "bimod", "twolevel", "comb",
+		"tage", "perceptron" };
+	static char *bpred_indirect_map[] = { "btb", "ittage" };
+	opt_reg_enum("-bpred", "Branch predictor kind {perfect|taken|nottaken|bimod|twolevel|comb|tage|perceptron}",
+		(int *) &bpred_kind, bpred_kind_map, 8);
+	opt_reg_enum("-bpred:indirect", "Indirect branch target predictor {btb|ittage}",
+		(int *) &bpred_indirect, bpred_indirect_map, 2);
 	opt_reg_string("-bpred:btb", "BTB configuration (<sets>:<assoc>)", &bpred_btb);
 	opt_reg_uint32("-bpred:ras", "Return address stack size", &bpred_ras_size);
 	opt_reg_uint32("-bpred:bimod", "Number of entries for bimodal predictor", &bpred_bimod_size);
 	opt_reg_uint32_list("-bpred:twolevel", "Two-level adaptive (<l1size> <l2size> <hist_size>)",
 		bpred_twolevel_param, 3, NULL);
 	opt_reg_uint32("-bpred:choice", "Number of entries for choice predictor", &bpred_choice_size);
+	opt_reg_uint32_list("-bpred:tage", "TAGE tagged tables (<tables> <log_size> <min_hist> <max_hist> <tag_bits>)",
+		bpred_tage_param, 5, NULL);
+	opt_reg_uint32("-bpred:loop", "Number of entries for loop predictor of TAGE-SC-L", &bpred_loop_size);
+	opt_reg_uint32_list("-bpred:perceptron", "Hashed perceptron (<tables> <log_size> <min_hist> <max_hist>)",
+		bpred_perceptron_param, 4, NULL);
+	opt_reg_uint32_list("-bpred:ittage", "ITTAGE tagged tables (<tables> <log_size> <min_hist> <max_hist> <tag_bits>)",
+		bpred_ittage_param, 5, NULL);
+}
+
+
+/* Geometric series of 'count' history lengths from 'min' to 'max' */
+static void bpred_hist_lengths(int *hist, int count, int min, int max)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		hist[i] = count == 1 ? min : (int) (min * pow((double) max / min,
+			(double) i / (count - 1)) + 0.5);
+}
+
+
+/* Add a folded history of 'length' bits into 'width' bits */
+static int bpred_fold_add(int length, int width)
+{
+	assert(bpred_fold_count < BPRED_FOLD_MAX);
+	bpred_fold_length[bpred_fold_count] = length;
+	bpred_fold_width[bpred_fold_count] = width;
+	return bpred_fold_count++;
+}
+
+
+/* Check and set up the geometry of TAGE or ITTAGE tagged tables */
+static void bpred_tagged_init(struct bpred_tagged_t *cfg, uint32_t *param, char *name)
+{
+	int i;
+
+	cfg->tables = param[0];
+	cfg->log_size = param[1];
+	cfg->tag_bits = param[4];
+	if (param[0] < 1 || param[0] > BPRED_TABLE_MAX)
+		fatal("%s: number of tables must be >=1 and <=%d", name, BPRED_TABLE_MAX);
+	if (param[1] < 4 || param[1] > 16)
+		fatal("%s: log of table size must be >=4 and <=16", name);
+	if (param[2] < 1 || param[2] > param[3] || param[3] > BPRED_HIST_MAX)
+		fatal("%s: history lengths must be >=1 and <=%d", name, BPRED_HIST_MAX);
+	if (param[4] < 4 || param[4] > 16)
+		fatal("%s: tag size must be >=4 and <=16", name);
+	bpred_hist_lengths(cfg->hist, cfg->tables, param[2], param[3]);
+	cfg->fold = bpred_fold_count;
+	for (i = 0; i < cfg->tables; i++) {
+		bpred_fold_add(cfg->hist[i], cfg->log_size);
+		bpred_fold_add(cfg->hist[i], cfg->tag_bits);
+		bpred_fold_add(cfg->hist[i], cfg->tag_bits - 1);
+	}
+}
+
+
+/* Storage budget of the predictors, in bits */
+static void bpred_storage()
+{
+	struct bpred_tagged_t *cfg;
+	int hist = 0, ras_bits = 0, i;
+
+	/* Direction predictor */
+	switch (bpred_kind) {
+	case bpred_kind_bimod:
+		bpred_direction_bits = 2 * bpred_bimod_size;
+		break;
+	case bpred_kind_twolevel:
+		bpred_direction_bits = (uint64_t) bpred_level1_size * bpred_hist_size +
+			(uint64_t) bpred_level2_size * bpred_level2_height * 2;
+		break;
+	case bpred_kind_comb:
+		bpred_direction_bits = 2 * bpred_bimod_size + 2 * bpred_choice_size +
+			(uint64_t) bpred_level1_size * bpred_hist_size +
+			(uint64_t) bpred_level2_size * bpred_level2_height * 2;
+		break;
+	case bpred_kind_tage:
+		cfg = &bpred_tage_cfg;
+		bpred_tage_bits = 2 * bpred_bimod_size + 4 +
+			((uint64_t) cfg->tables << cfg->log_size) * cfg->entry_bits;
+		bpred_sc_bits = ((uint64_t) BPRED_SC_TABLES << BPRED_SC_LOG_SIZE) * BPRED_SC_BITS + 8 + 6;
+		bpred_loop_bits = (uint64_t) bpred_loop_size * LOOP_BITS + 7;
+		bpred_direction_bits = bpred_tage_bits + bpred_sc_bits + bpred_loop_bits;
+		break;
+	case bpred_kind_perceptron:
+		bpred_direction_bits = ((uint64_t) bpred_perceptron_tables << bpred_perceptron_log_size) *
+			BPRED_WEIGHT_BITS + 8 + 7;
+		break;
+	default:
+		bpred_direction_bits = 0;
+	}
+
+	/* ITTAGE */
+	if (bpred_indirect == bpred_indirect_ittage) {
+		cfg = &bpred_ittage_cfg;
+		bpred_indirect_bits = ((uint64_t) cfg->tables << cfg->log_size) * cfg->entry_bits;
+	}
+
+	/* Global and path history, counted with the direction predictor if it
+	 * uses them */
+	if (bpred_history) {
+		for (i = 0; i < bpred_fold_count; i++)
+			hist = MAX(hist, bpred_fold_length[i]);
+		if (bpred_kind == bpred_kind_tage || bpred_kind == bpred_kind_perceptron)
+			bpred_direction_bits += hist + 16;
+		else
+			bpred_indirect_bits += hist + 16;
+	}
+
+	/* BTB (source, target, and LRU counter) and RAS */
+	bpred_btb_bits = (uint64_t) bpred_btb_sets * bpred_btb_assoc *
+		(64 + log_base2(bpred_btb_assoc));
+	while ((1U << ras_bits) < bpred_ras_size)
+		ras_bits++;
+	bpred_ras_bits = 32 * bpred_ras_size + ras_bits;
 }
 
 
 void bpred_init()
 {
-	int core, thread;
+	int core, thread, i;
 
 	/* Two-level bpred parameters. */
 	bpred_hist_size = bpred_twolevel_param[2];
@@ -129,6 +443,51 @@ void bpred_init()
 		fatal("two-level predictor sizes must be power of 2");
 	if (bpred_level2_size & (bpred_level2_size - 1))
 		fatal("two-level predictor sizes must be power of 2");
+
+	/* TAGE-SC-L */
+	bpred_fold_count = 0;
+	if (bpred_kind == bpred_kind_tage) {
+		bpred_tagged_init(&bpred_tage_cfg, bpred_tage_param, "bpred:tage");
+		bpred_tage_cfg.u_shift = 3;
+		bpred_tage_cfg.u_bits = 2;
+		bpred_tage_cfg.tag_shift = 5;
+		bpred_tage_cfg.entry_bits = 5 + bpred_tage_cfg.tag_bits;
+		bpred_sc_fold = bpred_fold_count;
+		for (i = 0; i < BPRED_SC_TABLES; i++)
+			bpred_fold_add(bpred_sc_hist[i], BPRED_SC_LOG_SIZE);
+		if (bpred_loop_size < LOOP_ASSOC || (bpred_loop_size & (bpred_loop_size - 1)))
+			fatal("bpred:loop must be power of 2 and >=%d", LOOP_ASSOC);
+	}
+
+	/* Hashed perceptron */
+	if (bpred_kind == bpred_kind_perceptron) {
+		bpred_perceptron_tables = bpred_perceptron_param[0];
+		bpred_perceptron_log_size = bpred_perceptron_param[1];
+		if (bpred_perceptron_tables < 2 || bpred_perceptron_tables > BPRED_TABLE_MAX)
+			fatal("bpred:perceptron: number of tables must be >=2 and <=%d", BPRED_TABLE_MAX);
+		if (bpred_perceptron_log_size < 4 || bpred_perceptron_log_size > 16)
+			fatal("bpred:perceptron: log of table size must be >=4 and <=16");
+		if (bpred_perceptron_param[2] < 1 || bpred_perceptron_param[2] > bpred_perceptron_param[3] ||
+			bpred_perceptron_param[3] > BPRED_HIST_MAX)
+			fatal("bpred:perceptron: history lengths must be >=1 and <=%d", BPRED_HIST_MAX);
+		bpred_hist_lengths(bpred_perceptron_hist + 1, bpred_perceptron_tables - 1,
+			bpred_perceptron_param[2], bpred_perceptron_param[3]);
+		bpred_perceptron_fold = bpred_fold_count;
+		for (i = 0; i < bpred_perceptron_tables; i++)
+			bpred_fold_add(bpred_perceptron_hist[i], bpred_perceptron_log_size);
+	}
+
+	/* ITTAGE, not needed by a perfect predictor */
+	if (bpred_indirect == bpred_indirect_ittage && bpred_kind != bpred_kind_perfect) {
+		bpred_tagged_init(&bpred_ittage_cfg, bpred_ittage_param, "bpred:ittage");
+		bpred_ittage_cfg.u_shift = 2;
+		bpred_ittage_cfg.u_bits = 1;
+		bpred_ittage_cfg.tag_shift = 35;
+		bpred_ittage_cfg.entry_bits = 35 + bpred_ittage_cfg.tag_bits;
+	} else
+		bpred_indirect = bpred_indirect_btb;
+	bpred_history = bpred_fold_count > 0;
+	bpred_storage();
 	
 	/* Initialization */
 	FOREACH_CORE FOREACH_THREAD {
@@ -178,6 +537,40 @@ struct bpred_t *bpred_create()
 			bpred->choice[i] = 2;
 	}
 
+	/* Global history */
+	if (bpred_history)
+		bpred->fold = calloc(bpred_fold_count, sizeof(uint32_t));
+	bpred->seed = 1;
+
+	/* TAGE-SC-L. Counters start weakly taken in the base predictor, and
+	 * at 0 elsewhere. */
+	if (bpred_kind == bpred_kind_tage) {
+		bpred->tage_base = bpred_table_create(bpred_bimod_size, 2);
+		for (i = 0; i < bpred_bimod_size; i++)
+			bpred_table_set(bpred->tage_base, i, 2, 2);
+		for (i = 0; i < bpred_tage_cfg.tables; i++)
+			bpred->tage[i] = bpred_table_create(1 << bpred_tage_cfg.log_size,
+				bpred_tage_cfg.entry_bits);
+		for (i = 0; i < BPRED_SC_TABLES; i++)
+			bpred->sc[i] = bpred_table_create(1 << BPRED_SC_LOG_SIZE, BPRED_SC_BITS);
+		bpred->sc_theta = 32;
+		bpred->loop = bpred_table_create(bpred_loop_size, LOOP_BITS);
+	}
+
+	/* Hashed perceptron */
+	if (bpred_kind == bpred_kind_perceptron) {
+		for (i = 0; i < bpred_perceptron_tables; i++)
+			bpred->perceptron[i] = bpred_table_create(1 << bpred_perceptron_log_size,
+				BPRED_WEIGHT_BITS);
+		bpred->perceptron_theta = (214 * (bpred_perceptron_tables + 1) + 2058) / 100;
+	}
+
+	/* ITTAGE */
+	if (bpred_indirect == bpred_indirect_ittage)
+		for (i = 0; i < bpred_ittage_cfg.tables; i++)
+			bpred->ittage[i] = bpred_table_create(1 << bpred_ittage_cfg.log_size,
+				bpred_ittage_cfg.entry_bits);
+
 	/* Allocate BTB and assign lru counters */
 	bpred->btb = calloc(bpred_btb_sets * bpred_btb_assoc, sizeof(struct btb_entry_t));
 	for (i = 0; i < bpred_btb_sets; i++)
@@ -191,6 +584,8 @@ struct bpred_t *bpred_create()
 
 void bpred_free(struct bpred_t *bpred)
 {
+	int i;
+
 	/* Bimodal table */
 	if (bpred_kind == bpred_kind_bimod || bpred_kind == bpred_kind_comb)
 		free(bpred->bimod);
@@ -204,6 +599,18 @@ void bpred_free(struct bpred_t *bpred)
 	/* Choice table */
 	if (bpred_kind == bpred_kind_comb)
 		free(bpred->choice);
+
+	/* TAGE-SC-L, perceptron, and ITTAGE tables */
+	free(bpred->tage_base);
+	free(bpred->loop);
+	for (i = 0; i < BPRED_TABLE_MAX; i++) {
+		free(bpred->tage[i]);
+		free(bpred->perceptron[i]);
+		free(bpred->ittage[i]);
+	}
+	for (i = 0; i < BPRED_SC_TABLES; i++)
+		free(bpred->sc[i]);
+	free(bpred->fold);
 	
 	/* Free */
 	free(bpred->btb);
@@ -212,6 +619,523 @@ void bpred_free(struct bpred_t *bpred)
 }
 
 
+/* Shift a bit into the global history, and update folded histories. Folded
+ * history 'i' is the XOR of the chunks of 'width' bits of the last 'length'
+ * history bits, so it needs the bit that was just pushed and the one that
+ * fell out of the window. */
+static void bpred_history_push(struct bpred_t *bpred, int bit, uint32_t eip)
+{
+	uint32_t head = bpred->ghist_head++;
+	uint64_t *word = &bpred->ghist[(head >> 6) & (BPRED_GHIST_WORDS - 1)];
+	uint32_t value;
+	int i, length, width;
+
+	*word = (*word & ~(1ULL << (head & 63))) | ((uint64_t) bit << (head & 63));
+	for (i = 0; i < bpred_fold_count; i++) {
+		length = bpred_fold_length[i];
+		width = bpred_fold_width[i];
+		value = (bpred->fold[i] << 1) | bit;
+		value ^= BPRED_GHIST_BIT(head - length) << (length % width);
+		value ^= value >> width;
+		bpred->fold[i] = value & ((1 << width) - 1);
+	}
+	bpred->phist = ((bpred->phist << 1) | (eip & 1)) & 0xffff;
+}
+
+
+/* Index into table 'table' of 2^'log_size' entries, from the branch address, a
+ * folded history, and a path history rotated differently for each table. */
+static uint32_t bpred_hash(uint32_t eip, uint32_t fold, uint32_t path, int table, int log_size)
+{
+	uint32_t mask = (1 << log_size) - 1;
+	int rot = table % log_size;
+
+	path = (path ^ (path >> log_size)) & mask;
+	path = ((path << rot) | (path >> (log_size - rot))) & mask;
+	return (eip ^ (eip >> log_size) ^ fold ^ path) & mask;
+}
+
+
+/* Pseudo-random numbers for allocation. The simulator does not use random()
+ * here, so as not to shift the sequence other modules see. */
+static uint32_t bpred_random(struct bpred_t *bpred)
+{
+	bpred->seed = bpred->seed * 1103515245 + 12345;
+	return bpred->seed >> 16;
+}
+
+
+/* Compute indices and tags of the tagged tables of TAGE or ITTAGE, and find
+ * the two hitting tables with longest history. */
+static void bpred_tagged_lookup(struct bpred_t *bpred, uint64_t **table,
+	struct bpred_tagged_t *cfg, struct uop_t *uop)
+{
+	uint32_t *fold, path;
+	uint64_t entry;
+	int i;
+
+	for (i = 0; i < cfg->tables; i++) {
+		fold = &bpred->fold[cfg->fold + i * 3];
+		path = bpred->phist & ((1 << MIN(cfg->hist[i], 16)) - 1);
+		uop->table_index[i] = bpred_hash(uop->eip, fold[0], path, i, cfg->log_size);
+		uop->table_tag[i] = (uop->eip ^ fold[1] ^ (fold[2] << 1)) & ((1 << cfg->tag_bits) - 1);
+	}
+	uop->tage_provider = uop->tage_alt = -1;
+	for (i = cfg->tables - 1; i >= 0; i--) {
+		entry = bpred_table_get(table[i], uop->table_index[i], cfg->entry_bits);
+		if (BPRED_FIELD(entry, cfg->tag_shift, cfg->tag_bits) != uop->table_tag[i])
+			continue;
+		if (uop->tage_provider < 0) {
+			uop->tage_provider = i;
+			continue;
+		}
+		uop->tage_alt = i;
+		break;
+	}
+}
+
+
+/* Entry of table 'i' read at lookup, or -1 if it has been replaced since */
+static int64_t bpred_tagged_entry(uint64_t **table, struct bpred_tagged_t *cfg,
+	struct uop_t *uop, int i)
+{
+	uint64_t entry;
+
+	if (i < 0)
+		return -1;
+	entry = bpred_table_get(table[i], uop->table_index[i], cfg->entry_bits);
+	if (BPRED_FIELD(entry, cfg->tag_shift, cfg->tag_bits) != uop->table_tag[i])
+		return -1;
+	return entry;
+}
+
+
+/* Allocate 'entry' in a table with longer history than 'provider', in the
+ * first one with a useless entry. The search starts one table further at
+ * random, to spread allocations. If all entries are useful, age them. */
+static void bpred_tagged_allocate(struct bpred_t *bpred, uint64_t **table,
+	struct bpred_tagged_t *cfg, struct uop_t *uop, int provider, uint64_t entry)
+{
+	uint64_t victim;
+	int i, start;
+
+	start = provider + 1;
+	if (start < cfg->tables - 1 && (bpred_random(bpred) & 1))
+		start++;
+	for (i = start; i < cfg->tables; i++) {
+		victim = bpred_table_get(table[i], uop->table_index[i], cfg->entry_bits);
+		if (BPRED_FIELD(victim, cfg->u_shift, cfg->u_bits))
+			continue;
+		BPRED_FIELD_SET(entry, cfg->tag_shift, cfg->tag_bits, uop->table_tag[i]);
+		bpred_table_set(table[i], uop->table_index[i], cfg->entry_bits, entry);
+		return;
+	}
+	for (i = provider + 1; i < cfg->tables; i++) {
+		victim = bpred_table_get(table[i], uop->table_index[i], cfg->entry_bits);
+		if (BPRED_FIELD(victim, cfg->u_shift, cfg->u_bits))
+			BPRED_FIELD_SET(victim, cfg->u_shift, cfg->u_bits,
+				BPRED_FIELD(victim, cfg->u_shift, cfg->u_bits) - 1);
+		bpred_table_set(table[i], uop->table_index[i], cfg->entry_bits, victim);
+	}
+}
+
+
+/* Halve the useful counters of all entries, so that stale entries can be
+ * replaced. */
+static void bpred_tagged_age(uint64_t **table, struct bpred_tagged_t *cfg)
+{
+	uint64_t entry;
+	int i, j;
+
+	for (i = 0; i < cfg->tables; i++) {
+		for (j = 0; j < 1 << cfg->log_size; j++) {
+			entry = bpred_table_get(table[i], j, cfg->entry_bits);
+			BPRED_FIELD_SET(entry, cfg->u_shift, cfg->u_bits,
+				BPRED_FIELD(entry, cfg->u_shift, cfg->u_bits) >> 1);
+			bpred_table_set(table[i], j, cfg->entry_bits, entry);
+		}
+	}
+}
+
+
+/* Loop predictor. Entries are found by address in sets of LOOP_ASSOC ways. */
+static void bpred_loop_lookup(struct bpred_t *bpred, struct uop_t *uop)
+{
+	uint32_t set, tag;
+	uint64_t entry;
+	int way;
+
+	set = uop->eip & (bpred_loop_size / LOOP_ASSOC - 1);
+	tag = (uop->eip >> 2) & ((1 << 14) - 1);
+	uop->loop_entry = -1;
+	for (way = 0; way < LOOP_ASSOC; way++) {
+		entry = bpred_table_get(bpred->loop, set * LOOP_ASSOC + way, LOOP_BITS);
+		if (!LOOP_AGE(entry) || LOOP_TAG(entry) != tag)
+			continue;
+		uop->loop_entry = set * LOOP_ASSOC + way;
+		uop->loop_iter = LOOP_CUR(entry);
+		uop->loop_pred = LOOP_CUR(entry) == LOOP_PAST(entry) ?
+			!LOOP_DIR(entry) : LOOP_DIR(entry);
+		uop->loop_valid = LOOP_CONF(entry) == LOOP_CONF_MAX;
+		return;
+	}
+}
+
+
+/* Count the iterations of the current run of a loop, for a branch in the
+ * correct path with outcome 'taken' */
+static void bpred_loop_iterate(struct bpred_t *bpred, struct uop_t *uop, int taken)
+{
+	uint64_t entry;
+
+	entry = bpred_table_get(bpred->loop, uop->loop_entry, LOOP_BITS);
+	LOOP_SET_CUR(entry, LOOP_DIR(entry) == taken ?
+		MIN(LOOP_CUR(entry) + 1, LOOP_ITER_MAX) : 0);
+	bpred_table_set(bpred->loop, uop->loop_entry, LOOP_BITS, entry);
+}
+
+
+/* Train the loop predictor. Entries are allocated when TAGE-SC mispredicts,
+ * assuming the branch just left a loop. */
+static void bpred_loop_update(struct bpred_t *bpred, struct uop_t *uop, int taken)
+{
+	uint32_t set, tag;
+	uint64_t entry;
+	int way, age;
+
+	set = uop->eip & (bpred_loop_size / LOOP_ASSOC - 1);
+	tag = (uop->eip >> 2) & ((1 << 14) - 1);
+
+	/* Entry hit at lookup, if not replaced since */
+	if (uop->loop_entry >= 0) {
+		entry = bpred_table_get(bpred->loop, uop->loop_entry, LOOP_BITS);
+		if (!LOOP_AGE(entry) || LOOP_TAG(entry) != tag)
+			return;
+
+		/* Confident and wrong: free entry */
+		if (uop->loop_valid && uop->loop_pred != taken) {
+			bpred_table_set(bpred->loop, uop->loop_entry, LOOP_BITS, 0);
+			return;
+		}
+
+		/* Correct where TAGE-SC was not */
+		age = LOOP_AGE(entry);
+		if (uop->loop_valid && uop->loop_pred != uop->sc_pred)
+			age = MIN(age + 1, LOOP_AGE_MAX);
+
+		/* Loop exit. The run confirms the iteration count, or replaces it. */
+		if (LOOP_DIR(entry) != taken) {
+			if (LOOP_PAST(entry) == uop->loop_iter) {
+				LOOP_SET_CONF(entry, MIN(LOOP_CONF(entry) + 1, LOOP_CONF_MAX));
+			} else {
+				if (LOOP_PAST(entry))
+					age--;
+				LOOP_SET_PAST(entry, uop->loop_iter);
+				LOOP_SET_CONF(entry, 0);
+			}
+		}
+		LOOP_SET_AGE(entry, age);
+		bpred_table_set(bpred->loop, uop->loop_entry, LOOP_BITS, entry);
+		return;
+	}
+
+	/* Allocate a free way, or age them all */
+	if (uop->sc_pred == taken)
+		return;
+	for (way = 0; way < LOOP_ASSOC; way++) {
+		entry = bpred_table_get(bpred->loop, set * LOOP_ASSOC + way, LOOP_BITS);
+		if (!LOOP_AGE(entry))
+			break;
+	}
+	if (way == LOOP_ASSOC) {
+		for (way = 0; way < LOOP_ASSOC; way++) {
+			entry = bpred_table_get(bpred->loop, set * LOOP_ASSOC + way, LOOP_BITS);
+			LOOP_SET_AGE(entry, LOOP_AGE(entry) - 1);
+			bpred_table_set(bpred->loop, set * LOOP_ASSOC + way, LOOP_BITS,
+				LOOP_AGE(entry) ? entry : 0);
+		}
+		return;
+	}
+	entry = 0;
+	LOOP_SET_TAG(entry, tag);
+	LOOP_SET_AGE(entry, LOOP_AGE_MAX / 2);
+	LOOP_SET_DIR(entry, !taken);
+	bpred_table_set(bpred->loop, set * LOOP_ASSOC + way, LOOP_BITS, entry);
+}
+
+
+/* TAGE-SC-L. TAGE predicts with the tagged table of longest history hit by
+ * the branch, or the alternate prediction if that entry is new. The
+ * statistical corrector can revert the prediction, and the loop predictor
+ * overrides both for loops with a constant iteration count. */
+static void bpred_tage_lookup(struct bpred_t *bpred, struct uop_t *uop)
+{
+	struct bpred_tagged_t *cfg = &bpred_tage_cfg;
+	uint64_t entry;
+	int ctr, conf, sum, i;
+
+	/* TAGE */
+	bpred_tagged_lookup(bpred, bpred->tage, cfg, uop);
+	ctr = bpred_table_get(bpred->tage_base, uop->eip & (bpred_bimod_size - 1), 2);
+	uop->tage_alt_pred = ctr > 1;
+	conf = ctr == 0 || ctr == 3 ? 3 : 1;
+	if (uop->tage_alt >= 0) {
+		entry = bpred_table_get(bpred->tage[uop->tage_alt],
+			uop->table_index[uop->tage_alt], cfg->entry_bits);
+		uop->tage_alt_pred = TAGE_CTR(entry) > 3;
+	}
+	uop->tage_pred = uop->tage_alt_pred;
+	if (uop->tage_provider >= 0) {
+		entry = bpred_table_get(bpred->tage[uop->tage_provider],
+			uop->table_index[uop->tage_provider], cfg->entry_bits);
+		ctr = TAGE_CTR(entry);
+		conf = abs(2 * ctr - 7);
+		if (conf > 1 || bpred->tage_use_alt < 0)
+			uop->tage_pred = ctr > 3;
+	}
+
+	/* Statistical corrector. The sum starts with the TAGE prediction, weighted
+	 * by its confidence. */
+	sum = (uop->tage_pred ? 4 : -4) * (conf + 1);
+	for (i = 0; i < BPRED_SC_TABLES; i++) {
+		uop->sc_index[i] = bpred_hash(uop->eip, bpred->fold[bpred_sc_fold + i],
+			uop->tage_pred, i, BPRED_SC_LOG_SIZE);
+		sum += 2 * bpred_table_get_signed(bpred->sc[i], uop->sc_index[i], BPRED_SC_BITS) + 1;
+	}
+	uop->sc_sum = sum;
+	uop->sc_pred = uop->tage_pred;
+	if ((sum >= 0) != uop->tage_pred && abs(sum) >= bpred->sc_theta)
+		uop->sc_pred = sum >= 0;
+
+	/* Loop predictor */
+	bpred_loop_lookup(bpred, uop);
+	uop->pred = uop->loop_entry >= 0 && uop->loop_valid && bpred->loop_use >= 0 ?
+		uop->loop_pred : uop->sc_pred;
+}
+
+
+static void bpred_tage_update(struct bpred_t *bpred, struct uop_t *uop, int taken)
+{
+	struct bpred_tagged_t *cfg = &bpred_tage_cfg;
+	int64_t entry, alt;
+	uint64_t new_entry;
+	int provider, ctr, u, i, sum;
+
+	/* Loop predictor */
+	bpred_loop_update(bpred, uop, taken);
+	if (uop->loop_entry >= 0 && uop->loop_valid && uop->loop_pred != uop->sc_pred)
+		bpred->loop_use = uop->loop_pred == taken ? MIN(bpred->loop_use + 1, 63) :
+			MAX(bpred->loop_use - 1, -64);
+
+	/* Statistical corrector. It is trained when wrong or not confident, and the
+	 * threshold adapts to how often it is right when reverting TAGE. */
+	sum = uop->sc_sum;
+	if ((sum >= 0) != taken || abs(sum) < bpred->sc_theta)
+		for (i = 0; i < BPRED_SC_TABLES; i++)
+			bpred_table_count(bpred->sc[i], uop->sc_index[i], BPRED_SC_BITS, taken);
+	if ((sum >= 0) != uop->tage_pred) {
+		bpred->sc_tc += (sum >= 0) == taken ? -1 : 1;
+		if (bpred->sc_tc > 31) {
+			bpred->sc_theta = MIN(bpred->sc_theta + 1, 255);
+			bpred->sc_tc = 0;
+		}
+		if (bpred->sc_tc < -32) {
+			bpred->sc_theta = MAX(bpred->sc_theta - 1, 8);
+			bpred->sc_tc = 0;
+		}
+	}
+
+	/* Provider entry, unless replaced after lookup */
+	provider = uop->tage_provider;
+	entry = bpred_tagged_entry(bpred->tage, cfg, uop, provider);
+	if (entry < 0)
+		provider = -1;
+
+	/* Allocate entries on misprediction, unless the provider itself was right */
+	if (uop->tage_pred != taken && provider < cfg->tables - 1 &&
+		(provider < 0 || (TAGE_CTR(entry) > 3) != taken))
+	{
+		new_entry = taken ? 4 : 3;
+		bpred_tagged_allocate(bpred, bpred->tage, cfg, uop, provider, new_entry);
+	}
+
+	/* Base predictor */
+	if (provider < 0) {
+		ctr = bpred_table_get(bpred->tage_base, uop->eip & (bpred_bimod_size - 1), 2);
+		ctr = taken ? MIN(ctr + 1, 3) : MAX(ctr - 1, 0);
+		bpred_table_set(bpred->tage_base, uop->eip & (bpred_bimod_size - 1), 2, ctr);
+	}
+
+	/* Provider. New entries (weak counter) train the choice of the alternate
+	 * prediction, and useful counters follow entries that beat it. */
+	if (provider >= 0) {
+		ctr = TAGE_CTR(entry);
+		u = TAGE_U(entry);
+		if ((ctr == 3 || ctr == 4) && (ctr > 3) != uop->tage_alt_pred)
+			bpred->tage_use_alt = uop->tage_alt_pred == taken ?
+				MIN(bpred->tage_use_alt + 1, 7) : MAX(bpred->tage_use_alt - 1, -8);
+		if ((ctr > 3) != uop->tage_alt_pred)
+			u = (ctr > 3) == taken ? MIN(u + 1, 3) : MAX(u - 1, 0);
+		ctr = taken ? MIN(ctr + 1, 7) : MAX(ctr - 1, 0);
+		TAGE_SET_CTR(entry, ctr);
+		TAGE_SET_U(entry, u);
+		bpred_table_set(bpred->tage[provider], uop->table_index[provider],
+			cfg->entry_bits, entry);
+
+		/* The alternate learns along with entries not yet useful */
+		if (!u) {
+			alt = bpred_tagged_entry(bpred->tage, cfg, uop, uop->tage_alt);
+			if (alt >= 0) {
+				ctr = TAGE_CTR(alt);
+				TAGE_SET_CTR(alt, taken ? MIN(ctr + 1, 7) : MAX(ctr - 1, 0));
+				bpred_table_set(bpred->tage[uop->tage_alt],
+					uop->table_index[uop->tage_alt], cfg->entry_bits, alt);
+			}
+		}
+	}
+
+	/* Aging */
+	if (!(++bpred->tage_tick % BPRED_U_RESET))
+		bpred_tagged_age(bpred->tage, cfg);
+}
+
+
+/* Hashed perceptron. Each table holds weights indexed by a hash of the
+ * address and of a global history segment, and the prediction is the sign
+ * of their sum. */
+static void bpred_perceptron_lookup(struct bpred_t *bpred, struct uop_t *uop)
+{
+	int sum = 0, i;
+
+	for (i = 0; i < bpred_perceptron_tables; i++) {
+		uop->table_index[i] = bpred_hash(uop->eip, bpred->fold[bpred_perceptron_fold + i],
+			bpred->phist & ((1 << MIN(bpred_perceptron_hist[i], 16)) - 1),
+			i, bpred_perceptron_log_size);
+		sum += bpred_table_get_signed(bpred->perceptron[i], uop->table_index[i],
+			BPRED_WEIGHT_BITS);
+	}
+	uop->perceptron_sum = sum;
+	uop->pred = sum >= 0;
+}
+
+
+/* Train weights when wrong or not confident. The threshold adapts so that
+ * both cases are about as frequent. */
+static void bpred_perceptron_update(struct bpred_t *bpred, struct uop_t *uop, int taken)
+{
+	int sum = uop->perceptron_sum, i;
+
+	if ((sum >= 0) == taken && abs(sum) > bpred->perceptron_theta)
+		return;
+	for (i = 0; i < bpred_perceptron_tables; i++)
+		bpred_table_count(bpred->perceptron[i], uop->table_index[i],
+			BPRED_WEIGHT_BITS, taken);
+	if ((sum >= 0) != taken) {
+		if (++bpred->perceptron_tc >= 64) {
+			bpred->perceptron_theta++;
+			bpred->perceptron_tc = 0;
+		}
+	} else if (--bpred->perceptron_tc <= -64) {
+		bpred->perceptron_theta = MAX(bpred->perceptron_theta - 1, 1);
+		bpred->perceptron_tc = 0;
+	}
+}
+
+
+/* ITTAGE. The target comes from the tagged table of longest history hit by
+ * the branch, or from the alternate if the entry has no confidence. */
+static void bpred_ittage_lookup(struct bpred_t *bpred, struct uop_t *uop)
+{
+	struct bpred_tagged_t *cfg = &bpred_ittage_cfg;
+	uint64_t entry;
+	int i;
+
+	bpred_tagged_lookup(bpred, bpred->ittage, cfg, uop);
+	i = uop->tage_provider;
+	if (i < 0)
+		return;
+	entry = bpred_table_get(bpred->ittage[i], uop->table_index[i], cfg->entry_bits);
+	if (!ITTAGE_CTR(entry) && uop->tage_alt >= 0) {
+		i = uop->tage_alt;
+		entry = bpred_table_get(bpred->ittage[i], uop->table_index[i], cfg->entry_bits);
+	}
+	uop->ittage_target = ITTAGE_TARGET(entry);
+}
+
+
+static void bpred_ittage_update(struct bpred_t *bpred, struct uop_t *uop)
+{
+	struct bpred_tagged_t *cfg = &bpred_ittage_cfg;
+	int64_t entry, alt;
+	uint64_t new_entry = 0;
+	int provider, ctr;
+
+	/* Provider entry, unless replaced after lookup */
+	provider = uop->tage_provider;
+	entry = bpred_tagged_entry(bpred->ittage, cfg, uop, provider);
+	if (entry < 0)
+		provider = -1;
+
+	/* Allocate on a wrong target */
+	if (uop->ittage_target != uop->neip && provider < cfg->tables - 1) {
+		ITTAGE_SET_TARGET(new_entry, uop->neip);
+		bpred_tagged_allocate(bpred, bpred->ittage, cfg, uop, provider, new_entry);
+	}
+
+	/* Provider. The target is replaced once the counter drops to 0. The entry
+	 * is useful if right where the alternate was not. */
+	if (provider >= 0) {
+		ctr = ITTAGE_CTR(entry);
+		alt = bpred_tagged_entry(bpred->ittage, cfg, uop, uop->tage_alt);
+		if (alt >= 0 && ITTAGE_TARGET(alt) != ITTAGE_TARGET(entry))
+			ITTAGE_SET_U(entry, ITTAGE_TARGET(entry) == uop->neip);
+		if (ITTAGE_TARGET(entry) == uop->neip)
+			ITTAGE_SET_CTR(entry, MIN(ctr + 1, 3));
+		else if (ctr)
+			ITTAGE_SET_CTR(entry, ctr - 1);
+		else
+			ITTAGE_SET_TARGET(entry, uop->neip);
+		bpred_table_set(bpred->ittage[provider], uop->table_index[provider],
+			cfg->entry_bits, entry);
+	}
+
+	/* Aging */
+	if (!(++bpred->ittage_tick % BPRED_U_RESET))
+		bpred_tagged_age(bpred->ittage, cfg);
+}
+
+
+/* Read the tables of TAGE-SC-L, the perceptron, or ITTAGE for a branch, and
+ * shift it into the global history. As for the RAS, only branches in the
+ * correct path shift the history, with their actual outcome, so it needs no
+ * repair at recovery. Conditional branches shift their direction, and
+ * indirect branches a bit of their target. */
+static void bpred_history_lookup(struct bpred_t *bpred, struct uop_t *uop)
+{
+	int cond = UOP_HOT(uop, flags) & FCOND;
+	int taken;
+
+	uop->table_lookup = 1;
+	uop->loop_entry = -1;
+	if (cond && bpred_kind == bpred_kind_tage)
+		bpred_tage_lookup(bpred, uop);
+	if (cond && bpred_kind == bpred_kind_perceptron)
+		bpred_perceptron_lookup(bpred, uop);
+	if (!cond && bpred_indirect == bpred_indirect_ittage && BPRED_INDIRECT(uop))
+		bpred_ittage_lookup(bpred, uop);
+
+	if (UOP_HOT(uop, specmode))
+		return;
+	if (cond) {
+		taken = uop->neip != uop->eip + uop->mop_size;
+		if (uop->loop_entry >= 0)
+			bpred_loop_iterate(bpred, uop, taken);
+		bpred_history_push(bpred, taken, uop->eip);
+	} else if (BPRED_INDIRECT(uop))
+		bpred_history_push(bpred, (uop->neip ^ (uop->neip >> 4)) & 1, uop->eip);
+}
+
+
 /* Return prediction for an address (0=not taken, 1=taken) */
 int bpred_lookup(struct bpred_t *bpred, struct uop_t *uop)
 {
@@ -219,8 +1143,10 @@ int bpred_lookup(struct bpred_t *bpred, struct uop_t *uop)
 	 * provides information about the branch, i.e., target address and whether it
 	 * is a call, ret, jump, or conditional branch. Thus, branches other than
 	 * conditional ones are always predicted taken. */
-	assert(uop->flags & FCTRL);
-	if ((uop->flags & FCALL) || (uop->flags & FRET) || !(uop->flags & FCOND)) {
+	assert(UOP_HOT(uop, flags) & FCTRL);
+	if (bpred_history && !uop->table_lookup)
+		bpred_history_lookup(bpred, uop);
+	if ((UOP_HOT(uop, flags) & (FCALL | FRET)) || !(UOP_HOT(uop, flags) & FCOND)) {
 		uop->pred = 1;
 		return 1;
 	}
@@ -262,6 +1188,8 @@ int bpred_lookup(struct bpred_t *bpred, struct uop_t *uop)
 		uop->pred = uop->choice_pred ? uop->twolevel_pred : uop->bimod_pred;
 	}
 
+	/* TAGE-SC-L and perceptron predicted with the global history above */
+
 	/* Return prediction */
 	assert(!uop->pred || uop->pred == 1);
 	return uop->pred;
@@ -308,19 +1236,24 @@ void bpred_update(struct bpred_t *bpred, struct uop_t *uop)
 	char *pctr;  /* pointer to 2-bit counter */
 	uint32_t *pbhr;  /* pointer to branch history register */
 
-	assert(!uop->specmode);
-	assert(uop->flags & FCTRL);
+	assert(!UOP_HOT(uop, specmode));
+	assert(UOP_HOT(uop, flags) & FCTRL);
 	taken = uop->neip != uop->eip + uop->mop_size;
 
 	/* Stats */
 	bpred->accesses++;
 	if (uop->neip == uop->pred_neip)
 		bpred->hits++;
+
+	/* Indirect target predictor */
+	if (bpred_indirect == bpred_indirect_ittage && uop->table_lookup &&
+		!(UOP_HOT(uop, flags) & FCOND) && BPRED_INDIRECT(uop))
+		bpred_ittage_update(bpred, uop);
 	
 	/* Update predictors. This is only done for conditional branches. Thus,
 	 * exit now if instruction is a call, ret, or jmp.
 	 * No update is performed in a perfect branch predictor either. */
-	if ((uop->flags & FCALL) || (uop->flags & FRET) || !(uop->flags & FCOND)
+	if ((UOP_HOT(uop, flags) & (FCALL | FRET)) || !(UOP_HOT(uop, flags) & FCOND)
 		|| bpred_kind == bpred_kind_perfect)
 		return;
 	
@@ -352,6 +1285,12 @@ void bpred_update(struct bpred_t *bpred, struct uop_t *uop)
 		pctr = &bpred->choice[uop->choice_index];
 		*pctr = uop->bimod_pred == taken ? MAX(*pctr - 1, 0) : MIN(*pctr + 1, 3);
 	}
+
+	/* TAGE-SC-L and perceptron */
+	if (bpred_kind == bpred_kind_tage && uop->table_lookup)
+		bpred_tage_update(bpred, uop, taken);
+	if (bpred_kind == bpred_kind_perceptron && uop->table_lookup)
+		bpred_perceptron_update(bpred, uop, taken);
 }
 
 
@@ -365,10 +1304,14 @@ uint32_t bpred_btb_lookup(struct bpred_t *bpred, struct uop_t *uop)
 	int hit = 0;
 
 	/* Perfect branch predictor */
-	assert(uop->flags & FCTRL);
+	assert(UOP_HOT(uop, flags) & FCTRL);
 	if (bpred_kind == bpred_kind_perfect)
 		return uop->neip;
 
+	/* Branches enter the global history as soon as the BTB is read */
+	if (bpred_history && !uop->table_lookup)
+		bpred_history_lookup(bpred, uop);
+
 	/* Search address in BTB */
 	set = uop->eip & (bpred_btb_sets - 1);
 	for (way = 0; way < bpred_btb_assoc; way++) {
@@ -379,18 +1322,22 @@ uint32_t bpred_btb_lookup(struct bpred_t *bpred, struct uop_t *uop)
 		hit = 1;
 		break;
 	}
+
+	/* Target of indirect branch from ITTAGE */
+	if (hit && uop->ittage_target)
+		target = uop->ittage_target;
 	
 	/* If there was a hit, we know whether branch is a call.
 	 * In this case, push return address into RAS. To avoid
 	 * updates at recovery, do it only for non-spec instructions. */
-	if (hit && (uop->flags & FCALL) && !uop->specmode) {
+	if (hit && (UOP_HOT(uop, flags) & FCALL) && !UOP_HOT(uop, specmode)) {
 		bpred->ras[bpred->ras_idx] = uop->eip + uop->mop_size;
 		bpred->ras_idx = (bpred->ras_idx + 1) % bpred_ras_size;
 	}
 
 	/* If there was a hit, we know whether branch is a ret. In this case,
 	 * pop target from the RAS, and ignore target obtained from BTB. */
-	if (hit && (uop->flags & FRET) && !uop->specmode) {
+	if (hit && (UOP_HOT(uop, flags) & FRET) && !UOP_HOT(uop, specmode)) {
 		bpred->ras_idx = (bpred->ras_idx + bpred_ras_size - 1) % bpred_ras_size;
 		target = bpred->ras[bpred->ras_idx];
 	}
@@ -404,11 +1351,21 @@ uint32_t bpred_btb_lookup(struct bpred_t *bpred, struct uop_t *uop)
 void bpred_btb_update(struct bpred_t *bpred, struct uop_t *uop)
 {
 	struct btb_entry_t *entry, *found = NULL;
+	uint32_t target;
 	int way, set;
 
 	/* No update for perfect branch predictor */
 	if (bpred_kind == bpred_kind_perfect)
 		return;
+
+	/* With the TAGE and perceptron predictors, conditional branches keep
+	 * their taken target, even when not taken, since the BTB target is only
+	 * used when predicted taken. The other predictors keep the target of
+	 * the last outcome. */
+	target = uop->neip;
+	if ((bpred_kind == bpred_kind_tage || bpred_kind == bpred_kind_perceptron) &&
+		(UOP_HOT(uop, flags) & FCOND) && uop->target_neip)
+		target = uop->target_neip;
 	
 	/* Search address in BTB */
 	set = uop->eip & (bpred_btb_sets - 1);
@@ -428,7 +1385,7 @@ void bpred_btb_update(struct bpred_t *bpred, struct uop_t *uop)
 			if (entry->counter < 0) {
 				entry->counter = bpred_btb_assoc - 1;
 				entry->source = uop->eip;
-				entry->target = uop->neip;
+				entry->target = target;
 			}
 		}
 	}
@@ -441,7 +1398,7 @@ void bpred_btb_update(struct bpred_t *bpred, struct uop_t *uop)
 				entry->counter--;
 		}
 		found->counter = bpred_btb_assoc - 1;
-		found->target = uop->neip;
+		found->target = target;
 	}
 }
 
@@ -470,3 +1427,42 @@ uint32_t bpred_btb_next_branch(struct bpred_t *bpred, uint32_t eip, uint32_t bsi
 	return 0;
 }
 
+
+
+/* Look up and update the predictor for a branch run functionally, as fetch
+ * and commit would, without counting it in the statistics. */
+void bpred_warm(struct bpred_t *bpred, struct uop_t *uop)
+{
+	uint64_t accesses = bpred->accesses, hits = bpred->hits;
+	uint32_t target;
+
+	target = bpred_btb_lookup(bpred, uop);
+	uop->pred_neip = target && bpred_lookup(bpred, uop) ?
+		target : uop->eip + uop->mop_size;
+	bpred_update(bpred, uop);
+	bpred_btb_update(bpred, uop);
+	bpred->accesses = accesses;
+	bpred->hits = hits;
+}
+
+
+/* Storage budget of the predictor, in bits */
+void bpred_dump_report(struct bpred_t *bpred, FILE *f)
+{
+	uint64_t total;
+
+	total = bpred_direction_bits + bpred_indirect_bits + bpred_btb_bits + bpred_ras_bits;
+	fprintf(f, "# Branch predictor (storage in bits)\n");
+	fprintf(f, "BranchPredictor.DirectionBits = %lld\n", (long long) bpred_direction_bits);
+	if (bpred_kind == bpred_kind_tage) {
+		fprintf(f, "BranchPredictor.TageBits = %lld\n", (long long) bpred_tage_bits);
+		fprintf(f, "BranchPredictor.SCBits = %lld\n", (long long) bpred_sc_bits);
+		fprintf(f, "BranchPredictor.LoopBits = %lld\n", (long long) bpred_loop_bits);
+	}
+	if (bpred_indirect == bpred_indirect_ittage)
+		fprintf(f, "BranchPredictor.ITTageBits = %lld\n", (long long) bpred_indirect_bits);
+	fprintf(f, "BranchPredictor.BTBBits = %lld\n", (long long) bpred_btb_bits);
+	fprintf(f, "BranchPredictor.RASBits = %lld\n", (long long) bpred_ras_bits);
+	fprintf(f, "BranchPredictor.StorageKB = %.2f\n", (double) total / 8 / 1024);
+	fprintf(f, "\n");
+}
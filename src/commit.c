@@ -42,13 +42,9 @@ static int can_commit_thread(int core, int thread)
 	assert(uop_exists(uop));
 	assert(uop->core == core && uop->thread == thread);
 
-	/* Stores must be ready. Update here 'uop->ready' flag for efficiency,
-	 * if the call to 'rf_ready' shows input registers to be ready. */
-	if (uop->flags & FSTORE) {
-		if (!uop->ready && rf_ready(uop))
-			uop->ready = 1;
-		return uop->ready;
-	}
+	/* Stores must be ready. */
+	if (UOP_HOT(uop, flags) & FSTORE)
+		return UOP_HOT(uop, ready);
 	
 	/* Instructions other than stores must be completed. */
 	return uop->completed;
@@ -61,10 +57,6 @@ static void commit_thread(int core, int thread, int quant)
 	struct uop_t *uop;
 	int recover = 0;
 
-	/* Update pipeline debugger with ready stores */
-	if (esim_debug_file)
-		uop_lnlist_check_if_ready(THREAD.sq);
-	
 	/* Commit stage for thread */
 	assert(ctx);
 	while (quant && can_commit_thread(core, thread)) {
@@ -78,15 +70,15 @@ static void commit_thread(int core, int thread, int quant)
 		
 		/* Mispredicted branch */
 		if (p_recover_kind == p_recover_kind_commit &&
-			(uop->flags & FCTRL) && uop->neip != uop->pred_neip)
+			(UOP_HOT(uop, flags) & FCTRL) && uop->neip != uop->pred_neip)
 			recover = 1;
 	
 		/* Free physical registers */
-		assert(!uop->specmode);
+		assert(!UOP_HOT(uop, specmode));
 		rf_commit(uop);
 		
 		/* Branches update branch predictor and btb */
-		if (uop->flags & FCTRL) {
+		if (UOP_HOT(uop, flags) & FCTRL) {
 			bpred_update(THREAD.bpred, uop);
 			bpred_btb_update(THREAD.bpred, uop);
 			THREAD.btb_writes++;
@@ -100,26 +92,23 @@ static void commit_thread(int core, int thread, int quant)
 		THREAD.last_commit_cycle = sim_cycle;
 		THREAD.committed[uop->uop]++;
 		CORE.committed[uop->uop]++;
-		p->committed[uop->uop]++;
-		sim_inst++;
+		CORE.inst++;
 		if (uop->fetch_tcache)
 			THREAD.tcache->committed++;
-		if (uop->flags & FCTRL) {
+		if (UOP_HOT(uop, flags) & FCTRL) {
 			THREAD.branches++;
 			CORE.branches++;
-			p->branches++;
 			if (uop->neip != uop->pred_neip) {
 				THREAD.mispred++;
 				CORE.mispred++;
-				p->mispred++;
 			}
 		}
 
 		/* Debug */
 		esim_debug("uop action=\"update\", core=%d, seq=%llu, stg_commit=1\n",
-			uop->core, (long long unsigned) uop->di_seq);
+			uop->core, (long long unsigned) UOP_HOT(uop, di_seq));
 		esim_debug("uop action=\"destroy\", core=%d, seq=%llu\n",
-			uop->core, (long long unsigned) uop->di_seq);
+			uop->core, (long long unsigned) UOP_HOT(uop, di_seq));
 		
 		/* Retire instruction */
 		rob_remove_head(core, thread);
@@ -137,7 +126,8 @@ static void commit_thread(int core, int thread, int quant)
 
 	/* If context eviction signal is activated and pipeline is empty,
 	 * deallocate context. */
-	if (ctx->dealloc_signal && p_pipeline_empty(core, thread))
+	if (ctx->dealloc_signal && p_pipeline_empty(core, thread) &&
+		!parallel_defer(core, thread, parallel_action_unmap))
 		p_unmap_context(core, thread);
 }
 
@@ -179,6 +169,23 @@ void commit_core(int core)
 }
 
 
+/* Return true if no thread can commit */
+int commit_idle(int core)
+{
+	struct uop_t *uop;
+	int thread;
+
+	FOREACH_THREAD {
+		if (!rob_can_dequeue(core, thread))
+			continue;
+		uop = rob_head(core, thread);
+		if (UOP_HOT(uop, flags) & FSTORE ? UOP_HOT(uop, ready) : uop->completed)
+			return 0;
+	}
+	return 1;
+}
+
+
 void p_commit()
 {
 	int core;
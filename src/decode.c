@@ -64,7 +64,26 @@ static void decode_thread(int core, int thread)
 }
 
 
-static void decode_core(int core)
+/* Return true if no thread can decode until an instruction cache
+ * access finishes. */
+int decode_idle(int core)
+{
+	struct uop_t *uop;
+	int thread;
+
+	FOREACH_THREAD {
+		uop = list_get(THREAD.fetchq, 0);
+		if (!uop || list_count(THREAD.uopq) >= uopq_size)
+			continue;
+		if (uop->fetch_tcache || !cache_system_pending_access(core, thread,
+			cache_kind_inst, uop->fetch_access))
+			return 0;
+	}
+	return 1;
+}
+
+
+void decode_core(int core)
 {
 	int thread;
 	FOREACH_THREAD
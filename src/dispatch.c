@@ -36,9 +36,9 @@ static enum di_stall_enum can_dispatch_thread(int core, int thread)
 	/* If iq/lq/sq/rob full, done */
 	if (!rob_can_enqueue(uop))
 		return di_stall_rob;
-	if (!(uop->flags & FMEM) && !iq_can_insert(uop))
+	if (!(UOP_HOT(uop, flags) & FMEM) && !iq_can_insert(uop))
 		return di_stall_iq;
-	if ((uop->flags & FMEM) && !lsq_can_insert(uop))
+	if ((UOP_HOT(uop, flags) & FMEM) && !lsq_can_insert(uop))
 		return di_stall_lsq;
 	if (!rf_can_rename(uop))
 		return di_stall_rename;
@@ -51,6 +51,7 @@ static int dispatch_thread(int core, int thread, int quant)
 {
 	struct uop_t *uop;
 	enum di_stall_enum stall;
+	char name[40], *mop_name;
 
 	while (quant) {
 		
@@ -68,6 +69,7 @@ static int dispatch_thread(int core, int thread, int quant)
 		
 		/* Rename */
 		rf_rename(uop);
+		UOP_HOT(uop, di_seq) = ++CORE.di_seq;
 		
 		/* Insert in ROB */
 		rob_enqueue(uop);
@@ -75,34 +77,41 @@ static int dispatch_thread(int core, int thread, int quant)
 		THREAD.rob_writes++;
 		
 		/* Non memory instruction into IQ */
-		if (!(uop->flags & FMEM)) {
+		if (!(UOP_HOT(uop, flags) & FMEM)) {
 			iq_insert(uop);
 			CORE.iq_writes++;
 			THREAD.iq_writes++;
 		}
 		
 		/* Memory instructions into the LSQ */
-		if (uop->flags & FMEM) {
+		if (UOP_HOT(uop, flags) & FMEM) {
 			lsq_insert(uop);
 			CORE.lsq_writes++;
 			THREAD.lsq_writes++;
 		}
 		
 		/* Another instruction dispatched */
-		uop->di_seq = ++CORE.di_seq;
-		CORE.di_stall[uop->specmode ? di_stall_spec : di_stall_used]++;
+		CORE.di_stall[UOP_HOT(uop, specmode) ? di_stall_spec : di_stall_used]++;
 		THREAD.dispatched[uop->uop]++;
 		CORE.dispatched[uop->uop]++;
-		p->dispatched[uop->uop]++;
 		quant--;
 
-		/* Pipeline debug */
-		esim_debug("uop action=\"create\", core=%d, seq=%llu, name=\"%s\","
-			" mop_name=\"%s\", mop_count=%d, mop_index=%d, spec=%u,"
-			" stg_dispatch=1, in_rob=%u, in_iq=%u, in_lsq=%u\n",
-			uop->core, (long long unsigned) uop->di_seq, uop->name,
-			uop->mop_name, uop->mop_count, uop->mop_index, uop->specmode,
-			!!uop->in_rob, !!uop->in_iq, uop->in_lq || uop->in_sq);
+		/* Pipeline debug. Names are obtained from the opcodes. */
+		if (esim_debug_file) {
+			uop_dump_buf(uop, name, sizeof(name));
+			mop_name = x86_inst_name(uop->mop_opcode);
+			esim_debug("uop action=\"create\", core=%d, seq=%llu, name=\"%s\","
+				" mop_name=\"%s\", mop_count=%d, mop_index=%d, spec=%u,"
+				" stg_dispatch=1, in_rob=%u, in_iq=%u, in_lsq=%u\n",
+				uop->core, (long long unsigned) UOP_HOT(uop, di_seq), name,
+				mop_name ? mop_name : "", uop->mop_count, uop->mop_index,
+				UOP_HOT(uop, specmode), !!uop->in_rob, !!uop->in_iq,
+				uop->in_lq || uop->in_sq);
+		}
+
+		/* Wait for input registers. This might make the uop ready, so
+		 * it comes after its creation in the pipeline debugger. */
+		rf_wait(uop);
 	}
 
 	return quant;
@@ -138,6 +147,39 @@ void dispatch_core(int core)
 }
 
 
+/* Return true if no thread can dispatch */
+int dispatch_idle(int core)
+{
+	int thread;
+
+	FOREACH_THREAD
+		if (can_dispatch_thread(core, thread) == di_stall_used)
+			return 0;
+	return 1;
+}
+
+
+/* Account for 'cycles' skipped cycles in which no thread could dispatch,
+ * as 'dispatch_core' would have done on each of them */
+void dispatch_skip(int core, uint64_t cycles)
+{
+	int thread;
+
+	switch (p_dispatch_kind) {
+
+	case p_dispatch_kind_shared:
+		FOREACH_THREAD
+			CORE.di_stall[can_dispatch_thread(core, thread)] += cycles;
+		break;
+
+	case p_dispatch_kind_timeslice:
+		thread = CORE.dispatch_current;
+		CORE.di_stall[can_dispatch_thread(core, thread)] += cycles * p_dispatch_width;
+		break;
+	}
+}
+
+
 void p_dispatch()
 {
 	int core;
@@ -67,12 +67,14 @@ static struct uop_t *fetch_inst(int core, int thread, int fetch_tcache)
 	/* Functional simulation */
 	THREAD.fetch_eip = THREAD.fetch_neip;
 	ctx_set_eip(ctx, THREAD.fetch_eip);
+	if (!ctx_get_status(ctx, ctx_specmode))
+		p->executed++;
 	ctx_execute_inst(ctx);
 	THREAD.fetch_neip = THREAD.fetch_eip + isa_inst.size;
 
 	/* Split macroinstruction into uops stored in list. */
 	count = list_count(fetchq);
-	ret = uop_decode(fetchq);
+	ret = uop_decode(fetchq, core);
 	newcount = list_count(fetchq);
 
 	/* Check that at least one instruction was inserted */
@@ -87,7 +89,7 @@ static struct uop_t *fetch_inst(int core, int thread, int fetch_tcache)
 	for (i = count; i < newcount; i++) {
 		uop = list_get(fetchq, i);
 		assert(uop);
-		uop->seq = ++p->seq;
+		UOP_HOT(uop, seq) = ++p->seq;
 		uop->mop_seq = p->seq - i + count;
 		uop->mop_size = isa_inst.size;
 		uop->mop_count = newcount - count;
@@ -98,7 +100,7 @@ static struct uop_t *fetch_inst(int core, int thread, int fetch_tcache)
 		uop->eip = THREAD.fetch_eip;
 		uop->in_fetchq = 1;
 		uop->fetch_tcache = fetch_tcache;
-		uop->specmode = ctx_get_status(ctx, ctx_specmode);
+		UOP_HOT(uop, specmode) = ctx_get_status(ctx, ctx_specmode);
 		uop->fetch_access = THREAD.fetch_access;
 		uop->neip = ctx->regs->eip;
 		uop->pred_neip = THREAD.fetch_neip;
@@ -110,17 +112,11 @@ static struct uop_t *fetch_inst(int core, int thread, int fetch_tcache)
 		rf_count_deps(uop);
 
 		/* Memory access uops */
-		if (uop->flags & FMEM) {
+		if (UOP_HOT(uop, flags) & FMEM) {
 			uop->mem_vtladdr = ctx->mem->last_address;
 			uop->mem_phaddr = mmu_translate(THREAD.ctx->mid, ctx->mem->last_address);
 		}
 
-		/* Store macroinstruction/uop names */
-		uop_dump_buf(uop, uop->name, sizeof(uop->name));
-		if (i == count)
-			x86_inst_dump_buf(&isa_inst, uop->mop_name,
-				sizeof(uop->mop_name));
-
 		/* New uop */
 		p->fetched++;
 		THREAD.fetched++;
@@ -178,7 +174,7 @@ static int fetch_thread_tcache(int core, int thread)
 
 		/* If instruction is a branch, access branch predictor just in order
 		 * to have the necessary information to update it at commit. */
-		if (uop->flags & FCTRL) {
+		if (UOP_HOT(uop, flags) & FCTRL) {
 			bpred_lookup(THREAD.bpred, uop);
 			uop->pred_neip = i == mop_count - 1 ? neip :
 				mop_array[i + 1];
@@ -233,7 +229,7 @@ static void fetch_thread(int core, int thread)
 		/* Instruction detected as branches by the BTB are checked for branch
 		 * direction in the branch predictor. If they are predicted taken,
 		 * stop fetching from this block and set new fetch address. */
-		if (uop->flags & FCTRL) {
+		if (UOP_HOT(uop, flags) & FCTRL) {
 			target = bpred_btb_lookup(THREAD.bpred, uop);
 			taken = target && bpred_lookup(THREAD.bpred, uop);
 			if (taken) {
@@ -248,6 +244,27 @@ static void fetch_thread(int core, int thread)
 
 
 
+/* Return true if no thread can fetch. A thread about to access a new block
+ * is not checked further, so as not to translate its address early. */
+int fetch_idle(int core)
+{
+	struct ctx_t *ctx;
+	int thread;
+
+	FOREACH_THREAD {
+		ctx = THREAD.ctx;
+		if (!ctx || !ctx_get_status(ctx, ctx_running))
+			continue;
+		if (THREAD.fetch_stall || ctx->dealloc_signal)
+			continue;
+		if (THREAD.fetchq_occ >= fetchq_size)
+			continue;
+		return 0;
+	}
+	return 1;
+}
+
+
 static void fetch_core(int core)
 {
 	int thread, new;
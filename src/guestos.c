@@ -23,6 +23,9 @@
 #include <m2skernel.h>
 #include <string.h>
 #include <limits.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 
 /* Multi2Sim version */
@@ -37,6 +40,7 @@
 static char *sim_title = "";
 static char *configfile = "";
 static char *ctxconfig = "";
+static char *restore_file = "";
 
 static char *ctx_debug_file = "";
 static char *syscall_debug_file = "";
@@ -59,10 +63,9 @@ static uint64_t sim_inst = 0;
 
 /* Variables */
 static int sigint_received = 0;
+static int sigusr1_received = 0;
 
 //Block Info
-extern int blocksize, numblocks;
-extern int *blockowners;
 
 //int max_path_length = 100;
 void shell();
@@ -72,6 +75,7 @@ static void sim_reg_options() {
     opt_reg_string("-title", "Simulation title", &sim_title);
     opt_reg_string("-config", "m2s-fast configuration file", &configfile);
     opt_reg_string("-ctxconfig", "Context configuration file", &ctxconfig);
+    opt_reg_string("-restore", "Checkpoint to resume the simulation from", &restore_file);
 
     opt_reg_string("-debug:ctx", "Debug information for context creation & status updates", &ctx_debug_file);
     opt_reg_string("-debug:syscall", "Debug information for system calls", &syscall_debug_file);
@@ -89,6 +93,10 @@ static void sim_reg_options() {
     opt_reg_uint64("-max_inst", "Maximum number of instructions", &max_inst);
     opt_reg_uint32("-break_point", "Value for eip to stop", &break_point);
     opt_reg_bool("-mem_safe_mode", "Safe accesses to memory", &mem_safe_mode);
+    opt_reg_bool("-mem_flat", "Back guest memory with a single host region", &mem_flat_mode);
+    opt_reg_bool("-block_dispatch", "Execute decoded basic blocks", &isa_block_dispatch);
+    opt_reg_bool("-block_check", "Check decoded basic blocks against per-instruction execution", &isa_block_check);
+    opt_reg_bool("-smp_check", "Check rounds of guest cores against a sequential run", &smp_check);
 
     gk_reg_options();
 }
@@ -130,9 +138,10 @@ static void sim_signal_handler(int signum) {
             exit(0);
             break;
 
+        /* Save a checkpoint after the current call to 'ke_run' */
         case SIGUSR1:
-            printf("\n Inside signal handler for signal named SIGUSR1");
-            printf("\ndoing nothing");
+            sigusr1_received = 1;
+            signal(SIGUSR1, sim_signal_handler);
             break;
     }
 }
@@ -167,25 +176,111 @@ void set_defaults(void) {
 	char param_value[LINE_MAX+1];
 	get_param("INSTR_SLICE", param_value);
 	instr_slice = atoi(param_value);
-
-	int heads, tracks, sectors;
-	char command[1000];
-	get_param("NUM_HEADS",param_value);
-	heads=atoi(param_value);
-	get_param("NUM_TRACKS",param_value);
-	tracks=atoi(param_value);
-	get_param("NUM_SECTORS",param_value);
-	sectors=atoi(param_value);
-	sprintf(command,"(dd if=/dev/zero of=Sim_disk bs=%dx%dx%db count=1) 2> /dev/zero",heads,tracks,sectors);
-	system(command);
+	if (!get_param("BLOCK_DISPATCH", param_value))
+		isa_block_dispatch = atoi(param_value);
+	if (!get_param("BLOCK_CHECK", param_value))
+		isa_block_check = atoi(param_value);
+	if (!get_param("MEM_FLAT", param_value))
+		mem_flat_mode = atoi(param_value);
+
+	/* Guest CPU scheduler */
+	if (!get_param("SCHED_POLICY", param_value)) {
+		param_value[strcspn(param_value, " \t\r\n")] = '\0';
+		sched_policy = map_string_case(&sched_policy_map, param_value);
+		if (!sched_policy)
+			fatal("%s: invalid value for SCHED_POLICY (rr|cfs|mlfq|lottery)", param_value);
+	}
+	if (!get_param("SCHED_CFS_LATENCY", param_value))
+		sched_cfs_latency = atoll(param_value);
+	if (!get_param("SCHED_CFS_GRANULARITY", param_value))
+		sched_cfs_granularity = atoll(param_value);
+	if (!get_param("SCHED_MLFQ_LEVELS", param_value))
+		sched_mlfq_levels = atoi(param_value);
+	if (!get_param("SCHED_MLFQ_BOOST", param_value))
+		sched_mlfq_boost = atoll(param_value);
+	if (!get_param("SCHED_LOTTERY_TICKETS", param_value))
+		sched_lottery_tickets = atoi(param_value);
+	if (!get_param("SCHED_LOTTERY_SEED", param_value))
+		sched_lottery_seed = atoi(param_value);
+	sched_init();
+
+	/* Guest cores */
+	if (!get_param("CORES", param_value))
+		smp_cores = atoi(param_value);
+	if (!get_param("SMP_QUANTUM", param_value))
+		smp_quantum = atoll(param_value);
+	if (!get_param("SMP_CHECK", param_value))
+		smp_check = atoi(param_value);
+	smp_init();
+
+	/* Disk geometry, a 1.44MB floppy by default */
+	int heads = 2, tracks = 80, sectors = 18, disk_fd;
+	struct stat disk_stat;
+	off_t disk_size;
+	if (!get_param("NUM_HEADS",param_value))
+		heads=atoi(param_value);
+	if (!get_param("NUM_TRACKS",param_value))
+		tracks=atoi(param_value);
+	if (!get_param("NUM_SECTORS",param_value))
+		sectors=atoi(param_value);
+
+	/* A filesystem lives across runs, so an image of the right size is kept.
+	 * Otherwise, the disk starts empty. */
+	if (!get_param("SIMFS", param_value))
+		simfs_enable = atoi(param_value);
+	disk_size = (off_t) heads * tracks * sectors * 512;
+	if (!simfs_enable || stat("Sim_disk", &disk_stat) || disk_stat.st_size != disk_size) {
+		disk_fd = open("Sim_disk", O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (disk_fd < 0 || ftruncate(disk_fd, disk_size) < 0)
+			fatal("Sim_disk: cannot create disk image");
+		close(disk_fd);
+	}
 	
 	instr_num = 0;
-	schedint = malloc(2000 * sizeof(interrupt));
-	sched_count = 0;
+	init_interrupts();
 	
 	blocksize = 512;
 	numblocks = sectors * tracks * heads;
-	blockowners = calloc(numblocks, sizeof(int));
+
+	/* Simulated disk */
+	if (!get_param("DISK_POLICY", param_value)) {
+		param_value[strcspn(param_value, " \t\r\n")] = '\0';
+		disk_policy = map_string_case(&disk_policy_map, param_value);
+		if (!disk_policy)
+			fatal("%s: invalid value for DISK_POLICY (fcfs|sstf|scan|clook)", param_value);
+	}
+	if (!get_param("DISK_SEEK_BASE", param_value))
+		disk_seek_base = atoll(param_value);
+	if (!get_param("DISK_SEEK_TRACK", param_value))
+		disk_seek_track = atoll(param_value);
+	if (!get_param("DISK_ROTATION", param_value))
+		disk_rotation = atoll(param_value);
+	if (!get_param("BCACHE_POLICY", param_value)) {
+		param_value[strcspn(param_value, " \t\r\n")] = '\0';
+		bcache_policy = map_string_case(&bcache_policy_map, param_value);
+		if (!bcache_policy)
+			fatal("%s: invalid value for BCACHE_POLICY (lru|clock)", param_value);
+	}
+	if (!get_param("BCACHE_SIZE", param_value))
+		bcache_size = atoi(param_value);
+	if (!get_param("BCACHE_FLUSH", param_value))
+		bcache_flush_interval = atoll(param_value);
+	if (!get_param("BCACHE_MMAP", param_value))
+		bcache_mmap = atoi(param_value);
+	disk_init("Sim_disk", heads, tracks, sectors);
+
+	/* Filesystem */
+	if (!get_param("SIMFS_COMMIT", param_value))
+		simfs_commit_interval = atoll(param_value);
+	simfs_init();
+
+	/* Checkpoints */
+	if (!get_param("CKPT_FILE", param_value)) {
+		param_value[strcspn(param_value, " \t\r\n")] = '\0';
+		ckpt_file = strdup(param_value);
+	}
+	if (!get_param("CKPT_AT", param_value))
+		ckpt_at = atoll(param_value);
 }
 
 void install_signals(void){
@@ -229,7 +324,7 @@ int main(int argc, char **argv) {
     ///////////////////////////////////////
     /////	p_reg_options();
     ///	cache_system_reg_options();
-    ////	opt_check_options(&argc, argv);
+    opt_check_options(&argc, argv);
 
     /////////////////////////////////////////////
 
@@ -260,7 +355,8 @@ int main(int argc, char **argv) {
     //// argv=user_prog_path;
     //argv=origargv;
     ///fgets(user_prog_path,max_path_length,stdin);
-    shell();
+    if (!*restore_file)
+        shell();
     if (*configfile) {
         ///		printf("\n Entered inside checking\n\n")	;
         opt_check_config(configfile);
@@ -282,7 +378,10 @@ int main(int argc, char **argv) {
     ///printf("\n the rcvd pa ths is %s \n",user_prog_path);
     /* Load programs from configuration file and command line. */
     ///////	if (*ctxconfig)
-    ld_load_prog_from_ctxconfig(ctxconfig);
+    if (*restore_file)
+        ckpt_restore(restore_file);
+    else
+        ld_load_prog_from_ctxconfig(ctxconfig);
     ///////////////////if (argc >= 1)
     ///		ld_load_prog_from_cmdline(argc - 1, user_prog_path );
     ////////////		ld_load_prog_from_cmdline(argc - 1, argv + 1);
@@ -293,6 +392,7 @@ int main(int argc, char **argv) {
     signal(SIGABRT, &sim_signal_handler);
     signal(SIGFPE, &sim_signal_handler);
     signal(SIGUSR2, &sim_signal_handler);
+    signal(SIGUSR1, &sim_signal_handler);
     //raise(8);
     //raise(10);
     //raise(12);
@@ -304,12 +404,18 @@ int main(int argc, char **argv) {
             break;
         }
 
-        /* Run an instruction from each running context */
-        ke_run();
-        sim_inst += ke->running_count;
+        /* Run a time slice, or an SMP round */
+        sim_inst += ke_run();
         if (!ke->context_list_head)
             break;
 
+        /* Checkpoints */
+        if (sigusr1_received) {
+            sigusr1_received = 0;
+            ckpt_save(ckpt_file);
+        }
+        ckpt_tick();
+
         /* Stop conditions */
         sim_cycle++;
         if ((sim_cycle >= max_cycles && max_cycles) ||
@@ -327,6 +433,10 @@ int main(int argc, char **argv) {
 
     }
 
+    /* Interrupted simulations can be resumed */
+    if (sigint_received && ke->context_list_head)
+        ckpt_save(ckpt_file);
+
     /* Finalization */
     ke_done();
     ///opt_done();
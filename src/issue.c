@@ -31,7 +31,7 @@ static int issue_sq(int core, int thread, int quant)
 		
 		/* Get store */
 		store = lnlist_get(sq);
-		assert(store->flags & FSTORE);
+		assert(UOP_HOT(store, flags) & FSTORE);
 
 		/* Check that it can issue */
 		if (store->in_rob)
@@ -43,14 +43,14 @@ static int issue_sq(int core, int thread, int quant)
 		/* Store can be issued. */
 		sq_remove(core, thread);
 		cache_system_write(core, thread, cache_kind_data,
-			store->mem_phaddr, CORE.eventq, store);
+			store->mem_phaddr, CORE.eventq->mem, store);
 
-		/* The cache system will place the store at the head of the
-		 * event queue when it is ready. For now, mark "in_eventq" to
-		 * prevent the uop from being freed. */
-		store->in_eventq = 1;
+		/* The cache system will place the store in the list of completed
+		 * accesses of the event queue when it is ready. Meanwhile, it is
+		 * already in the event queue, which prevents it from being freed. */
 		store->issued = 1;
 		store->issue_when = sim_cycle;
+		eventq_insert_mem(store);
 	
 		/* Instruction issued */
 		CORE.issued[store->uop]++;
@@ -61,13 +61,12 @@ static int issue_sq(int core, int thread, int quant)
 		THREAD.lsq_reads++;
 		THREAD.rf_int_reads += store->ph_int_idep_count;
 		THREAD.rf_fp_reads += store->ph_fp_idep_count;
-		p->issued[store->uop]++;
 		quant--;
 		
 		/* Debug */
 		esim_debug("uop action=\"update\", core=%d, seq=%llu,"
 			" stg_issue=1, in_lsq=0, issued=1\n",
-			store->core, (long long unsigned) store->di_seq);
+			store->core, (long long unsigned) UOP_HOT(store, di_seq));
 	}
 	return quant;
 }
@@ -78,10 +77,6 @@ static int issue_lq(int core, int thread, int quant)
 	struct lnlist_t *lq = THREAD.lq;
 	struct uop_t *load;
 
-	/* Debug */
-	if (esim_debug_file)
-		uop_lnlist_check_if_ready(lq);
-	
 	/* Process lq */
 	lnlist_head(lq);
 	while (!lnlist_eol(lq) && quant) {
@@ -89,11 +84,10 @@ static int issue_lq(int core, int thread, int quant)
 		/* Get element from LQ.
 		 * If it is not ready, go to the next one */
 		load = lnlist_get(lq);
-		if (!load->ready && !rf_ready(load)) {
+		if (!UOP_HOT(load, ready)) {
 			lnlist_next(lq);
 			continue;
 		}
-		load->ready = 1;
 		if (!cache_system_can_access(core, thread, cache_kind_data,
 			cache_access_kind_read, load->mem_phaddr))
 		{
@@ -105,14 +99,14 @@ static int issue_lq(int core, int thread, int quant)
 		 * Access data tlb and cache. */
 		lq_remove(core, thread);
 		cache_system_read(core, thread, cache_kind_data,
-			load->mem_phaddr, CORE.eventq, load);
+			load->mem_phaddr, CORE.eventq->mem, load);
 
-		/* The cache system will place the load at the head of the
-		 * event queue when it is ready. For now, mark "in_eventq" to
-		 * prevent the uop from being freed. */
-		load->in_eventq = 1;
+		/* The cache system will place the load in the list of completed
+		 * accesses of the event queue when it is ready. Meanwhile, it is
+		 * already in the event queue, which prevents it from being freed. */
 		load->issued = 1;
 		load->issue_when = sim_cycle;
+		eventq_insert_mem(load);
 		
 		/* Instruction issued */
 		CORE.issued[load->uop]++;
@@ -123,42 +117,45 @@ static int issue_lq(int core, int thread, int quant)
 		THREAD.lsq_reads++;
 		THREAD.rf_int_reads += load->ph_int_idep_count;
 		THREAD.rf_fp_reads += load->ph_fp_idep_count;
-		p->issued[load->uop]++;
 		quant--;
 		
 		/* Debug */
 		esim_debug("uop action=\"update\", core=%d, seq=%llu,"
 			" stg_issue=1, in_lsq=0, issued=1\n",
-			load->core, (long long unsigned) load->di_seq);
+			load->core, (long long unsigned) UOP_HOT(load, di_seq));
 	}
 	
 	return quant;
 }
 
 
+/* Select ready uops in age order among the heads of the ready queues.
+ * When a functional unit class has no free unit, the rest of its queue is
+ * skipped for this cycle. */
 static int issue_iq(int core, int thread, int quant)
 {
-	struct lnlist_t *iq = THREAD.iq;
+	struct uop_ring_t *ring = CORE.uop_ring;
 	struct uop_t *uop;
-	int lat;
+	uint32_t index, head;
+	int fu_class, lat;
+	int busy[fu_count];
 
-	/* Debug */
-	if (esim_debug_file)
-		uop_lnlist_check_if_ready(iq);
-	
-	/* Find instruction to issue */
-	lnlist_head(iq);
-	while (!lnlist_eol(iq) && quant) {
+	memset(busy, 0, sizeof(busy));
+	while (quant) {
 		
-		/* Get element from IQ */
-		uop = lnlist_get(iq);
-		assert(uop_exists(uop));
-		assert(!(uop->flags & FMEM));
-		if (!uop->ready && !rf_ready(uop)) {
-			lnlist_next(iq);
-			continue;
+		/* Find oldest ready uop */
+		index = 0;
+		for (fu_class = 0; fu_class < fu_count; fu_class++) {
+			head = THREAD.iq_ready_head[fu_class];
+			if (head && !busy[fu_class] && (!index || ring->di_seq[head] < ring->di_seq[index]))
+				index = head;
 		}
-		uop->ready = 1;  /* avoid next call to 'rf_ready' */
+		if (!index)
+			break;
+		uop = UOP_GET(ring, index);
+		assert(uop_exists(uop));
+		assert(!(UOP_HOT(uop, flags) & FMEM));
+		assert(UOP_HOT(uop, ready));
 		
 		/* If inst does not require fu, one cycle latency.
 		 * Otherwise, try to reserve the corresponding fu. */
@@ -167,22 +164,22 @@ static int issue_iq(int core, int thread, int quant)
 		} else {
 			lat = fu_reserve(uop);
 			if (!lat) {
-				lnlist_next(iq);
+				busy[uop->fu_class] = 1;
 				continue;
 			}
 		}
 		
 		/* Instruction was issued to the corresponding fu.
 		 * Remove it from IQ */
-		iq_remove(core, thread);
+		iq_remove(uop);
 		
 		/* Schedule inst in Event Queue */
 		assert(!uop->in_eventq);
 		assert(lat > 0);
 		uop->issued = 1;
 		uop->issue_when = sim_cycle;
-		uop->when = sim_cycle + lat;
-		eventq_insert(CORE.eventq, uop);
+		UOP_HOT(uop, when) = sim_cycle + lat;
+		eventq_insert(uop);
 		
 		/* Instruction issued */
 		CORE.issued[uop->uop]++;
@@ -193,13 +190,12 @@ static int issue_iq(int core, int thread, int quant)
 		THREAD.iq_reads++;
 		THREAD.rf_int_reads += uop->ph_int_idep_count;
 		THREAD.rf_fp_reads += uop->ph_fp_idep_count;
-		p->issued[uop->uop]++;
 		quant--;
 
 		/* Debug */
 		esim_debug("uop action=\"update\", core=%d, seq=%llu,"
 			" stg_issue=1, in_iq=0, issued=1\n",
-			uop->core, (long long unsigned) uop->di_seq);
+			uop->core, (long long unsigned) UOP_HOT(uop, di_seq));
 	}
 	
 	return quant;
@@ -274,6 +270,42 @@ void issue_core(int core)
 }
 
 
+/* Return true if no uop can issue until a register is written
+ * or a cache access finishes */
+int issue_idle(int core)
+{
+	struct lnlist_t *lq, *sq;
+	struct uop_t *uop;
+	int thread, fu_class;
+
+	FOREACH_THREAD {
+
+		/* Ready uops in the IQ */
+		for (fu_class = 0; fu_class < fu_count; fu_class++)
+			if (THREAD.iq_ready_head[fu_class])
+				return 0;
+
+		/* Ready loads with a free cache port */
+		lq = THREAD.lq;
+		for (lnlist_head(lq); !lnlist_eol(lq); lnlist_next(lq)) {
+			uop = lnlist_get(lq);
+			if (UOP_HOT(uop, ready) && cache_system_can_access(core, thread, cache_kind_data,
+				cache_access_kind_read, uop->mem_phaddr))
+				return 0;
+		}
+
+		/* Committed store with a free cache port */
+		sq = THREAD.sq;
+		lnlist_head(sq);
+		uop = lnlist_get(sq);
+		if (uop && !uop->in_rob && cache_system_can_access(core, thread,
+			cache_kind_data, cache_access_kind_write, uop->mem_phaddr))
+			return 0;
+	}
+	return 1;
+}
+
+
 void p_issue()
 {
 	int core;
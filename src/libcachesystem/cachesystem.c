@@ -23,10 +23,9 @@
 
 static int cores = 0;
 static int threads = 0;
-static int ccache_count = 0;
+int ccache_count = 0;
 static int tlb_count = 0;
 static int net_count = 0;
-static uint64_t access_counter = 0;
 
 struct node_t {
 	struct ccache_t *icache;
@@ -34,24 +33,46 @@ struct node_t {
 };
 
 static struct node_t *node_array;
-static struct ccache_t **ccache_array;
+struct ccache_t **ccache_array;
 static struct tlb_t **tlb_array;
 static struct net_t **net_array;
 struct ccache_t *main_memory;  /* last element of ccache_array */
 
+/* Accesses started while deferring is on. They are recorded in the
+ * first-level cache right away, but the events that send them down the
+ * hierarchy are queued per core. Each queue is filled by the host thread
+ * running its core and drained by the main thread once all of them are
+ * done, so they need no locks. */
+struct cache_system_deferred_t {
+	int thread;
+	enum cache_kind_enum cache_kind;
+	enum cache_access_kind_enum cache_access_kind;
+	uint32_t addr;
+	struct lnlist_t *eventq;
+	void *eventq_item;
+};
 
+struct cache_system_defer_queue_t {
+	struct cache_system_deferred_t *elem;
+	int count;
+	int size;
+};
 
+static int cache_system_deferring;
+static struct cache_system_defer_queue_t *cache_system_defer_queue;  /* One per core */
 
-/* Coherent Cache */
 
-static struct repos_t *ccache_access_repos;
 
 
+/* Coherent Cache */
+
 struct ccache_t *ccache_create()
 {
 	struct ccache_t *ccache;
 	ccache = calloc(1, sizeof(struct ccache_t));
 	ccache->access_list = lnlist_create();
+	ccache->access_repos = repos_create(sizeof(struct ccache_access_t),
+		"ccache_access_repos");
 	return ccache;
 }
 
@@ -70,11 +91,12 @@ void ccache_free(struct ccache_t *ccache)
 		lnlist_head(ccache->access_list);
 		for (a = lnlist_get(ccache->access_list); a; a = n) {
 			n = a->next;
-			repos_free_object(ccache_access_repos, a);
+			repos_free_object(ccache->access_repos, a);
 		}
 		lnlist_remove(ccache->access_list);
 	}
 	lnlist_free(ccache->access_list);
+	repos_free(ccache->access_repos);
 
 	/* Free cache */
 	if (ccache->dir)
@@ -111,7 +133,7 @@ struct ccache_access_t *ccache_start_access(struct ccache_t *ccache,
 	struct ccache_access_t *access, *alias;
 
 	/* Create access */
-	access = repos_create_object(ccache_access_repos);
+	access = repos_create_object(ccache->access_repos);
 	access->cache_access_kind = cache_access_kind;
 	access->address = addr & ~(ccache->bsize - 1);
 	access->eventq = eventq;
@@ -129,7 +151,7 @@ struct ccache_access_t *ccache_start_access(struct ccache_t *ccache,
 	} else {
 		lnlist_out(ccache->access_list);
 		lnlist_insert(ccache->access_list, access);
-		access->id = ++access_counter;
+		access->id = ++ccache->access_counter;
 		cache_access_kind == cache_access_kind_read ? ccache->pending_reads++
 			: ccache->pending_writes++;
 		assert(ccache->pending_reads <= ccache->read_ports);
@@ -164,7 +186,7 @@ void ccache_end_access(struct ccache_t *ccache, uint32_t addr)
 	assert(ccache->pending_writes >= 0);
 	while (access) {
 		alias = access->next;
-		repos_free_object(ccache_access_repos, access);
+		repos_free_object(ccache->access_repos, access);
 		access = alias;
 	}
 	lnlist_remove(ccache->access_list);
@@ -542,8 +564,7 @@ void cache_system_init(int _cores, int _threads)
 	/* Repositories */
 	cache_system_stack_repos = repos_create(sizeof(struct cache_system_stack_t),
 		"cache_system_stack_repos");
-	ccache_access_repos = repos_create(sizeof(struct ccache_access_t),
-		"ccache_access_repos");
+	cache_system_defer_queue = calloc(cores, sizeof(struct cache_system_defer_queue_t));
 	
 	/* Events */
 	EV_CACHE_SYSTEM_ACCESS = esim_register_event(cache_system_handler);
@@ -968,7 +989,9 @@ void cache_system_done()
 	/* Other */
 	free(node_array);
 	repos_free(cache_system_stack_repos);
-	repos_free(ccache_access_repos);
+	for (i = 0; i < cores; i++)
+		free(cache_system_defer_queue[i].elem);
+	free(cache_system_defer_queue);
 	
 	/* Finalizations */
 	moesi_done();
@@ -1081,11 +1104,93 @@ int cache_system_can_access(int core, int thread, enum cache_kind_enum cache_kin
 }
 
 
-static uint64_t cache_system_access(int core, int thread, enum cache_kind_enum cache_kind,
+/* Return non-zero if no first-level cache is accessed by more than one core. */
+int cache_system_private_caches(void)
+{
+	struct node_t *a, *b;
+	int i, j;
+
+	for (i = 0; i < cores * threads; i++) {
+		for (j = (i / threads + 1) * threads; j < cores * threads; j++) {
+			a = &node_array[i];
+			b = &node_array[j];
+			if (a->icache == b->icache || a->icache == b->dcache ||
+				a->dcache == b->icache || a->dcache == b->dcache)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+
+static void cache_system_start(int core, int thread, enum cache_kind_enum cache_kind,
 	enum cache_access_kind_enum cache_access_kind, uint32_t addr,
 	struct lnlist_t *eventq, void *eventq_item)
 {
 	struct cache_system_stack_t *newstack;
+
+	newstack = cache_system_stack_create(core, thread, addr,
+		ESIM_EV_NONE, NULL);
+	newstack->cache_kind = cache_kind;
+	newstack->cache_access_kind = cache_access_kind;
+	newstack->eventq = eventq;
+	newstack->eventq_item = eventq_item;
+	esim_schedule_event(EV_CACHE_SYSTEM_ACCESS, newstack, 0);
+}
+
+
+static void cache_system_defer_access(int core, int thread, enum cache_kind_enum cache_kind,
+	enum cache_access_kind_enum cache_access_kind, uint32_t addr,
+	struct lnlist_t *eventq, void *eventq_item)
+{
+	struct cache_system_defer_queue_t *queue = &cache_system_defer_queue[core];
+	struct cache_system_deferred_t *deferred;
+
+	if (queue->count == queue->size) {
+		queue->size = queue->size ? queue->size * 2 : 16;
+		queue->elem = realloc(queue->elem, queue->size * sizeof(struct cache_system_deferred_t));
+		if (!queue->elem)
+			fatal("cache_system_defer_access: out of memory");
+	}
+	deferred = &queue->elem[queue->count++];
+	deferred->thread = thread;
+	deferred->cache_kind = cache_kind;
+	deferred->cache_access_kind = cache_access_kind;
+	deferred->addr = addr;
+	deferred->eventq = eventq;
+	deferred->eventq_item = eventq_item;
+}
+
+
+/* Turn deferring of new accesses on or off. When turned off, deferred
+ * accesses start in order of core, and then in the order they were issued,
+ * which is the order they would have had with deferring off. */
+void cache_system_defer(int defer)
+{
+	struct cache_system_defer_queue_t *queue;
+	struct cache_system_deferred_t *deferred;
+	int core, i;
+
+	cache_system_deferring = defer;
+	if (defer)
+		return;
+	for (core = 0; core < cores; core++) {
+		queue = &cache_system_defer_queue[core];
+		for (i = 0; i < queue->count; i++) {
+			deferred = &queue->elem[i];
+			cache_system_start(core, deferred->thread, deferred->cache_kind,
+				deferred->cache_access_kind, deferred->addr,
+				deferred->eventq, deferred->eventq_item);
+		}
+		queue->count = 0;
+	}
+}
+
+
+static uint64_t cache_system_access(int core, int thread, enum cache_kind_enum cache_kind,
+	enum cache_access_kind_enum cache_access_kind, uint32_t addr,
+	struct lnlist_t *eventq, void *eventq_item)
+{
 	struct ccache_t *ccache;
 	struct ccache_access_t *access, *alias;
 
@@ -1103,15 +1208,12 @@ static uint64_t cache_system_access(int core, int thread, enum cache_kind_enum c
 		eventq, eventq_item);
 
 	/* If there was no alias, start cache access */
-	if (!alias) {
-		newstack = cache_system_stack_create(core, thread, addr,
-			ESIM_EV_NONE, NULL);
-		newstack->cache_kind = cache_kind;
-		newstack->cache_access_kind = cache_access_kind;
-		newstack->eventq = eventq;
-		newstack->eventq_item = eventq_item;
-		esim_schedule_event(EV_CACHE_SYSTEM_ACCESS, newstack, 0);
-	}
+	if (!alias && cache_system_deferring)
+		cache_system_defer_access(core, thread, cache_kind, cache_access_kind,
+			addr, eventq, eventq_item);
+	else if (!alias)
+		cache_system_start(core, thread, cache_kind, cache_access_kind,
+			addr, eventq, eventq_item);
 
 	/* Return access identifier */
 	return access->id;
@@ -1138,6 +1240,32 @@ uint64_t cache_system_read(int core, int thread, enum cache_kind_enum cache_kind
 		addr, eventq, eventq_item);
 }
 
+void cache_system_warm(int core, int thread, enum cache_kind_enum cache_kind,
+	enum cache_access_kind_enum cache_access_kind, uint32_t addr)
+{
+	struct ccache_t *ccache;
+	struct tlb_t *tlb;
+	uint32_t set, way, tag;
+
+	/* TLB */
+	tlb = cache_system_get_tlb(core, thread, cache_kind);
+	if (!cache_find_block(tlb->cache, addr, &set, &way, NULL)) {
+		cache_decode_address(tlb->cache, addr, &set, &tag, NULL);
+		way = cache_replace_block(tlb->cache, set);
+		cache_set_block(tlb->cache, set, way, tag, 1);
+	}
+	cache_access_block(tlb->cache, set, way);
+
+	/* Caches, if not perfect */
+	if ((cache_kind == cache_kind_data && dperfect) ||
+		(cache_kind == cache_kind_inst && iperfect))
+		return;
+	ccache = cache_system_get_ccache(core, thread, cache_kind);
+	if (ccache->cache)
+		moesi_warm(ccache, cache_access_kind, addr);
+}
+
+
 void cache_system_handler(int event, void *data)
 {
 	struct cache_system_stack_t *stack = data;
@@ -274,6 +274,10 @@ struct moesi_stack_t *moesi_stack_create(uint64_t id, struct ccache_t *ccache,
 	uint32_t addr, int retevent, void *retstack);
 void moesi_stack_return(struct moesi_stack_t *stack);
 
+/* Functional load or store, with no timing, for warm-up */
+void moesi_warm(struct ccache_t *ccache, enum cache_access_kind_enum cache_access_kind,
+	uint32_t addr);
+
 
 
 
@@ -303,8 +307,12 @@ struct ccache_t {
 	struct cache_t *cache;  /* Cache holding data */
 	struct dir_t *dir;
 
-	/* List of in-flight accesses */
+	/* List of in-flight accesses. Accesses are allocated and numbered per
+	 * cache, so that caches of different cores can be accessed from
+	 * different host threads. */
 	struct lnlist_t *access_list;  /* Elements of type ccache_access_t */
+	struct repos_t *access_repos;  /* Repository of ccache_access_t */
+	uint64_t access_counter;  /* Identifier of the last access */
 	int pending_reads;  /* Non-aliasing reads in access_list */
 	int pending_writes;  /* Writes in access_list */
 
@@ -376,6 +384,8 @@ extern char *cache_system_report_file;
 extern int cache_min_block_size;
 extern int cache_max_block_size;
 extern struct ccache_t *main_memory;
+extern struct ccache_t **ccache_array;  /* All caches, main memory last */
+extern int ccache_count;
 
 enum cache_kind_enum {
 	cache_kind_inst,
@@ -415,6 +425,8 @@ void cache_system_reg_options(void);
 void cache_system_init(int def_cores, int def_threads);
 void cache_system_done(void);
 void cache_system_dump(FILE *f);
+int cache_system_private_caches(void);
+void cache_system_defer(int defer);
 
 /* Return block size of the first cache when accessing the cache system
  * by a given core-thread and cache kind. */
@@ -438,6 +450,12 @@ uint64_t cache_system_read(int core, int thread, enum cache_kind_enum cache_kind
 uint64_t cache_system_write(int core, int thread, enum cache_kind_enum cache_kind,
 	uint32_t addr, struct lnlist_t *eventq, void *eventq_item);
 
+/* Functional access that updates the TLB and caches at once, with no timing
+ * or statistics. It is used to warm them up while fast-forwarding, when no
+ * other access is in flight. */
+void cache_system_warm(int core, int thread, enum cache_kind_enum cache_kind,
+	enum cache_access_kind_enum cache_access_kind, uint32_t addr);
+
 
 #endif
 
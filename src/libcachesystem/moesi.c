@@ -1263,3 +1263,273 @@ void moesi_handler_invalidate(int event, void *data)
 
 	abort();
 }
+
+
+
+
+/* Functional Accesses */
+
+/* The following functions make the same transitions as the event-driven
+ * protocol, but at once, with no latencies, locks, or statistics. They are
+ * used to warm up the hierarchy while fast-forwarding, so they must not
+ * overlap with timing accesses. */
+
+static void moesi_warm_evict(struct ccache_t *ccache, uint32_t set, uint32_t way);
+static void moesi_warm_write_downup(struct ccache_t *target, uint32_t addr);
+static void moesi_warm_write_request(struct ccache_t *ccache, struct ccache_t *target,
+	uint32_t addr);
+
+
+/* Find a block, or make room for it evicting the victim. Return the status
+ * of the block. */
+static int moesi_warm_find(struct ccache_t *ccache, uint32_t addr,
+	uint32_t *pset, uint32_t *pway, uint32_t *ptag)
+{
+	int status;
+
+	if (ccache_find_block(ccache, addr, pset, pway, ptag, &status))
+		return status;
+	*pway = cache_replace_block(ccache->cache, *pset);
+	cache_get_block(ccache->cache, *pset, *pway, NULL, &status);
+	if (status)
+		moesi_warm_evict(ccache, *pset, *pway);
+	return moesi_status_invalid;
+}
+
+
+/* Invalidate the copies of a block in the upper level sharers but 'except' */
+static void moesi_warm_invalidate(struct ccache_t *ccache, uint32_t set, uint32_t way,
+	struct ccache_t *except)
+{
+	struct ccache_t *sharer;
+	struct dir_t *dir;
+	struct dir_entry_t *dir_entry;
+	uint32_t tag, dir_entry_tag, z;
+	int node_count, i;
+
+	ccache_get_block(ccache, set, way, &tag, NULL);
+	dir = ccache_get_dir(ccache, tag);
+	node_count = ccache->hinet ? ccache->hinet->end_node_count : 0;
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry_tag = tag + z * cache_min_block_size;
+		dir_entry = ccache_get_dir_entry(ccache, set, way, z);
+		for (i = 1; i < node_count; i++) {
+			if (!dir_entry_is_sharer(dir, dir_entry, i))
+				continue;
+			sharer = net_get_node_data(ccache->hinet, i);
+			if (sharer == except)
+				continue;
+			dir_entry_clear_sharer(dir, dir_entry, i);
+			if (dir_entry->owner == i)
+				dir_entry->owner = 0;
+			if (dir_entry_tag % sharer->bsize)
+				continue;
+			moesi_warm_write_downup(sharer, dir_entry_tag);
+		}
+	}
+}
+
+
+/* Write request from a lower level to an upper level sharer, which
+ * invalidates its copy and those above it. */
+static void moesi_warm_write_downup(struct ccache_t *target, uint32_t addr)
+{
+	uint32_t set, way, tag;
+	int status;
+
+	if (!ccache_find_block(target, addr, &set, &way, &tag, &status))
+		return;
+	moesi_warm_invalidate(target, set, way, NULL);
+	cache_set_block(target->cache, set, way, 0, moesi_status_invalid);
+}
+
+
+/* Read request from a lower level to the owner of a block, which keeps
+ * a shared copy. */
+static void moesi_warm_read_downup(struct ccache_t *target, uint32_t addr)
+{
+	struct ccache_t *owner;
+	struct dir_t *dir;
+	struct dir_entry_t *dir_entry;
+	uint32_t set, way, tag, dir_entry_tag, z;
+	int status;
+
+	if (!ccache_find_block(target, addr, &set, &way, &tag, &status))
+		return;
+	dir = ccache_get_dir(target, tag);
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry_tag = tag + z * cache_min_block_size;
+		dir_entry = ccache_get_dir_entry(target, set, way, z);
+		if (!dir_entry->owner)
+			continue;
+		owner = net_get_node_data(target->hinet, dir_entry->owner);
+		if (dir_entry_tag % owner->bsize)
+			continue;
+		moesi_warm_read_downup(owner, dir_entry_tag);
+	}
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry = ccache_get_dir_entry(target, set, way, z);
+		dir_entry->owner = 0;
+	}
+	cache_set_block(target->cache, set, way, tag, moesi_status_shared);
+	cache_access_block(target->cache, set, way);
+}
+
+
+/* Read request from 'ccache' to the next level 'target'. Return true if
+ * the block is shared by other caches. */
+static int moesi_warm_read_request(struct ccache_t *ccache, struct ccache_t *target,
+	uint32_t addr)
+{
+	struct ccache_t *owner;
+	struct dir_t *dir;
+	struct dir_entry_t *dir_entry;
+	uint32_t set, way, tag, dir_entry_tag, z;
+	int status, shared;
+
+	/* Bring the block, or take it from the owners other than ccache */
+	status = moesi_warm_find(target, addr, &set, &way, &tag);
+	dir = ccache_get_dir(target, tag);
+	if (status) {
+		for (z = 0; z < dir->zsize; z++) {
+			dir_entry_tag = tag + z * cache_min_block_size;
+			dir_entry = ccache_get_dir_entry(target, set, way, z);
+			if (!dir_entry->owner || dir_entry->owner == ccache->loid)
+				continue;
+			owner = net_get_node_data(target->hinet, dir_entry->owner);
+			if (dir_entry_tag % owner->bsize)
+				continue;
+			moesi_warm_read_downup(owner, dir_entry_tag);
+		}
+	} else {
+		shared = moesi_warm_read_request(target, target->next, tag);
+		cache_set_block(target->cache, set, way, tag,
+			shared ? moesi_status_shared : moesi_status_exclusive);
+	}
+
+	/* Set ccache as sharer, and as owner if nobody else shares it */
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry = ccache_get_dir_entry(target, set, way, z);
+		if (dir_entry->owner != ccache->loid)
+			dir_entry->owner = 0;
+	}
+	shared = 0;
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry_tag = tag + z * cache_min_block_size;
+		if (dir_entry_tag < addr || dir_entry_tag >= addr + ccache->bsize)
+			continue;
+		dir_entry = ccache_get_dir_entry(target, set, way, z);
+		dir_entry_set_sharer(dir, dir_entry, ccache->loid);
+		if (dir_entry->sharers > 1)
+			shared = 1;
+	}
+	if (!shared) {
+		for (z = 0; z < dir->zsize; z++) {
+			dir_entry_tag = tag + z * cache_min_block_size;
+			if (dir_entry_tag < addr || dir_entry_tag >= addr + ccache->bsize)
+				continue;
+			dir_entry = ccache_get_dir_entry(target, set, way, z);
+			dir_entry->owner = ccache->loid;
+		}
+	}
+	if (target->cache)
+		cache_access_block(target->cache, set, way);
+	return shared;
+}
+
+
+/* Write request from 'ccache' to the next level 'target', which leaves
+ * ccache as the only sharer and owner. */
+static void moesi_warm_write_request(struct ccache_t *ccache, struct ccache_t *target,
+	uint32_t addr)
+{
+	struct dir_t *dir;
+	struct dir_entry_t *dir_entry;
+	uint32_t set, way, tag, dir_entry_tag, z;
+	int status;
+
+	status = moesi_warm_find(target, addr, &set, &way, &tag);
+	moesi_warm_invalidate(target, set, way, ccache);
+	if (status != moesi_status_modified && status != moesi_status_exclusive)
+		moesi_warm_write_request(target, target->next, tag);
+
+	dir = ccache_get_dir(target, tag);
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry_tag = tag + z * cache_min_block_size;
+		if (dir_entry_tag < addr || dir_entry_tag >= addr + ccache->bsize)
+			continue;
+		dir_entry = ccache_get_dir_entry(target, set, way, z);
+		dir_entry_set_sharer(dir, dir_entry, ccache->loid);
+		dir_entry->owner = ccache->loid;
+	}
+	if (target->cache) {
+		cache_access_block(target->cache, set, way);
+		if (status != moesi_status_modified)
+			cache_set_block(target->cache, set, way, tag, moesi_status_exclusive);
+	}
+}
+
+
+/* Evict a valid block, writing it back to the next level if dirty */
+static void moesi_warm_evict(struct ccache_t *ccache, uint32_t set, uint32_t way)
+{
+	struct ccache_t *target = ccache->next;
+	struct dir_t *dir;
+	struct dir_entry_t *dir_entry;
+	uint32_t src_tag, target_set, target_way, tag, dir_entry_tag, z;
+	int status, target_status;
+
+	ccache_get_block(ccache, set, way, &src_tag, &status);
+	moesi_warm_invalidate(ccache, set, way, NULL);
+	target_status = moesi_warm_find(target, src_tag, &target_set, &target_way, &tag);
+
+	/* Writeback */
+	if (status == moesi_status_modified || status == moesi_status_owned) {
+		moesi_warm_invalidate(target, target_set, target_way, ccache);
+		if (target_status != moesi_status_modified &&
+			target_status != moesi_status_exclusive)
+			moesi_warm_write_request(target, target->next, tag);
+		if (target->cache) {
+			cache_set_block(target->cache, target_set, target_way, tag,
+				moesi_status_modified);
+			cache_access_block(target->cache, target_set, target_way);
+		}
+	}
+
+	/* Remove ccache as sharer and owner */
+	dir = ccache_get_dir(target, tag);
+	for (z = 0; z < dir->zsize; z++) {
+		dir_entry_tag = tag + z * cache_min_block_size;
+		if (dir_entry_tag < src_tag || dir_entry_tag >= src_tag + ccache->bsize)
+			continue;
+		dir_entry = ccache_get_dir_entry(target, target_set, target_way, z);
+		dir_entry_clear_sharer(dir, dir_entry, ccache->loid);
+		if (dir_entry->owner == ccache->loid)
+			dir_entry->owner = 0;
+	}
+	cache_set_block(ccache->cache, set, way, 0, moesi_status_invalid);
+}
+
+
+/* Load or store into a first level cache */
+void moesi_warm(struct ccache_t *ccache, enum cache_access_kind_enum cache_access_kind,
+	uint32_t addr)
+{
+	uint32_t set, way, tag;
+	int status, shared;
+
+	status = moesi_warm_find(ccache, addr, &set, &way, &tag);
+	if (cache_access_kind == cache_access_kind_read) {
+		if (!status) {
+			shared = moesi_warm_read_request(ccache, ccache->next, tag);
+			cache_set_block(ccache->cache, set, way, tag,
+				shared ? moesi_status_shared : moesi_status_exclusive);
+		}
+		cache_access_block(ccache->cache, set, way);
+		return;
+	}
+	if (status != moesi_status_modified && status != moesi_status_exclusive)
+		moesi_warm_write_request(ccache, ccache->next, tag);
+	cache_access_block(ccache->cache, set, way);
+	cache_set_block(ccache->cache, set, way, tag, moesi_status_modified);
+}
@@ -229,6 +229,13 @@ int esim_pending()
 }
 
 
+int esim_next_event(uint64_t *pwhen)
+{
+	*pwhen = heap_peek(event_heap, NULL);
+	return !heap_error(event_heap);
+}
+
+
 
 
 /* Debugging */
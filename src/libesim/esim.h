@@ -55,6 +55,10 @@ uint64_t esim_extract_event(int *event, void **data);
 /* Return number of events in the heap */
 int esim_pending();
 
+/* Return in 'pwhen' the cycle of the next event in the heap;
+ * return false if the heap is empty */
+int esim_next_event(uint64_t *pwhen);
+
 /* Process esim events, without enabling the schedule of a new event;
  * when all events are processed, esim heap will be empty;
  * esim_cycle is not incremented */
@@ -0,0 +1,355 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Run of blocks owned by a uid */
+struct balloc_extent_t {
+	int start;
+	int count;
+};
+
+/* Extents of a uid, sorted by start block. Adjacent extents are merged,
+ * so a contiguous range of owned blocks is always inside one extent. */
+struct balloc_owner_t {
+	int uid;
+	int blocks;
+	struct balloc_extent_t *ext;
+	int count, size;
+};
+
+/* Free-space bitmap, one bit per block, set if allocated. Bits past the
+ * last block are set, so that they are never allocated. */
+static uint64_t *balloc_map;
+static int balloc_words;
+static int balloc_blocks, balloc_used;
+
+static struct balloc_owner_t *balloc_owners;
+static int balloc_owners_count, balloc_owners_size;
+
+
+#define BALLOC_BIT(block)  (1ULL << ((block) & 63))
+#define BALLOC_WORD(block)  (balloc_map[(block) >> 6])
+
+
+static struct balloc_owner_t *balloc_owner_get(int uid, int create)
+{
+	int i;
+
+	for (i = 0; i < balloc_owners_count; i++)
+		if (balloc_owners[i].uid == uid)
+			return &balloc_owners[i];
+	if (!create)
+		return NULL;
+	if (balloc_owners_count == balloc_owners_size) {
+		balloc_owners_size = balloc_owners_size ? balloc_owners_size * 2 : 8;
+		balloc_owners = realloc(balloc_owners, balloc_owners_size * sizeof(struct balloc_owner_t));
+		if (!balloc_owners)
+			fatal("balloc: out of memory");
+	}
+	memset(&balloc_owners[i], 0, sizeof(struct balloc_owner_t));
+	balloc_owners[i].uid = uid;
+	balloc_owners_count++;
+	return &balloc_owners[i];
+}
+
+
+/* Index of the last extent starting at or before 'block', or -1 */
+static int balloc_extent_find(struct balloc_owner_t *owner, int block)
+{
+	int lo = 0, hi = owner->count - 1, mid, found = -1;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (owner->ext[mid].start <= block) {
+			found = mid;
+			lo = mid + 1;
+		} else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+
+static void balloc_extent_insert(struct balloc_owner_t *owner, int start, int count)
+{
+	struct balloc_extent_t *prev, *next;
+	int pos = balloc_extent_find(owner, start) + 1;
+
+	owner->blocks += count;
+	prev = pos > 0 ? &owner->ext[pos - 1] : NULL;
+	next = pos < owner->count ? &owner->ext[pos] : NULL;
+
+	/* Merge with neighbors */
+	if (prev && prev->start + prev->count == start) {
+		prev->count += count;
+		if (next && start + count == next->start) {
+			prev->count += next->count;
+			memmove(next, next + 1, (owner->count - pos - 1) * sizeof(struct balloc_extent_t));
+			owner->count--;
+		}
+		return;
+	}
+	if (next && start + count == next->start) {
+		next->start = start;
+		next->count += count;
+		return;
+	}
+
+	/* New extent */
+	if (owner->count == owner->size) {
+		owner->size = owner->size ? owner->size * 2 : 4;
+		owner->ext = realloc(owner->ext, owner->size * sizeof(struct balloc_extent_t));
+		if (!owner->ext)
+			fatal("balloc: out of memory");
+	}
+	memmove(&owner->ext[pos + 1], &owner->ext[pos],
+		(owner->count - pos) * sizeof(struct balloc_extent_t));
+	owner->ext[pos].start = start;
+	owner->ext[pos].count = count;
+	owner->count++;
+}
+
+
+static void balloc_map_set(int start, int count, int value)
+{
+	int block;
+
+	for (block = start; block < start + count; block++) {
+		if (value)
+			BALLOC_WORD(block) |= BALLOC_BIT(block);
+		else
+			BALLOC_WORD(block) &= ~BALLOC_BIT(block);
+	}
+	balloc_used += value ? count : -count;
+}
+
+
+/* First block of the lowest run of 'count' free blocks, or -1. Full words
+ * are skipped and empty words counted whole. */
+static int balloc_find(int count)
+{
+	uint64_t word;
+	int w, bit, start = -1, run = 0;
+
+	for (w = 0; w < balloc_words; w++) {
+		word = balloc_map[w];
+		if (word == ~0ULL) {
+			run = 0;
+			continue;
+		}
+		if (count == 1)
+			return w * 64 + __builtin_ctzll(~word);
+		if (!word) {
+			if (!run)
+				start = w * 64;
+			run += 64;
+			if (run >= count)
+				return start;
+			continue;
+		}
+		for (bit = 0; bit < 64; bit++) {
+			if (word & (1ULL << bit)) {
+				run = 0;
+				continue;
+			}
+			if (!run)
+				start = w * 64 + bit;
+			if (++run >= count)
+				return start;
+		}
+	}
+	return -1;
+}
+
+
+void balloc_init(int blocks)
+{
+	int block;
+
+	balloc_blocks = blocks;
+	balloc_words = (blocks + 63) / 64;
+	balloc_map = calloc(balloc_words, sizeof(uint64_t));
+	if (!balloc_map)
+		fatal("balloc_init: out of memory");
+	for (block = blocks; block < balloc_words * 64; block++)
+		BALLOC_WORD(block) |= BALLOC_BIT(block);
+	balloc_used = 0;
+}
+
+
+void balloc_done(void)
+{
+	int i;
+
+	for (i = 0; i < balloc_owners_count; i++)
+		free(balloc_owners[i].ext);
+	free(balloc_owners);
+	free(balloc_map);
+	balloc_owners = NULL;
+	balloc_owners_count = balloc_owners_size = 0;
+	balloc_map = NULL;
+}
+
+
+void balloc_dump(FILE *f)
+{
+	struct balloc_owner_t *owner;
+	int i, extents = 0;
+
+	for (i = 0; i < balloc_owners_count; i++)
+		extents += balloc_owners[i].count;
+	fprintf(f, "balloc.used  %d  # Allocated blocks\n", balloc_used);
+	fprintf(f, "balloc.free  %d\n", balloc_blocks - balloc_used);
+	fprintf(f, "balloc.extents  %d  # Runs of contiguous blocks of a uid\n", extents);
+	for (i = 0; i < balloc_owners_count; i++) {
+		owner = &balloc_owners[i];
+		fprintf(f, "balloc.uid%d.blocks  %d\n", owner->uid, owner->blocks);
+		fprintf(f, "balloc.uid%d.extents  %d\n", owner->uid, owner->count);
+	}
+}
+
+
+int balloc_is_free(int block)
+{
+	assert(block >= 0 && block < balloc_blocks);
+	return !(BALLOC_WORD(block) & BALLOC_BIT(block));
+}
+
+
+/* Return non-zero if all 'count' blocks from 'start' belong to 'uid' */
+int balloc_owned(int uid, int start, int count)
+{
+	struct balloc_owner_t *owner;
+	struct balloc_extent_t *ext;
+	int i;
+
+	owner = balloc_owner_get(uid, 0);
+	if (!owner)
+		return 0;
+	i = balloc_extent_find(owner, start);
+	if (i < 0)
+		return 0;
+	ext = &owner->ext[i];
+	return start + count <= ext->start + ext->count;
+}
+
+
+/* Allocate 'count' contiguous blocks to 'uid'. Return the first block, or
+ * -1 if there is no free run that long. */
+int balloc_alloc(int uid, int count)
+{
+	int start;
+
+	assert(count > 0);
+	start = balloc_find(count);
+	if (start < 0)
+		return -1;
+	balloc_map_set(start, count, 1);
+	balloc_extent_insert(balloc_owner_get(uid, 1), start, count);
+	return start;
+}
+
+
+/* Allocate a given free block to 'uid' */
+void balloc_claim(int uid, int block)
+{
+	assert(balloc_is_free(block));
+	balloc_map_set(block, 1, 1);
+	balloc_extent_insert(balloc_owner_get(uid, 1), block, 1);
+}
+
+
+/* Free 'count' blocks from 'start'. Return 0, or -1 if any of them does not
+ * belong to 'uid'. */
+int balloc_free(int uid, int start, int count)
+{
+	struct balloc_owner_t *owner;
+	struct balloc_extent_t *ext;
+	int i, end;
+
+	if (count <= 0 || !balloc_owned(uid, start, count))
+		return -1;
+	owner = balloc_owner_get(uid, 0);
+	i = balloc_extent_find(owner, start);
+	ext = &owner->ext[i];
+	end = ext->start + ext->count;
+
+	/* Shrink, remove or split the extent */
+	if (ext->start == start && end == start + count) {
+		memmove(ext, ext + 1, (owner->count - i - 1) * sizeof(struct balloc_extent_t));
+		owner->count--;
+	} else if (ext->start == start) {
+		ext->start += count;
+		ext->count -= count;
+	} else if (end == start + count) {
+		ext->count -= count;
+	} else {
+		ext->count = start - ext->start;
+		owner->blocks -= end - (start + count);
+		balloc_extent_insert(owner, start + count, end - (start + count));
+	}
+	owner->blocks -= count;
+	balloc_map_set(start, count, 0);
+	return 0;
+}
+
+
+/* Checkpoints. The bitmap is rebuilt from the extents. */
+void balloc_save(FILE *f)
+{
+	struct balloc_owner_t *owner;
+	int i;
+
+	ckpt_write(f, &balloc_owners_count, sizeof(balloc_owners_count));
+	for (i = 0; i < balloc_owners_count; i++) {
+		owner = &balloc_owners[i];
+		ckpt_write(f, &owner->uid, sizeof(owner->uid));
+		ckpt_write(f, &owner->count, sizeof(owner->count));
+		ckpt_write(f, owner->ext, owner->count * sizeof(struct balloc_extent_t));
+	}
+}
+
+
+void balloc_restore(FILE *f)
+{
+	struct balloc_owner_t *owner;
+	int i, j, count, uid;
+
+	balloc_done();
+	balloc_init(balloc_blocks);
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		ckpt_read(f, &uid, sizeof(uid));
+		owner = balloc_owner_get(uid, 1);
+		ckpt_read(f, &owner->count, sizeof(owner->count));
+		owner->size = owner->count + 1;
+		owner->ext = calloc(owner->count + 1, sizeof(struct balloc_extent_t));
+		if (!owner->ext)
+			fatal("balloc_restore: out of memory");
+		ckpt_read(f, owner->ext, owner->count * sizeof(struct balloc_extent_t));
+		for (j = 0; j < owner->count; j++) {
+			if (owner->ext[j].start < 0 || owner->ext[j].start + owner->ext[j].count > balloc_blocks)
+				fatal("balloc_restore: invalid extent in checkpoint");
+			balloc_map_set(owner->ext[j].start, owner->ext[j].count, 1);
+			owner->blocks += owner->ext[j].count;
+		}
+	}
+}
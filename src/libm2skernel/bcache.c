@@ -0,0 +1,376 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+#include <sys/mman.h>
+
+
+/* Buffer cache parameters */
+struct string_map_t bcache_policy_map = {
+	2, {
+		{ "lru",    bcache_policy_lru },
+		{ "clock",  bcache_policy_clock }
+	}
+};
+
+enum bcache_policy_enum bcache_policy = bcache_policy_lru;
+int bcache_size = 64;  /* Number of buffers */
+long long bcache_flush_interval = 100000;  /* Instructions between flushes (0=only at exit) */
+int bcache_mmap = 0;  /* Map the whole image instead of using buffers */
+
+
+/* Buffer holding one disk block */
+struct bcache_buf_t {
+	int block;  /* Cached block, -1 if unused */
+	int dirty;  /* Modified since it was read or written back */
+	int ref;  /* CLOCK reference bit */
+	struct bcache_buf_t *prev, *next;  /* LRU list, most recently used first (LRU only) */
+	unsigned char *data;
+};
+
+static FILE *bcache_file;
+static int bcache_blocks, bcache_blocksize;
+
+/* Buffers and the buffer holding each block, or NULL */
+static struct bcache_buf_t *bcache_bufs;
+static unsigned char *bcache_data;
+static struct bcache_buf_t **bcache_map;
+
+/* Replacement state: the LRU list, or the CLOCK hand */
+static struct bcache_buf_t *bcache_lru_head, *bcache_lru_tail;
+static int bcache_hand;
+
+/* Mapped image, if 'bcache_mmap' is set */
+static unsigned char *bcache_image;
+static size_t bcache_image_size;
+static int bcache_image_dirty;
+
+/* Statistics */
+static long long bcache_last_flush;
+static long long bcache_hits, bcache_misses, bcache_evictions;
+static long long bcache_writebacks, bcache_flushes;
+
+
+static void bcache_lru_remove(struct bcache_buf_t *buf)
+{
+	if (buf->prev)
+		buf->prev->next = buf->next;
+	else
+		bcache_lru_head = buf->next;
+	if (buf->next)
+		buf->next->prev = buf->prev;
+	else
+		bcache_lru_tail = buf->prev;
+	buf->prev = buf->next = NULL;
+}
+
+
+static void bcache_lru_insert_head(struct bcache_buf_t *buf)
+{
+	buf->prev = NULL;
+	buf->next = bcache_lru_head;
+	if (bcache_lru_head)
+		bcache_lru_head->prev = buf;
+	else
+		bcache_lru_tail = buf;
+	bcache_lru_head = buf;
+}
+
+
+static void bcache_touch(struct bcache_buf_t *buf)
+{
+	if (bcache_policy == bcache_policy_clock) {
+		buf->ref = 1;
+		return;
+	}
+	bcache_lru_remove(buf);
+	bcache_lru_insert_head(buf);
+}
+
+
+/* Buffer to reuse. Unused buffers are taken first: they start at the LRU
+ * tail, and have no reference bit for CLOCK. */
+static struct bcache_buf_t *bcache_victim(void)
+{
+	struct bcache_buf_t *buf;
+
+	if (bcache_policy == bcache_policy_lru)
+		return bcache_lru_tail;
+	for (;;) {
+		buf = &bcache_bufs[bcache_hand];
+		bcache_hand = (bcache_hand + 1) % bcache_size;
+		if (buf->block < 0 || !buf->ref)
+			return buf;
+		buf->ref = 0;
+	}
+}
+
+
+static void bcache_writeback(struct bcache_buf_t *buf)
+{
+	fseek(bcache_file, (long) buf->block * bcache_blocksize, SEEK_SET);
+	if (fwrite(buf->data, 1, bcache_blocksize, bcache_file) != bcache_blocksize)
+		fatal("bcache: cannot write block %d to disk image", buf->block);
+	buf->dirty = 0;
+	bcache_writebacks++;
+}
+
+
+void bcache_init(FILE *f, int blocks, int blocksize)
+{
+	int i;
+
+	bcache_file = f;
+	bcache_blocks = blocks;
+	bcache_blocksize = blocksize;
+	bcache_last_flush = instr_num;
+
+	/* Mapped image */
+	if (bcache_mmap) {
+		bcache_image_size = (size_t) blocks * blocksize;
+		bcache_image = mmap(NULL, bcache_image_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fileno(f), 0);
+		if (bcache_image == MAP_FAILED)
+			fatal("bcache_init: cannot map disk image");
+		return;
+	}
+
+	/* Buffers */
+	if (bcache_size < 1)
+		fatal("bcache_init: buffer cache needs at least one buffer");
+	if (bcache_policy != bcache_policy_lru && bcache_policy != bcache_policy_clock)
+		fatal("bcache_init: invalid replacement policy");
+	bcache_bufs = calloc(bcache_size, sizeof(struct bcache_buf_t));
+	bcache_data = calloc(bcache_size, blocksize);
+	bcache_map = calloc(blocks, sizeof(struct bcache_buf_t *));
+	if (!bcache_bufs || !bcache_data || !bcache_map)
+		fatal("bcache_init: out of memory");
+	for (i = 0; i < bcache_size; i++) {
+		bcache_bufs[i].block = -1;
+		bcache_bufs[i].data = bcache_data + (size_t) i * blocksize;
+		if (bcache_policy == bcache_policy_lru)
+			bcache_lru_insert_head(&bcache_bufs[i]);
+	}
+}
+
+
+void bcache_done(void)
+{
+	bcache_flush();
+	if (bcache_image) {
+		munmap(bcache_image, bcache_image_size);
+		bcache_image = NULL;
+	}
+	free(bcache_bufs);
+	free(bcache_data);
+	free(bcache_map);
+	bcache_bufs = NULL;
+	bcache_data = NULL;
+	bcache_map = NULL;
+	bcache_lru_head = bcache_lru_tail = NULL;
+}
+
+
+void bcache_dump(FILE *f)
+{
+	long long accesses = bcache_hits + bcache_misses;
+
+	fprintf(f, "bcache.policy  %s  # Buffer cache replacement policy\n",
+		bcache_mmap ? "mmap" : map_value(&bcache_policy_map, bcache_policy));
+	fprintf(f, "bcache.size  %d  # Buffers\n", bcache_mmap ? bcache_blocks : bcache_size);
+	fprintf(f, "bcache.hits  %lld  # Block accesses without host I/O\n", bcache_hits);
+	fprintf(f, "bcache.misses  %lld\n", bcache_misses);
+	fprintf(f, "bcache.hit_ratio  %.4f\n",
+		accesses ? (double) bcache_hits / accesses : 0.0);
+	fprintf(f, "bcache.evictions  %lld\n", bcache_evictions);
+	fprintf(f, "bcache.writebacks  %lld  # Dirty blocks written to the image\n",
+		bcache_writebacks);
+	fprintf(f, "bcache.flushes  %lld\n", bcache_flushes);
+}
+
+
+/* Return the cached data of a block, reading it from the image on a miss.
+ * If 'write' is set, the block is marked dirty and written back on
+ * eviction or flush. */
+unsigned char *bcache_get(int block, int write)
+{
+	struct bcache_buf_t *buf;
+	size_t count;
+
+	assert(block >= 0 && block < bcache_blocks);
+	if (bcache_image) {
+		bcache_hits++;
+		bcache_image_dirty |= write;
+		return bcache_image + (size_t) block * bcache_blocksize;
+	}
+
+	buf = bcache_map[block];
+	if (buf) {
+		bcache_hits++;
+	} else {
+		bcache_misses++;
+		buf = bcache_victim();
+		if (buf->block >= 0) {
+			if (buf->dirty)
+				bcache_writeback(buf);
+			bcache_map[buf->block] = NULL;
+			bcache_evictions++;
+		}
+		fseek(bcache_file, (long) block * bcache_blocksize, SEEK_SET);
+		count = fread(buf->data, 1, bcache_blocksize, bcache_file);
+		memset(buf->data + count, 0, bcache_blocksize - count);
+		buf->block = block;
+		buf->dirty = 0;
+		bcache_map[block] = buf;
+	}
+	bcache_touch(buf);
+	buf->dirty |= write;
+	return buf->data;
+}
+
+
+/* Write all dirty blocks to the image */
+void bcache_flush(void)
+{
+	int i;
+
+	bcache_last_flush = instr_num;
+	bcache_flushes++;
+	if (bcache_image) {
+		if (bcache_image_dirty && msync(bcache_image, bcache_image_size, MS_SYNC))
+			fatal("bcache_flush: cannot sync disk image");
+		bcache_image_dirty = 0;
+		return;
+	}
+	for (i = 0; i < bcache_size; i++)
+		if (bcache_bufs[i].dirty)
+			bcache_writeback(&bcache_bufs[i]);
+	fflush(bcache_file);
+}
+
+
+/* Flush if 'bcache_flush_interval' instructions went by since the last
+ * flush */
+void bcache_tick(void)
+{
+	if (bcache_flush_interval && instr_num - bcache_last_flush >= bcache_flush_interval)
+		bcache_flush();
+}
+
+
+/* Checkpoints. Buffers keep their blocks, dirty data and replacement order,
+ * so that a restored run sees the same hits and writebacks. Clean buffers
+ * are read back from the image, which the caller restores first. */
+void bcache_save(FILE *f)
+{
+	struct bcache_buf_t *buf;
+	int i;
+
+	ckpt_write(f, &bcache_last_flush, sizeof(bcache_last_flush));
+	ckpt_write(f, &bcache_hits, sizeof(bcache_hits));
+	ckpt_write(f, &bcache_misses, sizeof(bcache_misses));
+	ckpt_write(f, &bcache_evictions, sizeof(bcache_evictions));
+	ckpt_write(f, &bcache_writebacks, sizeof(bcache_writebacks));
+	ckpt_write(f, &bcache_flushes, sizeof(bcache_flushes));
+	ckpt_write(f, &bcache_mmap, sizeof(bcache_mmap));
+	if (bcache_image) {
+		ckpt_write(f, &bcache_image_dirty, sizeof(bcache_image_dirty));
+		return;
+	}
+	ckpt_write(f, &bcache_size, sizeof(bcache_size));
+	ckpt_write(f, &bcache_policy, sizeof(bcache_policy));
+	ckpt_write(f, &bcache_hand, sizeof(bcache_hand));
+	for (i = 0; i < bcache_size; i++) {
+		buf = &bcache_bufs[i];
+		ckpt_write(f, &buf->block, sizeof(buf->block));
+		ckpt_write(f, &buf->dirty, sizeof(buf->dirty));
+		ckpt_write(f, &buf->ref, sizeof(buf->ref));
+		if (buf->dirty)
+			ckpt_write(f, buf->data, bcache_blocksize);
+	}
+	for (buf = bcache_lru_head; buf; buf = buf->next) {
+		i = buf - bcache_bufs;
+		ckpt_write(f, &i, sizeof(i));
+	}
+}
+
+
+void bcache_restore(FILE *f)
+{
+	struct bcache_buf_t *buf;
+	enum bcache_policy_enum policy;
+	int i, size, mapped, *order;
+	size_t count;
+
+	ckpt_read(f, &bcache_last_flush, sizeof(bcache_last_flush));
+	ckpt_read(f, &bcache_hits, sizeof(bcache_hits));
+	ckpt_read(f, &bcache_misses, sizeof(bcache_misses));
+	ckpt_read(f, &bcache_evictions, sizeof(bcache_evictions));
+	ckpt_read(f, &bcache_writebacks, sizeof(bcache_writebacks));
+	ckpt_read(f, &bcache_flushes, sizeof(bcache_flushes));
+	ckpt_read(f, &mapped, sizeof(mapped));
+	if (mapped != bcache_mmap)
+		fatal("bcache_restore: checkpoint saved with BCACHE_MMAP=%d", mapped);
+	if (bcache_image) {
+		ckpt_read(f, &bcache_image_dirty, sizeof(bcache_image_dirty));
+		return;
+	}
+	ckpt_read(f, &size, sizeof(size));
+	if (size != bcache_size)
+		fatal("bcache_restore: checkpoint saved with %d buffers", size);
+	ckpt_read(f, &policy, sizeof(policy));
+	if (policy != bcache_policy)
+		fatal("bcache_restore: checkpoint saved with BCACHE_POLICY=%s",
+			map_value(&bcache_policy_map, policy));
+	ckpt_read(f, &bcache_hand, sizeof(bcache_hand));
+	for (i = 0; i < bcache_size; i++) {
+		buf = &bcache_bufs[i];
+		ckpt_read(f, &buf->block, sizeof(buf->block));
+		ckpt_read(f, &buf->dirty, sizeof(buf->dirty));
+		ckpt_read(f, &buf->ref, sizeof(buf->ref));
+		if (buf->block < 0)
+			continue;
+		if (buf->block >= bcache_blocks)
+			fatal("bcache_restore: invalid block in checkpoint");
+		bcache_map[buf->block] = buf;
+		if (buf->dirty) {
+			ckpt_read(f, buf->data, bcache_blocksize);
+			continue;
+		}
+		fseek(bcache_file, (long) buf->block * bcache_blocksize, SEEK_SET);
+		count = fread(buf->data, 1, bcache_blocksize, bcache_file);
+		memset(buf->data + count, 0, bcache_blocksize - count);
+	}
+
+	/* Replacement order, most recently used first */
+	if (bcache_policy != bcache_policy_lru)
+		return;
+	order = calloc(bcache_size, sizeof(int));
+	if (!order)
+		fatal("bcache_restore: out of memory");
+	for (i = 0; i < bcache_size; i++) {
+		ckpt_read(f, &order[i], sizeof(int));
+		if (order[i] < 0 || order[i] >= bcache_size)
+			fatal("bcache_restore: invalid buffer in checkpoint");
+	}
+	bcache_lru_head = bcache_lru_tail = NULL;
+	for (i = bcache_size - 1; i >= 0; i--)
+		bcache_lru_insert_head(&bcache_bufs[order[i]]);
+	free(order);
+}
@@ -0,0 +1,587 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Checkpoint parameters */
+char *ckpt_file = "Sim_ckpt";
+long long ckpt_at = 0;  /* Value of 'instr_num' to save a checkpoint at (0=none) */
+
+
+#define CKPT_MAGIC  0x54504b43
+#define CKPT_VERSION  4
+
+/* The header records the size of the structures saved as raw copies, so
+ * that a checkpoint is not restored by a different build. */
+struct ckpt_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ctx_size;
+	uint32_t regs_size;
+	uint32_t loader_size;
+	uint32_t fd_size;
+	int numblocks;
+	int blocksize;
+	uint64_t timer;  /* 'ke_timer' at save time */
+};
+
+
+void ckpt_write(FILE *f, void *buf, size_t size)
+{
+	if (size && fwrite(buf, size, 1, f) != 1)
+		fatal("checkpoint: cannot write file");
+}
+
+
+void ckpt_read(FILE *f, void *buf, size_t size)
+{
+	if (size && fread(buf, size, 1, f) != 1)
+		fatal("checkpoint: file is truncated");
+}
+
+
+static void ckpt_write_string(FILE *f, char *str)
+{
+	int len = str ? strlen(str) : -1;
+
+	ckpt_write(f, &len, sizeof(len));
+	ckpt_write(f, str, len > 0 ? len : 0);
+}
+
+
+static char *ckpt_read_string(FILE *f)
+{
+	char *str;
+	int len;
+
+	ckpt_read(f, &len, sizeof(len));
+	if (len < 0)
+		return NULL;
+	str = calloc(1, len + 1);
+	if (!str)
+		fatal("checkpoint: out of memory");
+	ckpt_read(f, str, len);
+	return str;
+}
+
+
+
+
+/*
+ * Structures shared by the contexts of a memory map
+ */
+
+static void ckpt_loader_save(FILE *f, struct loader_t *ld)
+{
+	int count;
+
+	ckpt_write(f, ld, sizeof(struct loader_t));
+	ckpt_write_string(f, ld->elf ? ld->elf->path : NULL);
+	count = lnlist_count(ld->args);
+	ckpt_write(f, &count, sizeof(count));
+	for (lnlist_head(ld->args); !lnlist_eol(ld->args); lnlist_next(ld->args))
+		ckpt_write_string(f, lnlist_get(ld->args));
+	count = lnlist_count(ld->env);
+	ckpt_write(f, &count, sizeof(count));
+	for (lnlist_head(ld->env); !lnlist_eol(ld->env); lnlist_next(ld->env))
+		ckpt_write_string(f, lnlist_get(ld->env));
+	ckpt_write_string(f, ld->interp);
+	ckpt_write_string(f, ld->exe);
+	ckpt_write_string(f, ld->cwd);
+	ckpt_write_string(f, ld->stdin_file);
+	ckpt_write_string(f, ld->stdout_file);
+}
+
+
+static struct loader_t *ckpt_loader_restore(FILE *f)
+{
+	struct loader_t *ld;
+	char *path;
+	int i, count;
+
+	ld = calloc(1, sizeof(struct loader_t));
+	if (!ld)
+		fatal("ckpt_restore: out of memory");
+	ckpt_read(f, ld, sizeof(struct loader_t));
+	path = ckpt_read_string(f);
+	ld->elf = path ? elf_open(path) : NULL;
+	free(path);
+	ld->args = lnlist_create();
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++)
+		lnlist_add(ld->args, ckpt_read_string(f));
+	ld->env = lnlist_create();
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++)
+		lnlist_add(ld->env, ckpt_read_string(f));
+	ld->interp = ckpt_read_string(f);
+	ld->exe = ckpt_read_string(f);
+	ld->cwd = ckpt_read_string(f);
+	ld->stdin_file = ckpt_read_string(f);
+	ld->stdout_file = ckpt_read_string(f);
+	return ld;
+}
+
+
+/* Host files are saved by path and offset, and opened again on restore */
+static void ckpt_fdt_save(FILE *f, struct fdt_t *fdt)
+{
+	struct fd_t *fd;
+	int i, count, present;
+	off_t offset;
+
+	count = list_count(fdt->fd_list);
+	ckpt_write(f, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		fd = list_get(fdt->fd_list, i);
+		present = fd != NULL;
+		ckpt_write(f, &present, sizeof(present));
+		if (!fd)
+			continue;
+		offset = 0;
+		if ((fd->kind == fd_kind_regular || fd->kind == fd_kind_virtual) && fd->host_fd >= 0)
+			offset = lseek(fd->host_fd, 0, SEEK_CUR);
+		ckpt_write(f, fd, sizeof(struct fd_t));
+		ckpt_write(f, &offset, sizeof(offset));
+	}
+}
+
+
+static struct fdt_t *ckpt_fdt_restore(FILE *f)
+{
+	struct fdt_t *fdt;
+	struct fd_t *fd;
+	int i, count, present;
+	off_t offset;
+
+	ckpt_read(f, &count, sizeof(count));
+	fdt = calloc(1, sizeof(struct fdt_t));
+	if (!fdt)
+		fatal("ckpt_restore: out of memory");
+	fdt->fd_list = list_create(count);
+	for (i = 0; i < count; i++) {
+		ckpt_read(f, &present, sizeof(present));
+		if (!present) {
+			list_add(fdt->fd_list, NULL);
+			continue;
+		}
+		fd = calloc(1, sizeof(struct fd_t));
+		if (!fd)
+			fatal("ckpt_restore: out of memory");
+		ckpt_read(f, fd, sizeof(struct fd_t));
+		ckpt_read(f, &offset, sizeof(offset));
+
+		switch (fd->kind) {
+
+		case fd_kind_std:
+			break;
+
+		case fd_kind_regular:
+		case fd_kind_virtual:
+			if (fd->host_fd < 0)
+				break;
+			fd->host_fd = open(fd->path, fd->flags & ~(O_CREAT | O_TRUNC | O_EXCL));
+			if (fd->host_fd < 0)
+				fatal("ckpt_restore: cannot open '%s' for guest file descriptor %d",
+					fd->path, fd->guest_fd);
+			lseek(fd->host_fd, offset, SEEK_SET);
+			break;
+
+		/* Pipes, sockets and devices only exist in the saving process */
+		default:
+			warning("ckpt_restore: guest file descriptor %d cannot be restored, closed",
+				fd->guest_fd);
+			free(fd);
+			fd = NULL;
+		}
+		list_add(fdt->fd_list, fd);
+	}
+	return fdt;
+}
+
+
+/* Host handler pointers are those of the restoring process */
+static void ckpt_signal_handlers_save(FILE *f, struct signal_handlers_t *handlers)
+{
+	int sig;
+
+	for (sig = 0; sig < 64; sig++) {
+		ckpt_write(f, &handlers->sigaction[sig].handler, sizeof(uint32_t));
+		ckpt_write(f, &handlers->sigaction[sig].flags, sizeof(uint32_t));
+		ckpt_write(f, &handlers->sigaction[sig].restorer, sizeof(uint32_t));
+		ckpt_write(f, &handlers->sigaction[sig].mask, sizeof(uint64_t));
+	}
+}
+
+
+static struct signal_handlers_t *ckpt_signal_handlers_restore(FILE *f)
+{
+	struct signal_handlers_t *handlers;
+	int sig;
+
+	handlers = install_signal_handlers();
+	for (sig = 0; sig < 64; sig++) {
+		ckpt_read(f, &handlers->sigaction[sig].handler, sizeof(uint32_t));
+		ckpt_read(f, &handlers->sigaction[sig].flags, sizeof(uint32_t));
+		ckpt_read(f, &handlers->sigaction[sig].restorer, sizeof(uint32_t));
+		ckpt_read(f, &handlers->sigaction[sig].mask, sizeof(uint64_t));
+	}
+	return handlers;
+}
+
+
+
+
+/*
+ * Contexts
+ */
+
+/* First context in the context list with the memory map of 'ctx'. It saves
+ * the structures shared by all of them. */
+static struct ctx_t *ckpt_ctx_leader(struct ctx_t *ctx)
+{
+	struct ctx_t *other;
+
+	for (other = ke->context_list_head; other->mem != ctx->mem; other = other->context_next);
+	if (other->loader != ctx->loader || other->fdt != ctx->fdt ||
+		other->signal_handlers != ctx->signal_handlers)
+		fatal("ckpt_save: context %d shares its memory map but not its loader, "
+			"files or signal handlers", ctx->pid);
+	return other;
+}
+
+
+static void ckpt_ctx_save(FILE *f, struct ctx_t *ctx)
+{
+	struct signal_masks_t *masks = ctx->signal_masks;
+	struct ctx_t *leader;
+	int pid, has_regs;
+
+	/* Pointers in the raw copy are set again on restore */
+	ckpt_write(f, ctx, sizeof(struct ctx_t));
+	pid = ctx->parent ? ctx->parent->pid : -1;
+	ckpt_write(f, &pid, sizeof(pid));
+	ckpt_write(f, ctx->regs, sizeof(struct regs_t));
+
+	has_regs = masks->regs != NULL;
+	ckpt_write(f, &masks->pending, sizeof(masks->pending));
+	ckpt_write(f, &masks->blocked, sizeof(masks->blocked));
+	ckpt_write(f, &masks->backup, sizeof(masks->backup));
+	ckpt_write(f, &masks->pretcode, sizeof(masks->pretcode));
+	ckpt_write(f, &has_regs, sizeof(has_regs));
+	if (has_regs)
+		ckpt_write(f, masks->regs, sizeof(struct regs_t));
+
+	leader = ckpt_ctx_leader(ctx);
+	ckpt_write(f, &leader->pid, sizeof(leader->pid));
+	if (leader != ctx)
+		return;
+	mem_save(ctx->mem, f);
+	ckpt_loader_save(f, ctx->loader);
+	ckpt_fdt_save(f, ctx->fdt);
+	ckpt_signal_handlers_save(f, ctx->signal_handlers);
+}
+
+
+/* Create a context from a checkpoint and add it at the tail of the context
+ * list. Contexts are restored in list order, so the context saving shared
+ * structures comes first. Return the pid of its parent. */
+static int ckpt_ctx_restore(FILE *f, uint64_t timer_delta)
+{
+	struct signal_masks_t *masks;
+	struct ctx_t *ctx, *leader;
+	int i, parent, pid, has_regs;
+
+	ctx = calloc(1, sizeof(struct ctx_t));
+	if (!ctx)
+		fatal("ckpt_restore: out of memory");
+	ckpt_read(f, ctx, sizeof(struct ctx_t));
+	ckpt_read(f, &parent, sizeof(parent));
+	ctx->parent = NULL;
+	ctx->context_next = ctx->context_prev = NULL;
+	ctx->running_next = ctx->running_prev = NULL;
+	ctx->suspended_next = ctx->suspended_prev = NULL;
+	ctx->finished_next = ctx->finished_prev = NULL;
+	ctx->zombie_next = ctx->zombie_prev = NULL;
+	ctx->alloc_next = ctx->alloc_prev = NULL;
+	ctx->host_thread_suspend_active = 0;
+	ctx->host_thread_timer_active = 0;
+	ctx->sched.ctx = ctx;
+	ctx->sched.queued = 0;
+	ctx->sched.picked = 0;
+	ctx->sched.left = ctx->sched.right = ctx->sched.parent = NULL;
+	ctx->sched.next = ctx->sched.prev = NULL;
+
+	/* Host times are relative to the start of the simulation */
+	if (ctx->wakeup_time)
+		ctx->wakeup_time += timer_delta;
+	if (ctx->host_thread_timer_wakeup)
+		ctx->host_thread_timer_wakeup += timer_delta;
+	for (i = 0; i < 3; i++)
+		if (ctx->itimer_value[i])
+			ctx->itimer_value[i] += timer_delta;
+
+	ctx->regs = regs_create();
+	ckpt_read(f, ctx->regs, sizeof(struct regs_t));
+	ctx->signal_masks = masks = signal_masks_create();
+	ckpt_read(f, &masks->pending, sizeof(masks->pending));
+	ckpt_read(f, &masks->blocked, sizeof(masks->blocked));
+	ckpt_read(f, &masks->backup, sizeof(masks->backup));
+	ckpt_read(f, &masks->pretcode, sizeof(masks->pretcode));
+	ckpt_read(f, &has_regs, sizeof(has_regs));
+	if (has_regs) {
+		masks->regs = regs_create();
+		ckpt_read(f, masks->regs, sizeof(struct regs_t));
+	}
+
+	ckpt_read(f, &pid, sizeof(pid));
+	if (pid == ctx->pid) {
+		ctx->mem = mem_restore(f);
+		ctx->loader = ckpt_loader_restore(f);
+		ctx->fdt = ckpt_fdt_restore(f);
+		ctx->signal_handlers = ckpt_signal_handlers_restore(f);
+	} else {
+		leader = ctx_get(pid);
+		if (!leader)
+			fatal("ckpt_restore: context %d shares the memory map of missing context %d",
+				ctx->pid, pid);
+		ctx->mem = leader->mem;
+		ctx->mem->sharing++;
+		ctx->loader = leader->loader;
+		ctx->fdt = leader->fdt;
+		ctx->signal_handlers = leader->signal_handlers;
+	}
+	ke_list_insert_tail(ke_list_context, ctx);
+	return parent;
+}
+
+
+/* Order of the kernel lists other than the context list */
+static enum ke_list_enum ckpt_lists[] = {
+	ke_list_running,
+	ke_list_suspended,
+	ke_list_zombie,
+	ke_list_finished,
+	ke_list_alloc
+};
+
+#define CKPT_LISTS  (sizeof(ckpt_lists) / sizeof(ckpt_lists[0]))
+
+
+/* Context following 'ctx' in a list, or its head if 'ctx' is NULL */
+static struct ctx_t *ckpt_list_next(enum ke_list_enum list, struct ctx_t *ctx)
+{
+	switch (list) {
+	case ke_list_running:
+		return ctx ? ctx->running_next : ke->running_list_head;
+	case ke_list_suspended:
+		return ctx ? ctx->suspended_next : ke->suspended_list_head;
+	case ke_list_zombie:
+		return ctx ? ctx->zombie_next : ke->zombie_list_head;
+	case ke_list_finished:
+		return ctx ? ctx->finished_next : ke->finished_list_head;
+	case ke_list_alloc:
+		return ctx ? ctx->alloc_next : ke->alloc_list_head;
+	default:
+		return ctx ? ctx->context_next : ke->context_list_head;
+	}
+}
+
+
+static void ckpt_lists_save(FILE *f)
+{
+	struct ctx_t *ctx;
+	int i, count;
+
+	for (i = 0; i < CKPT_LISTS; i++) {
+		count = 0;
+		for (ctx = ckpt_list_next(ckpt_lists[i], NULL); ctx; ctx = ckpt_list_next(ckpt_lists[i], ctx))
+			count++;
+		ckpt_write(f, &count, sizeof(count));
+		for (ctx = ckpt_list_next(ckpt_lists[i], NULL); ctx; ctx = ckpt_list_next(ckpt_lists[i], ctx))
+			ckpt_write(f, &ctx->pid, sizeof(ctx->pid));
+	}
+}
+
+
+static void ckpt_lists_restore(FILE *f)
+{
+	struct ctx_t *ctx;
+	int i, j, count, pid;
+
+	for (i = 0; i < CKPT_LISTS; i++) {
+		ckpt_read(f, &count, sizeof(count));
+		for (j = 0; j < count; j++) {
+			ckpt_read(f, &pid, sizeof(pid));
+			ctx = ctx_get(pid);
+			if (!ctx)
+				fatal("ckpt_restore: missing context %d", pid);
+			ke_list_insert_tail(ckpt_lists[i], ctx);
+		}
+	}
+}
+
+
+
+
+/*
+ * Public functions
+ */
+
+/* Save the simulation state to 'path'. Must be called between two calls to
+ * 'ke_run'. The file is written under a temporary name and then renamed,
+ * so that an interrupted save leaves the previous checkpoint, and a
+ * restored simulation mapping the previous file keeps its pages. */
+void ckpt_save(char *path)
+{
+	struct ckpt_header_t header;
+	struct ctx_t *ctx;
+	char tmp_path[MAX_PATH_SIZE];
+	FILE *f;
+	int i, pid;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+		fatal("ckpt_save: path too long");
+	f = fopen(tmp_path, "wb");
+	if (!f)
+		fatal("%s: cannot create checkpoint", tmp_path);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CKPT_MAGIC;
+	header.version = CKPT_VERSION;
+	header.ctx_size = sizeof(struct ctx_t);
+	header.regs_size = sizeof(struct regs_t);
+	header.loader_size = sizeof(struct loader_t);
+	header.fd_size = sizeof(struct fd_t);
+	header.numblocks = numblocks;
+	header.blocksize = blocksize;
+	header.timer = ke_timer();
+	ckpt_write(f, &header, sizeof(header));
+
+	/* Kernel */
+	ckpt_write(f, &instr_num, sizeof(instr_num));
+	ckpt_write(f, &ke->current_pid, sizeof(ke->current_pid));
+	ckpt_write(f, &ke->current_mid, sizeof(ke->current_mid));
+	ckpt_write(f, &ke->futex_sleep_count, sizeof(ke->futex_sleep_count));
+	ckpt_write(f, &ke->context_count, sizeof(ke->context_count));
+	for (ctx = ke->context_list_head; ctx; ctx = ctx->context_next)
+		ckpt_ctx_save(f, ctx);
+	ckpt_lists_save(f);
+
+	/* Interrupt heap, in array order, so that pushing the entries again
+	 * gives the same heap */
+	ckpt_write(f, &sched_count, sizeof(sched_count));
+	for (i = 1; i <= sched_count; i++) {
+		pid = schedint[i].details.proc ? schedint[i].details.proc->pid : -1;
+		ckpt_write(f, &schedint[i].instno, sizeof(schedint[i].instno));
+		ckpt_write(f, &schedint[i].type, sizeof(schedint[i].type));
+		ckpt_write(f, &pid, sizeof(pid));
+	}
+
+	sched_save(f);
+	smp_save(f);
+	disk_save(f);
+	balloc_save(f);
+	simfs_save(f);
+
+	if (fclose(f))
+		fatal("%s: cannot write checkpoint", tmp_path);
+	if (rename(tmp_path, path))
+		fatal("%s: cannot rename checkpoint", tmp_path);
+	fprintf(stderr, "\nCheckpoint saved to '%s' at inst no. %lld\n", path, instr_num);
+}
+
+
+/* Replace the initial state with a checkpoint. Called after the kernel,
+ * the disk and the filesystem are initialized, instead of loading
+ * programs. */
+void ckpt_restore(char *path)
+{
+	struct ckpt_header_t header;
+	struct ctx_t *ctx;
+	interrupt itrp;
+	uint64_t timer_delta;
+	int i, count, pid, *parents;
+	FILE *f;
+
+	if (ke->context_list_head)
+		fatal("ckpt_restore: contexts already loaded");
+	f = fopen(path, "rb");
+	if (!f)
+		fatal("%s: cannot open checkpoint", path);
+	ckpt_read(f, &header, sizeof(header));
+	if (header.magic != CKPT_MAGIC || header.version != CKPT_VERSION)
+		fatal("%s: not a checkpoint, or saved by another version", path);
+	if (header.ctx_size != sizeof(struct ctx_t) || header.regs_size != sizeof(struct regs_t) ||
+		header.loader_size != sizeof(struct loader_t) || header.fd_size != sizeof(struct fd_t))
+		fatal("%s: checkpoint saved by a different build", path);
+	if (header.numblocks != numblocks || header.blocksize != blocksize)
+		fatal("%s: checkpoint saved with a disk of %d blocks of %d bytes",
+			path, header.numblocks, header.blocksize);
+	timer_delta = ke_timer() - header.timer;
+
+	/* Kernel */
+	ckpt_read(f, &instr_num, sizeof(instr_num));
+	ckpt_read(f, &ke->current_pid, sizeof(ke->current_pid));
+	ckpt_read(f, &ke->current_mid, sizeof(ke->current_mid));
+	ckpt_read(f, &ke->futex_sleep_count, sizeof(ke->futex_sleep_count));
+	ckpt_read(f, &count, sizeof(count));
+	parents = calloc(count + 1, sizeof(int));
+	if (!parents)
+		fatal("ckpt_restore: out of memory");
+	for (i = 0; i < count; i++)
+		parents[i] = ckpt_ctx_restore(f, timer_delta);
+	for (ctx = ke->context_list_head, i = 0; ctx; ctx = ctx->context_next, i++)
+		ctx->parent = parents[i] >= 0 ? ctx_get(parents[i]) : NULL;
+	free(parents);
+	ckpt_lists_restore(f);
+	ke->context_reschedule = 1;
+
+	/* Interrupt heap */
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		ckpt_read(f, &itrp.instno, sizeof(itrp.instno));
+		ckpt_read(f, &itrp.type, sizeof(itrp.type));
+		ckpt_read(f, &pid, sizeof(pid));
+		itrp.details.proc = pid >= 0 ? ctx_get(pid) : NULL;
+		push_interrupt(itrp);
+	}
+
+	sched_restore(f);
+	smp_restore(f);
+	disk_restore(f);
+	balloc_restore(f);
+	simfs_restore(f);
+
+	/* Mapped pages stay valid after closing */
+	fclose(f);
+	fprintf(stderr, "\nCheckpoint '%s' restored at inst no. %lld\n", path, instr_num);
+}
+
+
+/* Called between calls to 'ke_run'. Save a checkpoint once 'instr_num'
+ * reaches 'ckpt_at'. */
+void ckpt_tick(void)
+{
+	if (!ckpt_at || instr_num < ckpt_at)
+		return;
+	ckpt_at = 0;
+	ckpt_save(ckpt_file);
+}
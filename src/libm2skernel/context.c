@@ -112,6 +112,8 @@ struct ctx_t *ctx_clone(struct ctx_t *ctx)
 
 	/* Update other fields. */
 	new->parent = ctx;
+	new->uid = ctx->uid;
+	new->instr_slice = ctx->instr_slice;
 
 	/* Return new context id */
 	return new;
@@ -119,6 +121,37 @@ struct ctx_t *ctx_clone(struct ctx_t *ctx)
 }
 
 
+/* Create a child context with its own copy of the memory map, loader
+ * information, signal handlers and file descriptor table, as done by a
+ * 'fork' system call. Memory pages are shared copy-on-write. */
+struct ctx_t *ctx_fork(struct ctx_t *ctx)
+{
+	struct ctx_t *new;
+
+	new = ctx_do_create();
+	regs_copy(new->regs, ctx->regs);
+
+	/* Private copies of the shared structures */
+	new->mid = ke->current_mid++;
+	new->mem = mem_clone(ctx->mem);
+	ld_clone(new, ctx);
+	new->signal_handlers = install_signal_handlers();
+	memcpy(new->signal_handlers, ctx->signal_handlers, sizeof(struct signal_handlers_t));
+	new->fdt = fdt_clone(ctx->fdt);
+	new->glibc_segment_base = ctx->glibc_segment_base;
+	new->glibc_segment_limit = ctx->glibc_segment_limit;
+
+	/* The child keeps the blocked signals, but none of the pending ones */
+	new->signal_masks->blocked = ctx->signal_masks->blocked;
+
+	/* The child runs as the same user, with the same time slice */
+	new->parent = ctx;
+	new->uid = ctx->uid;
+	new->instr_slice = ctx->instr_slice;
+	return new;
+}
+
+
 /* Free a context */
 void ctx_free(struct ctx_t *ctx)
 {
@@ -135,6 +168,12 @@ void ctx_free(struct ctx_t *ctx)
 	assert(ke_list_member(ke_list_finished, ctx));
 	ke_list_remove(ke_list_finished, ctx);
 		
+	/* Pending interrupts and disk requests must not refer to a freed context */
+	cancel_interrupts(ctx);
+	disk_cancel(ctx);
+	simfs_close_ctx(ctx);
+	sched_exit(ctx);
+
 	/* Free private structures */
 	regs_free(ctx->regs);
 	signal_masks_free(ctx->signal_masks);
@@ -188,7 +227,8 @@ void ctx_dump(struct ctx_t *ctx, FILE *f)
 void ctx_execute_inst(struct ctx_t *ctx)
 {
 	unsigned char fixed[20];
-	void *buf;
+	void *buf = NULL;
+	x86_inst_t *inst;
 
 	/* The isa_xxx functions work on these global
 	 * variables. */
@@ -198,19 +238,29 @@ void ctx_execute_inst(struct ctx_t *ctx)
 	isa_eip = isa_regs->eip;
 	isa_inst_count++;
 
-	/* Read instruction from memory */
-	ctx->mem->safe = mem_safe_mode;
-	if (ctx_get_status(ctx, ctx_specmode))
-		ctx->mem->safe = 0;
-	buf = mem_get_buffer(ctx->mem, ctx->regs->eip, 20, mem_access_exec);
-	if (!buf) {
-		buf = &fixed;
-		mem_access(ctx->mem, ctx->regs->eip, 20, buf, mem_access_exec);
-	}
-	ctx->mem->safe = mem_safe_mode;
+	/* Instructions decoded before are taken from the decoded
+	 * instruction cache of the memory map. */
+	inst = mem_icache_lookup(ctx->mem, isa_eip);
+	if (inst) {
+		isa_inst = *inst;
+	} else {
+
+		/* Read instruction from memory */
+		ctx->mem->safe = mem_safe_mode;
+		if (ctx_get_status(ctx, ctx_specmode))
+			ctx->mem->safe = 0;
+		buf = mem_get_buffer(ctx->mem, ctx->regs->eip, 20, mem_access_exec);
+		if (!buf) {
+			buf = &fixed;
+			mem_access(ctx->mem, ctx->regs->eip, 20, buf, mem_access_exec);
+		}
+		ctx->mem->safe = mem_safe_mode;
 
-	/* Disassemble */
-	x86_disasm(buf, isa_eip, &isa_inst);
+		/* Disassemble */
+		x86_disasm(buf, isa_eip, &isa_inst);
+		if (isa_inst.opcode != op_none)
+			mem_icache_insert(ctx->mem, &isa_inst);
+	}
 
 	/* Call the isa module to execute one machine instruction,
 	 * only if we are not in speculative mode. */
@@ -219,6 +269,38 @@ void ctx_execute_inst(struct ctx_t *ctx)
 }
 
 
+/* Execute up to 'limit' instructions of the basic block starting at the
+ * current eip, and return the number of executed instructions. Contexts in
+ * speculative mode, code that cannot be cached and instruction debugging
+ * fall back to 'ctx_execute_inst'. Executed instructions are added to
+ * 'instr_num'. With 'isa_block_check', each block is compared against
+ * per-instruction execution. */
+int ctx_execute_block(struct ctx_t *ctx, int limit)
+{
+	struct mem_block_t *block = NULL;
+
+	isa_ctx = ctx;
+	isa_regs = ctx->regs;
+	isa_mem = ctx->mem;
+	if (!ctx_get_status(ctx, ctx_specmode) &&
+		!debug_status(isa_inst_debug_category) &&
+		!debug_status(isa_call_debug_category))
+	{
+		block = mem_block_lookup(ctx->mem, ctx->regs->eip);
+		if (!block)
+			block = isa_decode_block(ctx->regs->eip);
+	}
+	if (!block) {
+		ctx_execute_inst(ctx);
+		instr_num++;
+		return 1;
+	}
+	if (isa_block_check)
+		return isa_check_block(block, limit);
+	return isa_execute_block(block, limit);
+}
+
+
 void ctx_set_eip(struct ctx_t *ctx, uint32_t eip)
 {
 	/* Entering specmode */
@@ -249,6 +331,7 @@ int ctx_get_status(struct ctx_t *ctx, enum ctx_status_enum status)
 static void ctx_update_status(struct ctx_t *ctx, enum ctx_status_enum status)
 {
 	enum ctx_status_enum status_diff;
+	int was_running = ctx->status & ctx_running;
 
 	/* Remove contexts from the following lists:
 	 *   running, suspended, zombie */
@@ -269,8 +352,16 @@ static void ctx_update_status(struct ctx_t *ctx, enum ctx_status_enum status)
 	if (status_diff & ~ctx_specmode)
 		ke->context_reschedule = 1;
 	
-	/* Update status */
-	ctx->status = status_diff; //Changed here
+	/* Update status. The bits owned by the timing simulator are set and
+	 * cleared as given, since the pipeline does not follow the kernel
+	 * convention of passing the changed bits. They are carried over when
+	 * other bits change, so that suspending a context mapped to the
+	 * pipeline keeps 'ctx_alloc'. */
+	if (status_diff & ~(ctx_alloc | ctx_specmode))
+		ctx->status = (status_diff & ~(ctx_alloc | ctx_specmode)) |
+			(status & (ctx_alloc | ctx_specmode)); //Changed here
+	else
+		ctx->status = status;
 	
 	if (ctx->status & ctx_finished)
 		ctx->status = ctx_finished | (status & ctx_alloc);
@@ -296,6 +387,12 @@ static void ctx_update_status(struct ctx_t *ctx, enum ctx_status_enum status)
 	if (ctx->status & ctx_alloc)
 		ke_list_insert_tail(ke_list_alloc, ctx);
 	
+	/* Notify the scheduler */
+	if (was_running && !(ctx->status & ctx_running))
+		sched_block(ctx);
+	else if (!was_running && (ctx->status & ctx_running))
+		sched_wake(ctx);
+	
 	/* Dump new status (ignore 'ctx_specmode' status, it's too frequent) */
 	if (debug_status(ctx_debug_category) && (status_diff & ~ctx_specmode)) {
 		char sstatus[200];
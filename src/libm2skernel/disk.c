@@ -0,0 +1,570 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Disk parameters. Times are in instructions; zero values are replaced by
+ * defaults derived from the geometry in 'disk_init'. */
+struct string_map_t disk_policy_map = {
+	4, {
+		{ "fcfs",   disk_policy_fcfs },
+		{ "sstf",   disk_policy_sstf },
+		{ "scan",   disk_policy_scan },
+		{ "clook",  disk_policy_clook }
+	}
+};
+
+enum disk_policy_enum disk_policy = disk_policy_fcfs;
+long long disk_seek_base = 0;  /* Fixed cost of a non-zero seek */
+long long disk_seek_track = 0;  /* Cost per track crossed */
+long long disk_rotation = 0;  /* Time of a full revolution */
+
+
+/* Queued disk request */
+struct disk_request_t {
+	struct ctx_t *ctx;  /* Requesting context, NULL if it was freed */
+	int op;  /* 1 = read, 0 = write */
+	int string;  /* Transfer strings instead of binary data */
+	int cylinder;  /* Cylinder of the first segment */
+	long long submit;  /* 'instr_num' at submission */
+	struct disk_request_t *next;
+
+	/* Data of a write from a context, copied from guest memory at
+	 * submission, with the size of all segments */
+	unsigned char *data;
+	int data_size;
+
+	/* Segments, with 'offset' less than 'blocksize' */
+	int count;
+	struct disk_segment_t seg[];
+};
+
+/* Disk image and geometry */
+static FILE *disk_file;
+static int disk_heads, disk_tracks, disk_sectors;
+
+/* Pending requests in arrival order, and request in service */
+static struct disk_request_t *disk_queue_head;
+static struct disk_request_t **disk_queue_tail = &disk_queue_head;
+static int disk_queue_count;
+static struct disk_request_t *disk_current;
+
+/* Head position and direction of the SCAN sweep */
+static int disk_cylinder;
+static int disk_direction = 1;
+
+/* Statistics */
+static long long disk_requests, disk_reads, disk_writes, disk_bytes, disk_segments;
+static long long disk_latency_total, disk_latency_max;
+static long long disk_service_total, disk_seek_total;
+static int disk_queue_max;
+
+
+static int disk_block_cylinder(int block)
+{
+	return block / (disk_heads * disk_sectors);
+}
+
+
+static void disk_request_free(struct disk_request_t *req)
+{
+	free(req->data);
+	free(req);
+}
+
+
+/* Return the link pointing to the next request to serve */
+static struct disk_request_t **disk_pick(void)
+{
+	struct disk_request_t **link, **best = NULL;
+	int dist, best_dist = 0, pass;
+
+	switch (disk_policy) {
+
+	case disk_policy_sstf:
+		for (link = &disk_queue_head; *link; link = &(*link)->next) {
+			dist = abs((*link)->cylinder - disk_cylinder);
+			if (!best || dist < best_dist) {
+				best = link;
+				best_dist = dist;
+			}
+		}
+		return best;
+
+	/* Closest request ahead in the current direction; reverse the
+	 * direction when there is none. */
+	case disk_policy_scan:
+		for (pass = 0; pass < 2 && !best; pass++) {
+			for (link = &disk_queue_head; *link; link = &(*link)->next) {
+				dist = ((*link)->cylinder - disk_cylinder) * disk_direction;
+				if (dist >= 0 && (!best || dist < best_dist)) {
+					best = link;
+					best_dist = dist;
+				}
+			}
+			if (!best)
+				disk_direction = -disk_direction;
+		}
+		return best;
+
+	/* Closest request at or above the head; when there is none, jump
+	 * back to the lowest pending cylinder. */
+	case disk_policy_clook:
+		for (link = &disk_queue_head; *link; link = &(*link)->next) {
+			dist = (*link)->cylinder - disk_cylinder;
+			if (dist < 0)
+				dist += disk_tracks;
+			if (!best || dist < best_dist) {
+				best = link;
+				best_dist = dist;
+			}
+		}
+		return best;
+
+	default:
+		return &disk_queue_head;
+	}
+}
+
+
+/* Start serving the next request if the disk is idle. Each segment costs
+ * the seek to its first cylinder, the rotation until its first sector is
+ * under the head, and the transfer of all its sectors. */
+static void disk_start(void)
+{
+	struct disk_request_t **link, *req;
+	struct disk_segment_t *seg;
+	long long service, seek, pos, target, sector_time;
+	interrupt itrp;
+	int i, dist, blocks;
+
+	if (disk_current || !disk_queue_head)
+		return;
+	link = disk_pick();
+	req = *link;
+	*link = req->next;
+	if (!*link)
+		disk_queue_tail = link;
+	disk_queue_count--;
+
+	service = 0;
+	sector_time = MAX(disk_rotation / disk_sectors, 1);
+	for (i = 0; i < req->count; i++) {
+		seg = &req->seg[i];
+		blocks = (seg->offset + seg->size + blocksize - 1) / blocksize;
+		if (!blocks)
+			continue;
+		dist = abs(disk_block_cylinder(seg->block) - disk_cylinder);
+		seek = dist ? disk_seek_base + disk_seek_track * dist : 0;
+		pos = (instr_num + service + seek) % disk_rotation;
+		target = (long long) (seg->block % disk_sectors) * disk_rotation / disk_sectors;
+		service += seek + (target - pos + disk_rotation) % disk_rotation;
+		service += blocks * sector_time;
+		disk_cylinder = disk_block_cylinder(seg->block + blocks - 1);
+		disk_seek_total += dist;
+	}
+	service = MAX(service, 1);
+	disk_service_total += service;
+	disk_current = req;
+
+	/* The interrupt belongs to the disk, not to the context, so that it
+	 * survives the context being freed. */
+	itrp.type = DISK_INTERRUPT;
+	itrp.instno = instr_num + service;
+	itrp.details.proc = NULL;
+	push_interrupt(itrp);
+}
+
+
+void disk_init(char *path, int heads, int tracks, int sectors)
+{
+	if (heads <= 0 || tracks <= 0 || sectors <= 0)
+		fatal("disk_init: invalid geometry %d/%d/%d", heads, tracks, sectors);
+	disk_file = fopen(path, "r+");
+	if (!disk_file)
+		fatal("%s: cannot open disk image", path);
+
+	disk_heads = heads;
+	disk_tracks = tracks;
+	disk_sectors = sectors;
+	bcache_init(disk_file, heads * tracks * sectors, blocksize);
+	balloc_init(heads * tracks * sectors);
+	if (!disk_rotation)
+		disk_rotation = sectors * 4;
+	if (!disk_seek_base)
+		disk_seek_base = 8;
+	if (!disk_seek_track)
+		disk_seek_track = 1;
+}
+
+
+void disk_done(void)
+{
+	struct disk_request_t *req;
+
+	if (!disk_file)
+		return;
+	bcache_done();
+	disk_dump(stdout);
+	balloc_done();
+	while ((req = disk_queue_head)) {
+		disk_queue_head = req->next;
+		disk_request_free(req);
+	}
+	if (disk_current)
+		disk_request_free(disk_current);
+	disk_queue_tail = &disk_queue_head;
+	disk_current = NULL;
+	fclose(disk_file);
+	disk_file = NULL;
+}
+
+
+void disk_dump(FILE *f)
+{
+	fprintf(f, "\nDisk summary:\n");
+	fprintf(f, "disk.policy  %s  # Request scheduling policy\n",
+		map_value(&disk_policy_map, disk_policy));
+	fprintf(f, "disk.requests  %lld  # Completed requests\n", disk_requests);
+	fprintf(f, "disk.reads  %lld\n", disk_reads);
+	fprintf(f, "disk.writes  %lld\n", disk_writes);
+	fprintf(f, "disk.segments  %lld  # Segments of all requests\n", disk_segments);
+	fprintf(f, "disk.bytes  %lld  # Bytes transferred\n", disk_bytes);
+	fprintf(f, "disk.latency  %.1f  # Average instructions from submission to completion\n",
+		disk_requests ? (double) disk_latency_total / disk_requests : 0.0);
+	fprintf(f, "disk.latency_max  %lld\n", disk_latency_max);
+	fprintf(f, "disk.service  %.1f  # Average instructions of seek, rotation and transfer\n",
+		disk_requests ? (double) disk_service_total / disk_requests : 0.0);
+	fprintf(f, "disk.seek_distance  %.2f  # Average tracks crossed per request\n",
+		disk_requests ? (double) disk_seek_total / disk_requests : 0.0);
+	fprintf(f, "disk.queue_max  %d  # Maximum number of pending requests\n", disk_queue_max);
+	fprintf(f, "disk.busy  %.4f  # Fraction of time serving requests\n",
+		instr_num ? (double) disk_service_total / instr_num : 0.0);
+	fprintf(f, "disk.throughput  %.2f  # Requests per million instructions\n",
+		instr_num ? (double) disk_requests * 1000000 / instr_num : 0.0);
+	bcache_dump(f);
+	balloc_dump(f);
+}
+
+
+/* Queue a request of 'count' segments and suspend the context until it
+ * completes. Segments must have been checked against the disk size. A
+ * request with no context only occupies the disk: it is used for blocks
+ * already written through the buffer cache. If
+ * 'string' is set, a segment is transferred as a string: a read stops at
+ * the first null byte and terminates the string in guest memory, and a
+ * write pads the string with zeros. The data of a write is taken from
+ * guest memory now, so that it reaches the disk even if the context is
+ * freed before the request completes. */
+void disk_submit(struct ctx_t *ctx, int op, int string, struct disk_segment_t *seg, int count)
+{
+	struct disk_request_t *req;
+	unsigned char *data;
+	int i, len;
+
+	assert(count > 0);
+	req = calloc(1, sizeof(struct disk_request_t) + count * sizeof(struct disk_segment_t));
+	req->ctx = ctx;
+	req->op = op;
+	req->string = string;
+	req->submit = instr_num;
+	req->count = count;
+	memcpy(req->seg, seg, count * sizeof(struct disk_segment_t));
+	for (i = 0; i < count; i++) {
+		req->seg[i].block += req->seg[i].offset / blocksize;
+		req->seg[i].offset %= blocksize;
+	}
+	req->cylinder = disk_block_cylinder(req->seg[0].block);
+
+	/* Write data */
+	if (ctx && !op) {
+		for (i = 0; i < count; i++)
+			req->data_size += req->seg[i].size;
+		req->data = malloc(MAX(req->data_size, 1));
+		if (!req->data)
+			fatal("disk_submit: out of memory");
+		data = req->data;
+		for (i = 0; i < count; i++) {
+			if (string) {
+				len = mem_read_string(ctx->mem, req->seg[i].addr, req->seg[i].size,
+					(char *) data);
+				memset(data + len, 0, req->seg[i].size - len);
+			} else
+				mem_read(ctx->mem, req->seg[i].addr, req->seg[i].size, data);
+			data += req->seg[i].size;
+		}
+	}
+
+	*disk_queue_tail = req;
+	disk_queue_tail = &req->next;
+	disk_queue_count++;
+	disk_queue_max = MAX(disk_queue_max, disk_queue_count);
+
+	if (ctx) {
+		printf("\nSending process of uid %d at inst no. %lld\n", ctx->uid, instr_num);
+		ctx_set_status(ctx, ctx_suspended);
+	}
+	disk_start();
+}
+
+
+/* Read a segment into guest memory as a string */
+static void disk_read_string(struct ctx_t *ctx, struct disk_segment_t *seg)
+{
+	char *data, zero = 0;
+	int len;
+
+	data = (char *) bcache_get(seg->block, 0) + seg->offset;
+	len = strnlen(data, seg->size);
+	mem_write(ctx->mem, seg->addr, len, data);
+	mem_write(ctx->mem, seg->addr + len, 1, &zero);
+}
+
+
+/* Read a segment into guest memory if 'ctx' is set, or write 'buf' to it
+ * otherwise */
+static void disk_transfer(struct ctx_t *ctx, struct disk_segment_t *seg, unsigned char *buf)
+{
+	unsigned char *data;
+	uint32_t addr = seg->addr;
+	int block = seg->block, offset = seg->offset;
+	int left, len;
+
+	for (left = seg->size; left > 0; left -= len) {
+		len = MIN(left, blocksize - offset);
+		data = bcache_get(block, !ctx) + offset;
+		if (ctx)
+			mem_write(ctx->mem, addr, len, data);
+		else {
+			memcpy(data, buf, len);
+			buf += len;
+		}
+		addr += len;
+		block++;
+		offset = 0;
+	}
+}
+
+
+/* Called on a DISK_INTERRUPT. Transfer the data of the request in service,
+ * wake up its context and start the next request. */
+void disk_complete(void)
+{
+	struct disk_request_t *req = disk_current;
+	struct ctx_t *ctx;
+	unsigned char *data;
+	int i;
+
+	assert(req);
+	ctx = req->ctx;
+	disk_current = NULL;
+
+	/* Write data, even if the context was freed */
+	data = req->data;
+	for (i = 0; data && i < req->count; i++) {
+		disk_transfer(NULL, &req->seg[i], data);
+		data += req->seg[i].size;
+	}
+
+	/* Read data, and wake up the context */
+	if (ctx) {
+		printf("\nHandling interrupt for uid %d at inst no. %lld\n", ctx->uid, instr_num);
+		for (i = 0; req->op && i < req->count; i++) {
+			if (req->string)
+				disk_read_string(ctx, &req->seg[i]);
+			else
+				disk_transfer(ctx, &req->seg[i], NULL);
+		}
+		ctx_set_status(ctx, ctx_running);
+	}
+
+	disk_requests++;
+	if (req->op)
+		disk_reads++;
+	else
+		disk_writes++;
+	for (i = 0; i < req->count; i++)
+		disk_bytes += req->seg[i].size;
+	disk_segments += req->count;
+	disk_latency_total += instr_num - req->submit;
+	disk_latency_max = MAX(disk_latency_max, instr_num - req->submit);
+	disk_request_free(req);
+	bcache_tick();
+	disk_start();
+}
+
+
+/* Drop the reads of a context being freed. Its writes, and a request
+ * already in service, complete without a context. */
+void disk_cancel(struct ctx_t *ctx)
+{
+	struct disk_request_t **link = &disk_queue_head, *req;
+
+	while ((req = *link)) {
+		if (req->ctx == ctx && req->op) {
+			*link = req->next;
+			disk_queue_count--;
+			disk_request_free(req);
+			continue;
+		}
+		if (req->ctx == ctx)
+			req->ctx = NULL;
+		link = &req->next;
+	}
+	disk_queue_tail = link;
+	if (disk_current && disk_current->ctx == ctx)
+		disk_current->ctx = NULL;
+}
+
+
+static void disk_request_save(FILE *f, struct disk_request_t *req)
+{
+	int pid = req->ctx ? req->ctx->pid : -1;
+
+	ckpt_write(f, &pid, sizeof(pid));
+	ckpt_write(f, &req->count, sizeof(req->count));
+	ckpt_write(f, &req->op, sizeof(req->op));
+	ckpt_write(f, &req->string, sizeof(req->string));
+	ckpt_write(f, &req->cylinder, sizeof(req->cylinder));
+	ckpt_write(f, &req->submit, sizeof(req->submit));
+	ckpt_write(f, req->seg, req->count * sizeof(struct disk_segment_t));
+	ckpt_write(f, &req->data_size, sizeof(req->data_size));
+	if (req->data)
+		ckpt_write(f, req->data, req->data_size);
+}
+
+
+static struct disk_request_t *disk_request_restore(FILE *f)
+{
+	struct disk_request_t *req;
+	int pid, count;
+
+	ckpt_read(f, &pid, sizeof(pid));
+	ckpt_read(f, &count, sizeof(count));
+	req = calloc(1, sizeof(struct disk_request_t) + count * sizeof(struct disk_segment_t));
+	if (!req)
+		fatal("disk_restore: out of memory");
+	req->ctx = pid >= 0 ? ctx_get(pid) : NULL;
+	req->count = count;
+	ckpt_read(f, &req->op, sizeof(req->op));
+	ckpt_read(f, &req->string, sizeof(req->string));
+	ckpt_read(f, &req->cylinder, sizeof(req->cylinder));
+	ckpt_read(f, &req->submit, sizeof(req->submit));
+	ckpt_read(f, req->seg, count * sizeof(struct disk_segment_t));
+	ckpt_read(f, &req->data_size, sizeof(req->data_size));
+	if (req->data_size) {
+		req->data = malloc(req->data_size);
+		if (!req->data)
+			fatal("disk_restore: out of memory");
+		ckpt_read(f, req->data, req->data_size);
+	}
+	return req;
+}
+
+
+/* Checkpoints. The pending requests, the request in service, the whole
+ * image and the buffer cache are saved. Its DISK_INTERRUPT is part of the
+ * interrupt heap. */
+void disk_save(FILE *f)
+{
+	struct disk_request_t *req;
+	unsigned char *buf;
+	int block, busy = disk_current != NULL;
+
+	ckpt_write(f, &disk_queue_count, sizeof(disk_queue_count));
+	for (req = disk_queue_head; req; req = req->next)
+		disk_request_save(f, req);
+	ckpt_write(f, &busy, sizeof(busy));
+	if (busy)
+		disk_request_save(f, disk_current);
+	ckpt_write(f, &disk_cylinder, sizeof(disk_cylinder));
+	ckpt_write(f, &disk_direction, sizeof(disk_direction));
+	ckpt_write(f, &disk_requests, sizeof(disk_requests));
+	ckpt_write(f, &disk_reads, sizeof(disk_reads));
+	ckpt_write(f, &disk_writes, sizeof(disk_writes));
+	ckpt_write(f, &disk_bytes, sizeof(disk_bytes));
+	ckpt_write(f, &disk_segments, sizeof(disk_segments));
+	ckpt_write(f, &disk_latency_total, sizeof(disk_latency_total));
+	ckpt_write(f, &disk_latency_max, sizeof(disk_latency_max));
+	ckpt_write(f, &disk_service_total, sizeof(disk_service_total));
+	ckpt_write(f, &disk_seek_total, sizeof(disk_seek_total));
+	ckpt_write(f, &disk_queue_max, sizeof(disk_queue_max));
+
+	/* Image, without the dirty buffers, which the cache saves */
+	buf = malloc(blocksize);
+	if (!buf)
+		fatal("disk_save: out of memory");
+	fseek(disk_file, 0, SEEK_SET);
+	for (block = 0; block < numblocks; block++) {
+		if (fread(buf, 1, blocksize, disk_file) != blocksize)
+			memset(buf, 0, blocksize);
+		ckpt_write(f, buf, blocksize);
+	}
+	free(buf);
+	bcache_save(f);
+}
+
+
+void disk_restore(FILE *f)
+{
+	struct disk_request_t *req;
+	unsigned char *buf;
+	int i, count, busy, block;
+
+	assert(!disk_queue_head && !disk_current);
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		req = disk_request_restore(f);
+		*disk_queue_tail = req;
+		disk_queue_tail = &req->next;
+		disk_queue_count++;
+	}
+	ckpt_read(f, &busy, sizeof(busy));
+	if (busy)
+		disk_current = disk_request_restore(f);
+	ckpt_read(f, &disk_cylinder, sizeof(disk_cylinder));
+	ckpt_read(f, &disk_direction, sizeof(disk_direction));
+	ckpt_read(f, &disk_requests, sizeof(disk_requests));
+	ckpt_read(f, &disk_reads, sizeof(disk_reads));
+	ckpt_read(f, &disk_writes, sizeof(disk_writes));
+	ckpt_read(f, &disk_bytes, sizeof(disk_bytes));
+	ckpt_read(f, &disk_segments, sizeof(disk_segments));
+	ckpt_read(f, &disk_latency_total, sizeof(disk_latency_total));
+	ckpt_read(f, &disk_latency_max, sizeof(disk_latency_max));
+	ckpt_read(f, &disk_service_total, sizeof(disk_service_total));
+	ckpt_read(f, &disk_seek_total, sizeof(disk_seek_total));
+	ckpt_read(f, &disk_queue_max, sizeof(disk_queue_max));
+
+	/* Image and buffer cache */
+	bcache_done();
+	buf = malloc(blocksize);
+	if (!buf)
+		fatal("disk_restore: out of memory");
+	fseek(disk_file, 0, SEEK_SET);
+	for (block = 0; block < numblocks; block++) {
+		ckpt_read(f, buf, blocksize);
+		if (fwrite(buf, 1, blocksize, disk_file) != blocksize)
+			fatal("disk_restore: cannot write disk image");
+	}
+	fflush(disk_file);
+	free(buf);
+	bcache_init(disk_file, numblocks, blocksize);
+	bcache_restore(f);
+}
@@ -71,6 +71,32 @@ void fdt_free(struct fdt_t *fdt)
 }
 
 
+/* Copy a file descriptor table for a forked context. Host file descriptors
+ * are duplicated, so that closing them in one table does not affect the other.
+ * Standard input and output are shared. */
+struct fdt_t *fdt_clone(struct fdt_t *fdt)
+{
+	struct fdt_t *new;
+	struct fd_t *fd, *new_fd;
+	int i;
+
+	new = calloc(1, sizeof(struct fdt_t));
+	new->fd_list = list_create(list_count(fdt->fd_list));
+	for (i = 0; i < list_count(fdt->fd_list); i++) {
+		fd = list_get(fdt->fd_list, i);
+		new_fd = NULL;
+		if (fd) {
+			new_fd = calloc(1, sizeof(struct fd_t));
+			memcpy(new_fd, fd, sizeof(struct fd_t));
+			if (fd->kind != fd_kind_std && fd->host_fd >= 0)
+				new_fd->host_fd = dup(fd->host_fd);
+		}
+		list_add(new->fd_list, new_fd);
+	}
+	return new;
+}
+
+
 void fdt_dump(struct fdt_t *fdt, FILE *f)
 {
 	int i, busy = 0;
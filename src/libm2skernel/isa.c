@@ -20,16 +20,18 @@
 #include "m2skernel.h"
 
 
-/* Variables to perform instruction simulation */
-struct ctx_t *isa_ctx;
-struct regs_t *isa_regs;
-struct mem_t *isa_mem;
-uint32_t isa_eip;
-uint32_t isa_addr;  /* Address of last memory access */
-uint32_t isa_target;  /* Target address of branch/jmp/call/ret inst, even if it's not taken */
-x86_inst_t isa_inst;
-uint64_t isa_inst_count;
-int isa_function_level;
+/* Variables to perform instruction simulation, one copy per host thread */
+__thread struct ctx_t *isa_ctx;
+__thread struct regs_t *isa_regs;
+__thread struct mem_t *isa_mem;
+__thread uint32_t isa_eip;
+__thread uint32_t isa_addr;  /* Address of last memory access */
+__thread uint32_t isa_target;  /* Target address of branch/jmp/call/ret inst, even if it's not taken */
+__thread x86_inst_t isa_inst;
+__thread uint64_t isa_inst_count;
+__thread int isa_function_level;
+int isa_block_dispatch = 0;  /* Run decoded basic blocks in 'ke_run' */
+int isa_block_check = 0;  /* Compare each block against per-instruction execution */
 
 int isa_call_debug_category;
 int isa_inst_debug_category;
@@ -45,31 +47,60 @@ static inst_impl_fn_t inst_impl_table[x86_opcode_count] = {
 #undef DEFINST
 };
 
+/* Opcodes that end a basic block (branches, calls, returns, interrupts).
+ * Initialized in 'isa_init'. */
+static unsigned char inst_ends_block[x86_opcode_count];
 
+/* Opcodes whose effect cannot be reproduced by running them twice (system
+ * calls, halt, time stamp counter). Blocks containing them are not checked. */
+static unsigned char inst_not_checked[x86_opcode_count];
 
 
-/* Instruction stats */
 
-static uint64_t inst_freq[x86_opcode_count];
+
+/* Instruction stats. Each host thread counts in 'inst_freq', which is added
+ * to 'inst_freq_total' by 'isa_inst_stat_merge'. */
+
+static __thread uint64_t inst_freq[x86_opcode_count];
+static uint64_t inst_freq_total[x86_opcode_count];
+
+/* Must not be called by several threads at a time */
+void isa_inst_stat_merge(void)
+{
+	int i;
+	for (i = 1; i < x86_opcode_count; i++) {
+		inst_freq_total[i] += inst_freq[i];
+		inst_freq[i] = 0;
+	}
+}
 
 void isa_inst_stat_dump(FILE *f)
 {
 	int i;
+	isa_inst_stat_merge();
 	for (i = 1; i < x86_opcode_count; i++) {
-		if (!inst_freq[i])
+		if (!inst_freq_total[i])
 			continue;
 		fprintf(f, "%s    %lld\n", x86_inst_name(i),
-			(long long) inst_freq[i]);
+			(long long) inst_freq_total[i]);
 	}
 }
 
-void isa_inst_stat_reset(void)
+/* Discard the counts of this thread since the last merge */
+void isa_inst_stat_drop(void)
 {
 	int i;
 	for (i = 1; i < x86_opcode_count; i++)
 		inst_freq[i] = 0;
 }
 
+void isa_inst_stat_reset(void)
+{
+	int i;
+	for (i = 1; i < x86_opcode_count; i++)
+		inst_freq[i] = inst_freq_total[i] = 0;
+}
+
 
 
 
@@ -144,22 +175,44 @@ static struct {
 
 void isa_set_flag(x86_flag_t flag)
 {
+	regs_flags_eval(isa_regs);
 	isa_regs->eflags = SETBIT32(isa_regs->eflags, flag);
 }
 
 
 void isa_clear_flag(x86_flag_t flag)
 {
+	regs_flags_eval(isa_regs);
 	isa_regs->eflags = CLEARBIT32(isa_regs->eflags, flag);
 }
 
 
 int isa_get_flag(x86_flag_t flag)
 {
-	int ret;
-	ret = GETBIT32(isa_regs->eflags, flag) > 0;
-	assert(ret == 0 || ret == 1);
-	return ret;
+	return regs_flags_get(isa_regs, 1U << flag) != 0;
+}
+
+
+/* Set CF, OF and AF explicitly, and SF, ZF and PF from a result of 'size' bytes.
+ * Argument 'flags' is a mask of eflags bits. */
+void isa_set_flags_res(uint32_t res, int size, uint32_t flags)
+{
+	isa_regs->flags_op = regs_flags_res;
+	isa_regs->flags_size = size;
+	isa_regs->flags_res = res;
+	isa_regs->flags_aux = flags;
+}
+
+
+/* Record a lazy flag-setting operation */
+static void isa_flags_save(int op, int size, uint32_t res, uint32_t src1, uint32_t src2, uint32_t aux)
+{
+	isa_regs->flags_op = op;
+	isa_regs->flags_size = size;
+	isa_regs->flags_res = res;
+	isa_regs->flags_src1 = src1;
+	isa_regs->flags_src2 = src2;
+	isa_regs->flags_aux = aux;
 }
 
 
@@ -187,6 +240,104 @@ void isa_store_reg(x86_register_t reg, uint32_t value)
 }
 
 
+/* Integer ALU operations on operands of 'size' bytes (1, 2, 4). They
+ * return the result and record the operation for lazy flag evaluation. */
+
+uint32_t isa_alu_add(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t res = (src1 + src2) & mask;
+	isa_flags_save(regs_flags_add, size, res, src1 & mask, src2 & mask, 0);
+	return res;
+}
+
+
+uint32_t isa_alu_adc(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t cf = isa_get_flag(flag_cf);
+	uint32_t res = (src1 + src2 + cf) & mask;
+	isa_flags_save(regs_flags_adc, size, res, src1 & mask, src2 & mask, cf);
+	return res;
+}
+
+
+uint32_t isa_alu_sub(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t res = (src1 - src2) & mask;
+	isa_flags_save(regs_flags_sub, size, res, src1 & mask, src2 & mask, 0);
+	return res;
+}
+
+
+uint32_t isa_alu_sbb(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t cf = isa_get_flag(flag_cf);
+	uint32_t res = (src1 - src2 - cf) & mask;
+	isa_flags_save(regs_flags_sbb, size, res, src1 & mask, src2 & mask, cf);
+	return res;
+}
+
+
+uint32_t isa_alu_cmp(uint32_t src1, uint32_t src2, int size)
+{
+	return isa_alu_sub(src1, src2, size);
+}
+
+
+uint32_t isa_alu_and(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t res = src1 & src2 & isa_bit_mask[size];
+	isa_flags_save(regs_flags_logic, size, res, 0, 0, 0);
+	return res;
+}
+
+
+uint32_t isa_alu_or(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t res = (src1 | src2) & isa_bit_mask[size];
+	isa_flags_save(regs_flags_logic, size, res, 0, 0, 0);
+	return res;
+}
+
+
+uint32_t isa_alu_xor(uint32_t src1, uint32_t src2, int size)
+{
+	uint32_t res = (src1 ^ src2) & isa_bit_mask[size];
+	isa_flags_save(regs_flags_logic, size, res, 0, 0, 0);
+	return res;
+}
+
+
+uint32_t isa_alu_test(uint32_t src1, uint32_t src2, int size)
+{
+	return isa_alu_and(src1, src2, size);
+}
+
+
+/* Increment and decrement preserve CF */
+uint32_t isa_alu_inc(uint32_t src, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t cf = isa_get_flag(flag_cf);
+	uint32_t res = (src + 1) & mask;
+	isa_flags_save(regs_flags_inc, size, res, src & mask, 1, cf);
+	return res;
+}
+
+
+uint32_t isa_alu_dec(uint32_t src, int size)
+{
+	uint32_t mask = isa_bit_mask[size];
+	uint32_t cf = isa_get_flag(flag_cf);
+	uint32_t res = (src - 1) & mask;
+	isa_flags_save(regs_flags_dec, size, res, src & mask, 1, cf);
+	return res;
+}
+
+
 /* Return the final address obtained from binding address 'addr' inside
  * the corresponding segment. The segment boundaries are checked. */
 uint32_t isa_linear_address(uint32_t offset)
@@ -511,7 +662,22 @@ static void isa_debug_call()
 
 void isa_init()
 {
+	x86_opcode_t op;
+	char *name;
+
 	disasm_init();
+	for (op = 1; op < x86_opcode_count; op++) {
+		name = x86_inst_name(op);
+		inst_ends_block[op] = name[0] == 'j' ||
+			!strncmp(name, "call", 4) ||
+			!strncmp(name, "ret", 3) ||
+			!strncmp(name, "repz_ret", 8) ||
+			!strncmp(name, "int", 3) ||
+			!strncmp(name, "hlt", 3);
+		inst_not_checked[op] = !strncmp(name, "int", 3) ||
+			!strncmp(name, "hlt", 3) ||
+			!strncmp(name, "rdtsc", 5);
+	}
 }
 
 
@@ -570,3 +736,131 @@ void isa_execute_inst(void *buf)
 		isa_debug_call();
 }
 
+
+
+/* Decode the basic block starting at 'eip' in 'isa_mem' and store it in the
+ * block cache. Decoding stops after a branch, call, return or interrupt, before
+ * an instruction that might cross the page boundary, or when the block is full.
+ * Return NULL if the block cannot be cached. */
+struct mem_block_t *isa_decode_block(uint32_t eip)
+{
+	static __thread struct mem_block_t block;
+	struct mem_page_t *page;
+	x86_inst_t *inst;
+	void *buf;
+
+	/* Only code in executable pages is decoded ahead */
+	page = mem_page_get(isa_mem, eip);
+	if (!page || !(page->perm & mem_access_exec))
+		return NULL;
+
+	/* Decode */
+	block.eip = eip;
+	block.count = 0;
+	while (block.count < MEM_BLOCK_SIZE) {
+		buf = mem_get_buffer(isa_mem, eip, 20, mem_access_exec);
+		if (!buf)
+			break;
+		inst = &block.inst[block.count];
+		x86_disasm(buf, eip, inst);
+		if (inst->opcode == op_none)
+			break;
+		block.impl[block.count] = inst_impl_table[inst->opcode];
+		block.count++;
+		eip += inst->size;
+		if (inst_ends_block[inst->opcode])
+			break;
+	}
+
+	/* Store block */
+	if (!block.count)
+		return NULL;
+	return mem_block_insert(isa_mem, &block);
+}
+
+
+/* Execute up to 'limit' instructions of 'block', starting at its first one,
+ * and return the number of executed instructions. Instruction debugging is
+ * not done in this path. Execution stops early if an instruction overwrites
+ * the code of the block, or leaves 'eip' anywhere but at the next
+ * instruction, such as a repeated string instruction going back to itself
+ * or any branch not ending the block at decode time. */
+int isa_execute_block(struct mem_block_t *block, int limit)
+{
+	int i, count;
+
+	count = MIN(limit, block->count);
+	for (i = 0; i < count; i++) {
+		isa_inst = block->inst[i];
+		isa_eip = isa_inst.eip;
+		isa_inst_count++;
+		isa_target = 0;
+		isa_regs->eip = isa_eip + isa_inst.size;
+		block->impl[i]();
+		inst_freq[isa_inst.opcode]++;
+
+		/* Count here rather than per block, so that system calls
+		 * queuing interrupts see the same count as in 'ke_run'. */
+		instr_num++;
+
+		/* The last instruction can be a system call freeing the
+		 * memory map, so the block is not accessed after it. */
+		if (i + 1 < count && !block->valid)
+			return i + 1;
+		if (isa_regs->eip != isa_eip + isa_inst.size)
+			return i + 1;
+	}
+	return count;
+}
+
+
+/* Like 'isa_execute_block', but also run the same instructions one by one
+ * with 'ctx_execute_inst' on a copy of the registers and memory map of
+ * 'isa_ctx', and stop the simulation if the final states differ. The copy
+ * does not count in the instruction stats. */
+int isa_check_block(struct mem_block_t *block, int limit)
+{
+	struct ctx_t *ctx = isa_ctx;
+	struct regs_t *regs, *ref_regs;
+	struct mem_t *mem, *ref_mem;
+	uint64_t inst_count;
+	uint32_t eip = block->eip;
+	int i, count, expected;
+
+	expected = MIN(limit, block->count);
+	for (i = 0; i < expected; i++)
+		if (inst_not_checked[block->inst[i].opcode])
+			return isa_execute_block(block, limit);
+
+	/* Reference run, one instruction at a time */
+	regs = ctx->regs;
+	mem = ctx->mem;
+	ref_regs = regs_create();
+	regs_copy(ref_regs, regs);
+	ref_mem = mem_clone(mem);
+	inst_count = isa_inst_count;
+	ctx->regs = ref_regs;
+	ctx->mem = ref_mem;
+	for (i = 0; i < expected; i++) {
+		ctx_execute_inst(ctx);
+		inst_freq[isa_inst.opcode]--;
+	}
+	ctx->regs = regs;
+	ctx->mem = mem;
+	isa_regs = regs;
+	isa_mem = mem;
+	isa_inst_count = inst_count;
+
+	/* Block run. If it stopped early because the block overwrote its own
+	 * code, the states are not comparable. */
+	count = isa_execute_block(block, limit);
+	if (count == expected) {
+		if (memcmp(regs, ref_regs, sizeof(struct regs_t)))
+			fatal("block at 0x%x: registers differ from per-instruction execution", eip);
+		if (!mem_equal(mem, ref_mem))
+			fatal("block at 0x%x: memory differs from per-instruction execution", eip);
+	}
+	mem_free(ref_mem);
+	regs_free(ref_regs);
+	return count;
+}
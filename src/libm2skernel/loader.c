@@ -65,6 +65,33 @@ void ld_done(struct ctx_t *ctx)
 }
 
 
+/* Give context 'dst' a copy of the loader information of 'src', as done
+ * when 'src' forks a child with a new memory map. */
+void ld_clone(struct ctx_t *dst, struct ctx_t *src)
+{
+	struct loader_t *ld, *srcld = src->loader;
+
+	/* Copy code pointers and scalar fields */
+	ld = calloc(1, sizeof(struct loader_t));
+	memcpy(ld, srcld, sizeof(struct loader_t));
+	dst->loader = ld;
+
+	/* Duplicate owned data */
+	ld->elf = elf_open(srcld->elf->path);
+	ld->args = lnlist_create();
+	ld->env = lnlist_create();
+	for (lnlist_head(srcld->args); !lnlist_eol(srcld->args); lnlist_next(srcld->args))
+		lnlist_add(ld->args, strdup(lnlist_get(srcld->args)));
+	for (lnlist_head(srcld->env); !lnlist_eol(srcld->env); lnlist_next(srcld->env))
+		lnlist_add(ld->env, strdup(lnlist_get(srcld->env)));
+	ld->interp = srcld->interp ? strdup(srcld->interp) : NULL;
+	ld->exe = strdup(srcld->exe);
+	ld->cwd = strdup(srcld->cwd);
+	ld->stdin_file = strdup(srcld->stdin_file);
+	ld->stdout_file = strdup(srcld->stdout_file);
+}
+
+
 void ld_get_full_path(struct ctx_t *ctx, char *filename, char *fullpath, int size)
 {
 	if (*filename == '/' || !*filename) {
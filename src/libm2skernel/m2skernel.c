@@ -24,6 +24,12 @@
  * Kernel Variable */
 struct kernel_t *ke;
 
+__thread long long instr_num;
+
+/* Called by 'ke_run' after each basic block, or each instruction out of
+ * block dispatch mode */
+void (*ke_block_hook)(struct ctx_t *ctx, uint32_t eip, int count);
+
 /* Initialization */
 
 static uint64_t ke_init_time = 0;
@@ -44,6 +50,9 @@ void ke_init(void)
 	/* Initialize mutex for variables controlling calls to 'ke_process_events()' */
 	pthread_mutex_init(&ke->process_events_mutex, NULL);
 
+	/* Guest CPU scheduler, round robin unless configured otherwise */
+	sched_init();
+
 	/* Debug categories */
 	isa_inst_debug_category = debug_new_category();
 	isa_call_debug_category = debug_new_category();
@@ -78,40 +87,85 @@ void ke_done(void)
 	gk_done();
 
 	/* End */
+	smp_done();
 	free(ke);
+	free_interrupts();
+	simfs_done();
+	disk_done();
+	sched_done();
 	isa_done();
 	syscall_summary();
 }
 
+/* Interrupt queue */
+interrupt *schedint;
+int sched_count;
+int sched_size;
+
+void init_interrupts() {
+	schedint = NULL;
+	sched_count = 0;
+	sched_size = 0;
+}
+
+void free_interrupts() {
+	free(schedint);
+	init_interrupts();
+}
+
+/* Move the interrupt at 'pos' down the heap to its place */
+static void sift_down_interrupt (int pos) {
+	interrupt itrp = schedint[pos];
+	int child;
+	for (; 2*pos <= sched_count; pos = child) {
+		child = 2*pos;
+		if (child < sched_count && schedint[child+1].instno < schedint[child].instno)
+			child++;
+		if (itrp.instno <= schedint[child].instno)
+			break;
+		schedint[pos] = schedint[child];
+	}
+	schedint[pos] = itrp;
+}
+
 void push_interrupt (interrupt itrp) {
-	schedint[++sched_count] = itrp;
 	int pos;
-	for (pos = sched_count; pos>1 && schedint[pos].instno < schedint[pos/2].instno; pos /=2) {
-		schedint[pos] = schedint[pos/2];
-		schedint[pos/2] = itrp;
+
+	/* Grow the heap by doubling its size */
+	if (sched_count + 1 >= sched_size) {
+		sched_size = sched_size ? sched_size * 2 : 64;
+		schedint = realloc(schedint, sched_size * sizeof(interrupt));
+		if (!schedint)
+			fatal("push_interrupt: out of memory");
 	}
+
+	for (pos = ++sched_count; pos>1 && itrp.instno < schedint[pos/2].instno; pos /=2)
+		schedint[pos] = schedint[pos/2];
+	schedint[pos] = itrp;
 }
 
 interrupt pop_interrupt() {
 	interrupt ret = schedint[1];
-	int pos, nextpos;
-	sched_count--;
-	if (sched_count > 0) {
-		for (pos=1; pos <= sched_count/2; pos=nextpos) {
-			if (schedint[2*pos].instno < schedint[2*pos+1].instno)
-				nextpos = 2*pos;
-			else
-				nextpos = 2*pos + 1;
-			
-			if (schedint[sched_count+1].instno > schedint[nextpos].instno)
-				schedint[pos] = schedint[nextpos];
-			else break;
-		}
-		schedint[pos] = schedint[sched_count+1];
-	}
+	assert(sched_count > 0);
+	schedint[1] = schedint[sched_count--];
+	if (sched_count > 0)
+		sift_down_interrupt(1);
 	return ret;
 }
 
+/* Discard all pending interrupts for a context */
+void cancel_interrupts (struct ctx_t *ctx) {
+	int i, count = 0;
+	for (i = 1; i <= sched_count; i++)
+		if (schedint[i].details.proc != ctx)
+			schedint[++count] = schedint[i];
+	if (count == sched_count)
+		return;
+	sched_count = count;
+	for (i = sched_count/2; i >= 1; i--)
+		sift_down_interrupt(i);
+}
+
 long long next_interrupt_num() {
 	return schedint[1].instno;
 }
@@ -171,21 +225,17 @@ void unblock_process (struct ctx_t* ctx) {
 }
 
 void handle_interrupt (interrupt itrp) {
-	struct ctx_t *ctx, *currctx = ((io_interrupt_details*)(itrp.details))->proc;
-	printf("\nHandling interrupt for uid %d at inst no. %lld\n", currctx->uid, instr_num);
-	int k;
-	//for (k=0, ctx = ke->suspended_list_head; ctx; ctx = ctx->suspended_next, k++)
-		//printf ("Suspended process: %p status:%d\n", ctx, ctx->status);
-		
-	if (itrp.type == IO_INTERRUPT) {
+	struct ctx_t *currctx = itrp.details.proc;
+
+	switch (itrp.type) {
+	case IO_INTERRUPT:
+		printf("\nHandling interrupt for uid %d at inst no. %lld\n", currctx->uid, instr_num);
 		ctx_set_status(currctx, ctx_running);
-		//unblock_process(currctx);
+		break;
+	case DISK_INTERRUPT:
+		disk_complete();
+		break;
 	}
-	
-	//for (k=0, ctx = ke->suspended_list_head; ctx; ctx = ctx->suspended_next, k++);
-	//printf ("Instruction number: %lld, suspended processes:%d, process: %p, status: %d\n\nyy", instr_num, k, currctx, currctx->status);
-	
-	free(itrp.details);
 }
 
 void send_to_io (struct ctx_t* ctx, long long waitinstr) {
@@ -193,33 +243,71 @@ void send_to_io (struct ctx_t* ctx, long long waitinstr) {
 	
 	interrupt itrp;
 	itrp.type = IO_INTERRUPT;
-	itrp.details = malloc(sizeof(io_interrupt_details));
 	itrp.instno = instr_num + waitinstr;
-	((io_interrupt_details*)(itrp.details))->proc = ctx;
+	itrp.details.proc = ctx;
 	push_interrupt(itrp);
 	
 	ctx_set_status(ctx, ctx_suspended);
 	//block_process(ctx);
 }
 
-/* Execute one instruction from each running context. */
-void ke_run(void)
+/* Advance the kernel by one scheduling step. With one core, the scheduler
+ * picks a context and it runs for its time slice, until it blocks or
+ * finishes, with interrupts delivered as they become due. With several
+ * cores, one SMP round runs a context on each core. Finished contexts are
+ * then freed, and if no context is left running, 'instr_num' moves forward
+ * to the next interrupt. Callers counting calls (such as 'p_fast_forward')
+ * count scheduling steps, not instructions. Return the number of executed
+ * instructions, on all cores. */
+int ke_run(void)
 {
-	struct ctx_t *ctx, *ctx_trav; 
-	int k = 0;
-
-	/* Run an instruction from every running process */
-	for (k=0, ctx = ke->suspended_list_head; ctx; ctx = ctx->suspended_next, k++);
-	//printf ("Instruction number: %lld, suspended processes:%d, queue_size: %d\n", instr_num, k, sched_count);
-	for (ctx = ke->running_list_head; ctx; ctx = ctx->running_next) {
-		int i;
-		for ( i = 0 ; i < ctx->instr_slice && ctx_get_status(ctx, ctx_running); ++i) {
+	struct ctx_t *ctx;
+	int i = 0, count, limit, slice;
+	uint32_t eip;
+
+	/* Deliver due interrupts, which can wake up contexts */
+	while (interrupts_exist() && instr_num >= next_interrupt_num())
+		handle_interrupt (pop_interrupt());
+
+	/* Run a round of one context per core, or a time slice of the context
+	 * chosen by the scheduler */
+	ctx = NULL;
+	if (smp_cores > 1)
+		i = smp_run();
+	else
+		ctx = sched_pick_next(&slice);
+	if (ctx) {
+		for ( i = 0 ; i < slice && ctx_get_status(ctx, ctx_running); i += count) {
 			while (interrupts_exist() && instr_num >= next_interrupt_num())
 				handle_interrupt (pop_interrupt());
 			
-			ctx_execute_inst(ctx);
-			instr_num++;
+			/* Run up to the end of the slice or the next interrupt,
+			 * whatever comes first. System calls can queue new interrupts
+			 * without blocking, such as the disk writes of a file system
+			 * commit. A block ends at a system call, so the limit is
+			 * computed again after it; one instruction at a time, the run
+			 * stops as soon as an interrupt is due. */
+			limit = slice - i;
+			if (interrupts_exist())
+				limit = MIN(limit, next_interrupt_num() - instr_num);
+			if (isa_block_dispatch) {
+				eip = ctx->regs->eip;
+				count = ctx_execute_block(ctx, limit);
+				if (ke_block_hook)
+					ke_block_hook(ctx, eip, count);
+			} else {
+				for (count = 0; count < limit && ctx_get_status(ctx, ctx_running) &&
+					!(interrupts_exist() && instr_num >= next_interrupt_num()); count++)
+				{
+					eip = ctx->regs->eip;
+					ctx_execute_inst(ctx);
+					instr_num++;
+					if (ke_block_hook)
+						ke_block_hook(ctx, eip, 1);
+				}
+			}
 		}
+		sched_tick(ctx, i);
 	}
 	
 	/* Free finished contexts */
@@ -233,6 +321,7 @@ void ke_run(void)
 		instr_num = next_interrupt_num();
 		handle_interrupt(pop_interrupt());
 	}
+	return i;
 }
 
 
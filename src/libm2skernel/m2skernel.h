@@ -47,7 +47,10 @@ struct ctx_t;
 struct fd_t;
 
 int instr_slice;
-long long instr_num;
+
+/* Instructions executed by all contexts, which is the guest time. Each host
+ * thread running guest cores has its own copy (see 'smp.c'). */
+extern __thread long long instr_num;
 
 /* Maximum length for paths */
 #define MAX_PATH_SIZE  200
@@ -61,7 +64,12 @@ long long instr_num;
 #define MEM_PAGESHIFT      MEM_LOGPAGESIZE
 #define MEM_PAGESIZE       (1<<MEM_LOGPAGESIZE)
 #define MEM_PAGEMASK       (~(MEM_PAGESIZE-1))
-#define MEM_PAGE_COUNT     1024
+#define MEM_PAGE_COUNT     1024  /* Entries in each level of the page table */
+#define MEM_PAGE_DIR(addr)    ((addr) >> (MEM_LOGPAGESIZE + 10))
+#define MEM_PAGE_ENTRY(addr)  (((addr) >> MEM_LOGPAGESIZE) & (MEM_PAGE_COUNT - 1))
+#define MEM_ICACHE_SIZE    4096  /* Entries in the decoded instruction cache */
+#define MEM_BLOCK_COUNT    1024  /* Entries in the basic block cache */
+#define MEM_BLOCK_SIZE     32  /* Maximum number of instructions in a basic block */
 
 enum mem_access_enum {
 	mem_access_read   = 0x01,
@@ -74,6 +82,9 @@ enum mem_access_enum {
 /* Safe mode */
 extern int mem_safe_mode;
 
+/* Flat mode: guest space backed by one reserved host region */
+extern int mem_flat_mode;
+
 /* Host mapping: mappings performed with file descriptors other than -1 */
 struct mem_host_mapping_t {
 	void *host_ptr;  /* Pointer to the host memory space */
@@ -88,24 +99,46 @@ struct mem_host_mapping_t {
 struct mem_page_t {
 	uint32_t tag;
 	enum mem_access_enum perm;  /* Access permissions; combination of flags */
-	struct mem_page_t *next;
 	unsigned char *data;
 	struct mem_host_mapping_t *host_mapping;  /* If other than null, page is host mapping */
+	int decoded;  /* Page contains code held in the decoded instruction cache */
+	int *cow;  /* If other than null, 'data' is shared copy-on-write by '*cow' pages */
+};
+
+/* Entry of the decoded instruction cache */
+struct mem_icache_entry_t {
+	uint32_t eip;
+	int valid;
+	x86_inst_t inst;
+};
+
+/* Decoded basic block. All its instructions lie in the same page. */
+struct mem_block_t {
+	uint32_t eip;  /* Address of the first instruction */
+	int valid;
+	int count;  /* Number of instructions */
+	x86_inst_t inst[MEM_BLOCK_SIZE];
+	void (*impl[MEM_BLOCK_SIZE])(void);  /* Implementation of each instruction */
 };
 
 struct mem_t {
-	struct mem_page_t *pages[MEM_PAGE_COUNT];
+	struct mem_page_t **pages[MEM_PAGE_COUNT];  /* Two-level page table */
 	int sharing;  /* Number of contexts sharing memory map */
 	uint32_t last_address;  /* Address of last access */
 	int safe;  /* Safe mode */
 	struct mem_host_mapping_t *host_mapping_list;  /* List of host mappings */
+	struct mem_icache_entry_t *icache;  /* Decoded instructions, indexed by eip */
+	struct mem_block_t *blocks[MEM_BLOCK_COUNT];  /* Decoded basic blocks, indexed by eip */
+	unsigned char *host_base;  /* Host region backing the guest space in flat mode, or NULL */
 };
 
 extern unsigned long mem_mapped_space;
 extern unsigned long mem_max_mapped_space;
 
 struct mem_t *mem_create(void);
+struct mem_t *mem_clone(struct mem_t *mem);
 void mem_free(struct mem_t *mem);
+int mem_equal(struct mem_t *a, struct mem_t *b);
 
 struct mem_page_t *mem_page_get(struct mem_t *mem, uint32_t addr);
 struct mem_page_t *mem_page_get_next(struct mem_t *mem, uint32_t addr);
@@ -131,9 +164,17 @@ int mem_read_string(struct mem_t *mem, uint32_t addr, int size, char *str);
 void mem_write_string(struct mem_t *mem, uint32_t addr, char *str);
 void *mem_get_buffer(struct mem_t *mem, uint32_t addr, int size, enum mem_access_enum access);
 
+x86_inst_t *mem_icache_lookup(struct mem_t *mem, uint32_t eip);
+void mem_icache_insert(struct mem_t *mem, x86_inst_t *inst);
+struct mem_block_t *mem_block_lookup(struct mem_t *mem, uint32_t eip);
+struct mem_block_t *mem_block_insert(struct mem_t *mem, struct mem_block_t *block);
+
 void mem_dump(struct mem_t *mem, char *filename, uint32_t start, uint32_t end);
 void mem_load(struct mem_t *mem, char *filename, uint32_t start);
 
+void mem_save(struct mem_t *mem, FILE *f);
+struct mem_t *mem_restore(FILE *f);
+
 
 
 
@@ -156,8 +197,32 @@ struct regs_t {
 	int fpu_top;  /* top of stack (field 'top' of status register) */
 	int fpu_code;  /* field 'code' of status register (C3-C2-C1-C0) */
 	uint16_t fpu_ctrl;  /* fpu control word */
+
+	/* Lazy flags. Arithmetic flags (CF, PF, AF, ZF, SF, OF) are not computed
+	 * after each instruction. Instead, the last flag-setting operation is
+	 * recorded here and the flags are evaluated on demand. When 'flags_op'
+	 * is 'regs_flags_none', field 'eflags' is up to date. */
+	int flags_op;  /* enum regs_flags_op_enum */
+	int flags_size;  /* operand size in bytes (1, 2, 4) */
+	uint32_t flags_res, flags_src1, flags_src2;
+	uint32_t flags_aux;  /* carry-in for adc/sbb/inc/dec; explicit CF/OF/AF for 'regs_flags_res' */
 } __attribute__((packed));
 
+enum regs_flags_op_enum {
+	regs_flags_none = 0,
+	regs_flags_add,
+	regs_flags_adc,
+	regs_flags_sub,
+	regs_flags_sbb,
+	regs_flags_logic,
+	regs_flags_inc,
+	regs_flags_dec,
+	regs_flags_res  /* SF, ZF, PF from result; CF, OF, AF given in 'flags_aux' */
+};
+
+/* Mask of the arithmetic flags in 'eflags' */
+#define REGS_FLAGS_ARITH  0x8d5
+
 struct regs_t *regs_create(void);
 void regs_free(struct regs_t *regs);
 
@@ -165,6 +230,9 @@ void regs_copy(struct regs_t *dst, struct regs_t *src);
 void regs_dump(struct regs_t *regs, FILE *f);
 void regs_fpu_stack_dump(struct regs_t *regs, FILE *f);
 
+uint32_t regs_flags_get(struct regs_t *regs, uint32_t mask);
+void regs_flags_eval(struct regs_t *regs);
+
 
 
 
@@ -254,6 +322,7 @@ extern int ld_debug_category;
 
 void ld_init(struct ctx_t *ctx);
 void ld_done(struct ctx_t *ctx);
+void ld_clone(struct ctx_t *dst, struct ctx_t *src);
 
 void ld_add_args(struct ctx_t *ctx, int argc, char **argv);
 void ld_add_cmdline(struct ctx_t *ctx, char *cmdline);
@@ -272,14 +341,17 @@ void ld_get_full_path(struct ctx_t *ctx, char *filename, char *fullpath, int siz
 
 /* Machine & ISA */
 
-extern struct ctx_t *isa_ctx;
-extern struct regs_t *isa_regs;
-extern struct mem_t *isa_mem;
-extern uint32_t isa_eip;
-extern uint32_t isa_target;
-extern x86_inst_t isa_inst;
-extern uint64_t isa_inst_count;
-extern int isa_function_level;
+/* Execution state of the context being run by each host thread */
+extern __thread struct ctx_t *isa_ctx;
+extern __thread struct regs_t *isa_regs;
+extern __thread struct mem_t *isa_mem;
+extern __thread uint32_t isa_eip;
+extern __thread uint32_t isa_target;
+extern __thread x86_inst_t isa_inst;
+extern __thread uint64_t isa_inst_count;
+extern __thread int isa_function_level;
+extern int isa_block_dispatch;
+extern int isa_block_check;
 
 #define isa_call_debug(...) debug(isa_call_debug_category, __VA_ARGS__)
 #define isa_inst_debug(...) debug(isa_inst_debug_category, __VA_ARGS__)
@@ -295,6 +367,19 @@ void isa_dump_flags(FILE *f);
 void isa_set_flag(x86_flag_t flag);
 void isa_clear_flag(x86_flag_t flag);
 int isa_get_flag(x86_flag_t flag);
+void isa_set_flags_res(uint32_t res, int size, uint32_t flags);
+
+uint32_t isa_alu_add(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_adc(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_sub(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_sbb(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_cmp(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_and(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_or(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_xor(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_test(uint32_t src1, uint32_t src2, int size);
+uint32_t isa_alu_inc(uint32_t src, int size);
+uint32_t isa_alu_dec(uint32_t src, int size);
 
 uint32_t isa_load_reg(x86_register_t reg);
 void isa_store_reg(x86_register_t reg, uint32_t value);
@@ -349,12 +434,17 @@ void isa_init(void);
 void isa_done(void);
 void isa_dump(FILE *f);
 void isa_execute_inst(void *buf);
+struct mem_block_t *isa_decode_block(uint32_t eip);
+int isa_execute_block(struct mem_block_t *block, int limit);
+int isa_check_block(struct mem_block_t *block, int limit);
 
 void isa_trace_call_init(char *filename);
 void isa_trace_call_done(void);
 
 void isa_inst_stat_dump(FILE *f);
 void isa_inst_stat_reset(void);
+void isa_inst_stat_merge(void);
+void isa_inst_stat_drop(void);
 
 
 
@@ -443,6 +533,7 @@ struct fdt_t {
 };
 
 struct fdt_t *fdt_create(void);
+struct fdt_t *fdt_clone(struct fdt_t *fdt);
 void fdt_free(struct fdt_t *fdt);
 void fdt_dump(struct fdt_t *fdt, FILE *f);
 
@@ -462,6 +553,36 @@ int fdt_get_guest_fd(struct fdt_t *fdt, int host_fd);
 #define ctx_debug(...) debug(ctx_debug_category, __VA_ARGS__)
 extern int ctx_debug_category;
 
+/* Per-context state of the guest CPU scheduler */
+struct sched_entity_t {
+	struct ctx_t *ctx;  /* Owner context */
+	int queued;  /* In the run queue of the policy */
+
+	/* CFS: node of the red-black tree ordered by (vruntime, pid) */
+	struct sched_entity_t *left, *right, *parent;
+	int red;
+	long long vruntime;  /* Instructions run */
+
+	/* MLFQ: queue level and instructions used at that level */
+	struct sched_entity_t *next, *prev;
+	int level;
+	int used;
+	int boost_epoch;
+
+	/* Lottery */
+	int tickets;
+
+	/* Already picked to run in this round on another core */
+	int picked;
+
+	/* Statistics, in instructions of 'instr_num' */
+	long long start;  /* Time the context became runnable for the first time */
+	long long ready;  /* Time the context last entered the run queue */
+	long long wait;  /* Time spent runnable but not running */
+	long long insts;  /* Instructions executed */
+	long long slices;  /* Times picked to run */
+};
+
 struct ctx_t {
 	
 	/* Context properties */
@@ -533,6 +654,7 @@ struct ctx_t {
 
 	int instr_slice;
 	int uid;
+	struct sched_entity_t sched;  /* Scheduler state */
 };
 
 enum ctx_status_enum {
@@ -557,6 +679,7 @@ enum ctx_status_enum {
 
 struct ctx_t *ctx_create(void);
 struct ctx_t *ctx_clone(struct ctx_t *ctx);
+struct ctx_t *ctx_fork(struct ctx_t *ctx);
 void ctx_free(struct ctx_t *ctx);
 void ctx_dump(struct ctx_t *ctx, FILE *f);
 
@@ -569,6 +692,7 @@ void ctx_host_thread_timer_cancel(struct ctx_t *ctx);
 void ctx_finish(struct ctx_t *ctx, int status);
 void ctx_finish_group(struct ctx_t *ctx, int status);
 void ctx_execute_inst(struct ctx_t *ctx);
+int ctx_execute_block(struct ctx_t *ctx, int limit);
 
 void ctx_set_eip(struct ctx_t *ctx, uint32_t eip);
 void ctx_recover(struct ctx_t *ctx);
@@ -644,33 +768,286 @@ extern struct kernel_t *ke;
 
 void ke_init(void);
 void ke_done(void);
-void ke_run(void);
+int ke_run(void);
 void ke_dump(FILE *f);
 
+/* If set, called by 'ke_run' with the start address and the number of
+ * instructions of each basic block run in block dispatch mode, or of each
+ * instruction otherwise, on a single core. Used to profile basic block
+ * vectors and to warm up the timing simulator. */
+extern void (*ke_block_hook)(struct ctx_t *ctx, uint32_t eip, int count);
+
 uint64_t ke_timer(void);
 void ke_process_events(void);
 void ke_process_events_schedule(void);
 
-typedef enum {IO_INTERRUPT} interrupt_type;
+typedef enum {IO_INTERRUPT, DISK_INTERRUPT} interrupt_type;
+
+typedef struct {
+	struct ctx_t *proc;
+} io_interrupt_details;
 
 typedef struct {
 	long long instno;
 	interrupt_type type;
-	void * details;
+	io_interrupt_details details;  /* Payload, stored inline */
 } interrupt;
 
-typedef struct {
-	struct ctx_t *proc;
-} io_interrupt_details;
-
-interrupt *schedint;
-int sched_count;
+/* Pending interrupts, kept in a binary min-heap on 'instno' (1-based).
+ * The array grows on demand; 'sched_size' is its allocated length. */
+extern interrupt *schedint;
+extern int sched_count;
+extern int sched_size;
 
+void init_interrupts();
+void free_interrupts();
 void push_interrupt (interrupt itrp);
 interrupt pop_interrupt();
+void cancel_interrupts (struct ctx_t *ctx);
 long long next_interrupt_num();
 int interrupts_exist();
 
+
+
+/* Guest CPU scheduler
+ *
+ * The running contexts form the run queue of the selected policy. Status
+ * updates call 'sched_wake' and 'sched_block' when a context enters or
+ * leaves the 'ctx_running' state. 'ke_run' asks 'sched_pick_next' for the
+ * next context and its slice, and reports the executed instructions with
+ * 'sched_tick'. */
+
+enum sched_policy_enum {
+	sched_policy_invalid = 0,
+	sched_policy_rr,  /* Round robin over the running list */
+	sched_policy_cfs,  /* Completely fair, vruntime in instructions */
+	sched_policy_mlfq,  /* Multilevel feedback queue */
+	sched_policy_lottery  /* Proportional share by lottery */
+};
+
+extern struct string_map_t sched_policy_map;
+extern enum sched_policy_enum sched_policy;
+extern long long sched_cfs_latency;
+extern long long sched_cfs_granularity;
+extern int sched_mlfq_levels;
+extern long long sched_mlfq_boost;
+extern int sched_lottery_tickets;
+extern unsigned int sched_lottery_seed;
+
+void sched_init(void);
+void sched_done(void);
+void sched_dump(FILE *f);
+
+struct ctx_t *sched_pick_next(int *slice);
+void sched_block(struct ctx_t *ctx);
+void sched_wake(struct ctx_t *ctx);
+void sched_tick(struct ctx_t *ctx, int count);
+void sched_exit(struct ctx_t *ctx);
+
+void sched_save(FILE *f);
+void sched_restore(FILE *f);
+
+
+
+/* Guest cores
+ *
+ * With 'smp_cores' greater than one, each call to 'ke_run' is a round in
+ * which the scheduler picks up to one context per core, and the contexts
+ * run in parallel on a pool of host threads. Contexts sharing a memory map
+ * never run in the same round. A round ends before the next interrupt, and
+ * guest time advances by the longest run. A system call stops its core, and
+ * runs at the end of the round in core order; interrupts and scheduling
+ * happen between rounds.
+ *
+ * With 'smp_quantum' set, rounds are 'smp_quantum' instructions long and a
+ * core keeps its context until the slice ends, which makes runs reproducible.
+ * With 'smp_check' set, each round is also run sequentially on copies of the
+ * contexts, and the simulation stops if the results differ. */
+
+extern int smp_cores;
+extern long long smp_quantum;
+extern int smp_check;
+
+void smp_init(void);
+void smp_done(void);
+void smp_dump(FILE *f);
+
+int smp_run(void);
+int smp_syscall_defer(void);
+
+void smp_save(FILE *f);
+void smp_restore(FILE *f);
+
+
+
+/* Simulated disk
+ *
+ * Requests of the 'disk_io' system call are queued and served one at a
+ * time on the disk image, which stays open. The latency of a request, in
+ * instructions, depends on the head position and the geometry. Its
+ * completion raises a DISK_INTERRUPT that wakes up the requesting context. */
+
+enum disk_policy_enum {
+	disk_policy_invalid = 0,
+	disk_policy_fcfs,  /* Arrival order */
+	disk_policy_sstf,  /* Shortest seek first */
+	disk_policy_scan,  /* Elevator, sweeping in both directions */
+	disk_policy_clook  /* Elevator, sweeping upwards only */
+};
+
+extern struct string_map_t disk_policy_map;
+extern enum disk_policy_enum disk_policy;
+extern long long disk_seek_base;
+extern long long disk_seek_track;
+extern long long disk_rotation;
+
+extern int blocksize, numblocks;
+
+/* Segment of a request: 'size' bytes from 'offset' in 'block', spanning the
+ * following blocks if needed, to or from guest address 'addr'. This is also
+ * the layout of the segment array passed to the 'disk_iov' system call. */
+struct disk_segment_t {
+	int block;
+	int offset;
+	int size;
+	uint32_t addr;
+};
+
+#define DISK_IOV_MAX  1024
+
+void disk_init(char *path, int heads, int tracks, int sectors);
+void disk_done(void);
+void disk_dump(FILE *f);
+
+void disk_submit(struct ctx_t *ctx, int op, int string, struct disk_segment_t *seg, int count);
+void disk_complete(void);
+void disk_cancel(struct ctx_t *ctx);
+
+void disk_save(FILE *f);
+void disk_restore(FILE *f);
+
+
+
+/* Buffer cache
+ *
+ * Blocks of the disk image are accessed through a fixed set of buffers
+ * with LRU or CLOCK replacement. Written blocks stay dirty in the cache
+ * until they are evicted or flushed, every 'bcache_flush_interval'
+ * instructions and at exit. Alternatively, the whole image can be mapped in
+ * host memory. The cache does not change simulated disk latencies. */
+
+enum bcache_policy_enum {
+	bcache_policy_invalid = 0,
+	bcache_policy_lru,
+	bcache_policy_clock
+};
+
+extern struct string_map_t bcache_policy_map;
+extern enum bcache_policy_enum bcache_policy;
+extern int bcache_size;
+extern long long bcache_flush_interval;
+extern int bcache_mmap;
+
+void bcache_init(FILE *f, int blocks, int blocksize);
+void bcache_done(void);
+void bcache_dump(FILE *f);
+
+unsigned char *bcache_get(int block, int write);
+void bcache_flush(void);
+void bcache_tick(void);
+
+void bcache_save(FILE *f);
+void bcache_restore(FILE *f);
+
+
+
+/* Block allocator
+ *
+ * Free blocks are tracked in a bitmap scanned a 64-bit word at a time, and
+ * the blocks of each uid as a sorted list of extents, so that ownership
+ * checks are a binary search. Blocks are allocated in contiguous runs by
+ * the 'disk_alloc' system call, or one at a time on the first write to a
+ * free block. */
+
+void balloc_init(int blocks);
+void balloc_done(void);
+void balloc_dump(FILE *f);
+
+int balloc_is_free(int block);
+int balloc_owned(int uid, int start, int count);
+int balloc_alloc(int uid, int count);
+void balloc_claim(int uid, int block);
+int balloc_free(int uid, int start, int count);
+
+void balloc_save(FILE *f);
+void balloc_restore(FILE *f);
+
+
+
+/* Filesystem
+ *
+ * Optional filesystem in the disk image, with a superblock, an inode table,
+ * directories and files mapped by extents. Metadata changes are batched in
+ * a transaction and written through a journal every
+ * 'simfs_commit_interval' instructions or when the journal is full. File
+ * data is moved by disk requests of the calling context. Files belong to
+ * the uid that created them, and so do their blocks in the allocator. */
+
+#define SIMFS_O_CREAT  1
+#define SIMFS_O_TRUNC  2
+#define SIMFS_O_APPEND  4
+
+#define SIMFS_PATH_MAX  256
+
+/* Errors returned to the guest */
+#define SIMFS_ENOENT  -1
+#define SIMFS_EPERM  -2
+#define SIMFS_EINVAL  -3
+#define SIMFS_ENOSPC  -4
+#define SIMFS_EEXIST  -5
+#define SIMFS_EBUSY  -6
+#define SIMFS_ENOSYS  -38
+
+extern int simfs_enable;
+extern long long simfs_commit_interval;
+
+void simfs_init(void);
+void simfs_done(void);
+void simfs_dump(FILE *f);
+
+int simfs_open(struct ctx_t *ctx, char *path, int flags);
+int simfs_read(struct ctx_t *ctx, int fd, uint32_t addr, int size);
+int simfs_write(struct ctx_t *ctx, int fd, uint32_t addr, int size);
+int simfs_close(struct ctx_t *ctx, int fd);
+void simfs_close_ctx(struct ctx_t *ctx);
+int simfs_unlink(struct ctx_t *ctx, char *path);
+int simfs_mkdir(struct ctx_t *ctx, char *path);
+
+void simfs_save(FILE *f);
+void simfs_restore(FILE *f);
+
+
+
+/* Checkpoints
+ *
+ * A checkpoint holds the state between two calls to 'ke_run': contexts with
+ * their registers, memory maps, file descriptors, signal state and loader
+ * information, the kernel lists, the interrupt heap, 'instr_num', and the
+ * state of the scheduler, guest cores, disk with its image, block allocator
+ * and filesystem. Each module saves and restores its own state with
+ * 'ckpt_write' and 'ckpt_read'. Memory pages are mapped from the file on
+ * restore, so its cost grows with the pages the guest touches. */
+
+extern char *ckpt_file;
+extern long long ckpt_at;
+
+void ckpt_save(char *path);
+void ckpt_restore(char *path);
+void ckpt_tick(void);
+
+void ckpt_write(FILE *f, void *buf, size_t size);
+void ckpt_read(FILE *f, void *buf, size_t size);
+
 void block_process (struct ctx_t* ctx);
 void unblock_process (struct ctx_t* ctx);
 
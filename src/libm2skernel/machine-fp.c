@@ -306,21 +306,24 @@ void op_fcompp_impl() {
 
 void op_fcomi_st0_sti_impl() {
 	uint8_t st0[10], sti[10];
-	unsigned long flags = isa_regs->eflags;
+	unsigned long flags;
 
 	isa_load_fpu(0, st0);
 	isa_load_fpu(isa_inst.opindex, sti);
 	asm volatile (
-		"push %3 ; popf\n\t"
 		"fldt %2\n\t"
 		"fldt %1\n\t"
 		"fcomip %%st(1), %%st\n\t"
 		"fstp %%st(0)\n\t"
 		"pushf ; pop %0\n\t"
 		: "=g" (flags)
-		: "m" (*st0), "m" (*sti), "g" (flags)
+		: "m" (*st0), "m" (*sti)
 	);
-	isa_regs->eflags = flags;
+
+	/* Only ZF, PF and CF are set; OF, SF and AF are cleared */
+	regs_flags_eval(isa_regs);
+	isa_regs->eflags &= ~REGS_FLAGS_ARITH;
+	isa_regs->eflags |= flags & ((1 << flag_zf) | (1 << flag_pf) | (1 << flag_cf));
 }
 
 
@@ -332,21 +335,24 @@ void op_fcomip_st0_sti_impl() {
 
 void op_fucomi_st0_sti_impl() {
 	uint8_t st0[10], sti[10];
-	unsigned long flags = isa_regs->eflags;
+	unsigned long flags;
 
 	isa_load_fpu(0, st0);
 	isa_load_fpu(isa_inst.opindex, sti);
 	asm volatile (
-		"push %3 ; popf\n\t"
 		"fldt %2\n\t"
 		"fldt %1\n\t"
 		"fucomip %%st(1), %%st\n\t"
 		"fstp %%st(0)\n\t"
 		"pushf ; pop %0\n\t"
 		: "=g" (flags)
-		: "m" (*st0), "m" (*sti), "g" (flags)
+		: "m" (*st0), "m" (*sti)
 	);
-	isa_regs->eflags = flags;
+
+	/* Only ZF, PF and CF are set; OF, SF and AF are cleared */
+	regs_flags_eval(isa_regs);
+	isa_regs->eflags &= ~REGS_FLAGS_ARITH;
+	isa_regs->eflags |= flags & ((1 << flag_zf) | (1 << flag_pf) | (1 << flag_cf));
 }
 
 
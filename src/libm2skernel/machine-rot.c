@@ -20,183 +20,210 @@
 #include "m2skernel.h"
 
 
+/* Rotations only modify CF and OF, so pending lazy flags are evaluated first */
+static void rot_set_cf_of(int cf, int of)
+{
+	regs_flags_eval(isa_regs);
+	isa_regs->eflags &= ~((1 << flag_cf) | (1 << flag_of));
+	isa_regs->eflags |= (cf << flag_cf) | (of << flag_of);
+}
+
+
+/* Each function takes a value of 'size' bytes and a shift count,
+ * returns the result and updates the flags as the x86 instruction does.
+ * A masked count of 0 leaves both the value and the flags unchanged. */
+
+static uint32_t rot_rcl(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint64_t mask = (1ULL << (bits + 1)) - 1;
+	uint64_t tmp;
+	uint32_t res;
+	int cf;
+
+	count = (count & 0x1f) % (bits + 1);
+	if (!count)
+		return value;
+	tmp = value | ((uint64_t) isa_get_flag(flag_cf) << bits);
+	tmp = ((tmp << count) | (tmp >> (bits + 1 - count))) & mask;
+	res = tmp & ((1ULL << bits) - 1);
+	cf = (tmp >> bits) & 1;
+	rot_set_cf_of(cf, ((res >> (bits - 1)) & 1) ^ cf);
+	return res;
+}
+
+
+static uint32_t rot_rcr(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint64_t mask = (1ULL << (bits + 1)) - 1;
+	uint64_t tmp;
+	uint32_t res;
+
+	count = (count & 0x1f) % (bits + 1);
+	if (!count)
+		return value;
+	tmp = value | ((uint64_t) isa_get_flag(flag_cf) << bits);
+	tmp = ((tmp >> count) | (tmp << (bits + 1 - count))) & mask;
+	res = tmp & ((1ULL << bits) - 1);
+	rot_set_cf_of((tmp >> bits) & 1, ((res >> (bits - 1)) ^ (res >> (bits - 2))) & 1);
+	return res;
+}
+
+
+static uint32_t rot_rol(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint32_t mask = 0xffffffffU >> (32 - bits);
+	uint32_t res;
+	int cf;
+
+	count &= 0x1f;
+	if (!count)
+		return value;
+	count %= bits;
+	res = count ? ((value << count) | (value >> (bits - count))) & mask : value;
+	cf = res & 1;
+	rot_set_cf_of(cf, ((res >> (bits - 1)) & 1) ^ cf);
+	return res;
+}
+
+
+static uint32_t rot_ror(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint32_t mask = 0xffffffffU >> (32 - bits);
+	uint32_t res;
+
+	count &= 0x1f;
+	if (!count)
+		return value;
+	count %= bits;
+	res = count ? ((value >> count) | (value << (bits - count))) & mask : value;
+	rot_set_cf_of((res >> (bits - 1)) & 1, ((res >> (bits - 1)) ^ (res >> (bits - 2))) & 1);
+	return res;
+}
+
+
+static uint32_t rot_sar(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint32_t mask = 0xffffffffU >> (32 - bits);
+	int32_t svalue;
+	uint32_t res;
+
+	count &= 0x1f;
+	if (!count)
+		return value;
+	svalue = (int32_t) (value << (32 - bits)) >> (32 - bits);
+	res = (svalue >> count) & mask;
+	isa_set_flags_res(res, size, ((svalue >> (count - 1)) & 1) << flag_cf);
+	return res;
+}
+
+
+static uint32_t rot_shl(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint32_t mask = 0xffffffffU >> (32 - bits);
+	uint32_t res;
+	int cf;
+
+	count &= 0x1f;
+	if (!count)
+		return value;
+	res = (value << count) & mask;
+	cf = count <= bits ? (value >> (bits - count)) & 1 : 0;
+	isa_set_flags_res(res, size, (cf << flag_cf) |
+		((((res >> (bits - 1)) & 1) ^ cf) << flag_of));
+	return res;
+}
+
+
+static uint32_t rot_shr(uint32_t value, uint8_t count, int size)
+{
+	int bits = size * 8;
+	uint32_t res;
+
+	count &= 0x1f;
+	if (!count)
+		return value;
+	res = value >> count;
+	isa_set_flags_res(res, size, (((value >> (count - 1)) & 1) << flag_cf) |
+		(((value >> (bits - 1)) & 1) << flag_of));
+	return res;
+}
+
+
 #define op_xxx_rm8_1_impl(xxx) void op_##xxx##_rm8_1_impl() { \
 	uint8_t rm8 = isa_load_rm8(); \
 	uint8_t count = 1; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%al\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%al\n\t" \
-		"mov %%al, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm8) \
-		: "m" (rm8), "m" (count), "g" (flags) \
-		: "al", "cl" \
-	); \
+	rm8 = rot_##xxx(rm8, count, 1); \
 	isa_store_rm8(rm8); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm8_cl_impl(xxx) void op_##xxx##_rm8_cl_impl() { \
 	uint8_t rm8 = isa_load_rm8(); \
 	uint8_t count = isa_load_reg(reg_cl); \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%al\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%al\n\t" \
-		"mov %%al, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm8) \
-		: "m" (rm8), "m" (count), "g" (flags) \
-		: "al", "cl" \
-	); \
+	rm8 = rot_##xxx(rm8, count, 1); \
 	isa_store_rm8(rm8); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm8_imm8_impl(xxx) void op_##xxx##_rm8_imm8_impl() { \
 	uint8_t rm8 = isa_load_rm8(); \
 	uint8_t count = isa_inst.imm.b; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%al\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%al\n\t" \
-		"mov %%al, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm8) \
-		: "m" (rm8), "m" (count), "g" (flags) \
-		: "al", "cl" \
-	); \
+	rm8 = rot_##xxx(rm8, count, 1); \
 	isa_store_rm8(rm8); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm16_1_impl(xxx) void op_##xxx##_rm16_1_impl() { \
 	uint16_t rm16 = isa_load_rm16(); \
 	uint8_t count = 1; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%ax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%ax\n\t" \
-		"mov %%ax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm16) \
-		: "m" (rm16), "m" (count), "g" (flags) \
-		: "ax", "cl" \
-	); \
+	rm16 = rot_##xxx(rm16, count, 2); \
 	isa_store_rm16(rm16); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm16_cl_impl(xxx) void op_##xxx##_rm16_cl_impl() { \
 	uint16_t rm16 = isa_load_rm16(); \
 	uint8_t count = isa_load_reg(reg_cl); \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%ax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%ax\n\t" \
-		"mov %%ax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm16) \
-		: "m" (rm16), "m" (count), "g" (flags) \
-		: "ax", "cl" \
-	); \
+	rm16 = rot_##xxx(rm16, count, 2); \
 	isa_store_rm16(rm16); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm16_imm8_impl(xxx) void op_##xxx##_rm16_imm8_impl() { \
 	uint16_t rm16 = isa_load_rm16(); \
 	uint8_t count = isa_inst.imm.b; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%ax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%ax\n\t" \
-		"mov %%ax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm16) \
-		: "m" (rm16), "m" (count), "g" (flags) \
-		: "ax", "cl" \
-	); \
+	rm16 = rot_##xxx(rm16, count, 2); \
 	isa_store_rm16(rm16); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm32_1_impl(xxx) void op_##xxx##_rm32_1_impl() { \
 	uint32_t rm32 = isa_load_rm32(); \
 	uint8_t count = 1; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%eax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%eax\n\t" \
-		"mov %%eax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm32) \
-		: "m" (rm32), "m" (count), "g" (flags) \
-		: "eax", "cl" \
-	); \
+	rm32 = rot_##xxx(rm32, count, 4); \
 	isa_store_rm32(rm32); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm32_cl_impl(xxx) void op_##xxx##_rm32_cl_impl() { \
 	uint32_t rm32 = isa_load_rm32(); \
 	uint8_t count = isa_load_reg(reg_cl); \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%eax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%eax\n\t" \
-		"mov %%eax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm32) \
-		: "m" (rm32), "m" (count), "g" (flags) \
-		: "eax", "cl" \
-	); \
+	rm32 = rot_##xxx(rm32, count, 4); \
 	isa_store_rm32(rm32); \
-	isa_regs->eflags = flags; \
 }
 
 
 #define op_xxx_rm32_imm8_impl(xxx) void op_##xxx##_rm32_imm8_impl() { \
 	uint32_t rm32 = isa_load_rm32(); \
 	uint8_t count = isa_inst.imm.b; \
-	unsigned long flags = isa_regs->eflags; \
-	asm volatile ( \
-		"push %4 ; popf\n\t" \
-		"mov %2, %%eax\n\t" \
-		"mov %3, %%cl\n\t" \
-		#xxx " %%cl, %%eax\n\t" \
-		"mov %%eax, %1\n\t" \
-		"pushf ; pop %0" \
-		: "=g" (flags), "=m" (rm32) \
-		: "m" (rm32), "m" (count), "g" (flags) \
-		: "eax", "cl" \
-	); \
+	rm32 = rot_##xxx(rm32, count, 4); \
 	isa_store_rm32(rm32); \
-	isa_regs->eflags = flags; \
 }
 
 
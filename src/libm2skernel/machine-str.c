@@ -108,21 +108,10 @@ OP_REPNZ_IMPL(scasd)
 
 void op_cmpsb_impl() {
 	uint8_t op1, op2;
-	unsigned long flags;
 
 	mem_read(isa_mem, isa_regs->esi, 1, &op1);
 	mem_read(isa_mem, isa_regs->edi, 1, &op2);
-	flags = isa_regs->eflags;
-	asm volatile (
-		"push %1 ; popf\n\t"
-		"mov %2, %%al\n\t"
-		"cmp %3, %%al\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags)
-		: "g" (flags), "m" (op1), "m" (op2)
-		: "al"
-	);
-	isa_regs->eflags = flags;
+	isa_alu_cmp(op1, op2, 1);
 	isa_regs->esi += isa_get_flag(flag_df) ? -1 : 1;
 	isa_regs->edi += isa_get_flag(flag_df) ? -1 : 1;
 }
@@ -130,21 +119,10 @@ void op_cmpsb_impl() {
 
 void op_cmpsd_impl() {
 	uint32_t op1, op2;
-	unsigned long flags;
 
 	mem_read(isa_mem, isa_regs->edi, 4, &op1);
 	mem_read(isa_mem, isa_regs->esi, 4, &op2);
-	flags = isa_regs->eflags;
-	asm volatile (
-		"push %1 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"cmp %3, %%eax\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags)
-		: "g" (flags), "m" (op1), "m" (op2)
-		: "eax"
-	);
-	isa_regs->eflags = flags;
+	isa_alu_cmp(op1, op2, 4);
 	isa_regs->esi += isa_get_flag(flag_df) ? -4 : 4;
 	isa_regs->edi += isa_get_flag(flag_df) ? -4 : 4;
 }
@@ -180,18 +158,8 @@ void op_movsd_impl() {
 void op_scasb_impl() {
 	uint8_t al = isa_load_reg(reg_al);
 	uint8_t m8;
-	unsigned long flags = isa_regs->eflags;
 	mem_read(isa_mem, isa_regs->edi, 1, &m8);
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %1, %%al\n\t"
-		"cmp %2, %%al\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags)
-		: "m" (al), "m" (m8), "g" (flags)
-		: "al"
-	);
-	isa_regs->eflags = flags;
+	isa_alu_cmp(al, m8, 1);
 	isa_regs->edi += isa_get_flag(flag_df) ? -1 : 1;
 }
 
@@ -199,18 +167,8 @@ void op_scasb_impl() {
 void op_scasd_impl() {
 	uint32_t eax = isa_load_reg(reg_eax);
 	uint32_t m32;
-	unsigned long flags = isa_regs->eflags;
 	mem_read(isa_mem, isa_regs->edi, 4, &m32);
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %1, %%eax\n\t"
-		"cmp %2, %%eax\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags)
-		: "m" (eax), "m" (m32), "g" (flags)
-		: "eax"
-	);
-	isa_regs->eflags = flags;
+	isa_alu_cmp(eax, m32, 4);
 	isa_regs->edi += isa_get_flag(flag_df) ? -4 : 4;
 }
 
@@ -24,53 +24,35 @@
 
 
 void op_bsf_r32_rm32_impl() {
-	uint32_t r32 = isa_load_r32();
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"bsf %3, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=g" (r32)
-		: "g" (r32), "g" (rm32), "g" (flags)
-		: "eax"
-	);
-	isa_store_r32(r32);
-	isa_regs->eflags = flags;
+	int i;
+	if (!rm32) {
+		isa_set_flag(flag_zf);
+		return;
+	}
+	for (i = 0; !(rm32 & (1U << i)); i++);
+	isa_store_r32(i);
+	isa_clear_flag(flag_zf);
 }
 
 
 void op_bsr_r32_rm32_impl() {
-	uint32_t r32 = isa_load_r32();
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"bsr %3, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (r32)
-		: "m" (r32), "m" (rm32), "g" (flags)
-		: "eax"
-	);
-	isa_store_r32(r32);
-	isa_regs->eflags = flags;
+	int i;
+	if (!rm32) {
+		isa_set_flag(flag_zf);
+		return;
+	}
+	for (i = 31; !(rm32 & (1U << i)); i--);
+	isa_store_r32(i);
+	isa_clear_flag(flag_zf);
 }
 
 
 void op_bswap_ir32_impl() {
 	uint32_t ir32 = isa_load_ir32();
-	asm volatile (
-		"mov %1, %%eax\n\t"
-		"bswap %%eax\n\t"
-		"mov %%eax, %0\n\t"
-		: "=g" (ir32)
-		: "g" (ir32)
-		: "eax"
-	);
+	ir32 = (ir32 >> 24) | ((ir32 >> 8) & 0xff00) |
+		((ir32 << 8) & 0xff0000) | (ir32 << 24);
 	isa_store_ir32(ir32);
 }
 
@@ -78,56 +60,32 @@ void op_bswap_ir32_impl() {
 void op_bt_rm32_r32_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%ecx\n\t"
-		"mov %1, %%eax\n\t"
-		"bt %%ecx, %%eax\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags)
-		: "m" (rm32), "m" (r32), "g" (flags)
-		: "eax", "ecx"
-	);
-	isa_regs->eflags = flags;
+	if (rm32 & (1U << (r32 & 31)))
+		isa_set_flag(flag_cf);
+	else
+		isa_clear_flag(flag_cf);
 }
 
 
 void op_bt_rm32_imm8_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t imm8 = isa_inst.imm.b;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%ecx\n\t"
-		"mov %1, %%eax\n\t"
-		"bt %%ecx, %%eax\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags)
-		: "m" (rm32), "m" (imm8), "g" (flags)
-		: "eax", "ecx"
-	);
-	isa_regs->eflags = flags;
+	if (rm32 & (1U << (imm8 & 31)))
+		isa_set_flag(flag_cf);
+	else
+		isa_clear_flag(flag_cf);
 }
 
 
 void op_bts_rm32_imm8_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t imm8 = isa_inst.imm.b;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %3, %%ecx\n\t"
-		"mov %2, %%eax\n\t"
-		"btsl %%ecx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (rm32)
-		: "m" (rm32), "m" (imm8), "g" (flags)
-		: "eax", "ecx"
-	);
-	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
+	uint32_t bit = 1U << (imm8 & 31);
+	if (rm32 & bit)
+		isa_set_flag(flag_cf);
+	else
+		isa_clear_flag(flag_cf);
+	isa_store_rm32(rm32 | bit);
 }
 
 
@@ -166,23 +124,13 @@ void op_cld_impl() {
 
 void op_cmpxchg_rm32_r32_impl() {
 	uint32_t eax = isa_regs->eax;
-	unsigned long flags = isa_regs->eflags;
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %4, %%eax\n\t"
-		"mov %5, %%ebx\n\t"
-		"mov %6, %%ecx\n\t"
-		"cmpxchg %%ecx, %%ebx\n\t"
-		"pushf\n\tpop %0\n\t"
-		"mov %%eax, %1\n\t"
-		"mov %%ebx, %2\n\t"
-		: "=g" (flags), "=m" (eax), "=m" (rm32)
-		: "g" (flags), "m" (eax), "m" (rm32), "m" (r32)
-		: "eax", "ebx", "ecx"
-	);
-	isa_regs->eflags = flags;
+	isa_alu_cmp(eax, rm32, 4);
+	if (eax == rm32)
+		rm32 = r32;
+	else
+		eax = rm32;
 	isa_store_reg(reg_eax, eax);
 	isa_store_rm32(rm32);
 }
@@ -258,113 +206,57 @@ void op_cwde_impl() {
 
 void op_dec_rm8_impl() {
 	uint8_t rm8 = isa_load_rm8();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%al\n\t"
-		"dec %%al\n\t"
-		"mov %%al, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (rm8)
-		: "g" (rm8), "g" (flags)
-		: "al"
-	);
+	rm8 = isa_alu_dec(rm8, 1);
 	isa_store_rm8(rm8);
-	isa_regs->eflags = flags;
 }
 
 
 void op_dec_rm32_impl() {
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"dec %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (rm32)
-		: "g" (rm32), "g" (flags)
-		: "eax"
-	);
+	rm32 = isa_alu_dec(rm32, 4);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
 void op_dec_ir16_impl() {
 	uint16_t ir16 = isa_load_ir16();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%ax\n\t"
-		"dec %%ax\n\t"
-		"mov %%ax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (ir16)
-		: "g" (ir16), "g" (flags)
-		: "eax"
-	);
+	ir16 = isa_alu_dec(ir16, 2);
 	isa_store_ir16(ir16);
-	isa_regs->eflags = flags;
 }
 
 
 void op_dec_ir32_impl() {
 	uint32_t ir32 = isa_load_ir32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"dec %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (ir32)
-		: "g" (ir32), "g" (flags)
-		: "eax"
-	);
+	ir32 = isa_alu_dec(ir32, 4);
 	isa_store_ir32(ir32);
-	isa_regs->eflags = flags;
 }
 
 
 void op_div_rm8_impl() {
 	uint16_t ax = isa_load_reg(reg_ax);
 	uint8_t rm8 = isa_load_rm8();
+	uint16_t quo;
 	if (!rm8)
 		fatal("div_rm8: division by 0");
-	asm volatile(
-		"mov %1, %%ax\n\t"
-		"mov %2, %%bl\n\t"
-		"div %%bl\n\t"
-		"mov %%ax, %0\n\t"
-		: "=m" (ax)
-		: "m" (ax), "m" (rm8)
-		: "ax", "bl"
-	);
-	isa_store_reg(reg_ax, ax);
+	quo = ax / rm8;
+	if (quo > 0xff)
+		fatal("div_rm8: quotient overflow");
+	isa_store_reg(reg_al, quo);
+	isa_store_reg(reg_ah, ax % rm8);
 }
 
 
 void op_div_rm32_impl() {
-	uint32_t eax = isa_regs->eax;
-	uint32_t edx = isa_regs->edx;
+	uint64_t dividend = ((uint64_t) isa_regs->edx << 32) | isa_regs->eax;
 	uint32_t rm32 = isa_load_rm32();
+	uint64_t quo;
 	if (!rm32)
 		fatal("div_rm32: division by 0");
-	asm volatile (
-		"mov %2, %%eax\n\t"
-		"mov %3, %%edx\n\t"
-		"mov %4, %%ebx\n\t"
-		"div %%ebx\n\t"
-		"mov %%eax, %0\n\t"
-		"mov %%edx, %1\n\t"
-		: "=m" (eax), "=m" (edx)
-		: "m" (eax), "m" (edx), "m" (rm32)
-		: "eax", "edx", "ebx"
-	);
-	isa_store_reg(reg_eax, eax);
-	isa_store_reg(reg_edx, edx);
+	quo = dividend / rm32;
+	if (quo > 0xffffffffULL)
+		fatal("div_rm32: quotient overflow");
+	isa_store_reg(reg_eax, quo);
+	isa_store_reg(reg_edx, dividend % rm32);
 }
 
 
@@ -374,181 +266,87 @@ void op_hlt_impl() {
 
 
 void op_idiv_rm32_impl() {
-	uint32_t eax = isa_regs->eax;
-	uint32_t edx = isa_regs->edx;
-	uint32_t rm32 = isa_load_rm32();
+	int64_t dividend = (int64_t) (((uint64_t) isa_regs->edx << 32) | isa_regs->eax);
+	int32_t rm32 = isa_load_rm32();
+	int64_t quo;
 	if (!rm32)
 		fatal("idiv_rm32: division by 0");
-	asm volatile (
-		"mov %2, %%eax\n\t"
-		"mov %3, %%edx\n\t"
-		"mov %4, %%ebx\n\t"
-		"idiv %%ebx\n\t"
-		"mov %%eax, %0\n\t"
-		"mov %%edx, %1\n\t"
-		: "=m" (eax), "=m" (edx)
-		: "m" (eax), "m" (edx), "m" (rm32)
-		: "eax", "edx", "ebx"
-	);
-	isa_store_reg(reg_eax, eax);
-	isa_store_reg(reg_edx, edx);
+	if (dividend == INT64_MIN && rm32 == -1)
+		fatal("idiv_rm32: quotient overflow");
+	quo = dividend / rm32;
+	if (quo > INT32_MAX || quo < INT32_MIN)
+		fatal("idiv_rm32: quotient overflow");
+	isa_store_reg(reg_eax, quo);
+	isa_store_reg(reg_edx, dividend % rm32);
 }
 
 
 void op_imul_rm32_impl() {
-	uint32_t eax = isa_load_reg(reg_eax);
-	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	uint32_t edx;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %3, %%eax\n\t"
-		"mov %4, %%edx\n\t"
-		"imul %%edx\n\t"
-		"mov %%edx, %1\n\t"
-		"mov %%eax, %2\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (edx), "=m" (eax)
-		: "m" (eax), "m" (rm32), "g" (flags)
-		: "eax", "edx"
-	);
-	isa_store_reg(reg_eax, eax);
-	isa_store_reg(reg_edx, edx);
-	isa_regs->eflags = flags;
+	int32_t eax = isa_load_reg(reg_eax);
+	int32_t rm32 = isa_load_rm32();
+	int64_t res = (int64_t) eax * rm32;
+	uint32_t flags = res != (int32_t) res ? (1 << flag_cf) | (1 << flag_of) : 0;
+	isa_store_reg(reg_eax, res);
+	isa_store_reg(reg_edx, (uint64_t) res >> 32);
+	isa_set_flags_res(res, 4, flags);
 }
 
 
 void op_imul_r32_rm32_impl() {
-	uint32_t r32 = isa_load_r32();
-	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"mov %3, %%ebx\n\t"
-		"imul %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (r32)
-		: "m" (r32), "m" (rm32), "g" (flags)
-		: "eax", "ebx"
-	);
-	isa_store_r32(r32);
-	isa_regs->eflags = flags;
+	int32_t src1 = isa_load_r32();
+	int32_t src2 = isa_load_rm32();
+	int64_t res = (int64_t) src1 * src2;
+	uint32_t flags = res != (int32_t) res ? (1 << flag_cf) | (1 << flag_of) : 0;
+	isa_store_r32(res);
+	isa_set_flags_res(res, 4, flags);
 }
 
 
 void op_imul_r32_rm32_imm8_impl() {
-	uint32_t r32;
-	uint32_t rm32 = isa_load_rm32();
-	uint32_t imm8 = (int8_t) isa_inst.imm.b;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"mov %3, %%ebx\n\t"
-		"imul %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (r32)
-		: "m" (rm32), "m" (imm8), "g" (flags)
-		: "eax", "ebx"
-	);
-	isa_store_r32(r32);
-	isa_regs->eflags = flags;
+	int32_t src1 = isa_load_rm32();
+	int32_t src2 = (int8_t) isa_inst.imm.b;
+	int64_t res = (int64_t) src1 * src2;
+	uint32_t flags = res != (int32_t) res ? (1 << flag_cf) | (1 << flag_of) : 0;
+	isa_store_r32(res);
+	isa_set_flags_res(res, 4, flags);
 }
 
 
 void op_imul_r32_rm32_imm32_impl() {
-	uint32_t r32;
-	uint32_t rm32 = isa_load_rm32();
-	uint32_t imm32 = isa_inst.imm.d;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"mov %3, %%ebx\n\t"
-		"imul %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (r32)
-		: "m" (rm32), "m" (imm32), "g" (flags)
-		: "eax", "ebx"
-	);
-	isa_store_r32(r32);
-	isa_regs->eflags = flags;
+	int32_t src1 = isa_load_rm32();
+	int32_t src2 = isa_inst.imm.d;
+	int64_t res = (int64_t) src1 * src2;
+	uint32_t flags = res != (int32_t) res ? (1 << flag_cf) | (1 << flag_of) : 0;
+	isa_store_r32(res);
+	isa_set_flags_res(res, 4, flags);
 }
 
 
 void op_inc_rm8_impl() {
 	uint8_t rm8 = isa_load_rm8();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%al\n\t"
-		"inc %%al\n\t"
-		"mov %%al, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (rm8)
-		: "g" (rm8), "g" (flags)
-		: "al"
-	);
+	rm8 = isa_alu_inc(rm8, 1);
 	isa_store_rm8(rm8);
-	isa_regs->eflags = flags;
 }
 
 
 void op_inc_rm32_impl() {
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"inc %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (rm32)
-		: "g" (rm32), "g" (flags)
-		: "eax"
-	);
+	rm32 = isa_alu_inc(rm32, 4);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
 void op_inc_ir16_impl() {
 	uint16_t ir16 = isa_load_ir16();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%ax\n\t"
-		"inc %%ax\n\t"
-		"mov %%ax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (ir16)
-		: "g" (ir16), "g" (flags)
-		: "ax"
-	);
+	ir16 = isa_alu_inc(ir16, 2);
 	isa_store_ir16(ir16);
-	isa_regs->eflags = flags;
 }
 
 
 void op_inc_ir32_impl() {
 	uint32_t ir32 = isa_load_ir32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"inc %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=g" (ir32)
-		: "g" (ir32), "g" (flags)
-		: "eax"
-	);
+	ir32 = isa_alu_inc(ir32, 4);
 	isa_store_ir32(ir32);
-	isa_regs->eflags = flags;
 }
 
 
@@ -807,59 +605,25 @@ void op_movzx_r32_rm16_impl() {
 void op_mul_rm32_impl() {
 	uint32_t eax = isa_load_reg(reg_eax);
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	uint32_t edx;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %3, %%eax\n\t"
-		"mov %4, %%edx\n\t"
-		"mul %%edx\n\t"
-		"mov %%edx, %1\n\t"
-		"mov %%eax, %2\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (edx), "=m" (eax)
-		: "m" (eax), "m" (rm32), "g" (flags)
-		: "eax", "edx"
-	);
-	isa_store_reg(reg_eax, eax);
-	isa_store_reg(reg_edx, edx);
-	isa_regs->eflags = flags;
+	uint64_t res = (uint64_t) eax * rm32;
+	uint32_t flags = res >> 32 ? (1 << flag_cf) | (1 << flag_of) : 0;
+	isa_store_reg(reg_eax, res);
+	isa_store_reg(reg_edx, res >> 32);
+	isa_set_flags_res(res, 4, flags);
 }
 
 
 void op_neg_rm8_impl() {
 	uint8_t rm8 = isa_load_rm8();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%al\n\t"
-		"neg %%al\n\t"
-		"mov %%al, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=g" (rm8)
-		: "g" (rm8), "g" (flags)
-		: "al"
-	);
+	rm8 = isa_alu_sub(0, rm8, 1);
 	isa_store_rm8(rm8);
-	isa_regs->eflags = flags;
 }
 
 
 void op_neg_rm32_impl() {
 	uint32_t rm32 = isa_load_rm32();
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %3 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"neg %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=g" (rm32)
-		: "g" (rm32), "g" (flags)
-		: "eax"
-	);
+	rm32 = isa_alu_sub(0, rm32, 4);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
@@ -920,6 +684,7 @@ void op_pop_ir32_impl() {
 
 void op_popf_impl() {
 	mem_read(isa_mem, isa_regs->esp, 4, &isa_regs->eflags);
+	isa_regs->flags_op = regs_flags_none;
 	isa_regs->esp += 4;
 }
 
@@ -974,6 +739,7 @@ void op_push_ir32_impl() {
 
 
 void op_pushf_impl() {
+	regs_flags_eval(isa_regs);
 	isa_store_reg(reg_esp, isa_regs->esp - 4);
 	mem_write(isa_mem, isa_regs->esp, 4, &isa_regs->eflags);
 }
@@ -1018,6 +784,7 @@ void op_ret_imm16_impl() {
 
 
 void op_sahf_impl() {
+	regs_flags_eval(isa_regs);
 	isa_regs->eflags &= ~0xff;
 	isa_regs->eflags |= isa_load_reg(reg_ah);
 	isa_regs->eflags &= ~0x28;
@@ -1025,25 +792,40 @@ void op_sahf_impl() {
 }
 
 
+/* Double precision shifts. A masked count of 0 leaves the destination
+ * and the flags unchanged. */
+static uint32_t shld_value(uint32_t dst, uint32_t src, uint8_t count)
+{
+	uint32_t res;
+	count &= 0x1f;
+	if (!count)
+		return dst;
+	res = (dst << count) | (src >> (32 - count));
+	isa_set_flags_res(res, 4, (((dst >> (32 - count)) & 1) << flag_cf) |
+		(((res ^ dst) >> 31) << flag_of));
+	return res;
+}
+
+
+static uint32_t shrd_value(uint32_t dst, uint32_t src, uint8_t count)
+{
+	uint32_t res;
+	count &= 0x1f;
+	if (!count)
+		return dst;
+	res = (dst >> count) | (src << (32 - count));
+	isa_set_flags_res(res, 4, (((dst >> (count - 1)) & 1) << flag_cf) |
+		(((res ^ dst) >> 31) << flag_of));
+	return res;
+}
+
+
 void op_shld_rm32_r32_imm8_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
 	uint8_t imm8 = isa_inst.imm.b;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %4, %%cl\n\t"
-		"mov %3, %%ebx\n\t"
-		"mov %2, %%eax\n\t"
-		"shld %%cl, %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=m" (rm32)
-		: "m" (rm32), "m" (r32), "m" (imm8), "g" (flags)
-		: "eax", "ebx", "cl"
-	);
+	rm32 = shld_value(rm32, r32, imm8);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
@@ -1051,21 +833,8 @@ void op_shld_rm32_r32_cl_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
 	uint8_t cl = isa_load_reg(reg_cl);
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %4, %%cl\n\t"
-		"mov %3, %%ebx\n\t"
-		"mov %2, %%eax\n\t"
-		"shld %%cl, %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=m" (rm32)
-		: "m" (rm32), "m" (r32), "m" (cl), "g" (flags)
-		: "eax", "ebx", "cl"
-	);
+	rm32 = shld_value(rm32, r32, cl);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
@@ -1073,21 +842,8 @@ void op_shrd_rm32_r32_imm8_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
 	uint8_t imm8 = isa_inst.imm.b;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %4, %%cl\n\t"
-		"mov %3, %%ebx\n\t"
-		"mov %2, %%eax\n\t"
-		"shrd %%cl, %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=m" (rm32)
-		: "m" (rm32), "m" (r32), "m" (imm8), "g" (flags)
-		: "eax", "ebx", "cl"
-	);
+	rm32 = shrd_value(rm32, r32, imm8);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
@@ -1095,62 +851,25 @@ void op_shrd_rm32_r32_cl_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
 	uint8_t cl = isa_load_reg(reg_cl);
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %5 ; popf\n\t"
-		"mov %4, %%cl\n\t"
-		"mov %3, %%ebx\n\t"
-		"mov %2, %%eax\n\t"
-		"shrd %%cl, %%ebx, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0"
-		: "=g" (flags), "=m" (rm32)
-		: "m" (rm32), "m" (r32), "m" (cl), "g" (flags)
-		: "eax", "ebx", "cl"
-	);
+	rm32 = shrd_value(rm32, r32, cl);
 	isa_store_rm32(rm32);
-	isa_regs->eflags = flags;
 }
 
 
 void op_xadd_rm8_r8_impl() {
 	uint8_t rm8 = isa_load_rm8();
 	uint8_t r8 = isa_load_r8();
-	uint8_t sum;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%al\n\t"
-		"add %3, %%al\n\t"
-		"mov %%al, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (sum)
-		: "m" (rm8), "m" (r8), "g" (flags)
-		: "al"
-	);
+	uint8_t sum = isa_alu_add(rm8, r8, 1);
 	isa_store_r8(rm8);
 	isa_store_rm8(sum);
-	isa_regs->eflags = flags;
 }
 
 void op_xadd_rm32_r32_impl() {
 	uint32_t rm32 = isa_load_rm32();
 	uint32_t r32 = isa_load_r32();
-	uint32_t sum;
-	unsigned long flags = isa_regs->eflags;
-	asm volatile (
-		"push %4 ; popf\n\t"
-		"mov %2, %%eax\n\t"
-		"add %3, %%eax\n\t"
-		"mov %%eax, %1\n\t"
-		"pushf ; pop %0\n\t"
-		: "=g" (flags), "=m" (sum)
-		: "m" (rm32), "m" (r32), "g" (flags)
-		: "eax"
-	);
+	uint32_t sum = isa_alu_add(rm32, r32, 4);
 	isa_store_r32(rm32);
 	isa_store_rm32(sum);
-	isa_regs->eflags = flags;
 }
 
 void op_xchg_ir16_ax_impl()
@@ -19,6 +19,8 @@
 
 #include <m2skernel.h>
 #include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
 
 /* Total space allocated for memory pages */
 unsigned long mem_mapped_space = 0;
@@ -27,33 +29,27 @@ unsigned long mem_max_mapped_space = 0;
 /* Safe mode */
 int mem_safe_mode = 1;
 
+/* Flat mode. Each memory map reserves a host region as large as the guest
+ * address space (address space only, not memory), and page data lives at
+ * 'host_base + tag'. Guest reads and writes are done directly on the host
+ * region. The host protection of each page only allows the accesses that
+ * need no further action (see 'mem_flat_prot'); any other access faults,
+ * and is done again page by page, which performs the complete checks. */
+int mem_flat_mode = 0;
+#define MEM_FLAT_SIZE  (1ULL << 32)
+
+/* Recovery point of the direct access in progress in this host thread */
+static __thread sigjmp_buf mem_flat_env;
+static __thread volatile int mem_flat_active;
+
 
 /* Return mem page corresponding to an address. */
 struct mem_page_t *mem_page_get(struct mem_t *mem, uint32_t addr)
 {
-	uint32_t index, tag;
-	struct mem_page_t *prev, *page;
+	struct mem_page_t **table;
 
-	tag = addr & ~(MEM_PAGESIZE - 1);
-	index = (addr >> MEM_LOGPAGESIZE) % MEM_PAGE_COUNT;
-	page = mem->pages[index];
-	prev = NULL;
-	
-	/* Look for page */
-	while (page && page->tag != tag) {
-		prev = page;
-		page = page->next;
-	}
-	
-	/* Place page into list head */
-	if (prev && page) {
-		prev->next = page->next;
-		page->next = mem->pages[index];
-		mem->pages[index] = page;
-	}
-	
-	/* Return found page */
-	return page;
+	table = mem->pages[MEM_PAGE_DIR(addr)];
+	return table ? table[MEM_PAGE_ENTRY(addr)] : NULL;
 }
 
 
@@ -61,60 +57,193 @@ struct mem_page_t *mem_page_get(struct mem_t *mem, uint32_t addr)
  * is useful to reconstruct consecutive ranges of mapped pages. */
 struct mem_page_t *mem_page_get_next(struct mem_t *mem, uint32_t addr)
 {
-	uint32_t tag, index, mintag;
-	struct mem_page_t *prev, *page, *minpage;
+	uint32_t tag, dir, entry;
+	struct mem_page_t **table;
 
 	/* Get tag of the page just following addr */
 	tag = (addr + MEM_PAGESIZE) & ~(MEM_PAGESIZE - 1);
 	if (!tag)
 		return NULL;
-	index = (tag >> MEM_LOGPAGESIZE) % MEM_PAGE_COUNT;
-	page = mem->pages[index];
-	prev = NULL;
 
-	/* Look for a page exactly following addr. If it is found, return it. */
-	while (page && page->tag != tag) {
-		prev = page;
-		page = page->next;
+	/* Walk the page table in address order, skipping unallocated tables */
+	entry = MEM_PAGE_ENTRY(tag);
+	for (dir = MEM_PAGE_DIR(tag); dir < MEM_PAGE_COUNT; dir++, entry = 0) {
+		table = mem->pages[dir];
+		if (!table)
+			continue;
+		for (; entry < MEM_PAGE_COUNT; entry++)
+			if (table[entry])
+				return table[entry];
 	}
-	if (page)
-		return page;
-	
-	/* Page following addr is not found, so check all memory pages to find
-	 * the one with the lowest tag following addr. */
-	mintag = 0xffffffff;
-	minpage = NULL;
-	for (index = 0; index < MEM_PAGE_COUNT; index++) {
-		for (page = mem->pages[index]; page; page = page->next) {
-			if (page->tag > tag && page->tag < mintag) {
-				mintag = page->tag;
-				minpage = page;
-			}
-		}
+	return NULL;
+}
+
+
+/* Return true if page data is part of the flat host region */
+static int mem_page_is_flat(struct mem_t *mem, struct mem_page_t *page)
+{
+	return mem->host_base && page->data == mem->host_base + page->tag;
+}
+
+
+/* Host protection of a flat page. It is readable if the guest page is.
+ * It is writable if the guest page is, once a first write has gone
+ * through 'mem_access_page_boundary' and marked it as modified, and as
+ * long as it does not hold decoded instructions. */
+static int mem_flat_prot(struct mem_page_t *page)
+{
+	int prot = 0;
+
+	if (page->perm & mem_access_read)
+		prot |= PROT_READ;
+	if ((page->perm & mem_access_write) && (page->perm & mem_access_modif) &&
+		!page->decoded)
+		prot |= PROT_WRITE;
+	return prot;
+}
+
+
+/* Apply the host protection of a flat page */
+static void mem_flat_protect(struct mem_t *mem, struct mem_page_t *page)
+{
+	if (mprotect(mem->host_base + page->tag, MEM_PAGESIZE, mem_flat_prot(page)) < 0)
+		fatal("mem_flat_protect: host call 'mprotect' failed");
+}
+
+
+/* Let the simulator itself read and write a flat page, until the next call
+ * to 'mem_flat_protect'. */
+static void mem_flat_open(struct mem_t *mem, struct mem_page_t *page)
+{
+	if (mprotect(mem->host_base + page->tag, MEM_PAGESIZE, PROT_READ | PROT_WRITE) < 0)
+		fatal("mem_flat_open: host call 'mprotect' failed");
+}
+
+
+/* Host fault handler. A fault in a direct access resumes it in 'mem_access'.
+ * Any other fault is raised again with the default action. */
+static void mem_flat_fault(int sig, siginfo_t *info, void *context)
+{
+	if (mem_flat_active) {
+		mem_flat_active = 0;
+		siglongjmp(mem_flat_env, 1);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+
+/* Copy 'size' bytes from 'src' to 'dest', or clear them if 'src' is NULL,
+ * where either range can lie in a flat host region. Return zero if the host
+ * protection faulted, in which case part of the range may be done. */
+static int mem_flat_move(void *dest, void *src, size_t size)
+{
+	if (sigsetjmp(mem_flat_env, 0))
+		return 0;
+	mem_flat_active = 1;
+	if (src)
+		memmove(dest, src, size);
+	else
+		memset(dest, 0, size);
+	mem_flat_active = 0;
+	return 1;
+}
+
+
+/* Give a flat page back to the host. Its contents are discarded, and any
+ * later host access to it faults. */
+static void mem_flat_decommit(struct mem_t *mem, uint32_t tag)
+{
+	void *ptr;
+
+	ptr = mmap(mem->host_base + tag, MEM_PAGESIZE, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	if (ptr == MAP_FAILED)
+		fatal("mem_flat_decommit: host call 'mmap' failed");
+}
+
+
+/* Discard the decoded instructions and basic blocks read from 'page' */
+static void mem_icache_flush(struct mem_t *mem, struct mem_page_t *page)
+{
+	struct mem_icache_entry_t *entry;
+	struct mem_block_t *block;
+	int i;
+
+	page->decoded = 0;
+	if (mem_page_is_flat(mem, page))
+		mem_flat_protect(mem, page);
+	for (i = 0; i < MEM_BLOCK_COUNT; i++) {
+		block = mem->blocks[i];
+		if (block && (block->eip & MEM_PAGEMASK) == page->tag)
+			block->valid = 0;
+	}
+	if (!mem->icache)
+		return;
+	for (i = 0; i < MEM_ICACHE_SIZE; i++) {
+		entry = &mem->icache[i];
+		if (!entry->valid)
+			continue;
+		if ((entry->eip & MEM_PAGEMASK) == page->tag ||
+			((entry->eip + entry->inst.size - 1) & MEM_PAGEMASK) == page->tag)
+			entry->valid = 0;
 	}
+}
+
+
+/* Stop sharing the data of a copy-on-write page. If 'copy' is set, the page
+ * keeps a private copy of the contents; otherwise, its data is left NULL.
+ * Memory maps sharing the page can run on different host threads, so the
+ * count is updated atomically, and the contents are copied before dropping
+ * the reference. The last owner keeps the original data; a sole owner
+ * cannot see the count grow, since only owners clone the page. */
+static void mem_page_unshare(struct mem_page_t *page, int copy)
+{
+	unsigned char *data = NULL;
 
-	/* Return the found page (or NULL) */
-	return minpage;
+	assert(page->cow && __atomic_load_n(page->cow, __ATOMIC_ACQUIRE) > 0);
+	if (copy && __atomic_load_n(page->cow, __ATOMIC_ACQUIRE) > 1) {
+		data = malloc(MEM_PAGESIZE);
+		memcpy(data, page->data, MEM_PAGESIZE);
+	}
+	if (__atomic_sub_fetch(page->cow, 1, __ATOMIC_ACQ_REL)) {
+		page->data = data;
+	} else {
+		free(page->cow);
+		free(data);
+		if (!copy) {
+			free(page->data);
+			page->data = NULL;
+		}
+	}
+	page->cow = NULL;
 }
 
 
 /* Create new mem page */
 static struct mem_page_t *mem_page_create(struct mem_t *mem, uint32_t addr, int perm)
 {
-	uint32_t index, tag;
+	uint32_t dir, tag;
 	struct mem_page_t *page;
 
 	tag = addr & ~(MEM_PAGESIZE - 1);
-	index = (addr >> MEM_LOGPAGESIZE) % MEM_PAGE_COUNT;
+	dir = MEM_PAGE_DIR(addr);
 	
 	/* Create new page */
 	page = calloc(1, sizeof(struct mem_page_t));
 	page->tag = tag;
 	page->perm = perm;
+
+	/* In flat mode, commit the host page backing it */
+	if (mem->host_base) {
+		page->data = mem->host_base + tag;
+		mem_flat_protect(mem, page);
+	}
 	
-	/* Insert in pages hash table */
-	page->next = mem->pages[index];
-	mem->pages[index] = page;
+	/* Insert in page table */
+	if (!mem->pages[dir])
+		mem->pages[dir] = calloc(MEM_PAGE_COUNT, sizeof(struct mem_page_t *));
+	mem->pages[dir][MEM_PAGE_ENTRY(addr)] = page;
 	mem_mapped_space += MEM_PAGESIZE;
 	mem_max_mapped_space = MAX(mem_max_mapped_space, mem_mapped_space);
 	return page;
@@ -124,23 +253,20 @@ static struct mem_page_t *mem_page_create(struct mem_t *mem, uint32_t addr, int
 /* Free mem pages */
 static void mem_page_free(struct mem_t *mem, uint32_t addr)
 {
-	uint32_t index, tag;
-	struct mem_page_t *prev, *page;
+	uint32_t tag;
+	struct mem_page_t *page;
 	struct mem_host_mapping_t *hm;
 	
-	tag = addr & ~(MEM_PAGESIZE - 1);
-	index = (addr >> MEM_LOGPAGESIZE) % MEM_PAGE_COUNT;
-	prev = NULL;
-
 	/* Find page */
-	page = mem->pages[index];
-	while (page && page->tag != tag) {
-		prev = page;
-		page = page->next;
-	}
+	tag = addr & ~(MEM_PAGESIZE - 1);
+	page = mem_page_get(mem, addr);
 	if (!page)
 		return;
 	
+	/* Discard decoded instructions coming from this page */
+	if (page->decoded)
+		mem_icache_flush(mem, page);
+	
 	/* If page belongs to a host mapping, release it if
 	 * this is the last page allocated for it. */
 	hm = page->host_mapping;
@@ -155,12 +281,13 @@ static void mem_page_free(struct mem_t *mem, uint32_t addr)
 	}
 
 	/* Free page */
-	if (prev)
-		prev->next = page->next;
-	else
-		mem->pages[index] = page->next;
+	mem->pages[MEM_PAGE_DIR(addr)][MEM_PAGE_ENTRY(addr)] = NULL;
 	mem_mapped_space -= MEM_PAGESIZE;
-	if (page->data)
+	if (page->cow)
+		mem_page_unshare(page, 0);
+	if (mem_page_is_flat(mem, page))
+		mem_flat_decommit(mem, tag);
+	else if (page->data)
 		free(page->data);
 	free(page);
 }
@@ -179,7 +306,14 @@ void mem_copy(struct mem_t *mem, uint32_t dest, uint32_t src, int size)
 	if ((src < dest && src + size > dest) ||
 		(dest < src && dest + size > src))
 		fatal("mem_copy: cannot copy overlapping regions");
-	
+
+	/* In flat mode, try a single copy on the host region. It faults if a
+	 * page is missing, is not flat, or needs the per-page actions below. */
+	if (mem->host_base && size > 0 && dest + (uint32_t) (size - 1) >= dest &&
+		src + (uint32_t) (size - 1) >= src &&
+		mem_flat_move(mem->host_base + dest, mem->host_base + src, size))
+		return;
+
 	/* Copy */
 	while (size > 0) {
 		
@@ -187,9 +321,18 @@ void mem_copy(struct mem_t *mem, uint32_t dest, uint32_t src, int size)
 		page_dest = mem_page_get(mem, dest);
 		page_src = mem_page_get(mem, src);
 		assert(page_src && page_dest);
+		if (page_dest->decoded)
+			mem_icache_flush(mem, page_dest);
+		if (page_dest->cow)
+			mem_page_unshare(page_dest, 0);
+		page_dest->perm |= mem_access_modif;
 		
 		/* Different actions depending on whether source and
 		 * destination page data are allocated. */
+		if (mem_page_is_flat(mem, page_src))
+			mem_flat_open(mem, page_src);
+		if (mem_page_is_flat(mem, page_dest))
+			mem_flat_open(mem, page_dest);
 		if (page_src->data) {
 			if (!page_dest->data)
 				page_dest->data = malloc(MEM_PAGESIZE);
@@ -198,6 +341,10 @@ void mem_copy(struct mem_t *mem, uint32_t dest, uint32_t src, int size)
 			if (page_dest->data)
 				memset(page_dest->data, 0, MEM_PAGESIZE);
 		}
+		if (mem_page_is_flat(mem, page_src))
+			mem_flat_protect(mem, page_src);
+		if (mem_page_is_flat(mem, page_dest))
+			mem_flat_protect(mem, page_dest);
 
 		/* Advance pointers */
 		src += MEM_PAGESIZE;
@@ -230,6 +377,18 @@ void *mem_get_buffer(struct mem_t *mem, uint32_t addr, int size,
 	if ((page->perm & access) != access && mem->safe)
 		fatal("mem_get_buffer: permission denied at 0x%x", addr);
 	
+	/* The caller might write through the returned buffer */
+	if ((access & mem_access_write) && page->decoded)
+		mem_icache_flush(mem, page);
+	if ((access & mem_access_write) && page->cow)
+		mem_page_unshare(page, 1);
+	
+	/* Flat pages are only returned if the host protection allows the access.
+	 * Otherwise, the caller falls back to 'mem_access'. */
+	if (mem_page_is_flat(mem, page) && ((access & (mem_access_write |
+		mem_access_init)) || !(mem_flat_prot(page) & PROT_READ)))
+		return NULL;
+
 	/* Allocate and initialize page data if it does not exist yet. */
 	if (!page->data)
 		page->data = calloc(1, MEM_PAGESIZE);
@@ -280,15 +439,30 @@ static void mem_access_page_boundary(struct mem_t *mem, uint32_t addr,
 
 	/* Read/execute access */
 	if (access == mem_access_read || access == mem_access_exec) {
-		if (page->data)
+		if (mem_page_is_flat(mem, page) && !(mem_flat_prot(page) & PROT_READ)) {
+			mem_flat_open(mem, page);
+			memcpy(buf, page->data + offset, size);
+			mem_flat_protect(mem, page);
+		} else if (page->data)
 			memcpy(buf, page->data + offset, size);
 		else
 			memset(buf, 0, size);
 		return;
 	}
 
-	/* Write/initialize access */
+	/* Write/initialize access. A flat page is given its new host
+	 * protection afterwards, which lets later writes go direct. */
 	if (access == mem_access_write || access == mem_access_init) {
+		if (page->decoded)
+			mem_icache_flush(mem, page);
+		if (page->cow)
+			mem_page_unshare(page, 1);
+		if (mem_page_is_flat(mem, page)) {
+			mem_flat_open(mem, page);
+			memcpy(page->data + offset, buf, size);
+			mem_flat_protect(mem, page);
+			return;
+		}
 		if (!page->data)
 			page->data = calloc(1, MEM_PAGESIZE);
 		memcpy(page->data + offset, buf, size);
@@ -309,6 +483,17 @@ void mem_access(struct mem_t *mem, uint32_t addr, int size, void *buf,
 	int chunksize;
 
 	mem->last_address = addr;
+
+	/* In flat mode, reads and writes are tried directly on the host region,
+	 * unless the range wraps around the guest space. If the host protection
+	 * does not allow the access, it faults, and is done page by page. */
+	if (mem->host_base && size > 0 && addr + (uint32_t) (size - 1) >= addr) {
+		if (access == mem_access_read && mem_flat_move(buf, mem->host_base + addr, size))
+			return;
+		if (access == mem_access_write && mem_flat_move(mem->host_base + addr, buf, size))
+			return;
+	}
+
 	while (size) {
 		offset = addr & (MEM_PAGESIZE - 1);
 		chunksize = MIN(size, MEM_PAGESIZE - offset);
@@ -322,28 +507,124 @@ void mem_access(struct mem_t *mem, uint32_t addr, int size, void *buf,
 
 
 /* Creation and destruction */
+/* Install the host fault handler of flat mode. The signal is not blocked
+ * while it runs, since the handler does not return after a direct access. */
+static void mem_flat_handler_init(void)
+{
+	static int installed;
+	struct sigaction sa;
+
+	if (installed)
+		return;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = mem_flat_fault;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGSEGV, &sa, NULL) < 0)
+		fatal("mem_create: host call 'sigaction' failed");
+	installed = 1;
+}
+
+
 struct mem_t *mem_create()
 {
 	struct mem_t *mem;
 	mem = calloc(1, sizeof(struct mem_t));
 	mem->sharing = 1;
 	mem->safe = mem_safe_mode;
+
+	/* Reserve host region for flat mode */
+	if (mem_flat_mode) {
+		if (sizeof(void *) < 8)
+			fatal("mem_create: flat mode requires a 64-bit host");
+		mem->host_base = mmap(NULL, MEM_FLAT_SIZE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mem->host_base == MAP_FAILED)
+			fatal("mem_create: cannot reserve host space for flat mode");
+		mem_flat_handler_init();
+	}
 	return mem;
 }
 
 
+/* Create a copy of a memory map, as done by a 'fork' system call. Page
+ * data is not copied, but shared copy-on-write by both maps. Pages that
+ * cannot be shared (flat mode, host mappings) are copied right away. */
+struct mem_t *mem_clone(struct mem_t *mem)
+{
+	struct mem_t *new;
+	struct mem_page_t *page, *new_page;
+	int i, j;
+
+	new = mem_create();
+	new->safe = mem->safe;
+	for (i = 0; i < MEM_PAGE_COUNT; i++) {
+		if (!mem->pages[i])
+			continue;
+		for (j = 0; j < MEM_PAGE_COUNT; j++) {
+
+			/* Create page with the same permissions */
+			page = mem->pages[i][j];
+			if (!page)
+				continue;
+			new_page = mem_page_create(new, page->tag, page->perm);
+			if (!page->data)
+				continue;
+
+			/* Private copy */
+			if (new->host_base || page->host_mapping) {
+				if (!new_page->data)
+					new_page->data = malloc(MEM_PAGESIZE);
+				if (mem_page_is_flat(mem, page))
+					mem_flat_open(mem, page);
+				if (mem_page_is_flat(new, new_page))
+					mem_flat_open(new, new_page);
+				memcpy(new_page->data, page->data, MEM_PAGESIZE);
+				if (mem_page_is_flat(mem, page))
+					mem_flat_protect(mem, page);
+				if (mem_page_is_flat(new, new_page))
+					mem_flat_protect(new, new_page);
+				continue;
+			}
+
+			/* Shared copy-on-write */
+			if (!page->cow) {
+				page->cow = malloc(sizeof(int));
+				*page->cow = 1;
+			}
+			__atomic_add_fetch(page->cow, 1, __ATOMIC_ACQ_REL);
+			new_page->cow = page->cow;
+			new_page->data = page->data;
+		}
+	}
+	return new;
+}
+
+
 void mem_free(struct mem_t *mem)
 {
-	int i;
+	int i, j;
 	
-	/* Free pages */
-	for (i = 0; i < MEM_PAGE_COUNT; i++)
-		while (mem->pages[i])
-			mem_page_free(mem, mem->pages[i]->tag);
+	/* Free pages and page tables */
+	for (i = 0; i < MEM_PAGE_COUNT; i++) {
+		if (!mem->pages[i])
+			continue;
+		for (j = 0; j < MEM_PAGE_COUNT; j++)
+			if (mem->pages[i][j])
+				mem_page_free(mem, mem->pages[i][j]->tag);
+		free(mem->pages[i]);
+	}
 
 	/* This must have released all host mappings.
 	 * Now, free memory structure. */
 	assert(!mem->host_mapping_list);
+	if (mem->host_base)
+		munmap(mem->host_base, MEM_FLAT_SIZE);
+	if (mem->icache)
+		free(mem->icache);
+	for (i = 0; i < MEM_BLOCK_COUNT; i++)
+		if (mem->blocks[i])
+			free(mem->blocks[i]);
 	free(mem);
 }
 
@@ -505,8 +786,15 @@ void mem_map_host(struct mem_t *mem, struct fd_t *fd, uint32_t addr, int size,
 		if (page->host_mapping)
 			fatal("mem_map_host: cannot overwrite a previous host mapping");
 
-		/* If page is pointing to some data, overwrite it */
-		if (page->data)
+		/* If page is pointing to some data, overwrite it. A flat page
+		 * is decommitted, so that direct accesses to it fault. */
+		if (page->decoded)
+			mem_icache_flush(mem, page);
+		if (page->cow)
+			mem_page_unshare(page, 0);
+		if (mem_page_is_flat(mem, page))
+			mem_flat_decommit(mem, ptr);
+		else if (page->data)
 			free(page->data);
 
 		/* Create host mapping */
@@ -571,6 +859,10 @@ void mem_protect(struct mem_t *mem, uint32_t addr, int size, enum mem_access_enu
 
 		/* Set page new protection flags */
 		page->perm = perm;
+		if (page->decoded)
+			mem_icache_flush(mem, page);
+		else if (mem_page_is_flat(mem, page))
+			mem_flat_protect(mem, page);
 
 		/* If the page corresponds to a host mapping, host page must
 		 * update its permissions, too */
@@ -586,6 +878,145 @@ void mem_protect(struct mem_t *mem, uint32_t addr, int size, enum mem_access_enu
 }
 
 
+/* Mark a page as holding decoded instructions. A flat page stops being
+ * writable directly, so that writes discard them. */
+static void mem_page_set_decoded(struct mem_t *mem, struct mem_page_t *page)
+{
+	if (page->decoded)
+		return;
+	page->decoded = 1;
+	if (mem_page_is_flat(mem, page))
+		mem_flat_protect(mem, page);
+}
+
+
+/* Return the decoded instruction cached for 'eip', or NULL if there is none. */
+x86_inst_t *mem_icache_lookup(struct mem_t *mem, uint32_t eip)
+{
+	struct mem_icache_entry_t *entry;
+
+	if (!mem->icache)
+		return NULL;
+	entry = &mem->icache[eip % MEM_ICACHE_SIZE];
+	if (!entry->valid || entry->eip != eip)
+		return NULL;
+	return &entry->inst;
+}
+
+
+/* Record a decoded instruction. It is only cached if all pages it was read from
+ * exist and are executable, so that a hit never bypasses a permission check.
+ * Those pages are marked, so that writes, protection changes and unmappings
+ * discard the instruction. */
+void mem_icache_insert(struct mem_t *mem, x86_inst_t *inst)
+{
+	struct mem_icache_entry_t *entry;
+	struct mem_page_t *first, *last;
+
+	/* Check pages */
+	first = mem_page_get(mem, inst->eip);
+	last = mem_page_get(mem, inst->eip + inst->size - 1);
+	if (!first || !(first->perm & mem_access_exec))
+		return;
+	if (!last || !(last->perm & mem_access_exec))
+		return;
+
+	/* Allocate cache on first use */
+	if (!mem->icache)
+		mem->icache = calloc(MEM_ICACHE_SIZE, sizeof(struct mem_icache_entry_t));
+
+	/* Insert */
+	entry = &mem->icache[inst->eip % MEM_ICACHE_SIZE];
+	entry->eip = inst->eip;
+	entry->inst = *inst;
+	entry->valid = 1;
+	mem_page_set_decoded(mem, first);
+	mem_page_set_decoded(mem, last);
+}
+
+
+/* Return the valid basic block starting at 'eip', or NULL if there is none. */
+struct mem_block_t *mem_block_lookup(struct mem_t *mem, uint32_t eip)
+{
+	struct mem_block_t *block;
+
+	block = mem->blocks[eip % MEM_BLOCK_COUNT];
+	if (!block || !block->valid || block->eip != eip)
+		return NULL;
+	return block;
+}
+
+
+/* Store a copy of a decoded basic block and return it. As for single
+ * instructions, the block is only cached if its page is executable.
+ * Otherwise, NULL is returned. */
+struct mem_block_t *mem_block_insert(struct mem_t *mem, struct mem_block_t *block)
+{
+	struct mem_block_t **pblock;
+	struct mem_page_t *page;
+
+	/* Check page */
+	page = mem_page_get(mem, block->eip);
+	if (!page || !(page->perm & mem_access_exec))
+		return NULL;
+
+	/* Reuse the entry of a previous block, if any */
+	pblock = &mem->blocks[block->eip % MEM_BLOCK_COUNT];
+	if (!*pblock)
+		*pblock = malloc(sizeof(struct mem_block_t));
+	memcpy(*pblock, block, sizeof(struct mem_block_t));
+	(*pblock)->valid = 1;
+	mem_page_set_decoded(mem, page);
+	return *pblock;
+}
+
+
+/* Return non-zero if memory maps 'a' and 'b' have the same pages with the
+ * same permissions and contents. Pages without data read as zeros. */
+int mem_equal(struct mem_t *a, struct mem_t *b)
+{
+	static unsigned char zero[MEM_PAGESIZE];
+	struct mem_page_t *pa, *pb;
+	unsigned char *da, *db;
+	int i, j, equal;
+
+	for (i = 0; i < MEM_PAGE_COUNT; i++) {
+		if (!a->pages[i] || !b->pages[i]) {
+			if (a->pages[i] != b->pages[i])
+				return 0;
+			continue;
+		}
+		for (j = 0; j < MEM_PAGE_COUNT; j++) {
+			pa = a->pages[i][j];
+			pb = b->pages[i][j];
+			if (!pa || !pb) {
+				if (pa != pb)
+					return 0;
+				continue;
+			}
+			if ((pa->perm & ~mem_access_modif) != (pb->perm & ~mem_access_modif))
+				return 0;
+			da = pa->data ? pa->data : zero;
+			db = pb->data ? pb->data : zero;
+			if (da == db)
+				continue;
+			if (mem_page_is_flat(a, pa))
+				mem_flat_open(a, pa);
+			if (mem_page_is_flat(b, pb))
+				mem_flat_open(b, pb);
+			equal = !memcmp(da, db, MEM_PAGESIZE);
+			if (mem_page_is_flat(a, pa))
+				mem_flat_protect(a, pa);
+			if (mem_page_is_flat(b, pb))
+				mem_flat_protect(b, pb);
+			if (!equal)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+
 void mem_write_string(struct mem_t *mem, uint32_t addr, char *str)
 {
 	mem_access(mem, addr, strlen(str) + 1, str, mem_access_write);
@@ -609,9 +1040,22 @@ int mem_read_string(struct mem_t *mem, uint32_t addr, int size, char *str)
 
 void mem_zero(struct mem_t *mem, uint32_t addr, int size)
 {
-	unsigned char zero = 0;
-	while (size--)
-		mem_access(mem, addr++, 0, &zero, mem_access_write);
+	unsigned char zero[MEM_PAGESIZE];
+	int chunksize;
+
+	/* In flat mode, try a single clear on the host region, which faults
+	 * unless all pages can be written directly */
+	if (mem->host_base && size > 0 && addr + (uint32_t) (size - 1) >= addr &&
+		mem_flat_move(mem->host_base + addr, NULL, size))
+		return;
+
+	memset(zero, 0, sizeof(zero));
+	while (size > 0) {
+		chunksize = MIN(size, MEM_PAGESIZE);
+		mem_access(mem, addr, chunksize, zero, mem_access_write);
+		addr += chunksize;
+		size -= chunksize;
+	}
 }
 
 
@@ -665,3 +1109,110 @@ void mem_load(struct mem_t *mem, char *filename, uint32_t start)
 	fclose(f);
 }
 
+
+
+/* Checkpoints. Page data follows the page list, aligned to a page in the
+ * file, so that 'mem_restore' can map it. */
+void mem_save(struct mem_t *mem, FILE *f)
+{
+	struct mem_page_t *page;
+	int i, j, count = 0, has_data;
+	long offset;
+
+	for (i = 0; i < MEM_PAGE_COUNT; i++)
+		for (j = 0; mem->pages[i] && j < MEM_PAGE_COUNT; j++)
+			count += mem->pages[i][j] != NULL;
+	ckpt_write(f, &count, sizeof(count));
+	ckpt_write(f, &mem->safe, sizeof(mem->safe));
+	for (i = 0; i < MEM_PAGE_COUNT; i++) {
+		for (j = 0; mem->pages[i] && j < MEM_PAGE_COUNT; j++) {
+			page = mem->pages[i][j];
+			if (!page)
+				continue;
+			has_data = page->data != NULL;
+			ckpt_write(f, &page->tag, sizeof(page->tag));
+			ckpt_write(f, &page->perm, sizeof(page->perm));
+			ckpt_write(f, &has_data, sizeof(has_data));
+		}
+	}
+
+	/* Data. Pages of host mappings are saved as private pages. */
+	offset = (ftell(f) + MEM_PAGESIZE - 1) & MEM_PAGEMASK;
+	fseek(f, offset, SEEK_SET);
+	for (i = 0; i < MEM_PAGE_COUNT; i++) {
+		for (j = 0; mem->pages[i] && j < MEM_PAGE_COUNT; j++) {
+			page = mem->pages[i][j];
+			if (!page || !page->data)
+				continue;
+			if (mem_page_is_flat(mem, page))
+				mem_flat_open(mem, page);
+			ckpt_write(f, page->data, MEM_PAGESIZE);
+			if (mem_page_is_flat(mem, page))
+				mem_flat_protect(mem, page);
+		}
+	}
+}
+
+
+/* Create a memory map from a checkpoint. Page data is mapped read-only from
+ * the file and shared copy-on-write, so that the host only reads the pages
+ * the guest touches, and only copies those it writes. The copy-on-write
+ * counter keeps one extra reference for the mapping itself, which is never
+ * released. In flat mode, or if host pages are not as large as guest pages,
+ * data is read right away. */
+struct mem_t *mem_restore(FILE *f)
+{
+	struct mem_t *mem;
+	struct mem_page_t *page, **pages;
+	unsigned char *base = MAP_FAILED;
+	int i, count, has_data, data_count = 0;
+	int *cow;
+	long offset;
+
+	mem = mem_create();
+	ckpt_read(f, &count, sizeof(count));
+	ckpt_read(f, &mem->safe, sizeof(mem->safe));
+	pages = calloc(count + 1, sizeof(struct mem_page_t *));
+	if (!pages)
+		fatal("mem_restore: out of memory");
+	for (i = 0; i < count; i++) {
+		uint32_t tag;
+		enum mem_access_enum perm;
+
+		ckpt_read(f, &tag, sizeof(tag));
+		ckpt_read(f, &perm, sizeof(perm));
+		ckpt_read(f, &has_data, sizeof(has_data));
+		page = mem_page_create(mem, tag, perm);
+		if (has_data)
+			pages[data_count++] = page;
+	}
+
+	offset = (ftell(f) + MEM_PAGESIZE - 1) & MEM_PAGEMASK;
+	if (data_count && !mem->host_base && sysconf(_SC_PAGESIZE) == MEM_PAGESIZE)
+		base = mmap(NULL, (size_t) data_count * MEM_PAGESIZE, PROT_READ,
+			MAP_PRIVATE, fileno(f), offset);
+	if (base != MAP_FAILED) {
+		cow = malloc(sizeof(int));
+		if (!cow)
+			fatal("mem_restore: out of memory");
+		*cow = data_count + 1;
+		for (i = 0; i < data_count; i++) {
+			pages[i]->data = base + (size_t) i * MEM_PAGESIZE;
+			pages[i]->cow = cow;
+		}
+	} else {
+		fseek(f, offset, SEEK_SET);
+		for (i = 0; i < data_count; i++) {
+			if (!pages[i]->data)
+				pages[i]->data = malloc(MEM_PAGESIZE);
+			if (mem_page_is_flat(mem, pages[i]))
+				mem_flat_open(mem, pages[i]);
+			ckpt_read(f, pages[i]->data, MEM_PAGESIZE);
+			if (mem_page_is_flat(mem, pages[i]))
+				mem_flat_protect(mem, pages[i]);
+		}
+	}
+	fseek(f, offset + (long) data_count * MEM_PAGESIZE, SEEK_SET);
+	free(pages);
+	return mem;
+}
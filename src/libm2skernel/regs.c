@@ -39,6 +39,102 @@ void regs_copy(struct regs_t *dst, struct regs_t *src)
 }
 
 
+/* Return the bits of 'eflags' selected by 'mask', evaluating pending lazy
+ * arithmetic flags if needed. Only the requested flags are computed. */
+uint32_t regs_flags_get(struct regs_t *regs, uint32_t mask)
+{
+	uint32_t res, src1, src2, sign, flags;
+	int op;
+
+	op = regs->flags_op;
+	if (op == regs_flags_none || !(mask & REGS_FLAGS_ARITH))
+		return regs->eflags & mask;
+
+	res = regs->flags_res;
+	src1 = regs->flags_src1;
+	src2 = regs->flags_src2;
+	sign = 1U << (regs->flags_size * 8 - 1);
+	flags = regs->eflags & ~REGS_FLAGS_ARITH;
+
+	/* ZF, SF, PF depend only on the result */
+	if ((mask & (1 << flag_zf)) && !res)
+		flags |= 1 << flag_zf;
+	if ((mask & (1 << flag_sf)) && (res & sign))
+		flags |= 1 << flag_sf;
+	if (mask & (1 << flag_pf)) {
+		uint32_t parity = res & 0xff;
+		parity ^= parity >> 4;
+		parity ^= parity >> 2;
+		parity ^= parity >> 1;
+		if (!(parity & 1))
+			flags |= 1 << flag_pf;
+	}
+
+	/* CF, OF, AF depend on the operation */
+	switch (op) {
+
+	case regs_flags_add:
+	case regs_flags_adc:
+		if (res < src1 || (op == regs_flags_adc && regs->flags_aux && res == src1))
+			flags |= 1 << flag_cf;
+		if ((src1 ^ res) & (src2 ^ res) & sign)
+			flags |= 1 << flag_of;
+		if ((src1 ^ src2 ^ res) & 0x10)
+			flags |= 1 << flag_af;
+		break;
+
+	case regs_flags_sub:
+	case regs_flags_sbb:
+		if (src1 < src2 || (op == regs_flags_sbb && regs->flags_aux && src1 == src2))
+			flags |= 1 << flag_cf;
+		if ((src1 ^ src2) & (src1 ^ res) & sign)
+			flags |= 1 << flag_of;
+		if ((src1 ^ src2 ^ res) & 0x10)
+			flags |= 1 << flag_af;
+		break;
+
+	case regs_flags_logic:
+		break;
+
+	case regs_flags_inc:
+		if (regs->flags_aux)
+			flags |= 1 << flag_cf;
+		if (res == sign)
+			flags |= 1 << flag_of;
+		if (!(res & 0xf))
+			flags |= 1 << flag_af;
+		break;
+
+	case regs_flags_dec:
+		if (regs->flags_aux)
+			flags |= 1 << flag_cf;
+		if (src1 == sign)
+			flags |= 1 << flag_of;
+		if ((res & 0xf) == 0xf)
+			flags |= 1 << flag_af;
+		break;
+
+	case regs_flags_res:
+		flags |= regs->flags_aux & ((1 << flag_cf) | (1 << flag_of) | (1 << flag_af));
+		break;
+
+	default:
+		panic("regs_flags_get: invalid lazy flags operation");
+	}
+	return flags & mask;
+}
+
+
+/* Evaluate pending lazy flags into 'eflags' */
+void regs_flags_eval(struct regs_t *regs)
+{
+	if (regs->flags_op == regs_flags_none)
+		return;
+	regs->eflags = regs_flags_get(regs, 0xffffffff);
+	regs->flags_op = regs_flags_none;
+}
+
+
 void regs_fpu_stack_dump(struct regs_t *regs, FILE *f)
 {
 	int index, i;
@@ -61,6 +157,9 @@ void regs_fpu_stack_dump(struct regs_t *regs, FILE *f)
 
 void regs_dump(struct regs_t *regs, FILE *f)
 {
+	/* Evaluate pending lazy flags */
+	regs_flags_eval(regs);
+
 	/* Integer registers */
 	fprintf(f, "  eax=%08x  ecx=%08x  edx=%08x  ebx=%08x\n",
 		regs->eax, regs->ecx, regs->edx, regs->ebx);
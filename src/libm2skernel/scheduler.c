@@ -0,0 +1,874 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Scheduler parameters. Zero values stand for defaults derived from
+ * 'instr_slice', computed when used, since the configuration can set
+ * 'instr_slice' after the kernel initialized the scheduler. */
+struct string_map_t sched_policy_map = {
+	4, {
+		{ "rr",       sched_policy_rr },
+		{ "cfs",      sched_policy_cfs },
+		{ "mlfq",     sched_policy_mlfq },
+		{ "lottery",  sched_policy_lottery }
+	}
+};
+
+enum sched_policy_enum sched_policy = sched_policy_rr;
+long long sched_cfs_latency = 0;  /* Period in which every context runs once */
+long long sched_cfs_granularity = 0;  /* Minimum slice */
+int sched_mlfq_levels = 3;  /* Level 'l' has a quantum of 'instr_slice << l' */
+long long sched_mlfq_boost = 0;  /* Period to move all contexts to level 0 */
+int sched_lottery_tickets = 100;  /* Tickets of each context */
+unsigned int sched_lottery_seed = 1;
+
+static int sched_initialized = 0;
+
+
+static long long sched_cfs_latency_value(void)
+{
+	return sched_cfs_latency ? sched_cfs_latency : (long long) instr_slice * 4;
+}
+
+
+static long long sched_cfs_granularity_value(void)
+{
+	return sched_cfs_granularity ? sched_cfs_granularity : MAX(instr_slice / 4, 1);
+}
+
+
+static long long sched_mlfq_boost_value(void)
+{
+	return sched_mlfq_boost ? sched_mlfq_boost : (long long) instr_slice * 100;
+}
+
+
+/* Policy hooks */
+struct sched_policy_t {
+	void (*init)(void);
+	void (*done)(void);
+	struct ctx_t *(*pick_next)(int *slice);
+	void (*on_block)(struct ctx_t *ctx);
+	void (*on_wake)(struct ctx_t *ctx);
+	void (*on_tick)(struct ctx_t *ctx, int count);
+};
+
+
+/* Per-uid statistics of finished contexts */
+struct sched_stats_t {
+	int uid;
+	int procs;
+	long long insts;
+	long long wait;
+	long long turnaround;
+	long long slices;
+};
+
+static struct sched_stats_t *sched_stats;
+static int sched_stats_count, sched_stats_size;
+
+
+
+
+/*
+ * Round robin
+ *
+ * The kernel running list is the run queue. Status updates already insert
+ * woken up contexts at its tail.
+ */
+
+static struct ctx_t *rr_pick_next(int *slice)
+{
+	struct ctx_t *ctx = ke->running_list_head;
+	while (ctx && ctx->sched.picked)
+		ctx = ctx->running_next;
+	if (ctx)
+		*slice = ctx->instr_slice;
+	return ctx;
+}
+
+
+static void rr_on_tick(struct ctx_t *ctx, int count)
+{
+	if (!ke_list_member(ke_list_running, ctx))
+		return;
+	ke_list_remove(ke_list_running, ctx);
+	ke_list_insert_tail(ke_list_running, ctx);
+}
+
+
+
+
+/*
+ * Completely fair scheduler
+ *
+ * Runnable contexts are kept in a red-black tree ordered by the number of
+ * instructions they have run, and the leftmost one is picked. The tree
+ * follows CLRS, with a sentinel node instead of NULL leaves.
+ */
+
+static struct sched_entity_t cfs_nil = { NULL, 0, &cfs_nil, &cfs_nil, &cfs_nil, 0 };
+static struct sched_entity_t *cfs_root = &cfs_nil;
+static int cfs_count;
+static long long cfs_min_vruntime;
+
+
+static int cfs_less(struct sched_entity_t *a, struct sched_entity_t *b)
+{
+	if (a->vruntime != b->vruntime)
+		return a->vruntime < b->vruntime;
+	return a->ctx->pid < b->ctx->pid;
+}
+
+
+static void cfs_rotate_left(struct sched_entity_t *x)
+{
+	struct sched_entity_t *y = x->right;
+
+	x->right = y->left;
+	if (y->left != &cfs_nil)
+		y->left->parent = x;
+	y->parent = x->parent;
+	if (x->parent == &cfs_nil)
+		cfs_root = y;
+	else if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+}
+
+
+static void cfs_rotate_right(struct sched_entity_t *x)
+{
+	struct sched_entity_t *y = x->left;
+
+	x->left = y->right;
+	if (y->right != &cfs_nil)
+		y->right->parent = x;
+	y->parent = x->parent;
+	if (x->parent == &cfs_nil)
+		cfs_root = y;
+	else if (x == x->parent->right)
+		x->parent->right = y;
+	else
+		x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+}
+
+
+static struct sched_entity_t *cfs_minimum(struct sched_entity_t *x)
+{
+	while (x->left != &cfs_nil)
+		x = x->left;
+	return x;
+}
+
+
+/* In-order successor, or the sentinel */
+static struct sched_entity_t *cfs_successor(struct sched_entity_t *x)
+{
+	struct sched_entity_t *y;
+
+	if (x->right != &cfs_nil)
+		return cfs_minimum(x->right);
+	y = x->parent;
+	while (y != &cfs_nil && x == y->right) {
+		x = y;
+		y = y->parent;
+	}
+	return y;
+}
+
+
+static void cfs_insert(struct sched_entity_t *z)
+{
+	struct sched_entity_t *x = cfs_root, *y = &cfs_nil;
+
+	while (x != &cfs_nil) {
+		y = x;
+		x = cfs_less(z, x) ? x->left : x->right;
+	}
+	z->parent = y;
+	if (y == &cfs_nil)
+		cfs_root = z;
+	else if (cfs_less(z, y))
+		y->left = z;
+	else
+		y->right = z;
+	z->left = z->right = &cfs_nil;
+	z->red = 1;
+
+	/* Restore red-black properties */
+	while (z->parent->red) {
+		if (z->parent == z->parent->parent->left) {
+			y = z->parent->parent->right;
+			if (y->red) {
+				z->parent->red = 0;
+				y->red = 0;
+				z->parent->parent->red = 1;
+				z = z->parent->parent;
+			} else {
+				if (z == z->parent->right) {
+					z = z->parent;
+					cfs_rotate_left(z);
+				}
+				z->parent->red = 0;
+				z->parent->parent->red = 1;
+				cfs_rotate_right(z->parent->parent);
+			}
+		} else {
+			y = z->parent->parent->left;
+			if (y->red) {
+				z->parent->red = 0;
+				y->red = 0;
+				z->parent->parent->red = 1;
+				z = z->parent->parent;
+			} else {
+				if (z == z->parent->left) {
+					z = z->parent;
+					cfs_rotate_right(z);
+				}
+				z->parent->red = 0;
+				z->parent->parent->red = 1;
+				cfs_rotate_left(z->parent->parent);
+			}
+		}
+	}
+	cfs_root->red = 0;
+	cfs_count++;
+}
+
+
+static void cfs_transplant(struct sched_entity_t *u, struct sched_entity_t *v)
+{
+	if (u->parent == &cfs_nil)
+		cfs_root = v;
+	else if (u == u->parent->left)
+		u->parent->left = v;
+	else
+		u->parent->right = v;
+	v->parent = u->parent;
+}
+
+
+static void cfs_remove(struct sched_entity_t *z)
+{
+	struct sched_entity_t *x, *y = z, *w;
+	int y_red = y->red;
+
+	if (z->left == &cfs_nil) {
+		x = z->right;
+		cfs_transplant(z, z->right);
+	} else if (z->right == &cfs_nil) {
+		x = z->left;
+		cfs_transplant(z, z->left);
+	} else {
+		y = cfs_minimum(z->right);
+		y_red = y->red;
+		x = y->right;
+		if (y->parent == z)
+			x->parent = y;
+		else {
+			cfs_transplant(y, y->right);
+			y->right = z->right;
+			y->right->parent = y;
+		}
+		cfs_transplant(z, y);
+		y->left = z->left;
+		y->left->parent = y;
+		y->red = z->red;
+	}
+	cfs_count--;
+	if (y_red)
+		return;
+
+	/* Restore red-black properties */
+	while (x != cfs_root && !x->red) {
+		if (x == x->parent->left) {
+			w = x->parent->right;
+			if (w->red) {
+				w->red = 0;
+				x->parent->red = 1;
+				cfs_rotate_left(x->parent);
+				w = x->parent->right;
+			}
+			if (!w->left->red && !w->right->red) {
+				w->red = 1;
+				x = x->parent;
+			} else {
+				if (!w->right->red) {
+					w->left->red = 0;
+					w->red = 1;
+					cfs_rotate_right(w);
+					w = x->parent->right;
+				}
+				w->red = x->parent->red;
+				x->parent->red = 0;
+				w->right->red = 0;
+				cfs_rotate_left(x->parent);
+				x = cfs_root;
+			}
+		} else {
+			w = x->parent->left;
+			if (w->red) {
+				w->red = 0;
+				x->parent->red = 1;
+				cfs_rotate_right(x->parent);
+				w = x->parent->left;
+			}
+			if (!w->right->red && !w->left->red) {
+				w->red = 1;
+				x = x->parent;
+			} else {
+				if (!w->left->red) {
+					w->right->red = 0;
+					w->red = 1;
+					cfs_rotate_left(w);
+					w = x->parent->left;
+				}
+				w->red = x->parent->red;
+				x->parent->red = 0;
+				w->left->red = 0;
+				cfs_rotate_right(x->parent);
+				x = cfs_root;
+			}
+		}
+	}
+	x->red = 0;
+}
+
+
+static void cfs_init(void)
+{
+	cfs_root = &cfs_nil;
+	cfs_count = 0;
+	cfs_min_vruntime = 0;
+}
+
+
+static struct ctx_t *cfs_pick_next(int *slice)
+{
+	struct sched_entity_t *ent;
+
+	if (cfs_root == &cfs_nil)
+		return NULL;
+	ent = cfs_minimum(cfs_root);
+	while (ent != &cfs_nil && ent->picked)
+		ent = cfs_successor(ent);
+	if (ent == &cfs_nil)
+		return NULL;
+	*slice = MAX(sched_cfs_latency_value() / cfs_count, sched_cfs_granularity_value());
+	return ent->ctx;
+}
+
+
+static void cfs_on_block(struct ctx_t *ctx)
+{
+	cfs_remove(&ctx->sched);
+}
+
+
+/* A woken up context does not get credit for the time it was blocked,
+ * so that it cannot monopolize the CPU. */
+static void cfs_on_wake(struct ctx_t *ctx)
+{
+	ctx->sched.vruntime = MAX(ctx->sched.vruntime, cfs_min_vruntime);
+	cfs_insert(&ctx->sched);
+}
+
+
+static void cfs_on_tick(struct ctx_t *ctx, int count)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	if (ent->queued) {
+		cfs_remove(ent);
+		ent->vruntime += count;
+		cfs_insert(ent);
+	} else
+		ent->vruntime += count;
+	if (cfs_root != &cfs_nil)
+		cfs_min_vruntime = MAX(cfs_min_vruntime, cfs_minimum(cfs_root)->vruntime);
+}
+
+
+
+
+/*
+ * Multilevel feedback queue
+ *
+ * A context starts at level 0 and moves down a level when it uses up the
+ * quantum of its level; blocking keeps the level and the quantum used so
+ * far. Every 'sched_mlfq_boost' instructions, all contexts return to
+ * level 0.
+ */
+
+static struct sched_entity_t **mlfq_head, **mlfq_tail;
+static int mlfq_epoch;
+static long long mlfq_last_boost;
+
+
+static int mlfq_quantum(int level)
+{
+	return instr_slice << level;
+}
+
+
+static void mlfq_enqueue(struct sched_entity_t *ent)
+{
+	ent->next = NULL;
+	ent->prev = mlfq_tail[ent->level];
+	if (ent->prev)
+		ent->prev->next = ent;
+	else
+		mlfq_head[ent->level] = ent;
+	mlfq_tail[ent->level] = ent;
+}
+
+
+static void mlfq_dequeue(struct sched_entity_t *ent)
+{
+	if (ent->prev)
+		ent->prev->next = ent->next;
+	else
+		mlfq_head[ent->level] = ent->next;
+	if (ent->next)
+		ent->next->prev = ent->prev;
+	else
+		mlfq_tail[ent->level] = ent->prev;
+	ent->next = ent->prev = NULL;
+}
+
+
+static void mlfq_boost(void)
+{
+	struct sched_entity_t *ent;
+	int level;
+
+	mlfq_epoch++;
+	mlfq_last_boost = instr_num;
+	for (ent = mlfq_head[0]; ent; ent = ent->next) {
+		ent->used = 0;
+		ent->boost_epoch = mlfq_epoch;
+	}
+	for (level = 1; level < sched_mlfq_levels; level++) {
+		while ((ent = mlfq_head[level])) {
+			mlfq_dequeue(ent);
+			ent->level = 0;
+			ent->used = 0;
+			ent->boost_epoch = mlfq_epoch;
+			mlfq_enqueue(ent);
+		}
+	}
+}
+
+
+static void mlfq_init(void)
+{
+	mlfq_head = calloc(sched_mlfq_levels, sizeof(struct sched_entity_t *));
+	mlfq_tail = calloc(sched_mlfq_levels, sizeof(struct sched_entity_t *));
+	mlfq_epoch = 0;
+	mlfq_last_boost = 0;
+}
+
+
+static void mlfq_done(void)
+{
+	free(mlfq_head);
+	free(mlfq_tail);
+}
+
+
+static struct ctx_t *mlfq_pick_next(int *slice)
+{
+	struct sched_entity_t *ent;
+	int level;
+
+	for (level = 0; level < sched_mlfq_levels; level++) {
+		for (ent = mlfq_head[level]; ent; ent = ent->next) {
+			if (ent->picked)
+				continue;
+			*slice = mlfq_quantum(level) - ent->used;
+			return ent->ctx;
+		}
+	}
+	return NULL;
+}
+
+
+static void mlfq_on_block(struct ctx_t *ctx)
+{
+	mlfq_dequeue(&ctx->sched);
+}
+
+
+static void mlfq_on_wake(struct ctx_t *ctx)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	/* Missed a boost while blocked */
+	if (ent->boost_epoch != mlfq_epoch) {
+		ent->level = 0;
+		ent->used = 0;
+		ent->boost_epoch = mlfq_epoch;
+	}
+	mlfq_enqueue(ent);
+}
+
+
+static void mlfq_on_tick(struct ctx_t *ctx, int count)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	ent->used += count;
+	if (ent->used >= mlfq_quantum(ent->level)) {
+		if (ent->queued)
+			mlfq_dequeue(ent);
+		ent->level = MIN(ent->level + 1, sched_mlfq_levels - 1);
+		ent->used = 0;
+		if (ent->queued)
+			mlfq_enqueue(ent);
+	}
+	if (sched_mlfq_boost_value() && instr_num - mlfq_last_boost >= sched_mlfq_boost_value())
+		mlfq_boost();
+}
+
+
+
+
+/*
+ * Lottery
+ *
+ * Every slice goes to a context chosen at random with a probability
+ * proportional to its tickets. The running list is the run queue. A private
+ * generator keeps runs reproducible for a given seed.
+ */
+
+static unsigned int lottery_state;
+static int lottery_total;
+
+
+static unsigned int lottery_random(void)
+{
+	/* xorshift32 */
+	lottery_state ^= lottery_state << 13;
+	lottery_state ^= lottery_state >> 17;
+	lottery_state ^= lottery_state << 5;
+	return lottery_state;
+}
+
+
+static void lottery_init(void)
+{
+	lottery_state = sched_lottery_seed ? sched_lottery_seed : 1;
+	lottery_total = 0;
+}
+
+
+static struct ctx_t *lottery_pick_next(int *slice)
+{
+	struct ctx_t *ctx;
+	int winner, total = lottery_total;
+
+	for (ctx = ke->running_list_head; ctx; ctx = ctx->running_next)
+		if (ctx->sched.picked)
+			total -= ctx->sched.tickets;
+	if (!total)
+		return NULL;
+	winner = lottery_random() % total;
+	for (ctx = ke->running_list_head; ctx; ctx = ctx->running_next) {
+		if (ctx->sched.picked)
+			continue;
+		winner -= ctx->sched.tickets;
+		if (winner < 0)
+			break;
+	}
+	assert(ctx);
+	*slice = ctx->instr_slice;
+	return ctx;
+}
+
+
+static void lottery_on_block(struct ctx_t *ctx)
+{
+	lottery_total -= ctx->sched.tickets;
+}
+
+
+static void lottery_on_wake(struct ctx_t *ctx)
+{
+	if (!ctx->sched.tickets)
+		ctx->sched.tickets = MAX(sched_lottery_tickets, 1);
+	lottery_total += ctx->sched.tickets;
+}
+
+
+
+
+/*
+ * Public functions
+ */
+
+static struct sched_policy_t sched_policy_table[] = {
+	{ NULL, NULL, NULL, NULL, NULL, NULL },
+	{ NULL, NULL, rr_pick_next, NULL, NULL, rr_on_tick },
+	{ cfs_init, NULL, cfs_pick_next, cfs_on_block, cfs_on_wake, cfs_on_tick },
+	{ mlfq_init, mlfq_done, mlfq_pick_next, mlfq_on_block, mlfq_on_wake, mlfq_on_tick },
+	{ lottery_init, NULL, lottery_pick_next, lottery_on_block, lottery_on_wake, NULL }
+};
+
+static struct sched_policy_t *sched_ops = &sched_policy_table[sched_policy_rr];
+
+
+/* Set up the policy in 'sched_policy'. Called by 'ke_init', and again by
+ * the simulator once its configuration is read. Must be called before any
+ * context is created. */
+void sched_init(void)
+{
+	if (sched_policy <= sched_policy_invalid || sched_policy > sched_policy_lottery)
+		fatal("sched_init: invalid scheduling policy");
+	if (sched_mlfq_levels < 1)
+		fatal("sched_init: MLFQ needs at least one level");
+	if (ke->context_list_head)
+		fatal("sched_init: contexts already created");
+
+	if (sched_initialized && sched_ops->done)
+		sched_ops->done();
+	sched_ops = &sched_policy_table[sched_policy];
+	if (sched_ops->init)
+		sched_ops->init();
+	sched_initialized = 1;
+}
+
+
+void sched_done(void)
+{
+	if (sched_initialized) {
+		sched_dump(stdout);
+		if (sched_ops->done)
+			sched_ops->done();
+	}
+	free(sched_stats);
+	sched_stats = NULL;
+	sched_stats_count = sched_stats_size = 0;
+}
+
+
+/* Context to run next and its slice, or NULL. Contexts with the 'picked'
+ * flag set, already running on another core, are not considered. */
+struct ctx_t *sched_pick_next(int *slice)
+{
+	struct ctx_t *ctx;
+	struct sched_entity_t *ent;
+
+	ctx = sched_ops->pick_next(slice);
+	if (!ctx)
+		return NULL;
+	ent = &ctx->sched;
+	assert(ent->queued);
+	ent->wait += instr_num - ent->ready;
+	ent->slices++;
+	*slice = MAX(*slice, 1);
+	return ctx;
+}
+
+
+/* Context left the 'ctx_running' state */
+void sched_block(struct ctx_t *ctx)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	assert(ent->queued);
+	if (sched_ops->on_block)
+		sched_ops->on_block(ctx);
+	ent->queued = 0;
+}
+
+
+/* Context entered the 'ctx_running' state */
+void sched_wake(struct ctx_t *ctx)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	assert(!ent->queued);
+	if (!ent->ctx) {
+		ent->ctx = ctx;
+		ent->start = instr_num;
+	}
+	ent->ready = instr_num;
+	if (sched_ops->on_wake)
+		sched_ops->on_wake(ctx);
+	ent->queued = 1;
+}
+
+
+/* Context picked by 'sched_pick_next' executed 'count' instructions. It
+ * might have blocked or finished in the meantime. */
+void sched_tick(struct ctx_t *ctx, int count)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+
+	ent->insts += count;
+	ent->ready = instr_num;
+	if (sched_ops->on_tick)
+		sched_ops->on_tick(ctx, count);
+}
+
+
+/* Record statistics of a context being freed */
+void sched_exit(struct ctx_t *ctx)
+{
+	struct sched_entity_t *ent = &ctx->sched;
+	struct sched_stats_t *stats;
+	int i;
+
+	for (i = 0; i < sched_stats_count; i++)
+		if (sched_stats[i].uid == ctx->uid)
+			break;
+	if (i == sched_stats_count) {
+		if (sched_stats_count == sched_stats_size) {
+			sched_stats_size = sched_stats_size ? sched_stats_size * 2 : 8;
+			sched_stats = realloc(sched_stats, sched_stats_size * sizeof(struct sched_stats_t));
+			if (!sched_stats)
+				fatal("sched_exit: out of memory");
+		}
+		memset(&sched_stats[i], 0, sizeof(struct sched_stats_t));
+		sched_stats[i].uid = ctx->uid;
+		sched_stats_count++;
+	}
+
+	stats = &sched_stats[i];
+	stats->procs++;
+	stats->insts += ent->insts;
+	stats->wait += ent->wait;
+	stats->turnaround += instr_num - ent->start;
+	stats->slices += ent->slices;
+}
+
+
+/* Checkpoints. Scheduler fields of each context are saved with the
+ * context; this saves the state of the policy and the order of its run
+ * queue, which 'sched_restore' rebuilds once all contexts exist. */
+void sched_save(FILE *f)
+{
+	struct sched_entity_t *ent;
+	struct ctx_t *ctx;
+	int level;
+
+	ckpt_write(f, &sched_policy, sizeof(sched_policy));
+	ckpt_write(f, &cfs_min_vruntime, sizeof(cfs_min_vruntime));
+	ckpt_write(f, &mlfq_epoch, sizeof(mlfq_epoch));
+	ckpt_write(f, &mlfq_last_boost, sizeof(mlfq_last_boost));
+	ckpt_write(f, &lottery_state, sizeof(lottery_state));
+	ckpt_write(f, &sched_stats_count, sizeof(sched_stats_count));
+	ckpt_write(f, sched_stats, sched_stats_count * sizeof(struct sched_stats_t));
+
+	/* Queued contexts, in the order they must be queued again */
+	ckpt_write(f, &ke->running_count, sizeof(ke->running_count));
+	if (sched_policy == sched_policy_mlfq) {
+		for (level = 0; level < sched_mlfq_levels; level++)
+			for (ent = mlfq_head[level]; ent; ent = ent->next)
+				ckpt_write(f, &ent->ctx->pid, sizeof(ent->ctx->pid));
+	} else {
+		for (ctx = ke->running_list_head; ctx; ctx = ctx->running_next)
+			ckpt_write(f, &ctx->pid, sizeof(ctx->pid));
+	}
+}
+
+
+void sched_restore(FILE *f)
+{
+	enum sched_policy_enum policy;
+	struct ctx_t *ctx;
+	int i, count, pid;
+
+	ckpt_read(f, &policy, sizeof(policy));
+	if (policy != sched_policy)
+		fatal("sched_restore: checkpoint saved with policy '%s'",
+			map_value(&sched_policy_map, policy));
+	ckpt_read(f, &cfs_min_vruntime, sizeof(cfs_min_vruntime));
+	ckpt_read(f, &mlfq_epoch, sizeof(mlfq_epoch));
+	ckpt_read(f, &mlfq_last_boost, sizeof(mlfq_last_boost));
+	ckpt_read(f, &lottery_state, sizeof(lottery_state));
+	ckpt_read(f, &sched_stats_count, sizeof(sched_stats_count));
+	sched_stats_size = sched_stats_count + 1;
+	free(sched_stats);
+	sched_stats = calloc(sched_stats_count + 1, sizeof(struct sched_stats_t));
+	if (!sched_stats)
+		fatal("sched_restore: out of memory");
+	ckpt_read(f, sched_stats, sched_stats_count * sizeof(struct sched_stats_t));
+
+	ckpt_read(f, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		ckpt_read(f, &pid, sizeof(pid));
+		ctx = ctx_get(pid);
+		if (!ctx || ctx->sched.queued)
+			fatal("sched_restore: invalid run queue in checkpoint");
+		ctx->sched.ctx = ctx;
+		if (sched_ops->on_wake)
+			sched_ops->on_wake(ctx);
+		ctx->sched.queued = 1;
+	}
+}
+
+
+/* Dump statistics per uid. Fairness is Jain's index over the CPU rate of
+ * each uid, that is, instructions executed per instruction elapsed between
+ * start and exit of its contexts: 1 when all uids progressed at the same
+ * rate, down to 1/n when a single uid got the CPU. */
+void sched_dump(FILE *f)
+{
+	struct sched_stats_t *stats;
+	double rate, sum = 0.0, sum_sq = 0.0, insts = 0.0;
+	int i;
+
+	for (i = 0; i < sched_stats_count; i++) {
+		stats = &sched_stats[i];
+		rate = stats->turnaround ? (double) stats->insts / stats->turnaround : 0.0;
+		sum += rate;
+		sum_sq += rate * rate;
+		insts += stats->insts;
+	}
+
+	fprintf(f, "\nScheduler summary:\n");
+	fprintf(f, "sched.policy  %s  # Scheduling policy\n",
+		map_value(&sched_policy_map, sched_policy));
+	fprintf(f, "sched.fairness  %.4f  # Jain's fairness index of CPU rate over uids\n",
+		sum_sq ? sum * sum / (sched_stats_count * sum_sq) : 1.0);
+	for (i = 0; i < sched_stats_count; i++) {
+		stats = &sched_stats[i];
+		fprintf(f, "sched.uid%d.procs  %d  # Finished processes\n",
+			stats->uid, stats->procs);
+		fprintf(f, "sched.uid%d.inst  %lld  # Executed instructions\n",
+			stats->uid, stats->insts);
+		fprintf(f, "sched.uid%d.share  %.4f  # Fraction of all executed instructions\n",
+			stats->uid, insts ? stats->insts / insts : 0.0);
+		fprintf(f, "sched.uid%d.slices  %lld  # Times scheduled\n",
+			stats->uid, stats->slices);
+		fprintf(f, "sched.uid%d.wait  %.1f  # Average instructions waiting to run\n",
+			stats->uid, (double) stats->wait / stats->procs);
+		fprintf(f, "sched.uid%d.turnaround  %.1f  # Average instructions from start to exit\n",
+			stats->uid, (double) stats->turnaround / stats->procs);
+	}
+}
@@ -243,6 +243,7 @@ void signal_handler_run(struct ctx_t *ctx, int sig)
 	mem_access(ctx->mem, ctx->signal_masks->pretcode, sizeof(signal_retcode), signal_retcode, mem_access_init);
 
 	/* Initialize stack frame */
+	regs_flags_eval(ctx->regs);
 	sigframe.pretcode = ctx->signal_masks->pretcode;
 	sigframe.sig = sig;
 	sigframe.gs = ctx->regs->gs;
@@ -0,0 +1,920 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Filesystem parameters */
+int simfs_enable = 0;
+long long simfs_commit_interval = 10000;  /* Instructions between journal commits */
+
+
+/* Disk layout:
+ *   block 0                      superblock
+ *   journal_start                journal header
+ *   journal_start + 1 ...        logged blocks
+ *   inode_start ...              inode table
+ *   data_start ...               file and directory blocks
+ * Blocks before 'data_start' belong to uid 0 in the block allocator. */
+
+#define SIMFS_MAGIC  0x53494d46
+#define SIMFS_JOURNAL_MAGIC  0x4a524e4c
+#define SIMFS_JOURNAL_BLOCKS  33
+#define SIMFS_TXN_MAX  (SIMFS_JOURNAL_BLOCKS - 1)
+#define SIMFS_TXN_OP  4  /* Most metadata blocks changed by one operation */
+#define SIMFS_EXTENTS  6
+#define SIMFS_FREE_MAX  (SIMFS_TXN_MAX * SIMFS_EXTENTS)
+#define SIMFS_NAME_MAX  27
+#define SIMFS_FILES_MAX  256
+#define SIMFS_ROOT  1
+
+enum simfs_type_enum {
+	simfs_type_free = 0,
+	simfs_type_file,
+	simfs_type_dir
+};
+
+struct simfs_super_t {
+	uint32_t magic;
+	uint32_t blocks;
+	uint32_t inodes;
+	uint32_t journal_start, journal_blocks;
+	uint32_t inode_start, inode_blocks;
+	uint32_t data_start;
+};
+
+struct simfs_extent_t {
+	uint32_t start;
+	uint32_t count;
+};
+
+struct simfs_inode_t {
+	uint32_t type;
+	uint32_t uid;
+	uint32_t size;  /* Bytes; a directory holds 'size' / sizeof(simfs_dirent_t) entries */
+	uint32_t count;  /* Extents in use */
+	struct simfs_extent_t ext[SIMFS_EXTENTS];
+};
+
+struct simfs_dirent_t {
+	uint32_t ino;  /* 0 if unused */
+	char name[SIMFS_NAME_MAX + 1];
+};
+
+struct simfs_journal_t {
+	uint32_t magic;
+	uint32_t commit;  /* Set if the logged blocks must be replayed */
+	uint32_t seq;
+	uint32_t count;
+	uint32_t home[SIMFS_TXN_MAX];  /* Home block of each logged block */
+};
+
+/* Open file */
+struct simfs_file_t {
+	struct ctx_t *ctx;  /* NULL if unused */
+	int ino;
+	int pos;
+};
+
+static int simfs_mounted;
+static struct simfs_super_t simfs_super;
+static int simfs_inodes_per_block;
+static struct simfs_file_t simfs_files[SIMFS_FILES_MAX];
+
+/* Running transaction. Metadata blocks changed since the last commit are
+ * kept here and only reach the buffer cache after they are logged. */
+static int simfs_txn_count;
+static int simfs_txn_home[SIMFS_TXN_MAX];
+static unsigned char *simfs_txn_data;
+static uint32_t simfs_seq;
+static long long simfs_last_commit;
+
+/* Extents released by the running transaction. They go back to the block
+ * allocator once it is committed. Until then, the inodes still owning them
+ * on disk could be recovered, so no other file may reuse them. */
+static int simfs_free_count;
+static int simfs_free_uid[SIMFS_FREE_MAX];
+static struct simfs_extent_t simfs_free_ext[SIMFS_FREE_MAX];
+
+/* Statistics */
+static long long simfs_creates, simfs_opens, simfs_unlinks;
+static long long simfs_reads, simfs_writes, simfs_read_bytes, simfs_write_bytes;
+static long long simfs_commits, simfs_logged, simfs_replays;
+
+
+/* Return the contents of a metadata block. If 'write' is set, the block is
+ * added to the running transaction and the returned copy can be changed. */
+static unsigned char *simfs_meta_get(int block, int write)
+{
+	unsigned char *data;
+	int i;
+
+	for (i = 0; i < simfs_txn_count; i++)
+		if (simfs_txn_home[i] == block)
+			return simfs_txn_data + i * blocksize;
+	if (!write)
+		return bcache_get(block, 0);
+	assert(simfs_txn_count < SIMFS_TXN_MAX);
+	data = simfs_txn_data + simfs_txn_count * blocksize;
+	memcpy(data, bcache_get(block, 0), blocksize);
+	simfs_txn_home[simfs_txn_count++] = block;
+	return data;
+}
+
+
+/* Drop a freed block from the running transaction, so that the commit does
+ * not overwrite its new contents */
+static void simfs_txn_revoke(int block)
+{
+	int i;
+
+	for (i = 0; i < simfs_txn_count; i++) {
+		if (simfs_txn_home[i] != block)
+			continue;
+		simfs_txn_count--;
+		simfs_txn_home[i] = simfs_txn_home[simfs_txn_count];
+		memcpy(simfs_txn_data + i * blocksize,
+			simfs_txn_data + simfs_txn_count * blocksize, blocksize);
+		return;
+	}
+}
+
+
+/* Return the extents released by the committed transaction to the block
+ * allocator */
+static void simfs_free_release(void)
+{
+	int i;
+
+	for (i = 0; i < simfs_free_count; i++)
+		balloc_free(simfs_free_uid[i], simfs_free_ext[i].start, simfs_free_ext[i].count);
+	simfs_free_count = 0;
+}
+
+
+/* Write the running transaction to the journal, and then to the home
+ * blocks. If 'timed', the same writes are queued as disk requests with no
+ * context waiting for them, so that commits keep the disk busy. */
+static void simfs_commit(int timed)
+{
+	struct simfs_journal_t hdr;
+	struct disk_segment_t seg[SIMFS_TXN_MAX];
+	int i, start = simfs_super.journal_start;
+
+	if (!simfs_txn_count) {
+		simfs_free_release();
+		return;
+	}
+	for (i = 0; i < simfs_txn_count; i++)
+		memcpy(bcache_get(start + 1 + i, 1), simfs_txn_data + i * blocksize, blocksize);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SIMFS_JOURNAL_MAGIC;
+	hdr.commit = 1;
+	hdr.seq = ++simfs_seq;
+	hdr.count = simfs_txn_count;
+	for (i = 0; i < simfs_txn_count; i++)
+		hdr.home[i] = simfs_txn_home[i];
+	memcpy(bcache_get(start, 1), &hdr, sizeof(hdr));
+	bcache_flush();
+
+	/* Checkpoint. If it does not reach the image, the journal is
+	 * replayed on the next mount. The home blocks are flushed before the
+	 * header is cleared, so that the image never holds a cleared header
+	 * without them. */
+	for (i = 0; i < simfs_txn_count; i++)
+		memcpy(bcache_get(simfs_txn_home[i], 1), simfs_txn_data + i * blocksize, blocksize);
+	bcache_flush();
+	hdr.commit = 0;
+	memcpy(bcache_get(start, 1), &hdr, sizeof(hdr));
+
+	if (timed) {
+		seg[0].block = start;
+		seg[0].offset = 0;
+		seg[0].size = (simfs_txn_count + 1) * blocksize;
+		seg[0].addr = 0;
+		disk_submit(NULL, 0, 0, seg, 1);
+		for (i = 0; i < simfs_txn_count; i++) {
+			seg[i].block = simfs_txn_home[i];
+			seg[i].offset = 0;
+			seg[i].size = blocksize;
+			seg[i].addr = 0;
+		}
+		disk_submit(NULL, 0, 0, seg, simfs_txn_count);
+	}
+
+	simfs_commits++;
+	simfs_logged += simfs_txn_count;
+	simfs_txn_count = 0;
+	simfs_last_commit = instr_num;
+	simfs_free_release();
+}
+
+
+/* Called before each metadata operation. Commit the transaction if this
+ * operation could overflow it or its released extents, or if it is older
+ * than the commit interval. */
+static void simfs_begin(void)
+{
+	if (simfs_txn_count + SIMFS_TXN_OP > SIMFS_TXN_MAX ||
+		simfs_free_count + SIMFS_EXTENTS > SIMFS_FREE_MAX ||
+		(simfs_txn_count && simfs_commit_interval &&
+		instr_num - simfs_last_commit >= simfs_commit_interval))
+		simfs_commit(1);
+}
+
+
+static void simfs_inode_read(int ino, struct simfs_inode_t *inode)
+{
+	int block = simfs_super.inode_start + ino / simfs_inodes_per_block;
+	int offset = ino % simfs_inodes_per_block * sizeof(struct simfs_inode_t);
+
+	memcpy(inode, simfs_meta_get(block, 0) + offset, sizeof(struct simfs_inode_t));
+}
+
+
+static void simfs_inode_write(int ino, struct simfs_inode_t *inode)
+{
+	int block = simfs_super.inode_start + ino / simfs_inodes_per_block;
+	int offset = ino % simfs_inodes_per_block * sizeof(struct simfs_inode_t);
+
+	memcpy(simfs_meta_get(block, 1) + offset, inode, sizeof(struct simfs_inode_t));
+}
+
+
+/* Uid owning the blocks of an inode. Directory blocks are metadata. */
+static int simfs_inode_block_uid(struct simfs_inode_t *inode)
+{
+	return inode->type == simfs_type_dir ? 0 : inode->uid;
+}
+
+
+/* Disk block holding block 'index' of an inode, or -1 */
+static int simfs_inode_block(struct simfs_inode_t *inode, int index)
+{
+	int i;
+
+	for (i = 0; i < inode->count; i++) {
+		if (index < inode->ext[i].count)
+			return inode->ext[i].start + index;
+		index -= inode->ext[i].count;
+	}
+	return -1;
+}
+
+
+/* Add blocks to an inode until it has 'blocks'. The last extent is extended
+ * while the blocks following it are free; otherwise, the longest free run
+ * up to the missing length starts a new extent. */
+static int simfs_inode_grow(struct simfs_inode_t *inode, int blocks)
+{
+	struct simfs_extent_t *ext;
+	int uid = simfs_inode_block_uid(inode);
+	int i, have = 0, run, start = -1, next;
+
+	for (i = 0; i < inode->count; i++)
+		have += inode->ext[i].count;
+	while (have < blocks) {
+		ext = inode->count ? &inode->ext[inode->count - 1] : NULL;
+		next = ext ? ext->start + ext->count : numblocks;
+		if (next < numblocks && balloc_is_free(next)) {
+			balloc_claim(uid, next);
+			ext->count++;
+			have++;
+			continue;
+		}
+		if (inode->count == SIMFS_EXTENTS)
+			return SIMFS_ENOSPC;
+		for (run = blocks - have; run; run /= 2)
+			if ((start = balloc_alloc(uid, run)) >= 0)
+				break;
+		if (!run)
+			return SIMFS_ENOSPC;
+		inode->ext[inode->count].start = start;
+		inode->ext[inode->count].count = run;
+		inode->count++;
+		have += run;
+	}
+	return 0;
+}
+
+
+/* Free all blocks of an inode. They stay allocated until the running
+ * transaction, which holds the inode change, is committed. */
+static void simfs_inode_release(struct simfs_inode_t *inode)
+{
+	struct simfs_extent_t *ext;
+	int i, block;
+
+	for (i = 0; i < inode->count; i++) {
+		ext = &inode->ext[i];
+		if (inode->type == simfs_type_dir)
+			for (block = ext->start; block < ext->start + ext->count; block++)
+				simfs_txn_revoke(block);
+		assert(simfs_free_count < SIMFS_FREE_MAX);
+		simfs_free_uid[simfs_free_count] = simfs_inode_block_uid(inode);
+		simfs_free_ext[simfs_free_count] = *ext;
+		simfs_free_count++;
+	}
+	inode->count = 0;
+	inode->size = 0;
+}
+
+
+static void simfs_dirent_access(struct simfs_inode_t *dir, int index,
+	struct simfs_dirent_t *ent, int write)
+{
+	int per_block = blocksize / sizeof(struct simfs_dirent_t);
+	int block = simfs_inode_block(dir, index / per_block);
+	unsigned char *data;
+
+	assert(block >= 0);
+	data = simfs_meta_get(block, write) + index % per_block * sizeof(struct simfs_dirent_t);
+	if (write)
+		memcpy(data, ent, sizeof(struct simfs_dirent_t));
+	else
+		memcpy(ent, data, sizeof(struct simfs_dirent_t));
+}
+
+
+/* Inode of entry 'name' in directory 'dir', or 0. The entry index is
+ * returned in 'slot' if it is not NULL. */
+static int simfs_dir_find(int dir, char *name, int *slot)
+{
+	struct simfs_inode_t inode;
+	struct simfs_dirent_t ent;
+	int i, count;
+
+	simfs_inode_read(dir, &inode);
+	count = inode.size / sizeof(struct simfs_dirent_t);
+	for (i = 0; i < count; i++) {
+		simfs_dirent_access(&inode, i, &ent, 0);
+		if (ent.ino && !strcmp(ent.name, name)) {
+			if (slot)
+				*slot = i;
+			return ent.ino;
+		}
+	}
+	return 0;
+}
+
+
+static int simfs_dir_empty(int dir)
+{
+	struct simfs_inode_t inode;
+	struct simfs_dirent_t ent;
+	int i, count;
+
+	simfs_inode_read(dir, &inode);
+	count = inode.size / sizeof(struct simfs_dirent_t);
+	for (i = 0; i < count; i++) {
+		simfs_dirent_access(&inode, i, &ent, 0);
+		if (ent.ino)
+			return 0;
+	}
+	return 1;
+}
+
+
+/* Split 'path' into its parent directory, which is returned, and its last
+ * component, copied to 'name'. Return a negative error if a directory in
+ * the path does not exist. 'path' is modified. */
+static int simfs_lookup_parent(char *path, char *name)
+{
+	struct simfs_inode_t inode;
+	char *comp, *last = NULL, *save;
+	int dir = SIMFS_ROOT, ino;
+
+	for (comp = strtok_r(path, "/", &save); comp; comp = strtok_r(NULL, "/", &save)) {
+		if (strlen(comp) > SIMFS_NAME_MAX)
+			return SIMFS_EINVAL;
+		if (last) {
+			ino = simfs_dir_find(dir, last, NULL);
+			if (!ino)
+				return SIMFS_ENOENT;
+			simfs_inode_read(ino, &inode);
+			if (inode.type != simfs_type_dir)
+				return SIMFS_ENOENT;
+			dir = ino;
+		}
+		last = comp;
+	}
+	if (!last)
+		return SIMFS_EINVAL;
+	strcpy(name, last);
+	return dir;
+}
+
+
+/* Create an empty inode linked as 'name' in directory 'dir'. Entries can
+ * be added to directories of uid 0 or of the same uid. */
+static int simfs_create(int dir, char *name, int type, int uid)
+{
+	struct simfs_inode_t dinode, inode;
+	struct simfs_dirent_t ent;
+	int ino, i, count, err;
+
+	simfs_inode_read(dir, &dinode);
+	if (dinode.uid && dinode.uid != uid)
+		return SIMFS_EPERM;
+	for (ino = SIMFS_ROOT + 1; ino < simfs_super.inodes; ino++) {
+		simfs_inode_read(ino, &inode);
+		if (inode.type == simfs_type_free)
+			break;
+	}
+	if (ino == simfs_super.inodes)
+		return SIMFS_ENOSPC;
+
+	/* Reuse a free entry, or add one at the end */
+	count = dinode.size / sizeof(struct simfs_dirent_t);
+	for (i = 0; i < count; i++) {
+		simfs_dirent_access(&dinode, i, &ent, 0);
+		if (!ent.ino)
+			break;
+	}
+	if (i == count) {
+		err = simfs_inode_grow(&dinode, ((count + 1) *
+			sizeof(struct simfs_dirent_t) + blocksize - 1) / blocksize);
+		if (err)
+			return err;
+		dinode.size += sizeof(struct simfs_dirent_t);
+		simfs_inode_write(dir, &dinode);
+	}
+
+	memset(&inode, 0, sizeof(inode));
+	inode.type = type;
+	inode.uid = uid;
+	simfs_inode_write(ino, &inode);
+	memset(&ent, 0, sizeof(ent));
+	ent.ino = ino;
+	strcpy(ent.name, name);
+	simfs_dirent_access(&dinode, i, &ent, 1);
+	simfs_creates++;
+	return ino;
+}
+
+
+/* Segments moving 'size' bytes at 'pos' of a file to or from guest address
+ * 'addr', one per extent crossed. Return the number of segments. */
+static int simfs_map(struct simfs_inode_t *inode, int pos, int size, uint32_t addr,
+	struct disk_segment_t *seg)
+{
+	int i, count = 0, base = 0, bytes, len;
+
+	for (i = 0; i < inode->count && size > 0; i++) {
+		bytes = inode->ext[i].count * blocksize;
+		if (pos < base + bytes) {
+			len = MIN(size, base + bytes - pos);
+			seg[count].block = inode->ext[i].start;
+			seg[count].offset = pos - base;
+			seg[count].size = len;
+			seg[count].addr = addr;
+			count++;
+			pos += len;
+			addr += len;
+			size -= len;
+		}
+		base += bytes;
+	}
+	assert(!size);
+	return count;
+}
+
+
+static struct simfs_file_t *simfs_file_get(struct ctx_t *ctx, int fd)
+{
+	if (fd < 0 || fd >= SIMFS_FILES_MAX || simfs_files[fd].ctx != ctx)
+		return NULL;
+	return &simfs_files[fd];
+}
+
+
+static void simfs_format(void)
+{
+	struct simfs_super_t *super = &simfs_super;
+	struct simfs_inode_t root;
+	int block;
+
+	memset(super, 0, sizeof(struct simfs_super_t));
+	super->magic = SIMFS_MAGIC;
+	super->blocks = numblocks;
+	super->journal_start = 1;
+	super->journal_blocks = SIMFS_JOURNAL_BLOCKS;
+	super->inode_start = super->journal_start + super->journal_blocks;
+	super->inode_blocks = (numblocks / 8 + simfs_inodes_per_block - 1) / simfs_inodes_per_block;
+	super->inodes = super->inode_blocks * simfs_inodes_per_block;
+	super->data_start = super->inode_start + super->inode_blocks;
+	if (super->data_start >= numblocks)
+		fatal("simfs: disk of %d blocks is too small for a filesystem", numblocks);
+
+	/* The journal is empty, so metadata is written directly */
+	for (block = 0; block < super->data_start; block++)
+		memset(bcache_get(block, 1), 0, blocksize);
+	memcpy(bcache_get(0, 1), super, sizeof(struct simfs_super_t));
+	memset(&root, 0, sizeof(root));
+	root.type = simfs_type_dir;
+	memcpy(bcache_get(super->inode_start, 1) + SIMFS_ROOT * sizeof(root), &root, sizeof(root));
+	bcache_flush();
+}
+
+
+/* Replay a committed transaction left in the journal and rebuild the block
+ * allocator from the inode table */
+static void simfs_mount(void)
+{
+	struct simfs_journal_t hdr;
+	struct simfs_inode_t inode;
+	int i, ino, block, start = simfs_super.journal_start;
+
+	memcpy(&hdr, bcache_get(start, 0), sizeof(hdr));
+	if (hdr.magic == SIMFS_JOURNAL_MAGIC && hdr.commit) {
+		for (i = 0; i < hdr.count && i < SIMFS_TXN_MAX; i++) {
+			memcpy(simfs_txn_data, bcache_get(start + 1 + i, 0), blocksize);
+			memcpy(bcache_get(hdr.home[i], 1), simfs_txn_data, blocksize);
+		}
+		hdr.commit = 0;
+		memcpy(bcache_get(start, 1), &hdr, sizeof(hdr));
+		bcache_flush();
+		simfs_replays++;
+	}
+	simfs_seq = hdr.magic == SIMFS_JOURNAL_MAGIC ? hdr.seq : 0;
+
+	for (ino = SIMFS_ROOT; ino < simfs_super.inodes; ino++) {
+		simfs_inode_read(ino, &inode);
+		if (inode.type == simfs_type_free)
+			continue;
+		for (i = 0; i < inode.count; i++) {
+			for (block = inode.ext[i].start; block < inode.ext[i].start + inode.ext[i].count; block++) {
+				if (block < simfs_super.data_start || block >= numblocks || !balloc_is_free(block))
+					fatal("simfs: inode %d has invalid block %d", ino, block);
+				balloc_claim(simfs_inode_block_uid(&inode), block);
+			}
+		}
+	}
+}
+
+
+/* Mount the filesystem in the disk image, formatting it if it has none */
+void simfs_init(void)
+{
+	int block;
+
+	if (!simfs_enable)
+		return;
+	simfs_inodes_per_block = blocksize / sizeof(struct simfs_inode_t);
+	simfs_txn_data = calloc(SIMFS_TXN_MAX, blocksize);
+	if (!simfs_txn_data)
+		fatal("simfs_init: out of memory");
+
+	memcpy(&simfs_super, bcache_get(0, 0), sizeof(struct simfs_super_t));
+	if (simfs_super.magic != SIMFS_MAGIC || simfs_super.blocks != numblocks)
+		simfs_format();
+	for (block = 0; block < simfs_super.data_start; block++)
+		balloc_claim(0, block);
+	simfs_mount();
+	simfs_last_commit = instr_num;
+	simfs_mounted = 1;
+}
+
+
+void simfs_done(void)
+{
+	if (!simfs_mounted)
+		return;
+	simfs_commit(0);
+	simfs_dump(stdout);
+	free(simfs_txn_data);
+	simfs_txn_data = NULL;
+	simfs_mounted = 0;
+}
+
+
+void simfs_dump(FILE *f)
+{
+	struct simfs_inode_t inode;
+	int ino, files = 0, dirs = 0;
+
+	for (ino = SIMFS_ROOT; ino < simfs_super.inodes; ino++) {
+		simfs_inode_read(ino, &inode);
+		files += inode.type == simfs_type_file;
+		dirs += inode.type == simfs_type_dir;
+	}
+	fprintf(f, "\nFilesystem summary:\n");
+	fprintf(f, "simfs.files  %d\n", files);
+	fprintf(f, "simfs.directories  %d  # Including the root directory\n", dirs);
+	fprintf(f, "simfs.inodes  %d  # Size of the inode table\n", simfs_super.inodes);
+	fprintf(f, "simfs.creates  %lld\n", simfs_creates);
+	fprintf(f, "simfs.opens  %lld\n", simfs_opens);
+	fprintf(f, "simfs.unlinks  %lld\n", simfs_unlinks);
+	fprintf(f, "simfs.reads  %lld\n", simfs_reads);
+	fprintf(f, "simfs.read_bytes  %lld\n", simfs_read_bytes);
+	fprintf(f, "simfs.writes  %lld\n", simfs_writes);
+	fprintf(f, "simfs.write_bytes  %lld\n", simfs_write_bytes);
+	fprintf(f, "simfs.commits  %lld  # Journal transactions\n", simfs_commits);
+	fprintf(f, "simfs.logged  %lld  # Metadata blocks written through the journal\n", simfs_logged);
+	fprintf(f, "simfs.blocks_per_commit  %.2f\n",
+		simfs_commits ? (double) simfs_logged / simfs_commits : 0.0);
+	fprintf(f, "simfs.replays  %lld  # Transactions recovered at mount\n", simfs_replays);
+}
+
+
+/* Open the file at 'path', creating it with SIMFS_O_CREAT. Only the owner
+ * of a file can open it. Return a descriptor or a negative error. */
+int simfs_open(struct ctx_t *ctx, char *path, int flags)
+{
+	struct simfs_inode_t inode;
+	char name[SIMFS_NAME_MAX + 1];
+	int fd, dir, ino;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	for (fd = 0; fd < SIMFS_FILES_MAX; fd++)
+		if (!simfs_files[fd].ctx)
+			break;
+	if (fd == SIMFS_FILES_MAX)
+		return SIMFS_ENOSPC;
+
+	simfs_begin();
+	dir = simfs_lookup_parent(path, name);
+	if (dir < 0)
+		return dir;
+	ino = simfs_dir_find(dir, name, NULL);
+	if (!ino) {
+		if (!(flags & SIMFS_O_CREAT))
+			return SIMFS_ENOENT;
+		ino = simfs_create(dir, name, simfs_type_file, ctx->uid);
+		if (ino < 0)
+			return ino;
+	}
+	simfs_inode_read(ino, &inode);
+	if (inode.type != simfs_type_file)
+		return SIMFS_EINVAL;
+	if (inode.uid != ctx->uid)
+		return SIMFS_EPERM;
+	if ((flags & SIMFS_O_TRUNC) && inode.count) {
+		simfs_inode_release(&inode);
+		simfs_inode_write(ino, &inode);
+	}
+
+	simfs_files[fd].ctx = ctx;
+	simfs_files[fd].ino = ino;
+	simfs_files[fd].pos = flags & SIMFS_O_APPEND ? inode.size : 0;
+	simfs_opens++;
+	return fd;
+}
+
+
+/* Read up to 'size' bytes at the file position into guest address 'addr'.
+ * The context sleeps until the disk completes the transfer. Return the
+ * number of bytes, 0 at the end of the file. */
+int simfs_read(struct ctx_t *ctx, int fd, uint32_t addr, int size)
+{
+	struct simfs_file_t *file;
+	struct simfs_inode_t inode;
+	struct disk_segment_t seg[SIMFS_EXTENTS];
+	int count;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	file = simfs_file_get(ctx, fd);
+	if (!file)
+		return SIMFS_ENOENT;
+	if (size < 0)
+		return SIMFS_EINVAL;
+	simfs_inode_read(file->ino, &inode);
+	size = MIN(size, MAX((int) inode.size - file->pos, 0));
+	if (!size)
+		return 0;
+
+	count = simfs_map(&inode, file->pos, size, addr, seg);
+	file->pos += size;
+	simfs_reads++;
+	simfs_read_bytes += size;
+	disk_submit(ctx, 1, 0, seg, count);
+	return size;
+}
+
+
+/* Write 'size' bytes from guest address 'addr' at the file position,
+ * allocating blocks as needed. The position is clipped to the file size,
+ * so files have no holes. The context sleeps until the disk completes the
+ * transfer. */
+int simfs_write(struct ctx_t *ctx, int fd, uint32_t addr, int size)
+{
+	struct simfs_file_t *file;
+	struct simfs_inode_t inode;
+	struct disk_segment_t seg[SIMFS_EXTENTS];
+	int pos, count, err;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	file = simfs_file_get(ctx, fd);
+	if (!file)
+		return SIMFS_ENOENT;
+	if (size < 0)
+		return SIMFS_EINVAL;
+	if (!size)
+		return 0;
+
+	simfs_begin();
+	simfs_inode_read(file->ino, &inode);
+	pos = MIN(file->pos, inode.size);
+	if (size > (long long) numblocks * blocksize - pos)
+		return SIMFS_ENOSPC;
+	err = simfs_inode_grow(&inode, (pos + size + blocksize - 1) / blocksize);
+	if (err) {
+		/* Keep blocks allocated so far */
+		simfs_inode_write(file->ino, &inode);
+		return err;
+	}
+	inode.size = MAX(inode.size, pos + size);
+	simfs_inode_write(file->ino, &inode);
+
+	count = simfs_map(&inode, pos, size, addr, seg);
+	file->pos = pos + size;
+	simfs_writes++;
+	simfs_write_bytes += size;
+	disk_submit(ctx, 0, 0, seg, count);
+	return size;
+}
+
+
+int simfs_close(struct ctx_t *ctx, int fd)
+{
+	struct simfs_file_t *file;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	file = simfs_file_get(ctx, fd);
+	if (!file)
+		return SIMFS_ENOENT;
+	memset(file, 0, sizeof(struct simfs_file_t));
+	return 0;
+}
+
+
+/* Close the files of a context being freed */
+void simfs_close_ctx(struct ctx_t *ctx)
+{
+	int fd;
+
+	for (fd = 0; fd < SIMFS_FILES_MAX; fd++)
+		if (simfs_files[fd].ctx == ctx)
+			memset(&simfs_files[fd], 0, sizeof(struct simfs_file_t));
+}
+
+
+/* Remove a file that is not open, or an empty directory. Only its owner
+ * can remove it. */
+int simfs_unlink(struct ctx_t *ctx, char *path)
+{
+	struct simfs_inode_t inode, dinode;
+	struct simfs_dirent_t ent;
+	char name[SIMFS_NAME_MAX + 1];
+	int dir, ino, slot, fd;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	simfs_begin();
+	dir = simfs_lookup_parent(path, name);
+	if (dir < 0)
+		return dir;
+	ino = simfs_dir_find(dir, name, &slot);
+	if (!ino)
+		return SIMFS_ENOENT;
+	simfs_inode_read(ino, &inode);
+	if (inode.uid != ctx->uid)
+		return SIMFS_EPERM;
+	if (inode.type == simfs_type_dir && !simfs_dir_empty(ino))
+		return SIMFS_EBUSY;
+	for (fd = 0; fd < SIMFS_FILES_MAX; fd++)
+		if (simfs_files[fd].ctx && simfs_files[fd].ino == ino)
+			return SIMFS_EBUSY;
+
+	simfs_inode_release(&inode);
+	inode.type = simfs_type_free;
+	simfs_inode_write(ino, &inode);
+	simfs_inode_read(dir, &dinode);
+	memset(&ent, 0, sizeof(ent));
+	simfs_dirent_access(&dinode, slot, &ent, 1);
+	simfs_unlinks++;
+	return 0;
+}
+
+
+int simfs_mkdir(struct ctx_t *ctx, char *path)
+{
+	char name[SIMFS_NAME_MAX + 1];
+	int dir, ino;
+
+	if (!simfs_mounted)
+		return SIMFS_ENOSYS;
+	simfs_begin();
+	dir = simfs_lookup_parent(path, name);
+	if (dir < 0)
+		return dir;
+	if (simfs_dir_find(dir, name, NULL))
+		return SIMFS_EEXIST;
+	ino = simfs_create(dir, name, simfs_type_dir, ctx->uid);
+	return ino < 0 ? ino : 0;
+}
+
+
+/* Checkpoints. The running transaction and its released extents are saved
+ * as is, so that restoring does not change when the next commit happens.
+ * The disk image and the block allocator are saved by their own modules. */
+void simfs_save(FILE *f)
+{
+	struct simfs_file_t *file;
+	int fd, pid;
+
+	ckpt_write(f, &simfs_mounted, sizeof(simfs_mounted));
+	if (!simfs_mounted)
+		return;
+	ckpt_write(f, &simfs_super, sizeof(simfs_super));
+	ckpt_write(f, &simfs_txn_count, sizeof(simfs_txn_count));
+	ckpt_write(f, simfs_txn_home, sizeof(simfs_txn_home));
+	ckpt_write(f, simfs_txn_data, simfs_txn_count * blocksize);
+	ckpt_write(f, &simfs_seq, sizeof(simfs_seq));
+	ckpt_write(f, &simfs_last_commit, sizeof(simfs_last_commit));
+	ckpt_write(f, &simfs_free_count, sizeof(simfs_free_count));
+	ckpt_write(f, simfs_free_uid, simfs_free_count * sizeof(int));
+	ckpt_write(f, simfs_free_ext, simfs_free_count * sizeof(struct simfs_extent_t));
+	for (fd = 0; fd < SIMFS_FILES_MAX; fd++) {
+		file = &simfs_files[fd];
+		pid = file->ctx ? file->ctx->pid : -1;
+		ckpt_write(f, &pid, sizeof(pid));
+		ckpt_write(f, &file->ino, sizeof(file->ino));
+		ckpt_write(f, &file->pos, sizeof(file->pos));
+	}
+	ckpt_write(f, &simfs_creates, sizeof(simfs_creates));
+	ckpt_write(f, &simfs_opens, sizeof(simfs_opens));
+	ckpt_write(f, &simfs_unlinks, sizeof(simfs_unlinks));
+	ckpt_write(f, &simfs_reads, sizeof(simfs_reads));
+	ckpt_write(f, &simfs_writes, sizeof(simfs_writes));
+	ckpt_write(f, &simfs_read_bytes, sizeof(simfs_read_bytes));
+	ckpt_write(f, &simfs_write_bytes, sizeof(simfs_write_bytes));
+	ckpt_write(f, &simfs_commits, sizeof(simfs_commits));
+	ckpt_write(f, &simfs_logged, sizeof(simfs_logged));
+	ckpt_write(f, &simfs_replays, sizeof(simfs_replays));
+}
+
+
+void simfs_restore(FILE *f)
+{
+	struct simfs_file_t *file;
+	int fd, pid, mounted;
+
+	ckpt_read(f, &mounted, sizeof(mounted));
+	if (mounted != simfs_mounted)
+		fatal("simfs_restore: checkpoint saved with SIMFS=%d", mounted);
+	if (!simfs_mounted)
+		return;
+	ckpt_read(f, &simfs_super, sizeof(simfs_super));
+	if (simfs_super.magic != SIMFS_MAGIC)
+		fatal("simfs_restore: invalid superblock in checkpoint");
+	ckpt_read(f, &simfs_txn_count, sizeof(simfs_txn_count));
+	if (simfs_txn_count < 0 || simfs_txn_count > SIMFS_TXN_MAX)
+		fatal("simfs_restore: invalid transaction in checkpoint");
+	ckpt_read(f, simfs_txn_home, sizeof(simfs_txn_home));
+	ckpt_read(f, simfs_txn_data, simfs_txn_count * blocksize);
+	ckpt_read(f, &simfs_seq, sizeof(simfs_seq));
+	ckpt_read(f, &simfs_last_commit, sizeof(simfs_last_commit));
+	ckpt_read(f, &simfs_free_count, sizeof(simfs_free_count));
+	if (simfs_free_count < 0 || simfs_free_count > SIMFS_FREE_MAX)
+		fatal("simfs_restore: invalid released extents in checkpoint");
+	ckpt_read(f, simfs_free_uid, simfs_free_count * sizeof(int));
+	ckpt_read(f, simfs_free_ext, simfs_free_count * sizeof(struct simfs_extent_t));
+	for (fd = 0; fd < SIMFS_FILES_MAX; fd++) {
+		file = &simfs_files[fd];
+		ckpt_read(f, &pid, sizeof(pid));
+		ckpt_read(f, &file->ino, sizeof(file->ino));
+		ckpt_read(f, &file->pos, sizeof(file->pos));
+		file->ctx = pid >= 0 ? ctx_get(pid) : NULL;
+	}
+	ckpt_read(f, &simfs_creates, sizeof(simfs_creates));
+	ckpt_read(f, &simfs_opens, sizeof(simfs_opens));
+	ckpt_read(f, &simfs_unlinks, sizeof(simfs_unlinks));
+	ckpt_read(f, &simfs_reads, sizeof(simfs_reads));
+	ckpt_read(f, &simfs_writes, sizeof(simfs_writes));
+	ckpt_read(f, &simfs_read_bytes, sizeof(simfs_read_bytes));
+	ckpt_read(f, &simfs_write_bytes, sizeof(simfs_write_bytes));
+	ckpt_read(f, &simfs_commits, sizeof(simfs_commits));
+	ckpt_read(f, &simfs_logged, sizeof(simfs_logged));
+	ckpt_read(f, &simfs_replays, sizeof(simfs_replays));
+}
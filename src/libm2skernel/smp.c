@@ -0,0 +1,446 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2skernel.h>
+
+
+/* Number of guest cores, each run by a host thread */
+int smp_cores = 1;
+
+/* Instructions per round in deterministic mode, 0 for free-running rounds */
+long long smp_quantum = 0;
+
+/* Run each round again sequentially on copies of the contexts, and stop if
+ * the results differ */
+int smp_check = 0;
+
+/* Serializes calls to 'ke_block_hook' from the cores */
+static pthread_mutex_t smp_hook_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Context assigned to a core. In deterministic mode, a core keeps its
+ * context for several rounds, until its slice runs out. */
+struct smp_job_t {
+	struct ctx_t *ctx;  /* NULL if the core is idle */
+	int left;  /* Instructions left in the slice */
+	int used;  /* Instructions run since the context was picked */
+	int limit;  /* Maximum instructions to run in this round */
+	int count;  /* Instructions run in this round */
+	int syscall;  /* Stopped at a system call to run at the barrier */
+	long long clock;  /* 'instr_num' of the core, at the start and at the end */
+};
+
+/* One job per core */
+static struct smp_job_t *smp_jobs;
+
+/* Sequential run of a job in check mode, on copies of its context state */
+struct smp_check_t {
+	struct smp_job_t job;
+	struct regs_t *regs;  /* NULL if the core is idle */
+	struct mem_t *mem;
+};
+
+static struct smp_check_t *smp_checks;
+
+/* Job run by this thread */
+static __thread struct smp_job_t *smp_job;
+
+/* Worker threads run the jobs of cores 1 and up; the main thread runs the
+ * job of core 0. Workers wait for 'smp_round' to change. */
+static pthread_t *smp_threads;
+static pthread_mutex_t smp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smp_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t smp_done_cond = PTHREAD_COND_INITIALIZER;
+static long long smp_round;
+static int smp_pending;
+static int smp_exit;
+
+/* Statistics */
+static long long smp_rounds, smp_busy, smp_insts, smp_deferred;
+
+
+/* Run a job. If 'hook' is set, 'ke_block_hook' is called after each block
+ * or instruction. */
+static void smp_job_run(struct smp_job_t *job, int hook)
+{
+	struct ctx_t *ctx = job->ctx;
+	uint32_t eip;
+	int count;
+
+	instr_num = job->clock;
+	smp_job = job;
+	for (job->count = 0; job->count < job->limit && ctx_get_status(ctx, ctx_running) &&
+		!job->syscall; job->count += count)
+	{
+		eip = ctx->regs->eip;
+		if (isa_block_dispatch) {
+			count = ctx_execute_block(ctx, job->limit - job->count);
+		} else {
+			ctx_execute_inst(ctx);
+			instr_num++;
+			count = 1;
+		}
+		if (hook && ke_block_hook) {
+			pthread_mutex_lock(&smp_hook_mutex);
+			ke_block_hook(ctx, eip, count);
+			pthread_mutex_unlock(&smp_hook_mutex);
+		}
+	}
+	job->clock = instr_num;
+	smp_job = NULL;
+}
+
+
+static void *smp_worker(void *arg)
+{
+	int core = (long) arg;
+	long long round = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&smp_mutex);
+		while (smp_round == round && !smp_exit)
+			pthread_cond_wait(&smp_start_cond, &smp_mutex);
+		if (smp_exit) {
+			pthread_mutex_unlock(&smp_mutex);
+			return NULL;
+		}
+		round = smp_round;
+		pthread_mutex_unlock(&smp_mutex);
+
+		if (smp_jobs[core].ctx)
+			smp_job_run(&smp_jobs[core], 1);
+
+		pthread_mutex_lock(&smp_mutex);
+		isa_inst_stat_merge();
+		if (!--smp_pending)
+			pthread_cond_signal(&smp_done_cond);
+		pthread_mutex_unlock(&smp_mutex);
+	}
+}
+
+
+/* Start the worker threads. Called after the configuration is read. */
+void smp_init(void)
+{
+	long core;
+
+	if (smp_cores < 1)
+		fatal("smp_init: invalid number of cores (%d)", smp_cores);
+	if (smp_quantum < 0)
+		fatal("smp_init: invalid quantum (%lld)", smp_quantum);
+	smp_jobs = calloc(smp_cores, sizeof(struct smp_job_t));
+	smp_threads = calloc(smp_cores, sizeof(pthread_t));
+	smp_checks = calloc(smp_cores, sizeof(struct smp_check_t));
+	if (!smp_jobs || !smp_threads || !smp_checks)
+		fatal("smp_init: out of memory");
+	for (core = 1; core < smp_cores; core++)
+		if (pthread_create(&smp_threads[core], NULL, smp_worker, (void *) core))
+			fatal("smp_init: cannot create host thread");
+}
+
+
+void smp_done(void)
+{
+	int core;
+
+	if (!smp_jobs)
+		return;
+	pthread_mutex_lock(&smp_mutex);
+	smp_exit = 1;
+	pthread_cond_broadcast(&smp_start_cond);
+	pthread_mutex_unlock(&smp_mutex);
+	for (core = 1; core < smp_cores; core++)
+		pthread_join(smp_threads[core], NULL);
+	if (smp_cores > 1)
+		smp_dump(stdout);
+	free(smp_jobs);
+	free(smp_threads);
+	free(smp_checks);
+	smp_jobs = NULL;
+	smp_threads = NULL;
+	smp_checks = NULL;
+}
+
+
+void smp_dump(FILE *f)
+{
+	fprintf(f, "\nSMP summary:\n");
+	fprintf(f, "smp.cores  %d\n", smp_cores);
+	fprintf(f, "smp.quantum  %lld  # Instructions per round in deterministic mode\n", smp_quantum);
+	fprintf(f, "smp.rounds  %lld\n", smp_rounds);
+	fprintf(f, "smp.occupancy  %.4f  # Fraction of cores running a context per round\n",
+		smp_rounds ? (double) smp_busy / smp_rounds / smp_cores : 0.0);
+	fprintf(f, "smp.ipr  %.2f  # Instructions per round, all cores\n",
+		smp_rounds ? (double) smp_insts / smp_rounds : 0.0);
+	fprintf(f, "smp.speedup  %.4f  # Instructions run over guest time elapsed\n",
+		instr_num ? (double) smp_insts / instr_num : 0.0);
+	fprintf(f, "smp.deferred  %lld  # System calls run at the end of a round\n", smp_deferred);
+}
+
+
+/* Called by 'syscall_do'. A system call stops the job of its core and runs
+ * at the end of the round, when all cores have stopped, since it can change
+ * the state of contexts running on other cores (signals, exit, wait, futex
+ * wake-ups). Return non-zero if the call was deferred. */
+int smp_syscall_defer(void)
+{
+	if (!smp_job)
+		return 0;
+	smp_job->syscall = 1;
+	return 1;
+}
+
+
+/* Mark a context and those sharing its memory map as picked, since their
+ * instructions would race on it */
+static void smp_mark(struct ctx_t *ctx)
+{
+	struct ctx_t *other;
+
+	for (other = ke->running_list_head; other; other = other->running_next)
+		if (other->mem == ctx->mem)
+			other->sched.picked = 1;
+}
+
+
+/* Check mode. Before a round, run the job of each core on the main thread,
+ * one core after another, on copies of the registers and memory map of its
+ * context. Instruction counts of these runs are discarded. */
+static void smp_check_run(void)
+{
+	struct smp_check_t *check;
+	struct ctx_t *ctx;
+	struct regs_t *regs;
+	struct mem_t *mem;
+	long long start = instr_num;
+	uint64_t inst_count = isa_inst_count;
+	int core;
+
+	isa_inst_stat_merge();
+	for (core = 0; core < smp_cores; core++) {
+		check = &smp_checks[core];
+		check->regs = NULL;
+		if (!(ctx = smp_jobs[core].ctx))
+			continue;
+		check->job = smp_jobs[core];
+		check->regs = regs_create();
+		regs_copy(check->regs, ctx->regs);
+		check->mem = mem_clone(ctx->mem);
+		regs = ctx->regs;
+		mem = ctx->mem;
+		ctx->regs = check->regs;
+		ctx->mem = check->mem;
+		smp_job_run(&check->job, 0);
+		ctx->regs = regs;
+		ctx->mem = mem;
+	}
+	isa_inst_stat_drop();
+	isa_inst_count = inst_count;
+	instr_num = start;
+}
+
+
+/* Check mode. After the parallel run of a round, compare each core with its
+ * sequential run. */
+static void smp_check_compare(void)
+{
+	struct smp_check_t *check;
+	struct smp_job_t *job;
+	int core;
+
+	for (core = 0; core < smp_cores; core++) {
+		check = &smp_checks[core];
+		job = &smp_jobs[core];
+		if (!check->regs)
+			continue;
+		if (job->count != check->job.count || job->syscall != check->job.syscall)
+			fatal("smp round %lld, core %d: instructions run differ from a sequential run",
+				smp_rounds, core);
+		if (memcmp(job->ctx->regs, check->regs, sizeof(struct regs_t)))
+			fatal("smp round %lld, core %d: registers differ from a sequential run",
+				smp_rounds, core);
+		if (!mem_equal(job->ctx->mem, check->mem))
+			fatal("smp round %lld, core %d: memory differs from a sequential run",
+				smp_rounds, core);
+		mem_free(check->mem);
+		regs_free(check->regs);
+		check->regs = NULL;
+	}
+}
+
+
+/* Run a round. Idle cores get a context from the scheduler. Each core starts
+ * at the current 'instr_num' and runs until its slice ends, the next
+ * interrupt, or the end of the quantum in deterministic mode. Then
+ * 'instr_num' moves to the latest core. Return the number of instructions
+ * run on all cores.
+ *
+ * The instructions a core runs in a round should only depend on the state at
+ * its start. Contexts sharing a memory map never run in the same round.
+ * Processes forked from each other do share copy-on-write pages, which a
+ * core copies before writing them. System calls run at the barrier, in core
+ * order. This is not proven for every system call and instruction, so with
+ * 'smp_check' set, every round is also run sequentially on copies of the
+ * contexts, and the simulation stops on the first difference. */
+int smp_run(void)
+{
+	struct smp_job_t *job;
+	struct ctx_t *ctx;
+	long long start = instr_num;
+	int core, slice, busy = 0, count = 0;
+
+	/* Assign contexts to idle cores */
+	for (core = 0; core < smp_cores; core++)
+		if (smp_jobs[core].ctx)
+			smp_mark(smp_jobs[core].ctx);
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		if (job->ctx || !(ctx = sched_pick_next(&slice)))
+			continue;
+		smp_mark(ctx);
+		job->ctx = ctx;
+		job->left = slice;
+		job->used = 0;
+	}
+	for (ctx = ke->running_list_head; ctx; ctx = ctx->running_next)
+		ctx->sched.picked = 0;
+
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		if (!job->ctx)
+			continue;
+		job->limit = job->left;
+		if (smp_quantum)
+			job->limit = MIN(job->limit, smp_quantum);
+		if (interrupts_exist())
+			job->limit = MIN(job->limit, next_interrupt_num() - start);
+		job->count = 0;
+		job->clock = start;
+		busy++;
+	}
+	if (!busy)
+		return 0;
+	if (smp_check)
+		smp_check_run();
+
+	/* Run */
+	if (busy == 1 && smp_jobs[0].ctx) {
+		smp_job_run(&smp_jobs[0], 1);
+	} else {
+		pthread_mutex_lock(&smp_mutex);
+		smp_pending = smp_cores - 1;
+		smp_round++;
+		pthread_cond_broadcast(&smp_start_cond);
+		pthread_mutex_unlock(&smp_mutex);
+
+		if (smp_jobs[0].ctx)
+			smp_job_run(&smp_jobs[0], 1);
+
+		pthread_mutex_lock(&smp_mutex);
+		while (smp_pending)
+			pthread_cond_wait(&smp_done_cond, &smp_mutex);
+		pthread_mutex_unlock(&smp_mutex);
+	}
+	if (smp_check)
+		smp_check_compare();
+
+	/* Barrier: deferred system calls, at the time of their core */
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		if (!job->ctx || !job->syscall)
+			continue;
+		instr_num = job->clock;
+		isa_ctx = job->ctx;
+		isa_regs = job->ctx->regs;
+		isa_mem = job->ctx->mem;
+		syscall_do();
+		smp_deferred++;
+	}
+
+	/* Advance guest time. Contexts that used up their slice or stopped
+	 * running are reported to the scheduler in core order. In free-running
+	 * mode, other contexts are released too, unless they only stopped for
+	 * a system call. */
+	instr_num = start;
+	for (core = 0; core < smp_cores; core++)
+		if (smp_jobs[core].ctx)
+			instr_num = MAX(instr_num, smp_jobs[core].clock);
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		if (!job->ctx)
+			continue;
+		job->left -= job->count;
+		job->used += job->count;
+		smp_insts += job->count;
+		count += job->count;
+		if ((!smp_quantum && !job->syscall) || job->left <= 0 ||
+			!ctx_get_status(job->ctx, ctx_running))
+		{
+			sched_tick(job->ctx, job->used);
+			job->ctx = NULL;
+		}
+		job->syscall = 0;
+	}
+	smp_rounds++;
+	smp_busy += busy;
+	return count;
+}
+
+
+/* Checkpoints. Cores holding a context across rounds keep it. */
+void smp_save(FILE *f)
+{
+	struct smp_job_t *job;
+	int core, pid;
+
+	ckpt_write(f, &smp_cores, sizeof(smp_cores));
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		pid = job->ctx ? job->ctx->pid : -1;
+		ckpt_write(f, &pid, sizeof(pid));
+		ckpt_write(f, &job->left, sizeof(job->left));
+		ckpt_write(f, &job->used, sizeof(job->used));
+	}
+	ckpt_write(f, &smp_rounds, sizeof(smp_rounds));
+	ckpt_write(f, &smp_busy, sizeof(smp_busy));
+	ckpt_write(f, &smp_insts, sizeof(smp_insts));
+	ckpt_write(f, &smp_deferred, sizeof(smp_deferred));
+}
+
+
+void smp_restore(FILE *f)
+{
+	struct smp_job_t *job;
+	int core, cores, pid;
+
+	ckpt_read(f, &cores, sizeof(cores));
+	if (cores != smp_cores)
+		fatal("smp_restore: checkpoint saved with %d cores", cores);
+	for (core = 0; core < smp_cores; core++) {
+		job = &smp_jobs[core];
+		ckpt_read(f, &pid, sizeof(pid));
+		ckpt_read(f, &job->left, sizeof(job->left));
+		ckpt_read(f, &job->used, sizeof(job->used));
+		job->ctx = pid >= 0 ? ctx_get(pid) : NULL;
+	}
+	ckpt_read(f, &smp_rounds, sizeof(smp_rounds));
+	ckpt_read(f, &smp_busy, sizeof(smp_busy));
+	ckpt_read(f, &smp_insts, sizeof(smp_insts));
+	ckpt_read(f, &smp_deferred, sizeof(smp_deferred));
+}
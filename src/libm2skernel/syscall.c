@@ -40,7 +40,6 @@
 
 int syscall_debug_category;
 int blocksize, numblocks;
-int *blockowners;
 
 static char *syscall_name[] = {
 #define DEFSYSCALL(name,code) #name,
@@ -817,6 +816,22 @@ void syscall_summary() {
 
 
 /*  Following are the functions which implement systemcalls provided by guest os*/
+
+/* First and last blocks touched by a disk segment */
+static void disk_segment_blocks(struct disk_segment_t *seg, int *first, int *last) {
+	long long start = (long long) seg->block * blocksize + seg->offset;
+	*first = start / blocksize;
+	*last = (start + MAX(seg->size, 1) - 1) / blocksize;
+}
+
+/* Read a filesystem path from guest memory. Return 0, or an error if it
+ * does not fit in 'SIMFS_PATH_MAX' bytes. */
+static int simfs_path(uint32_t addr, char *path) {
+	if (mem_read_string(isa_mem, addr, SIMFS_PATH_MAX, path) == SIMFS_PATH_MAX)
+		return SIMFS_EINVAL;
+	return 0;
+}
+
 int get_pid() {
 	return isa_ctx->pid;
 }
@@ -846,44 +861,190 @@ int handle_guest_syscalls() {
 			
 			printf("Process of user %d attempting to write on block %d.\n", isa_ctx->uid, blocknum);
 			
-			if (blocknum >= numblocks) {
+			if (blocknum < 0 || blocknum >= numblocks) {
 				printf ("Block does not exist.\n");
 				return -1;
 			}
-			if (blockowners[blocknum]!=0 && blockowners[blocknum]!=isa_ctx->uid) {
+			if (!balloc_is_free(blocknum) && !balloc_owned(isa_ctx->uid, blocknum, 1)) {
 				printf ("This block belongs to another user.\n");
 				return -2;
 			}
-			else if (offset + numbytes > blocksize) {
+			else if (offset < 0 || numbytes < 0 || offset + numbytes > blocksize) {
 				printf ("Intended I/O exceeds block size.\n");
 				return -3;
 			}
 			
-			char *data = (char*)(malloc(numbytes));
-			FILE *disk = fopen ("Sim_disk","r+");
-			fseek (disk, blocknum*blocksize + offset, SEEK_SET);
-			
 			if (op) {//Read mode
-				if (blockowners[blocknum]==0) {
+				if (balloc_is_free(blocknum)) {
 					printf ("This block is not allocated to any user.\n");
 					return -2;
 				}
-				fread(data,1,numbytes,disk);
-				mem_write_string(isa_mem, addr,data);
 			}
 			else {//Write mode
-				if (blockowners[blocknum]==0) {
+				if (balloc_is_free(blocknum)) {
 					printf ("Block now allocated to this user.\n");
-					blockowners[blocknum] = isa_ctx->uid;
+					balloc_claim(isa_ctx->uid, blocknum);
 				}
-				mem_read_string(isa_mem, addr, numbytes, data);
-				fwrite(data,1,numbytes,disk);
 			}
 			
-			fclose(disk);
+			/* The context sleeps until the disk completes the request */
+			struct disk_segment_t seg = { blocknum, offset, numbytes, addr };
+			retval = 0;
+			disk_submit(isa_ctx, op, 1, &seg, 1);
+			
+			break;
+		}
+		case syscall_code_disk_iov:
+		{
+			/* Vectored binary I/O: ebx is the operation (1 = read,
+			 * 0 = write), ecx points to an array of 'disk_segment_t'
+			 * and edx is its number of elements. A segment can span
+			 * several blocks. All segments are moved by one request. */
+			int op = isa_regs->ebx;
+			uint32_t iov = isa_regs->ecx;
+			int count = isa_regs->edx;
+			struct disk_segment_t seg[DISK_IOV_MAX];
+			int i, block, first, last, claimed = 0;
+			
+			printf("Process of user %d attempting I/O on %d disk segments.\n", isa_ctx->uid, count);
+			
+			if (count <= 0 || count > DISK_IOV_MAX) {
+				printf ("Invalid number of segments.\n");
+				return -3;
+			}
+			mem_read(isa_mem, iov, count * sizeof(struct disk_segment_t), seg);
+			
+			/* Check all segments before claiming any block */
+			for (i = 0; i < count; i++) {
+				if (seg[i].block < 0 || seg[i].offset < 0 || seg[i].size < 0) {
+					printf ("Invalid disk segment.\n");
+					return -3;
+				}
+				disk_segment_blocks(&seg[i], &first, &last);
+				if (last >= numblocks) {
+					printf ("Block does not exist.\n");
+					return -1;
+				}
+				for (block = first; block <= last; block++) {
+					if (!balloc_is_free(block) && !balloc_owned(isa_ctx->uid, block, 1)) {
+						printf ("This block belongs to another user.\n");
+						return -2;
+					}
+					if (op && balloc_is_free(block)) {
+						printf ("This block is not allocated to any user.\n");
+						return -2;
+					}
+				}
+			}
+			if (!op) {
+				for (i = 0; i < count; i++) {
+					disk_segment_blocks(&seg[i], &first, &last);
+					for (block = first; block <= last; block++) {
+						if (balloc_is_free(block)) {
+							balloc_claim(isa_ctx->uid, block);
+							claimed++;
+						}
+					}
+				}
+				if (claimed)
+					printf ("%d blocks now allocated to this user.\n", claimed);
+			}
+			
+			retval = 0;
+			disk_submit(isa_ctx, op, 0, seg, count);
+			
+			break;
+		}
+		case syscall_code_disk_alloc:
+		{
+			/* Allocate ebx contiguous blocks to the user. Return the
+			 * first one. */
+			int count = isa_regs->ebx;
+			
+			printf("Process of user %d allocating %d blocks.\n", isa_ctx->uid, count);
+			
+			if (count <= 0 || count > numblocks) {
+				printf ("Invalid number of blocks.\n");
+				return -3;
+			}
+			retval = balloc_alloc(isa_ctx->uid, count);
+			if (retval < 0) {
+				printf ("No free run of %d blocks.\n", count);
+				return -1;
+			}
+			printf ("Blocks %d to %d now allocated to this user.\n", retval, retval + count - 1);
+			break;
+		}
+		case syscall_code_disk_free:
+		{
+			/* Free ecx blocks from block ebx. All of them must
+			 * belong to the user. */
+			int blocknum = isa_regs->ebx;
+			int count = isa_regs->ecx;
+			
+			printf("Process of user %d freeing %d blocks from block %d.\n", isa_ctx->uid, count, blocknum);
+			
+			if (count <= 0 || blocknum < 0 || blocknum > numblocks - count) {
+				printf ("Block does not exist.\n");
+				return -1;
+			}
+			if (balloc_free(isa_ctx->uid, blocknum, count)) {
+				printf ("These blocks do not belong to this user.\n");
+				return -2;
+			}
 			retval = 0;
-			send_to_io(isa_ctx, 30);
+			break;
+		}
+		case syscall_code_fs_open:
+		{
+			/* Open the file at path ebx with flags ecx (SIMFS_O_*) */
+			char path[SIMFS_PATH_MAX];
 			
+			retval = simfs_path(isa_regs->ebx, path);
+			if (!retval) {
+				printf("Process of user %d opening file %s.\n", isa_ctx->uid, path);
+				retval = simfs_open(isa_ctx, path, isa_regs->ecx);
+			}
+			break;
+		}
+		case syscall_code_fs_read:
+		{
+			/* Read edx bytes of file ebx into address ecx */
+			retval = simfs_read(isa_ctx, isa_regs->ebx, isa_regs->ecx, isa_regs->edx);
+			break;
+		}
+		case syscall_code_fs_write:
+		{
+			/* Write edx bytes from address ecx to file ebx */
+			retval = simfs_write(isa_ctx, isa_regs->ebx, isa_regs->ecx, isa_regs->edx);
+			break;
+		}
+		case syscall_code_fs_close:
+		{
+			retval = simfs_close(isa_ctx, isa_regs->ebx);
+			break;
+		}
+		case syscall_code_fs_unlink:
+		{
+			/* Remove the file or empty directory at path ebx */
+			char path[SIMFS_PATH_MAX];
+			
+			retval = simfs_path(isa_regs->ebx, path);
+			if (!retval) {
+				printf("Process of user %d removing %s.\n", isa_ctx->uid, path);
+				retval = simfs_unlink(isa_ctx, path);
+			}
+			break;
+		}
+		case syscall_code_fs_mkdir:
+		{
+			char path[SIMFS_PATH_MAX];
+			
+			retval = simfs_path(isa_regs->ebx, path);
+			if (!retval) {
+				printf("Process of user %d creating directory %s.\n", isa_ctx->uid, path);
+				retval = simfs_mkdir(isa_ctx, path);
+			}
 			break;
 		}
 		default:
@@ -903,7 +1064,7 @@ int handle_guest_syscalls() {
  * The system call code is in eax.
  * The parameters are given in ebx, ecx, edx, esi, edi, ebp.
  * The return value is placed in eax. */
-void syscall_do() {
+static void syscall_run() {
     int syscode = isa_regs->eax;
     int retval = 0;
     if (syscode > 325) {
@@ -2048,15 +2209,15 @@ void syscall_do() {
                 if (!newsp)
                     newsp = isa_regs->esp;
 
-                /* Create new context */
-                new_ctx = ctx_clone(isa_ctx);
-                retval = new_ctx->pid;
-                syscall_debug("  context %d created with pid %d\n",
-                        new_ctx->pid, retval);
-
-                /* Check not supported and mandatory flags */
+                /* Check not supported and mandatory flags. Without CLONE_VM, this is
+                 * a fork, and none of CLONE_FS, CLONE_FILES, CLONE_SIGHAND and
+                 * CLONE_THREAD can be specified. */
                 mandatory_flags = 0x00000f00;
                 supported_flags = 0x013d00ff | mandatory_flags;
+                if (!(flags & 0x100)) {
+                    mandatory_flags = 0;
+                    supported_flags = 0x013c00ff;
+                }
                 if ((flags & mandatory_flags) != mandatory_flags) {
                     map_flags(&clone_flags_map, ~flags & mandatory_flags, sflags, MAX_STRING_SIZE);
                     fatal("syscall clone: these mandatory flags are not specified: %s",
@@ -2068,6 +2229,12 @@ void syscall_do() {
                             sflags);
                 }
 
+                /* Create new context. A fork gets a copy-on-write memory map. */
+                new_ctx = flags & 0x100 ? ctx_clone(isa_ctx) : ctx_fork(isa_ctx);
+                retval = new_ctx->pid;
+                syscall_debug("  context %d created with pid %d\n",
+                        new_ctx->pid, retval);
+
                 /* Flag CLONE_THREAD.
                  * If specified, the exit signal is ignored. Otherwise, it is specified in the
                  * lower byte of the flags. */
@@ -2081,9 +2248,12 @@ void syscall_do() {
                 if (flags & 0x100000)
                     mem_write(isa_ctx->mem, parent_tidptr, 4, &new_ctx->pid);
 
-                /* Flags CLONE_CHILD_SETTID and CLONE_CHILD_CLEARTID */
-                if (flags & 0x1000000)
+                /* Flags CLONE_CHILD_SETTID and CLONE_CHILD_CLEARTID. The child thread
+                 * id is stored in the memory map of the child. */
+                if (flags & 0x1000000) {
                     new_ctx->set_child_tid = child_tidptr;
+                    mem_write(new_ctx->mem, child_tidptr, 4, &new_ctx->pid);
+                }
                 if (flags & 0x200000)
                     new_ctx->clear_child_tid = child_tidptr;
 
@@ -3648,8 +3818,18 @@ void syscall_do() {
         }
 
       }
-	 /* Return value (for all system calls except 'sigreturn') */
-        if (syscode != syscall_code_sigreturn && !ctx_get_status(isa_ctx, ctx_suspended))
+	 /* Return value (for all system calls except 'sigreturn'). Guest os
+	  * system calls return when they are issued, even if the context then
+	  * waits for the disk. */
+        if (syscode != syscall_code_sigreturn && (syscode > 325 || !ctx_get_status(isa_ctx, ctx_suspended)))
             isa_regs->eax = retval;
 }
 
+/* A system call made on a guest core is left for the end of the round,
+ * where calls run one at a time on the main thread, so no lock is needed. */
+void syscall_do() {
+	if (smp_syscall_defer())
+		return;
+	syscall_run();
+}
+
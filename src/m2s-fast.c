@@ -80,6 +80,8 @@ static void sim_reg_options()
 	opt_reg_uint64("-max_inst", "Maximum number of instructions", &max_inst);
 	opt_reg_uint32("-break_point", "Value for eip to stop", &break_point);
 	opt_reg_bool("-mem_safe_mode", "Safe accesses to memory", &mem_safe_mode);
+	opt_reg_bool("-block_dispatch", "Execute decoded basic blocks", &isa_block_dispatch);
+	opt_reg_bool("-block_check", "Check decoded basic blocks against per-instruction execution", &isa_block_check);
 
 	gk_reg_options();
 }
@@ -171,9 +173,8 @@ fprintf(stderr,"\n Welcome to guestos\n");
 			break;
 		}
 		
-		/* Run an instruction from each running context */
-		ke_run();
-		sim_inst += ke->running_count;
+		/* Run a time slice, or an SMP round */
+		sim_inst += ke_run();
 		if (!ke->context_list_head)
 			break;
 
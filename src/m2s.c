@@ -152,6 +152,8 @@ static void sim_signal_handler(int signum)
 
 int main(int argc, char **argv)
 {
+	uint64_t limit;
+
 	/* Options & stats */
 	opt_init();
 	sim_reg_options();
@@ -197,6 +199,9 @@ int main(int argc, char **argv)
 	/* Fast forward simulation */
 	p_fast_forward(fastfwd);
 
+	/* Sampled simulation, which runs the programs to the end */
+	sample_run();
+
 	/* Exhaustive simulation */
 	signal(SIGINT, &sim_signal_handler);
 	signal(SIGABRT, &sim_signal_handler);
@@ -233,6 +238,13 @@ int main(int argc, char **argv)
 		/* Dump log */
 		if (sigusr_received)
 			sim_dump_log();
+
+		/* Skip idle cycles. Stop at the next cycle checking
+		 * 'max_time' and at 'max_cycles'. */
+		limit = (sim_cycle / 10000 + 1) * 10000;
+		if (max_cycles)
+			limit = MIN(limit, max_cycles);
+		p_skip_cycles(limit);
 	}
 	signal(SIGALRM, SIG_IGN);
 	signal(SIGABRT, SIG_DFL);
@@ -51,6 +51,9 @@ extern uint32_t p_cores;
 extern uint32_t p_threads;
 extern uint32_t p_cpus;
 extern uint32_t p_context_quantum;
+extern int p_context_switch;
+extern int p_warm;
+extern int p_cycle_skip;
 extern uint32_t p_thread_quantum;
 extern uint32_t p_thread_switch_penalty;
 
@@ -242,24 +245,73 @@ enum uop_flags_enum {
 #define IDEP_COUNT 3
 #define ODEP_COUNT 4
 
+/* Largest number of tables of TAGE, ITTAGE and the hashed perceptron, and
+ * number of tables of the statistical corrector */
+#define BPRED_TABLE_MAX 16
+#define BPRED_SC_TABLES 4
+
+/* Uops of a core live in a ring of slots, allocated in fetch order and
+ * mostly freed in commit order, so that uops close in age are close in
+ * memory. A uop is named within its core by its 32-bit slot index, and slot
+ * 0 is never used, so that index 0 means no uop. Queues link uops by index.
+ * The fields read while scanning queues are kept apart from 'struct uop_t',
+ * in arrays indexed by slot. The ring grows by chunks of 'struct uop_t', so
+ * that uops do not move. */
+#define UOP_RING_CHUNK_SHIFT  8
+#define UOP_RING_CHUNK  (1 << UOP_RING_CHUNK_SHIFT)
+
+struct uop_ring_t {
+	uint32_t size;  /* Number of slots, power of 2 */
+	uint32_t count;  /* Allocated slots */
+	uint32_t next;  /* Slot where the search for a free one starts */
+	struct uop_t **uop;  /* Chunks of uops */
+	unsigned char *busy;  /* Slot allocated */
+
+	/* Hot fields */
+	uint64_t *seq;  /* sequence number - unique uop identifier */
+	uint64_t *di_seq;  /* dispatch sequence number - unique per core */
+	uint64_t *when;  /* cycle when ready */
+	int *flags;
+	unsigned char *ready;
+	unsigned char *specmode;
+	unsigned char *wait;  /* Input dependences not written yet, one bit each */
+
+	/* Instruction queue, in dispatch order, and ready queue of the
+	 * uop's functional unit class, in age order. */
+	uint32_t *iq_prev, *iq_next;
+	uint32_t *ready_prev, *ready_next;
+
+	/* Event queue. Uops of a thread in the event queue are linked in issue
+	 * order, both all of them and the loads. */
+	uint32_t *eventq_next;
+	uint32_t *age_prev[2], *age_next[2];
+
+	/* Consumer lists of physical registers. Entry 'index * IDEP_COUNT + dep'
+	 * belongs to input dependence 'dep' of a uop. */
+	uint32_t *wakeup_prev, *wakeup_next;
+};
+
+#define UOP_GET(ring, index)  (&(ring)->uop[(index) >> UOP_RING_CHUNK_SHIFT] \
+	[(index) & (UOP_RING_CHUNK - 1)])
+#define UOP_RING(uop)  (p->core[(uop)->core].uop_ring)
+#define UOP_HOT(uop, field)  (UOP_RING(uop)->field[(uop)->index])
+
 struct uop_t {
 	
-	/* Main uop fields */
-	char name[40];
+	/* Main uop fields. Names are obtained from 'uop' and 'mop_opcode'
+	 * when dumped. */
 	enum uop_enum uop;  /* opcode */
 	struct ctx_t *ctx;
 	int core, thread;
-	uint64_t seq;  /* sequence number - unique uop identifier */
-	uint64_t di_seq;  /* dispatch squence number - unique per core */
+	uint32_t index;  /* Slot in the uop ring of the core */
 	uint32_t eip;  /* address of macroinst */
 	uint32_t neip;  /* address of next non-speculative macroinst */
 	uint32_t pred_neip; /* address of next predicted macroinst (for branches) */
 	uint32_t target_neip;  /* address of target macroinst assuming branch taken (for branches) */
-	int specmode;
 	uint64_t fetch_access;  /* Access identifier to the instruction cache */
 
 	/* Fields associated with macroinstruction */
-	char mop_name[40];
+	x86_opcode_t mop_opcode;
 	int mop_index;  /* Index of uop within macroinstruction */
 	int mop_count;  /* Number of uops within macroinstruction */
 	int mop_size;  /* Corresponding macroinstruction size */
@@ -283,7 +335,6 @@ struct uop_t {
 
 	/* Execution */
 	int fu_class;
-	int flags;
 
 	/* Queues where instruction is */
 	int in_fetchq : 1;
@@ -295,7 +346,6 @@ struct uop_t {
 	int in_rob : 1;
 
 	/* Instruction status */
-	int ready;
 	int issued;
 	int completed;
 
@@ -304,7 +354,6 @@ struct uop_t {
 	uint32_t mem_phaddr;  /* physical address */
 
 	/* Cycles */
-	uint64_t when;  /* cycle when ready */
 	uint64_t issue_try_when;  /* first cycle when f.u. is tried to be reserved */
 	uint64_t issue_when;  /* cycle when issued */
 
@@ -313,15 +362,31 @@ struct uop_t {
 	int bimod_index, bimod_pred;
 	int twolevel_bht_index, twolevel_pht_row, twolevel_pht_col, twolevel_pred;
 	int choice_index, choice_pred;
+
+	/* TAGE-SC-L, hashed perceptron and ITTAGE. Entries read at lookup are
+	 * updated at commit. Conditional branches use the table fields for TAGE
+	 * or the perceptron, and indirect branches for ITTAGE. */
+	int table_lookup;  /* Tables were read and global history shifted */
+	uint16_t table_index[BPRED_TABLE_MAX];
+	uint16_t table_tag[BPRED_TABLE_MAX];
+	int tage_provider, tage_alt;  /* Hitting tables, or -1 */
+	int tage_pred, tage_alt_pred;
+	uint16_t sc_index[BPRED_SC_TABLES];
+	int sc_sum, sc_pred;
+	int loop_entry, loop_iter, loop_pred, loop_valid;  /* Entry is -1 on miss */
+	int perceptron_sum;
+	uint32_t ittage_target;  /* 0 if no table hit */
 };
 
 void uop_init(void);
 void uop_done(void);
 
+struct uop_ring_t *uop_ring_create(void);
+void uop_ring_free(struct uop_ring_t *ring);
+
 void uop_list_dump(struct list_t *uop_list, FILE *f);
 void uop_lnlist_dump(struct lnlist_t *uop_list, FILE *f);
-void uop_lnlist_check_if_ready(struct lnlist_t *uop_list);
-struct uop_t *uop_decode(struct list_t *list);
+struct uop_t *uop_decode(struct list_t *list, int core);
 
 void uop_free_if_not_queued(struct uop_t *uop);
 void uop_dump_buf(struct uop_t *uop, char *buf, int size);
@@ -414,13 +479,14 @@ extern enum iq_kind_enum {
 
 
 void iq_reg_options(void);
-void iq_init(void);
 void iq_done(void);
 
 int iq_can_insert(struct uop_t *uop);
 void iq_insert(struct uop_t *uop);
-void iq_remove(int core, int thread);
+void iq_remove(struct uop_t *uop);
 void iq_recover(int core, int thread);
+void iq_ready(struct uop_t *uop);
+void iq_dump(int core, int thread, FILE *f);
 
 
 
@@ -450,13 +516,29 @@ void sq_remove(int core, int thread);
 
 /* Event Queue */
 
+/* Uops being executed wait in a timing wheel with a bucket per cycle, or in
+ * an overflow list if they complete beyond it. Memory uops are placed by the
+ * cache system in a list of completed accesses. */
+#define EVENTQ_WHEEL_SIZE  256
+
+struct eventq_t {
+	uint32_t wheel[EVENTQ_WHEEL_SIZE];
+	uint32_t overflow;
+	uint64_t cycle;  /* Cycle of the first bucket */
+	int count;  /* Uops in the buckets */
+	struct lnlist_t *mem;  /* Memory uops with a completed access */
+};
+
 void eventq_init(void);
 void eventq_done(void);
+void eventq_dump(int core, FILE *f);
 
 int eventq_longlat(int core, int thread);
 int eventq_cachemiss(int core, int thread);
-void eventq_insert(struct lnlist_t *eventq, struct uop_t *uop);
-struct uop_t *eventq_extract(struct lnlist_t *eventq);
+void eventq_insert(struct uop_t *uop);
+void eventq_insert_mem(struct uop_t *uop);
+struct uop_t *eventq_extract(int core);
+uint64_t eventq_next(int core);
 void eventq_recover(int core, int thread);
 
 
@@ -476,6 +558,7 @@ extern enum rf_kind_enum {
 struct phreg_t {
 	int pending;  /* not completed (bit) */
 	int busy;  /* number of mapped logical registers */
+	uint32_t wakeup_head, wakeup_tail;  /* Entries of uops waiting for it */
 };
 
 struct rf_t {
@@ -508,6 +591,7 @@ void rf_count_deps(struct uop_t *uop);
 int rf_can_rename(struct uop_t *uop);
 void rf_rename(struct uop_t *uop);
 int rf_ready(struct uop_t *uop);
+void rf_wait(struct uop_t *uop);
 void rf_write(struct uop_t *uop);
 void rf_undo(struct uop_t *uop);
 void rf_commit(struct uop_t *uop);
@@ -534,6 +618,9 @@ uint32_t bpred_btb_lookup(struct bpred_t *bpred, struct uop_t *uop);
 void bpred_btb_update(struct bpred_t *bpred, struct uop_t *uop);
 uint32_t bpred_btb_next_branch(struct bpred_t *bpred, uint32_t eip, uint32_t bsize);
 
+void bpred_warm(struct bpred_t *bpred, struct uop_t *uop);
+void bpred_dump_report(struct bpred_t *bpred, FILE *f);
+
 
 
 
@@ -673,12 +760,15 @@ struct processor_thread_t {
 	/* Private structures */
 	struct list_t *fetchq;
 	struct list_t *uopq;
-	struct lnlist_t *iq;
+	uint32_t iq_head, iq_tail;  /* Instruction queue */
+	uint32_t iq_ready_head[fu_count], iq_ready_tail[fu_count];  /* Ready uops in IQ */
 	struct lnlist_t *lq;
 	struct lnlist_t *sq;
 	struct bpred_t *bpred;  /* branch predictor */
 	struct tcache_t *tcache;  /* trace cache */
 	struct rf_t *rf;  /* physical register file */
+	uint32_t eventq_oldest[2], eventq_newest[2];  /* Uops in the event queue */
+	int eventq_count[2];
 
 	/* Fetch */
 	uint32_t fetch_eip, fetch_neip;  /* eip and next eip */
@@ -744,7 +834,8 @@ struct processor_core_t {
 	struct processor_thread_t *thread;
 
 	/* Shared structures */
-	struct lnlist_t *eventq;
+	struct uop_ring_t *uop_ring;
+	struct eventq_t *eventq;
 	struct fu_t *fu;
 
 	/* Per core counters */
@@ -755,7 +846,7 @@ struct processor_core_t {
 	int rf_fp_count;
 
 	/* Reorder Buffer */
-	struct list_t *rob;
+	uint32_t *rob;
 	int rob_count;
 	int rob_head;
 	int rob_tail;
@@ -776,6 +867,7 @@ struct processor_core_t {
 	uint64_t squashed;
 	uint64_t branches;
 	uint64_t mispred;
+	uint64_t inst;  /* Committed uops, added up into 'sim_inst' */
 	
 	/* Statistics for shared structures */
 	uint64_t rob_occupancy;
@@ -824,14 +916,17 @@ struct processor_t {
 	/* Structures */
 	struct mm_t *mm;  /* Memory management unit */
 	
-	/* Statistics */
+	/* Statistics. Those filled by the stages after fetch are totals of the
+	 * per core counters, updated by 'p_sum_stats'. */
 	uint64_t fetched;
+	uint64_t executed;  /* Non-speculative macroinstructions run at fetch */
 	uint64_t dispatched[uop_count];
 	uint64_t issued[uop_count];
 	uint64_t committed[uop_count];
 	uint64_t squashed;
 	uint64_t branches;
 	uint64_t mispred;
+	uint64_t skipped;  /* Idle cycles skipped */
 	double time;
 
 	/* For dumping */
@@ -852,17 +947,21 @@ void p_init(void);
 void p_done(void);
 void p_load_progs(int argc, char **argv, char *ctxfile);
 void p_dump(FILE *f);
-void p_update_occupancy_stats(void);
+void p_update_occupancy_stats(uint64_t cycles);
+void p_sum_stats(void);
 uint32_t p_tlb_address(int ctx, uint32_t vaddr);
 void p_fast_forward(uint64_t cycles);
+void p_warm_inst(struct ctx_t *ctx, uint32_t eip);
 
 int p_pipeline_empty(int core, int thread);
 void p_map_context(int core, int thread, struct ctx_t *ctx);
 void p_unmap_context(int core, int thread);
+void p_unmap_context_signal(struct ctx_t *ctx);
 void p_static_schedule(void);
 void p_dynamic_schedule(void);
 
 void p_stages(void);
+void p_skip_cycles(uint64_t limit);
 void p_fetch(void);
 void p_decode(void);
 void p_dispatch(void);
@@ -870,4 +969,66 @@ void p_issue(void);
 void p_writeback(void);
 void p_commit(void);
 void p_recover(int core, int thread);
+void p_recover_context(int core, int thread);
+
+void decode_core(int core);
+void dispatch_core(int core);
+void issue_core(int core);
+void writeback_core(int core);
+void commit_core(int core);
+
+int fetch_idle(int core);
+int decode_idle(int core);
+int dispatch_idle(int core);
+int issue_idle(int core);
+int commit_idle(int core);
+void dispatch_skip(int core, uint64_t cycles);
+
+
+
+
+/* Sampled Simulation
+ *
+ * A profile run ('-sample:profile') executes the programs functionally and
+ * writes a basic block vector per interval of 'sample_interval' instructions,
+ * in SimPoint format. A sampled run ('-sample:bbv') clusters these vectors
+ * with k-means over a random projection, and simulates in detail only the
+ * intervals closest to the center of each cluster, each after a warm-up
+ * window. The rest runs functionally. Whole program CPI, branch
+ * mispredictions and cache miss rates are estimated with clusters as strata
+ * weighted by their size, with 95% confidence intervals. */
+
+extern char *sample_profile_file;
+extern char *sample_bbv_file;
+extern char *sample_report_file;
+extern uint64_t sample_interval;
+extern uint64_t sample_warmup;
+extern uint32_t sample_clusters;
+extern uint32_t sample_points;
+
+void sample_reg_options(void);
+void sample_run(void);
+
+
+
+
+/* Parallel Simulation
+ *
+ * With more than one host thread ('-host_threads'), the stages from commit
+ * to decode of each core run on a host thread, cores being dealt round robin
+ * to host threads, and fetch runs on the main thread afterwards. Results do
+ * not depend on the number of host threads. */
+
+enum parallel_action_enum {
+	parallel_action_recover = 0,  /* p_recover_context */
+	parallel_action_unmap  /* p_unmap_context */
+};
+
+extern uint32_t parallel_threads;
+
+void parallel_reg_options(void);
+void parallel_init(void);
+void parallel_done(void);
+void parallel_stages(void);
+int parallel_defer(int core, int thread, enum parallel_action_enum action);
 
@@ -0,0 +1,256 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2s.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+/* Number of host threads */
+uint32_t parallel_threads = 1;
+
+/* Times a worker checks for a new cycle before going to sleep. Threads
+ * waiting in a loop yield the host CPU, in case there are more host
+ * threads than CPUs. */
+#define PARALLEL_SPIN  100000
+
+
+/* Actions of a core on state shared by all cores, such as the kernel
+ * context lists, carried out by the main thread once all host threads are
+ * done. They are replayed stage by stage and core by core, which is the
+ * order the stages run them in serial simulation. */
+struct parallel_action_t {
+	enum parallel_action_enum action;
+	int stage;  /* 0 for commit, 1 for writeback */
+	int thread;
+	struct ctx_t *ctx;  /* Context to unmap */
+};
+
+struct parallel_core_t {
+	struct parallel_action_t *action;
+	int count;
+	int size;
+};
+
+/* One per core */
+static struct parallel_core_t *parallel_core;
+
+/* Host thread 0 is the main thread, and the rest are workers. Workers wait
+ * for 'parallel_cycle' to change, checking it in a loop at first, and then
+ * sleeping on 'parallel_cond'. The main thread waits for all workers to
+ * increase 'parallel_finished'. */
+static pthread_t *parallel_workers;
+static pthread_mutex_t parallel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t parallel_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int parallel_cycle;
+static int parallel_finished;
+static int parallel_sleeping;
+static int parallel_exit;
+
+/* Set while host threads run stages */
+static int parallel_running;
+
+
+void parallel_reg_options()
+{
+	opt_reg_uint32("-host_threads", "host threads running the cores (parallel simulation)",
+		&parallel_threads);
+}
+
+
+/* Run the stages from commit to decode of the cores of a host thread */
+static void parallel_run(int host)
+{
+	int core;
+
+	for (core = host; core < p_cores; core += parallel_threads) {
+		commit_core(core);
+		writeback_core(core);
+		issue_core(core);
+		dispatch_core(core);
+		decode_core(core);
+	}
+}
+
+
+/* Wait for the cycle following 'cycle'. Return 0 if simulation finished. */
+static int parallel_wait(unsigned int cycle)
+{
+	int spin;
+
+	for (spin = 0; spin < PARALLEL_SPIN; spin++) {
+		if (__atomic_load_n(&parallel_cycle, __ATOMIC_ACQUIRE) != cycle)
+			return 1;
+		sched_yield();
+	}
+	pthread_mutex_lock(&parallel_mutex);
+	__atomic_add_fetch(&parallel_sleeping, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&parallel_cycle, __ATOMIC_SEQ_CST) == cycle && !parallel_exit)
+		pthread_cond_wait(&parallel_cond, &parallel_mutex);
+	__atomic_sub_fetch(&parallel_sleeping, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&parallel_mutex);
+	return !parallel_exit;
+}
+
+
+static void *parallel_worker(void *arg)
+{
+	int host = (long) arg;
+	unsigned int cycle = 0;
+
+	while (parallel_wait(cycle)) {
+		cycle = __atomic_load_n(&parallel_cycle, __ATOMIC_ACQUIRE);
+		parallel_run(host);
+		__atomic_add_fetch(&parallel_finished, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+
+void parallel_init()
+{
+	long host;
+
+	if (parallel_threads < 1)
+		fatal("-host_threads must be at least 1");
+	if (parallel_threads > p_cores)
+		parallel_threads = p_cores;
+	if (parallel_threads > 1 && (esim_debug_file || p_stage_time_stats)) {
+		warning("-host_threads: pipeline debug and stage times need one host thread");
+		parallel_threads = 1;
+	}
+	if (parallel_threads == 1)
+		return;
+
+	/* Cores only meet in the cache system below their first-level caches */
+	if (!cache_system_private_caches())
+		fatal("-host_threads: first-level caches must be private to each core");
+
+	/* Start workers */
+	parallel_core = calloc(p_cores, sizeof(struct parallel_core_t));
+	parallel_workers = calloc(parallel_threads, sizeof(pthread_t));
+	for (host = 1; host < parallel_threads; host++)
+		if (pthread_create(&parallel_workers[host], NULL, parallel_worker, (void *) host))
+			fatal("parallel_init: cannot create host thread");
+}
+
+
+void parallel_done()
+{
+	int host, core;
+
+	if (!parallel_workers)
+		return;
+	pthread_mutex_lock(&parallel_mutex);
+	parallel_exit = 1;
+	pthread_cond_broadcast(&parallel_cond);
+	pthread_mutex_unlock(&parallel_mutex);
+	for (host = 1; host < parallel_threads; host++)
+		pthread_join(parallel_workers[host], NULL);
+	FOREACH_CORE
+		free(parallel_core[core].action);
+	free(parallel_core);
+	free(parallel_workers);
+	parallel_core = NULL;
+	parallel_workers = NULL;
+}
+
+
+/* Called by the stages before an action on shared state. If host threads
+ * are running, queue the action and return non-zero. An evicted context
+ * leaves its hardware thread right away, so that the following stages
+ * see it as they would in serial simulation. */
+int parallel_defer(int core, int thread, enum parallel_action_enum action)
+{
+	struct parallel_core_t *pcore;
+	struct parallel_action_t *paction;
+
+	if (!parallel_running)
+		return 0;
+	pcore = &parallel_core[core];
+	if (pcore->count == pcore->size) {
+		pcore->size = pcore->size ? pcore->size * 2 : 8;
+		pcore->action = realloc(pcore->action, pcore->size * sizeof(struct parallel_action_t));
+		if (!pcore->action)
+			fatal("parallel_defer: out of memory");
+	}
+	paction = &pcore->action[pcore->count++];
+	paction->action = action;
+	paction->stage = action == parallel_action_recover &&
+		p_recover_kind == p_recover_kind_writeback;
+	paction->thread = thread;
+	paction->ctx = THREAD.ctx;
+	if (action == parallel_action_unmap) {
+		THREAD.ctx = NULL;
+		THREAD.fetch_neip = 0;
+	}
+	return 1;
+}
+
+
+/* Stages from commit to decode of all cores. Accesses to the cache system
+ * are deferred meanwhile, so that coherence messages are sent in order of
+ * core once the host threads are done. */
+void parallel_stages()
+{
+	struct parallel_action_t *action;
+	int core, thread, stage, i;
+
+	/* Start workers */
+	p->stage = "parallel";
+	parallel_running = 1;
+	cache_system_defer(1);
+	__atomic_store_n(&parallel_finished, 0, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&parallel_cycle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&parallel_sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&parallel_mutex);
+		pthread_cond_broadcast(&parallel_cond);
+		pthread_mutex_unlock(&parallel_mutex);
+	}
+
+	/* Run cores of the main thread, and wait for the rest */
+	parallel_run(0);
+	while (__atomic_load_n(&parallel_finished, __ATOMIC_ACQUIRE) < parallel_threads - 1)
+		sched_yield();
+	parallel_running = 0;
+	cache_system_defer(0);
+
+	/* Actions on shared state */
+	for (stage = 0; stage < 2; stage++) {
+		FOREACH_CORE {
+			for (i = 0; i < parallel_core[core].count; i++) {
+				action = &parallel_core[core].action[i];
+				if (action->stage != stage)
+					continue;
+				thread = action->thread;
+				switch (action->action) {
+				case parallel_action_recover:
+					p_recover_context(core, thread);
+					break;
+				case parallel_action_unmap:
+					THREAD.ctx = action->ctx;
+					p_unmap_context(core, thread);
+					break;
+				}
+			}
+		}
+	}
+	FOREACH_CORE
+		parallel_core[core].count = 0;
+}
@@ -32,6 +32,8 @@ uint32_t p_threads = 1;
 uint32_t p_cpus = 1;
 uint32_t p_context_quantum = 100000;
 int p_context_switch = 1;
+int p_warm = 0;
+int p_cycle_skip = 1;
 uint32_t p_thread_quantum = 1000;
 uint32_t p_thread_switch_penalty = 0;
 char *p_report_file = "";
@@ -52,6 +54,15 @@ uint32_t p_issue_width = 4;
 enum p_commit_kind_enum p_commit_kind = p_commit_kind_shared;
 uint32_t p_commit_width = 4;
 
+/* Warming state per cpu */
+struct p_warm_cpu_t {
+	int pid;  /* Context warming this cpu */
+	uint32_t block;  /* Last instruction block fetched */
+};
+
+static struct p_warm_cpu_t *p_warm_cpu;
+static struct list_t *p_warm_list;
+
 
 
 
@@ -72,7 +83,11 @@ void p_reg_options()
 		&p_context_switch);
 	opt_reg_uint32("-context_quantum", "quantum for a context before context switch",
 		&p_context_quantum);
+	opt_reg_bool("-warm", "warm up caches, TLBs and branch predictors while fast-forwarding",
+		&p_warm);
 
+	opt_reg_bool("-cycle_skip", "skip cycles in which pipelines and caches are idle",
+		&p_cycle_skip);
 	opt_reg_bool("-stage_time_stats", "measure time for stages",
 		&p_stage_time_stats);
 	opt_reg_bool("-occupancy_stats", "include occupancy stats in the pipeline report",
@@ -116,6 +131,8 @@ void p_reg_options()
 	iq_reg_options();
 	lsq_reg_options();
 	fu_reg_options();
+	sample_reg_options();
+	parallel_reg_options();
 }
 
 
@@ -165,6 +182,34 @@ void p_dump_uop_report(FILE *f, uint64_t *uop_stats, char *prefix, int peak_ipc)
 		(double) CORE.fu->waiting_time[ITEM] / CORE.fu->accesses[ITEM] : 0.0); \
 }
 
+/* Add up the stage statistics of all cores into the processor totals. The
+ * stages only update per core counters, since cores can run on different
+ * host threads. */
+void p_sum_stats(void)
+{
+	int core, uop;
+
+	p->squashed = 0;
+	p->branches = 0;
+	p->mispred = 0;
+	for (uop = 0; uop < uop_count; uop++) {
+		p->dispatched[uop] = 0;
+		p->issued[uop] = 0;
+		p->committed[uop] = 0;
+	}
+	FOREACH_CORE {
+		p->squashed += CORE.squashed;
+		p->branches += CORE.branches;
+		p->mispred += CORE.mispred;
+		for (uop = 0; uop < uop_count; uop++) {
+			p->dispatched[uop] += CORE.dispatched[uop];
+			p->issued[uop] += CORE.issued[uop];
+			p->committed[uop] += CORE.committed[uop];
+		}
+	}
+}
+
+
 #define DUMP_DISPATCH_STAT(NAME) { \
 	fprintf(f, "Dispatch.Stall." #NAME " = %lld\n", (long long) CORE.di_stall[di_stall_##NAME]); \
 }
@@ -197,11 +242,13 @@ void p_dump_report()
 	f = open_write(p_report_file);
 	if (!f)
 		return;
+	p_sum_stats();
 	
 	/* Report for the complete processor */
 	fprintf(f, "; Global statistics\n");
 	fprintf(f, "[ global ]\n\n");
 	fprintf(f, "Cycles = %lld\n", (long long) sim_cycle);
+	fprintf(f, "CyclesSkipped = %lld\n", (long long) p->skipped);
 	fprintf(f, "Time = %.1f\n", (double) now / 1000000);
 	fprintf(f, "CyclesPerSecond = %.0f\n", now ? (double) sim_cycle / now * 1000000 : 0.0);
 	fprintf(f, "MemoryUsed = %lu\n", (long) mem_mapped_space);
@@ -371,6 +418,9 @@ void p_dump_report()
 			/* Trace cache stats */
 			if (THREAD.tcache)
 				tcache_dump_report(THREAD.tcache, f);
+
+			/* Branch predictor storage */
+			bpred_dump_report(THREAD.bpred, f);
 		}
 	}
 
@@ -383,6 +433,8 @@ void p_print_stats(FILE *f)
 {
 	uint64_t now = ke_timer();
 
+	p_sum_stats();
+
 	/* Global stats */
 	fprintf(f, "sim.cycles  %lld  # Simulation cycles\n",
 		(long long) sim_cycle);
@@ -436,6 +488,7 @@ void p_core_init(int core)
 {
 	int thread;
 	CORE.thread = calloc(p_threads, sizeof(struct processor_thread_t));
+	CORE.uop_ring = uop_ring_create();
 	FOREACH_THREAD
 		p_thread_init(core, thread);
 }
@@ -459,10 +512,16 @@ void p_init()
 	fetchq_init();
 	uopq_init();
 	rob_init();
-	iq_init();
 	lsq_init();
 	eventq_init();
 	fu_init();
+
+	/* Warming */
+	p_warm_cpu = calloc(p_cpus, sizeof(struct p_warm_cpu_t));
+	p_warm_list = list_create(10);
+
+	/* Host threads */
+	parallel_init();
 }
 
 
@@ -475,6 +534,7 @@ void p_done()
 	p_print_stats(stderr);
 
 	/* Finalize structures */
+	parallel_done();
 	fetchq_done();
 	uopq_done();
 	rob_done();
@@ -485,10 +545,14 @@ void p_done()
 	tcache_done();
 	rf_done();
 	fu_done();
+	free(p_warm_cpu);
+	list_free(p_warm_list);
 
 	/* Free processor */
-	FOREACH_CORE
+	FOREACH_CORE {
+		uop_ring_free(CORE.uop_ring);
 		free(CORE.thread);
+	}
 	free(p->core);
 	free(p);
 }
@@ -521,7 +585,7 @@ void p_dump(FILE *f)
 		fprintf(f, "Core %d:\n", core);
 		
 		fprintf(f, "eventq:\n");
-		uop_lnlist_dump(CORE.eventq, f);
+		eventq_dump(core, f);
 		fprintf(f, "rob:\n");
 		rob_dump(core, f);
 
@@ -533,7 +597,7 @@ void p_dump(FILE *f)
 			fprintf(f, "uop queue:\n");
 			uop_list_dump(THREAD.uopq, f);
 			fprintf(f, "iq:\n");
-			uop_lnlist_dump(THREAD.iq, f);
+			iq_dump(core, thread, f);
 			fprintf(f, "lq:\n");
 			uop_lnlist_dump(THREAD.lq, f);
 			fprintf(f, "sq:\n");
@@ -555,20 +619,21 @@ void p_dump(FILE *f)
 
 
 #define UPDATE_THREAD_OCCUPANCY_STATS(ITEM) { \
-	THREAD.ITEM##_occupancy += THREAD.ITEM##_count; \
+	THREAD.ITEM##_occupancy += THREAD.ITEM##_count * cycles; \
 	if (THREAD.ITEM##_count == ITEM##_size) \
-		THREAD.ITEM##_full++; \
+		THREAD.ITEM##_full += cycles; \
 }
 
 
 #define UPDATE_CORE_OCCUPANCY_STATS(ITEM) { \
-	CORE.ITEM##_occupancy += CORE.ITEM##_count; \
+	CORE.ITEM##_occupancy += CORE.ITEM##_count * cycles; \
 	if (CORE.ITEM##_count == ITEM##_size * p_threads) \
-		CORE.ITEM##_full++; \
+		CORE.ITEM##_full += cycles; \
 }
 
 
-void p_update_occupancy_stats()
+/* Add the occupancy of the structures over 'cycles' cycles */
+void p_update_occupancy_stats(uint64_t cycles)
 {
 	int core, thread;
 
@@ -620,6 +685,8 @@ static uint64_t stage_time_start;
 		stage_time_start = end; }
 void p_stages()
 {
+	int core;
+
 	/* Static scheduler called after any context changed status other than 'sepcmode' */
 	if (!p_context_switch && ke->context_reschedule) {
 		p_static_schedule();
@@ -643,31 +710,189 @@ void p_stages()
 		stage_time_start = end;
 	}
 
-	/* Stages */
-	STAGE(commit);
-	STAGE(writeback);
-	STAGE(issue);
-	STAGE(dispatch);
-	STAGE(decode);
-	STAGE(fetch);
+	/* Stages. With host threads, fetch runs alone after the rest. */
+	if (parallel_threads > 1) {
+		parallel_stages();
+		p_fetch();
+	} else {
+		STAGE(commit);
+		STAGE(writeback);
+		STAGE(issue);
+		STAGE(dispatch);
+		STAGE(decode);
+		STAGE(fetch);
+	}
+
+	/* Committed instructions */
+	sim_inst = 0;
+	FOREACH_CORE
+		sim_inst += CORE.inst;
 
 	/* Update stats for structures occupancy */
 	if (p_occupancy_stats)
-		p_update_occupancy_stats();
+		p_update_occupancy_stats(1);
 }
 #undef STAGE
 
 
+/* Cycle skipping. Called after a cycle. If no stage of any core can do
+ * anything but update statistics until some future cycle, and neither the
+ * cache system nor the scheduler have anything to do before, jump to the
+ * cycle before it, as if the cycles in between had been simulated. Cycle
+ * 'limit' is never skipped, unless it is 0. */
+void p_skip_cycles(uint64_t limit)
+{
+	uint64_t until, when, cycles;
+	int core;
+
+	/* Schedulers and kernel events */
+	if (!p_cycle_skip || ke->context_reschedule || p->ctx_dealloc_signals ||
+		ke->suspended_list_head)
+		return;
+
+	/* Idle stages. Each core bounds the skip with the next
+	 * uop completing in its event queue. */
+	until = limit ? limit : (uint64_t) -1;
+	FOREACH_CORE {
+		if (!commit_idle(core) || !issue_idle(core) || !dispatch_idle(core) ||
+			!decode_idle(core) || !fetch_idle(core))
+			return;
+		when = eventq_next(core);
+		if (when)
+			until = MIN(until, when);
+		if (until <= sim_cycle + 1)
+			return;
+	}
+
+	/* Next event in the cache system, processed at the end of a cycle */
+	if (esim_next_event(&when))
+		until = MIN(until, sim_cycle + 1 + when - esim_cycle);
+	if (p_context_switch)
+		until = MIN(until, p->ctx_alloc_oldest + p_context_quantum);
+	if (until == (uint64_t) -1 || until <= sim_cycle + 1)
+		return;
+
+	/* Skip cycles */
+	cycles = until - sim_cycle - 1;
+	FOREACH_CORE
+		dispatch_skip(core, cycles);
+	if (p_occupancy_stats)
+		p_update_occupancy_stats(cycles);
+	sim_cycle += cycles;
+	esim_cycle += cycles;
+	p->skipped += cycles;
+}
+
+
+/* Warming. While fast-forwarding, instructions run functionally feed their
+ * fetch and memory addresses and their branch outcomes to the caches, TLBs,
+ * branch predictors and trace caches, as if they had gone through the
+ * pipeline, so that detailed simulation does not start with them cold.
+ * A context warms the structures of the hardware thread it was last mapped
+ * to, or otherwise of one given to it in order of appearance. */
+
+static int p_warm_ctx_to_cpu(struct ctx_t *ctx)
+{
+	int cpu;
+
+	if (ctx->alloc_when)
+		return ctx->alloc_core * p_threads + ctx->alloc_thread;
+	for (cpu = 0; cpu < p_cpus; cpu++) {
+		if (!p_warm_cpu[cpu].pid)
+			p_warm_cpu[cpu].pid = ctx->pid;
+		if (p_warm_cpu[cpu].pid == ctx->pid)
+			return cpu;
+	}
+	return ctx->pid % p_cpus;
+}
+
+
+/* Warm up with the instruction just run by 'ctx' at 'eip', still
+ * in 'isa_inst'. */
+void p_warm_inst(struct ctx_t *ctx, uint32_t eip)
+{
+	struct uop_t *uop;
+	uint32_t block, phaddr;
+	int core, thread, cpu, count, i;
+
+	if (!isa_inst.size)
+		return;
+	cpu = p_warm_ctx_to_cpu(ctx);
+	core = cpu / p_threads;
+	thread = cpu % p_threads;
+
+	/* Instruction cache and TLB, once per block */
+	block = eip & ~(THREAD.fetch_bsize - 1);
+	if (block != p_warm_cpu[cpu].block) {
+		p_warm_cpu[cpu].block = block;
+		phaddr = mmu_translate(ctx->mid, eip);
+		cache_system_warm(core, thread, cache_kind_inst,
+			cache_access_kind_read, phaddr);
+	}
+
+	/* Decode the instruction and fill in the uop fields that the branch
+	 * predictor and trace cache read at commit */
+	uop_decode(p_warm_list, core);
+	count = list_count(p_warm_list);
+	for (i = 0; i < count; i++) {
+		uop = list_get(p_warm_list, i);
+		UOP_HOT(uop, seq) = i;
+		uop->mop_seq = 0;
+		uop->mop_size = isa_inst.size;
+		uop->mop_count = count;
+		uop->mop_index = i;
+		uop->ctx = ctx;
+		uop->core = core;
+		uop->thread = thread;
+		uop->eip = eip;
+		uop->neip = ctx->regs->eip;
+		uop->target_neip = isa_target;
+
+		/* Data cache and TLB */
+		if (UOP_HOT(uop, flags) & FMEM) {
+			phaddr = mmu_translate(ctx->mid, ctx->mem->last_address);
+			cache_system_warm(core, thread, cache_kind_data, UOP_HOT(uop, flags) & FSTORE ?
+				cache_access_kind_write : cache_access_kind_read, phaddr);
+		}
+
+		/* Branch predictor and trace cache */
+		if (UOP_HOT(uop, flags) & FCTRL)
+			bpred_warm(THREAD.bpred, uop);
+		if (tcache_present)
+			tcache_new_uop(THREAD.tcache, uop);
+	}
+
+	/* Free uops */
+	while (list_count(p_warm_list))
+		uop_free_if_not_queued(list_pop(p_warm_list));
+}
+
+
+static void p_warm_hook(struct ctx_t *ctx, uint32_t eip, int count)
+{
+	p_warm_inst(ctx, eip);
+}
+
+
 /* Fast forward simulation */
 void p_fast_forward(uint64_t cycles)
 {
+	void (*block_hook)(struct ctx_t *ctx, uint32_t eip, int count) = ke_block_hook;
+	int block_dispatch = isa_block_dispatch;
 	int core, thread;
 
-	/* Functional simulation */
+	/* Functional simulation. Warming needs each instruction to be decoded,
+	 * so basic blocks are not used meanwhile. */
+	if (p_warm) {
+		ke_block_hook = p_warm_hook;
+		isa_block_dispatch = 0;
+	}
 	while (cycles && ke->context_list_head) {
 		ke_run();
 		cycles--;
 	}
+	ke_block_hook = block_hook;
+	isa_block_dispatch = block_dispatch;
 	
 	/* Free finished contexts and update
 	 * context mappings. */
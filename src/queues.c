@@ -90,7 +90,7 @@ void fetchq_recover(int core, int thread)
 	while (list_count(fetchq)) {
 		uop = list_get(fetchq, list_count(fetchq) - 1);
 		assert(uop->thread == thread);
-		if (!uop->specmode)
+		if (!UOP_HOT(uop, specmode))
 			break;
 		uop = fetchq_remove(core, thread, list_count(fetchq) - 1);
 		uop_free_if_not_queued(uop);
@@ -145,7 +145,7 @@ void uopq_recover(int core, int thread)
 	while (list_count(uopq)) {
 		uop = list_get(uopq, list_count(uopq) - 1);
 		assert(uop->thread == thread);
-		if (!uop->specmode)
+		if (!UOP_HOT(uop, specmode))
 			break;
 		list_remove_at(uopq, list_count(uopq) - 1);
 		uop->in_uopq = 0;
@@ -172,29 +172,16 @@ void iq_reg_options()
 }
 
 
-void iq_init()
-{
-	int core, thread;
-	FOREACH_CORE FOREACH_THREAD
-		THREAD.iq = lnlist_create();
-}
-
-
 void iq_done()
 {
-	struct lnlist_t *iq;
 	struct uop_t *uop;
 	int core, thread;
 	FOREACH_CORE FOREACH_THREAD {
-		iq = THREAD.iq;
-		lnlist_head(iq);
-		while (lnlist_count(iq)) {
-			uop = lnlist_get(iq);
-			uop->in_iq = 0;
-			lnlist_remove(iq);
+		while (THREAD.iq_head) {
+			uop = UOP_GET(CORE.uop_ring, THREAD.iq_head);
+			iq_remove(uop);
 			uop_free_if_not_queued(uop);
 		}
-		lnlist_free(iq);
 	}
 }
 
@@ -211,17 +198,24 @@ int iq_can_insert(struct uop_t *uop)
 }
 
 
-/* Insert a uop into the corresponding IQ. Since this is a non-FIFO queue,
- * the insertion position doesn't matter. */
+/* Insert a uop into the corresponding IQ. Uops are kept in dispatch order,
+ * and they go into the ready queue of their functional unit class when
+ * their input registers are written (see 'iq_ready'). */
 void iq_insert(struct uop_t *uop)
 {
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t index = uop->index;
 	int core = uop->core;
 	int thread = uop->thread;
-	struct lnlist_t *iq = THREAD.iq;
 
 	assert(!uop->in_iq);
-	lnlist_out(iq);
-	lnlist_insert(iq, uop);
+	ring->iq_prev[index] = THREAD.iq_tail;
+	ring->iq_next[index] = 0;
+	if (THREAD.iq_tail)
+		ring->iq_next[THREAD.iq_tail] = index;
+	else
+		THREAD.iq_head = index;
+	THREAD.iq_tail = index;
 	uop->in_iq = 1;
 
 	CORE.iq_count++;
@@ -229,39 +223,107 @@ void iq_insert(struct uop_t *uop)
 }
 
 
-/* Remove the uop in the current position of the linked list representing
- * the IQ of the specified thread. */
-void iq_remove(int core, int thread)
+/* Remove a uop from the IQ and from its ready queue, if it is ready */
+void iq_remove(struct uop_t *uop)
 {
-	struct lnlist_t *iq = THREAD.iq;
-	struct uop_t *uop;
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t index = uop->index;
+	uint32_t prev, next;
+	int core = uop->core;
+	int thread = uop->thread;
+	int fu_class = uop->fu_class;
 
-	uop = lnlist_get(iq);
 	assert(uop_exists(uop));
-	lnlist_remove(iq);
+	assert(uop->in_iq);
+	prev = ring->iq_prev[index];
+	next = ring->iq_next[index];
+	if (prev)
+		ring->iq_next[prev] = next;
+	else
+		THREAD.iq_head = next;
+	if (next)
+		ring->iq_prev[next] = prev;
+	else
+		THREAD.iq_tail = prev;
+	ring->iq_prev[index] = ring->iq_next[index] = 0;
 	uop->in_iq = 0;
 
+	if (ring->ready[index]) {
+		prev = ring->ready_prev[index];
+		next = ring->ready_next[index];
+		if (prev)
+			ring->ready_next[prev] = next;
+		else
+			THREAD.iq_ready_head[fu_class] = next;
+		if (next)
+			ring->ready_prev[next] = prev;
+		else
+			THREAD.iq_ready_tail[fu_class] = prev;
+		ring->ready_prev[index] = ring->ready_next[index] = 0;
+	}
+
 	assert(CORE.iq_count && THREAD.iq_count);
 	CORE.iq_count--;
 	THREAD.iq_count--;
 }
 
 
-/* Remove all speculative uops from the current thread */
+/* Remove all speculative uops from the current thread. They are the
+ * youngest ones, at the tail of the IQ. */
 void iq_recover(int core, int thread)
 {
-	struct lnlist_t *iq = THREAD.iq;
+	struct uop_ring_t *ring = CORE.uop_ring;
 	struct uop_t *uop;
 
-	lnlist_head(iq);
-	while (!lnlist_eol(iq)) {
-		uop = lnlist_get(iq);
-		if (uop->specmode) {
-			iq_remove(core, thread);
-			uop_free_if_not_queued(uop);
-			continue;
-		}
-		lnlist_next(iq);
+	while (THREAD.iq_tail && ring->specmode[THREAD.iq_tail]) {
+		uop = UOP_GET(ring, THREAD.iq_tail);
+		iq_remove(uop);
+		uop_free_if_not_queued(uop);
+	}
+}
+
+
+/* Insert a uop in the IQ whose input registers have been written into the
+ * ready queue of its functional unit class. Queues are sorted by dispatch
+ * sequence number. Uops are mostly woken up in dispatch order, so the
+ * position is searched from the tail. */
+void iq_ready(struct uop_t *uop)
+{
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t index = uop->index;
+	uint32_t prev, next;
+	int core = uop->core;
+	int thread = uop->thread;
+	int fu_class = uop->fu_class;
+
+	assert(uop->in_iq && ring->ready[index]);
+	for (prev = THREAD.iq_ready_tail[fu_class]; prev; prev = ring->ready_prev[prev])
+		if (ring->di_seq[prev] < ring->di_seq[index])
+			break;
+	next = prev ? ring->ready_next[prev] : THREAD.iq_ready_head[fu_class];
+	ring->ready_prev[index] = prev;
+	ring->ready_next[index] = next;
+	if (next)
+		ring->ready_prev[next] = index;
+	else
+		THREAD.iq_ready_tail[fu_class] = index;
+	if (prev)
+		ring->ready_next[prev] = index;
+	else
+		THREAD.iq_ready_head[fu_class] = index;
+}
+
+
+void iq_dump(int core, int thread, FILE *f)
+{
+	struct uop_ring_t *ring = CORE.uop_ring;
+	uint32_t index;
+	int n = 0;
+
+	for (index = THREAD.iq_head; index; index = ring->iq_next[index]) {
+		fprintf(f, "%3d. ", n++);
+		uop_dump(UOP_GET(ring, index), f);
+		fprintf(f, "\n");
 	}
 }
 
@@ -349,8 +411,8 @@ void lsq_insert(struct uop_t *uop)
 	struct lnlist_t *sq = THREAD.sq;
 
 	assert(!uop->in_lq && !uop->in_sq);
-	assert((uop->flags & FLOAD) || (uop->flags & FSTORE));
-	if (uop->flags & FLOAD) {
+	assert(UOP_HOT(uop, flags) & (FLOAD | FSTORE));
+	if (UOP_HOT(uop, flags) & FLOAD) {
 		lnlist_out(lq);
 		lnlist_insert(lq, uop);
 		uop->in_lq = 1;
@@ -376,7 +438,7 @@ void lsq_recover(int core, int thread)
 	lnlist_head(lq);
 	while (!lnlist_eol(lq)) {
 		uop = lnlist_get(lq);
-		if (uop->specmode) {
+		if (UOP_HOT(uop, specmode)) {
 			lq_remove(core, thread);
 			uop_free_if_not_queued(uop);
 			continue;
@@ -388,7 +450,7 @@ void lsq_recover(int core, int thread)
 	lnlist_head(sq);
 	while (!lnlist_eol(sq)) {
 		uop = lnlist_get(sq);
-		if (uop->specmode) {
+		if (UOP_HOT(uop, specmode)) {
 			sq_remove(core, thread);
 			uop_free_if_not_queued(uop);
 			continue;
@@ -438,112 +500,337 @@ void sq_remove(int core, int thread)
 
 /* Event Queue */
 
+/* Uops complete within the wheel when 'when' is below 'cycle' plus the
+ * wheel size. Buckets are sorted by 'seq', and the overflow list by 'when'
+ * and 'seq', so uops are extracted in the same order as in a sorted list.
+ * Besides, each thread keeps its uops in the event queue in issue order,
+ * which is also age order, in two lists of all uops and of loads. Memory
+ * uops are in these lists since they are issued to the cache system. */
+
+#define EVENTQ_LONGLAT  20  /* Cycles for a uop to be a long latency one */
+#define EVENTQ_CACHEMISS  5  /* Cycles for a load to be a cache miss */
+
+enum {
+	eventq_age_all = 0,
+	eventq_age_load
+};
+
+
 void eventq_init()
 {
 	int core;
-	FOREACH_CORE
-		CORE.eventq = lnlist_create();
+	FOREACH_CORE {
+		CORE.eventq = calloc(1, sizeof(struct eventq_t));
+		CORE.eventq->mem = lnlist_create();
+	}
+}
+
+
+static void eventq_free_list(int core, uint32_t index)
+{
+	struct uop_ring_t *ring = CORE.uop_ring;
+	struct uop_t *uop;
+	uint32_t next;
+
+	for (; index; index = next) {
+		next = ring->eventq_next[index];
+		ring->eventq_next[index] = 0;
+		uop = UOP_GET(ring, index);
+		uop->in_eventq = 0;
+		uop_free_if_not_queued(uop);
+	}
 }
 
 
 void eventq_done()
 {
-	int core;
+	struct eventq_t *eventq;
+	struct uop_t *uop;
+	int core, i;
+
 	FOREACH_CORE {
-		while (lnlist_count(CORE.eventq))
-			uop_free_if_not_queued(eventq_extract(CORE.eventq));
-		lnlist_free(CORE.eventq);
+		eventq = CORE.eventq;
+		while (lnlist_count(eventq->mem)) {
+			lnlist_head(eventq->mem);
+			uop = lnlist_get(eventq->mem);
+			lnlist_remove(eventq->mem);
+			uop->in_eventq = 0;
+			uop_free_if_not_queued(uop);
+		}
+		for (i = 0; i < EVENTQ_WHEEL_SIZE; i++)
+			eventq_free_list(core, eventq->wheel[i]);
+		eventq_free_list(core, eventq->overflow);
+		lnlist_free(eventq->mem);
+		free(eventq);
 	}
 }
 
 
-static int eventq_compare(const void *item1, const void *item2)
+static void eventq_age_add(struct uop_t *uop, int list)
+{
+	struct processor_thread_t *thread = &p->core[uop->core].thread[uop->thread];
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t index = uop->index;
+
+	ring->age_prev[list][index] = thread->eventq_newest[list];
+	ring->age_next[list][index] = 0;
+	if (thread->eventq_newest[list])
+		ring->age_next[list][thread->eventq_newest[list]] = index;
+	else
+		thread->eventq_oldest[list] = index;
+	thread->eventq_newest[list] = index;
+	thread->eventq_count[list]++;
+}
+
+
+static void eventq_age_remove(struct uop_t *uop, int list)
+{
+	struct processor_thread_t *thread = &p->core[uop->core].thread[uop->thread];
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t prev = ring->age_prev[list][uop->index];
+	uint32_t next = ring->age_next[list][uop->index];
+
+	if (prev)
+		ring->age_next[list][prev] = next;
+	else
+		thread->eventq_oldest[list] = next;
+	if (next)
+		ring->age_prev[list][next] = prev;
+	else
+		thread->eventq_newest[list] = prev;
+	thread->eventq_count[list]--;
+	assert(thread->eventq_count[list] >= 0);
+}
+
+
+/* Uop issued, in the event queue until extracted */
+static void eventq_track(struct uop_t *uop)
+{
+	assert(!uop->in_eventq);
+	assert(uop->issue_when == sim_cycle);
+	uop->in_eventq = 1;
+	eventq_age_add(uop, eventq_age_all);
+	if (UOP_HOT(uop, flags) & FLOAD)
+		eventq_age_add(uop, eventq_age_load);
+}
+
+
+static void eventq_untrack(struct uop_t *uop)
 {
-	const struct uop_t *uop1 = item1;
-	const struct uop_t *uop2 = item2;
-	return uop1->when != uop2->when ? uop1->when - uop2->when
-		: uop1->seq - uop2->seq;
+	assert(uop->in_eventq);
+	uop->in_eventq = 0;
+	eventq_age_remove(uop, eventq_age_all);
+	if (UOP_HOT(uop, flags) & FLOAD)
+		eventq_age_remove(uop, eventq_age_load);
 }
 
 
+/* There is a uop of the thread in the event queue issued more than
+ * EVENTQ_LONGLAT cycles ago. The oldest one tells. */
 int eventq_longlat(int core, int thread)
 {
-	struct lnlist_t *eventq = CORE.eventq;
-	struct uop_t *uop;
-	
-	for (lnlist_head(eventq); !lnlist_eol(eventq); lnlist_next(eventq)) {
-		uop = lnlist_get(eventq);
-		if (uop->thread != thread)
-			continue;
-		if (sim_cycle - uop->issue_when > 20)
-			return 1;
-	}
-	return 0;
+	uint32_t index = THREAD.eventq_oldest[eventq_age_all];
+	return index && sim_cycle - UOP_GET(CORE.uop_ring, index)->issue_when > EVENTQ_LONGLAT;
 }
 
 
 int eventq_cachemiss(int core, int thread)
 {
-	struct lnlist_t *eventq = CORE.eventq;
-	struct uop_t *uop;
+	uint32_t index = THREAD.eventq_oldest[eventq_age_load];
+	return index && sim_cycle - UOP_GET(CORE.uop_ring, index)->issue_when > EVENTQ_CACHEMISS;
+}
 
-	for (lnlist_head(eventq); !lnlist_eol(eventq); lnlist_next(eventq)) {
-		uop = lnlist_get(eventq);
-		if (uop->thread != thread || !(uop->flags & FLOAD))
-			continue;
-		if (sim_cycle - uop->issue_when > 5)
-			return 1;
-	}
-	return 0;
+
+/* Insert a uop in a sorted list of the wheel, linked by 'eventq_next' */
+static void eventq_list_insert(struct uop_ring_t *ring, uint32_t *list, uint32_t index)
+{
+	uint32_t item;
+
+	while ((item = *list) && (ring->when[item] < ring->when[index] ||
+		(ring->when[item] == ring->when[index] && ring->seq[item] < ring->seq[index])))
+		list = &ring->eventq_next[item];
+	ring->eventq_next[index] = item;
+	*list = index;
 }
 
 
-void eventq_insert(struct lnlist_t *eventq, struct uop_t *uop)
+static void eventq_list_remove(struct uop_ring_t *ring, uint32_t *list, uint32_t index)
 {
-	struct uop_t *item;
-	assert(!uop->in_eventq);
-	lnlist_head(eventq);
-	for (;;) {
-		item = lnlist_get(eventq);
-		if (!item || eventq_compare(uop, item) < 0)
-			break;
-		lnlist_next(eventq);
+	while (*list != index) {
+		assert(*list);
+		list = &ring->eventq_next[*list];
 	}
-	lnlist_insert(eventq, uop);
-	uop->in_eventq = 1;
+	*list = ring->eventq_next[index];
+	ring->eventq_next[index] = 0;
 }
 
 
-struct uop_t *eventq_extract(struct lnlist_t *eventq)
+static uint32_t *eventq_list(struct eventq_t *eventq, uint64_t when)
 {
+	return when < eventq->cycle + EVENTQ_WHEEL_SIZE ?
+		&eventq->wheel[when % EVENTQ_WHEEL_SIZE] : &eventq->overflow;
+}
+
+
+/* Insert a uop with a known completion cycle 'when' */
+void eventq_insert(struct uop_t *uop)
+{
+	struct eventq_t *eventq = p->core[uop->core].eventq;
+	struct uop_ring_t *ring = UOP_RING(uop);
+	uint32_t *list;
+
+	assert(ring->when[uop->index] >= eventq->cycle);
+	eventq_track(uop);
+	list = eventq_list(eventq, ring->when[uop->index]);
+	eventq_list_insert(ring, list, uop->index);
+	if (list != &eventq->overflow)
+		eventq->count++;
+}
+
+
+/* Memory uop issued to the cache system, which inserts it in the list
+ * 'eventq->mem' when the access completes */
+void eventq_insert_mem(struct uop_t *uop)
+{
+	eventq_track(uop);
+}
+
+
+/* Extract the next uop completing at 'sim_cycle', or NULL. Memory uops in
+ * the list of completed accesses come first. */
+struct uop_t *eventq_extract(int core)
+{
+	struct eventq_t *eventq = CORE.eventq;
+	struct uop_ring_t *ring = CORE.uop_ring;
 	struct uop_t *uop;
-	if (!lnlist_count(eventq))
+	uint32_t index, *bucket;
+
+	/* Completed memory access */
+	lnlist_head(eventq->mem);
+	uop = lnlist_get(eventq->mem);
+	if (!lnlist_error(eventq->mem)) {
+		assert(uop_exists(uop));
+		lnlist_remove(eventq->mem);
+		ring->when[uop->index] = sim_cycle;
+		eventq_untrack(uop);
+		return uop;
+	}
+
+	/* With no uop in the buckets, move the wheel on to the current cycle,
+	 * or to the first uop in the overflow list */
+	if (!eventq->count) {
+		eventq->cycle = MAX(eventq->cycle, eventq->overflow ?
+			MIN(sim_cycle, ring->when[eventq->overflow]) : sim_cycle);
+		if (!eventq->overflow)
+			return NULL;
+	}
+
+	/* Advance the wheel up to the current cycle. Uops in the overflow list
+	 * move to their bucket as it comes within range. */
+	for (;;) {
+		while ((index = eventq->overflow) &&
+			ring->when[index] < eventq->cycle + EVENTQ_WHEEL_SIZE)
+		{
+			eventq->overflow = ring->eventq_next[index];
+			eventq_list_insert(ring, &eventq->wheel[ring->when[index] %
+				EVENTQ_WHEEL_SIZE], index);
+			eventq->count++;
+		}
+		bucket = &eventq->wheel[eventq->cycle % EVENTQ_WHEEL_SIZE];
+		if (*bucket || eventq->cycle >= sim_cycle)
+			break;
+		eventq->cycle++;
+	}
+	index = *bucket;
+	if (!index)
 		return NULL;
-	lnlist_head(eventq);
-	uop = lnlist_get(eventq);
-	assert(uop_exists(uop));
-	assert(uop->in_eventq);
-	lnlist_remove(eventq);
-	uop->in_eventq = 0;
+	assert(ring->when[index] == eventq->cycle);
+	*bucket = ring->eventq_next[index];
+	ring->eventq_next[index] = 0;
+	eventq->count--;
+	uop = UOP_GET(ring, index);
+	eventq_untrack(uop);
 	return uop;
 }
 
 
+/* Return the first cycle after the current one in which a uop completes,
+ * or 0 if there is none. Completed memory accesses are extracted in the
+ * next cycle. */
+uint64_t eventq_next(int core)
+{
+	struct eventq_t *eventq = CORE.eventq;
+	struct uop_ring_t *ring = CORE.uop_ring;
+	uint64_t cycle;
+
+	if (lnlist_count(eventq->mem))
+		return sim_cycle + 1;
+	if (eventq->count)
+		for (cycle = MAX(eventq->cycle, sim_cycle + 1);
+			cycle < eventq->cycle + EVENTQ_WHEEL_SIZE; cycle++)
+			if (eventq->wheel[cycle % EVENTQ_WHEEL_SIZE])
+				return ring->when[eventq->wheel[cycle % EVENTQ_WHEEL_SIZE]];
+	return eventq->overflow ? ring->when[eventq->overflow] : 0;
+}
+
+
+/* Remove speculative uops of a thread */
 void eventq_recover(int core, int thread)
 {
-	struct lnlist_t *eventq = CORE.eventq;
+	struct eventq_t *eventq = CORE.eventq;
+	struct uop_ring_t *ring = CORE.uop_ring;
 	struct uop_t *uop;
-
-	lnlist_head(eventq);
-	while (!lnlist_eol(eventq)) {
-		uop = lnlist_get(eventq);
-		if (uop->thread == thread && uop->specmode) {
-			lnlist_remove(eventq);
-			uop->in_eventq = 0;
+	uint32_t index, next, *list;
+
+	/* Completed memory accesses */
+	lnlist_head(eventq->mem);
+	while (!lnlist_eol(eventq->mem)) {
+		uop = lnlist_get(eventq->mem);
+		if (uop->thread == thread && ring->specmode[uop->index]) {
+			lnlist_remove(eventq->mem);
+			eventq_untrack(uop);
 			uop_free_if_not_queued(uop);
 			continue;
 		}
-		lnlist_next(eventq);
+		lnlist_next(eventq->mem);
+	}
+
+	/* Wheel. Memory uops still in the cache system stay. */
+	for (index = THREAD.eventq_oldest[eventq_age_all]; index; index = next) {
+		next = ring->age_next[eventq_age_all][index];
+		if (!ring->specmode[index] || (ring->flags[index] & FMEM))
+			continue;
+		list = eventq_list(eventq, ring->when[index]);
+		eventq_list_remove(ring, list, index);
+		if (list != &eventq->overflow)
+			eventq->count--;
+		uop = UOP_GET(ring, index);
+		eventq_untrack(uop);
+		uop_free_if_not_queued(uop);
 	}
 }
 
+
+static void eventq_dump_list(int core, uint32_t index, int *n, FILE *f)
+{
+	struct uop_ring_t *ring = CORE.uop_ring;
+
+	for (; index; index = ring->eventq_next[index]) {
+		fprintf(f, "%3d. ", (*n)++);
+		uop_dump(UOP_GET(ring, index), f);
+		fprintf(f, "\n");
+	}
+}
+
+
+void eventq_dump(int core, FILE *f)
+{
+	struct eventq_t *eventq = CORE.eventq;
+	uint64_t cycle;
+	int n = 0;
+
+	uop_lnlist_dump(eventq->mem, f);
+	for (cycle = eventq->cycle; cycle < eventq->cycle + EVENTQ_WHEEL_SIZE; cycle++)
+		eventq_dump_list(core, eventq->wheel[cycle % EVENTQ_WHEEL_SIZE], &n, f);
+	eventq_dump_list(core, eventq->overflow, &n, f);
+}
@@ -44,7 +44,7 @@ void p_recover(int core, int thread)
 		 * the work is finished */
 		assert(uop->core == core);
 		assert(uop->thread == thread);
-		if (!uop->specmode)
+		if (!UOP_HOT(uop, specmode))
 			break;
 		
 		/* Stats */
@@ -52,7 +52,6 @@ void p_recover(int core, int thread)
 			THREAD.tcache->squashed++;
 		THREAD.squashed++;
 		CORE.squashed++;
-		p->squashed++;
 		
 		/* Undo map */
 		if (!uop->completed)
@@ -61,18 +60,28 @@ void p_recover(int core, int thread)
 
 		/* Debug */
 		esim_debug("uop action=\"squash\", core=%d, seq=%llu\n",
-			uop->core, (long long unsigned) uop->di_seq);
+			uop->core, (long long unsigned) UOP_HOT(uop, di_seq));
  
 		/* Remove entry in ROB */
 		rob_remove_tail(core, thread);
 	}
 
-	/* If we actually fetched wrong instructions, recover kernel */
+	/* Stall fetch */
+	THREAD.fetch_stall = MAX(THREAD.fetch_stall, p_recover_penalty);
+
+	/* The context is left for the main thread if the
+	 * core runs on a host thread of its own. */
+	if (!parallel_defer(core, thread, parallel_action_recover))
+		p_recover_context(core, thread);
+}
+
+
+/* If we actually fetched wrong instructions, recover kernel.
+ * Set eip to fetch. */
+void p_recover_context(int core, int thread)
+{
 	if (ctx_get_status(THREAD.ctx, ctx_specmode))
 		ctx_recover(THREAD.ctx);
-	
-	/* Stall fetch and set eip to fetch. */
-	THREAD.fetch_stall = MAX(THREAD.fetch_stall, p_recover_penalty);
 	THREAD.fetch_neip = THREAD.ctx->regs->eip;
 }
 
@@ -49,6 +49,7 @@ static int rf_int_reclaim(int core, int thread)
 	THREAD.rf_int_count++;
 	assert(!rf->int_phreg[phreg].busy);
 	assert(!rf->int_phreg[phreg].pending);
+	assert(!rf->int_phreg[phreg].wakeup_head);
 	return phreg;
 }
 
@@ -67,6 +68,7 @@ static int rf_fp_reclaim(int core, int thread)
 	THREAD.rf_fp_count++;
 	assert(!rf->fp_phreg[phreg].busy);
 	assert(!rf->fp_phreg[phreg].pending);
+	assert(!rf->fp_phreg[phreg].wakeup_head);
 	return phreg;
 }
 
@@ -456,20 +458,130 @@ int rf_ready(struct uop_t *uop)
 }
 
 
+/* Mark an uop as ready, and insert it into the ready queue if it is in
+ * the IQ. Loads and stores are found ready in the LSQ. */
+static void rf_set_ready(struct uop_t *uop)
+{
+	assert(!UOP_HOT(uop, ready) && rf_ready(uop));
+	UOP_HOT(uop, ready) = 1;
+	if (uop->in_iq)
+		iq_ready(uop);
+	esim_debug("uop action=\"update\", core=%d, seq=%lld, ready=1\n",
+		uop->core, (long long) UOP_HOT(uop, di_seq));
+}
+
+
+/* Physical register of an input dependence, or NULL if it has none */
+static struct phreg_t *rf_idep_phreg(struct uop_t *uop, int dep)
+{
+	int core = uop->core;
+	int thread = uop->thread;
+	struct rf_t *rf = THREAD.rf;
+
+	if (DEP_IS_INT_REG(uop->idep[dep]))
+		return &rf->int_phreg[uop->ph_idep[dep]];
+	if (DEP_IS_FP_REG(uop->idep[dep]))
+		return &rf->fp_phreg[uop->ph_idep[dep]];
+	return NULL;
+}
+
+
+/* Insert a renamed uop into the consumer lists of its pending input
+ * registers. If none is pending, the uop is ready. Otherwise, it will be
+ * made ready by the 'rf_write' call of its last producer. */
+void rf_wait(struct uop_t *uop)
+{
+	struct uop_ring_t *ring = UOP_RING(uop);
+	struct phreg_t *phreg;
+	uint32_t entry;
+	int dep;
+
+	assert(!ring->ready[uop->index] && !ring->wait[uop->index]);
+	for (dep = 0; dep < IDEP_COUNT; dep++) {
+		phreg = rf_idep_phreg(uop, dep);
+		if (!phreg || !phreg->pending)
+			continue;
+		entry = uop->index * IDEP_COUNT + dep;
+		ring->wakeup_prev[entry] = phreg->wakeup_tail;
+		ring->wakeup_next[entry] = 0;
+		if (phreg->wakeup_tail)
+			ring->wakeup_next[phreg->wakeup_tail] = entry;
+		else
+			phreg->wakeup_head = entry;
+		phreg->wakeup_tail = entry;
+		ring->wait[uop->index] |= 1 << dep;
+	}
+	if (!ring->wait[uop->index])
+		rf_set_ready(uop);
+}
+
+
+/* Remove a squashed uop from the consumer lists it is in */
+static void rf_unwait(struct uop_t *uop)
+{
+	struct uop_ring_t *ring = UOP_RING(uop);
+	struct phreg_t *phreg;
+	uint32_t entry, prev, next;
+	int dep;
+
+	for (dep = 0; dep < IDEP_COUNT; dep++) {
+		if (!(ring->wait[uop->index] & (1 << dep)))
+			continue;
+		phreg = rf_idep_phreg(uop, dep);
+		entry = uop->index * IDEP_COUNT + dep;
+		prev = ring->wakeup_prev[entry];
+		next = ring->wakeup_next[entry];
+		if (prev)
+			ring->wakeup_next[prev] = next;
+		else
+			phreg->wakeup_head = next;
+		if (next)
+			ring->wakeup_prev[next] = prev;
+		else
+			phreg->wakeup_tail = prev;
+	}
+	ring->wait[uop->index] = 0;
+}
+
+
+/* Mark a physical register as written and wake up its consumers. Entries
+ * are numbered from IDEP_COUNT on, since slot 0 of the ring is not used,
+ * so entry 0 ends the list. */
+static void rf_phreg_write(struct uop_ring_t *ring, struct phreg_t *phreg)
+{
+	uint32_t entry, index;
+
+	if (!phreg->pending)
+		return;
+	phreg->pending = 0;
+	for (entry = phreg->wakeup_head; entry; entry = ring->wakeup_next[entry]) {
+		index = entry / IDEP_COUNT;
+		assert(ring->wait[index] & (1 << entry % IDEP_COUNT));
+		ring->wait[index] &= ~(1 << entry % IDEP_COUNT);
+		if (!ring->wait[index])
+			rf_set_ready(UOP_GET(ring, index));
+	}
+	phreg->wakeup_head = phreg->wakeup_tail = 0;
+}
+
+
 void rf_write(struct uop_t *uop)
 {
 	int dep, loreg, phreg;
 	int core = uop->core;
 	int thread = uop->thread;
 	struct rf_t *rf = THREAD.rf;
+	struct uop_ring_t *ring = CORE.uop_ring;
 	
+	/* Flags can share the physical register of another output, which is
+	 * only written once. */
 	for (dep = 0; dep < ODEP_COUNT; dep++) {
 		loreg = uop->odep[dep];
 		phreg = uop->ph_odep[dep];
 		if (DEP_IS_INT_REG(loreg))
-			rf->int_phreg[phreg].pending = 0;
+			rf_phreg_write(ring, &rf->int_phreg[phreg]);
 		else if (DEP_IS_FP_REG(loreg))
-			rf->fp_phreg[phreg].pending = 0;
+			rf_phreg_write(ring, &rf->fp_phreg[phreg]);
 	}
 }
 
@@ -481,9 +593,13 @@ void rf_undo(struct uop_t *uop)
 	int thread = uop->thread;
 	struct rf_t *rf = THREAD.rf;
 
+	/* The uop is about to be freed, so remove it from the consumer lists
+	 * of the registers it is waiting for. */
+	assert(UOP_HOT(uop, specmode));
+	rf_unwait(uop);
+
 	/* Undo mappings in reverse order, in case an instruction has a
 	 * duplicated output dependence. */
-	assert(uop->specmode);
 	for (dep = ODEP_COUNT - 1; dep >= 0; dep--) {
 		loreg = uop->odep[dep];
 		phreg = uop->ph_odep[dep];
@@ -562,7 +678,7 @@ void rf_commit(struct uop_t *uop)
 	int thread = uop->thread;
 	struct rf_t *rf = THREAD.rf;
 
-	assert(!uop->specmode);
+	assert(!UOP_HOT(uop, specmode));
 	for (dep = 0; dep < ODEP_COUNT; dep++) {
 		loreg = uop->odep[dep];
 		phreg = uop->ph_odep[dep];
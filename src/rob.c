@@ -32,15 +32,21 @@ int total_rob_size = 0;
 
 /* Private Functions */
 
+/* Uop in an entry of the ROB of a core, or NULL if it is empty */
+static struct uop_t *rob_uop(int core, int index)
+{
+	uint32_t uop = CORE.rob[index];
+	return uop ? UOP_GET(CORE.uop_ring, uop) : NULL;
+}
+
+
 static void rob_trim(int core)
 {
 	int idx;
-	struct uop_t *uop;
 
 	/* Trim head */
 	while (CORE.rob_count) {
-		uop = list_get(CORE.rob, CORE.rob_head);
-		if (uop)
+		if (CORE.rob[CORE.rob_head])
 			break;
 		CORE.rob_head = CORE.rob_head == total_rob_size - 1 ?
 			0 : CORE.rob_head + 1;
@@ -50,8 +56,7 @@ static void rob_trim(int core)
 	/* Trim tail */
 	while (CORE.rob_count) {
 		idx = CORE.rob_tail ? CORE.rob_tail - 1 : total_rob_size - 1;
-		uop = list_get(CORE.rob, idx);
-		if (uop)
+		if (CORE.rob[idx])
 			break;
 		CORE.rob_tail = idx;
 		CORE.rob_count--;
@@ -76,7 +81,6 @@ void rob_reg_options()
 void rob_init()
 {
 	int core, thread;
-	int i;
 
 	switch (rob_kind) {
 
@@ -98,11 +102,8 @@ void rob_init()
 
 	/* Create ROBs */
 	total_rob_size = rob_size * p_threads;
-	FOREACH_CORE {
-		CORE.rob = list_create(total_rob_size);
-		for (i = 0; i < total_rob_size; i++)
-			list_add(CORE.rob, NULL);
-	}
+	FOREACH_CORE
+		CORE.rob = calloc(total_rob_size, sizeof(uint32_t));
 }
 
 
@@ -120,15 +121,14 @@ void rob_done()
 	}
 
 	FOREACH_CORE {
-		assert(list_count(CORE.rob) == total_rob_size);
 		for (i = 0; i < total_rob_size; i++) {
-			uop = list_get(CORE.rob, i);
+			uop = rob_uop(core, i);
 			if (uop) {
 				uop->in_rob = 0;
 				uop_free_if_not_queued(uop);
 			}
 		}
-		list_free(CORE.rob);
+		free(CORE.rob);
 	}
 }
 
@@ -162,8 +162,8 @@ void rob_enqueue(struct uop_t *uop)
 	switch (rob_kind) {
 	case rob_kind_private:
 		assert(THREAD.rob_count < rob_size);
-		assert(!list_get(CORE.rob, THREAD.rob_tail));
-		list_set(CORE.rob, THREAD.rob_tail, uop);
+		assert(!CORE.rob[THREAD.rob_tail]);
+		CORE.rob[THREAD.rob_tail] = uop->index;
 		THREAD.rob_tail = THREAD.rob_tail == THREAD.rob_right_bound ?
 			THREAD.rob_left_bound : THREAD.rob_tail + 1;
 		THREAD.rob_count++;
@@ -172,8 +172,8 @@ void rob_enqueue(struct uop_t *uop)
 	case rob_kind_shared:
 		rob_trim(core);
 		assert(CORE.rob_count < total_rob_size);
-		assert(!list_get(CORE.rob, CORE.rob_tail));
-		list_set(CORE.rob, CORE.rob_tail, uop);
+		assert(!CORE.rob[CORE.rob_tail]);
+		CORE.rob[CORE.rob_tail] = uop->index;
 		CORE.rob_tail = CORE.rob_tail == total_rob_size - 1 ?
 			0 : CORE.rob_tail + 1;
 		CORE.rob_count++;
@@ -200,7 +200,7 @@ int rob_can_dequeue(int core, int thread)
 		rob_trim(core);
 		if (!CORE.rob_count)
 			return 0;
-		uop = list_get(CORE.rob, CORE.rob_head);
+		uop = rob_uop(core, CORE.rob_head);
 		assert(uop_exists(uop));
 		assert(uop->core == core);
 		if (uop->thread == thread)
@@ -219,7 +219,7 @@ struct uop_t *rob_head(int core, int thread)
 	switch (rob_kind) {
 	case rob_kind_private:
 		if (THREAD.rob_count > 0) {
-			uop = list_get(CORE.rob, THREAD.rob_head);
+			uop = rob_uop(core, THREAD.rob_head);
 			return uop;
 		}
 		break;
@@ -230,7 +230,7 @@ struct uop_t *rob_head(int core, int thread)
 			return NULL;
 		for (i = 0; i < CORE.rob_count; i++) {
 			idx = (CORE.rob_head + i) % total_rob_size;
-			uop = list_get(CORE.rob, idx);
+			uop = rob_uop(core, idx);
 			if (uop && uop->thread == thread)
 				return uop;
 		}
@@ -249,10 +249,10 @@ void rob_remove_head(int core, int thread)
 	switch (rob_kind) {
 	case rob_kind_private:
 		assert(THREAD.rob_count > 0);
-		uop = list_get(CORE.rob, THREAD.rob_head);
+		uop = rob_uop(core, THREAD.rob_head);
 		assert(uop_exists(uop));
 		assert(uop->core == core && uop->thread == thread);
-		list_set(CORE.rob, THREAD.rob_head, NULL);
+		CORE.rob[THREAD.rob_head] = 0;
 		THREAD.rob_head = THREAD.rob_head == THREAD.rob_right_bound ?
 			THREAD.rob_left_bound : THREAD.rob_head + 1;
 		THREAD.rob_count--;
@@ -263,9 +263,9 @@ void rob_remove_head(int core, int thread)
 		assert(THREAD.rob_count);
 		for (i = 0; i < CORE.rob_count; i++) {
 			idx = (CORE.rob_head + i) % total_rob_size;
-			uop = list_get(CORE.rob, idx);
+			uop = rob_uop(core, idx);
 			if (uop && uop->thread == thread) {
-				list_set(CORE.rob, idx, NULL);
+				CORE.rob[idx] = 0;
 				THREAD.rob_count--;
 				break;
 			}
@@ -289,7 +289,7 @@ struct uop_t *rob_tail(int core, int thread)
 		if (THREAD.rob_count > 0) {
 			idx = THREAD.rob_tail == THREAD.rob_left_bound ?
 				THREAD.rob_right_bound : THREAD.rob_tail - 1;
-			uop = list_get(CORE.rob, idx);
+			uop = rob_uop(core, idx);
 			return uop;
 		}
 		break;
@@ -300,7 +300,7 @@ struct uop_t *rob_tail(int core, int thread)
 			return NULL;
 		for (i = CORE.rob_count - 1; i >= 0; i--) {
 			idx = (CORE.rob_head + i) % total_rob_size;
-			uop = list_get(CORE.rob, idx);
+			uop = rob_uop(core, idx);
 			if (uop && uop->thread == thread)
 				return uop;
 		}
@@ -324,14 +324,14 @@ struct uop_t *rob_get(int core, int thread, int index)
 		index += THREAD.rob_head;
 		if (index > THREAD.rob_right_bound)
 			index = index - THREAD.rob_right_bound + THREAD.rob_left_bound - 1;
-		uop = list_get(CORE.rob, index);
+		uop = rob_uop(core, index);
 		assert(uop);
 		return uop;
 	
 	case rob_kind_shared:
 		rob_trim(core);
 		index = (CORE.rob_head + index) % total_rob_size;
-		uop = list_get(CORE.rob, index);
+		uop = rob_uop(core, index);
 		assert(uop);
 		return uop;
 	}
@@ -349,10 +349,10 @@ void rob_remove_tail(int core, int thread)
 		assert(THREAD.rob_count > 0);
 		idx = THREAD.rob_tail == THREAD.rob_left_bound ?
 			THREAD.rob_right_bound : THREAD.rob_tail - 1;
-		uop = list_get(CORE.rob, idx);
+		uop = rob_uop(core, idx);
 		assert(uop_exists(uop));
 		assert(uop->core == core && uop->thread == thread);
-		list_set(CORE.rob, idx, NULL);
+		CORE.rob[idx] = 0;
 		THREAD.rob_tail = idx;
 		THREAD.rob_count--;
 		break;
@@ -362,9 +362,9 @@ void rob_remove_tail(int core, int thread)
 		assert(THREAD.rob_count);
 		for (i = CORE.rob_count - 1; i >= 0; i--) {
 			idx = (CORE.rob_head + i) % total_rob_size;
-			uop = list_get(CORE.rob, idx);
+			uop = rob_uop(core, idx);
 			if (uop && uop->thread == thread) {
-				list_set(CORE.rob, idx, NULL);
+				CORE.rob[idx] = 0;
 				THREAD.rob_count--;
 				break;
 			}
@@ -390,7 +390,7 @@ void rob_dump(int core, FILE *f)
 				thread, THREAD.rob_left_bound, THREAD.rob_right_bound,
 				THREAD.rob_count, rob_size);
 			for (i = THREAD.rob_left_bound; i <= THREAD.rob_right_bound; i++) {
-				uop = list_get(CORE.rob, i);
+				uop = rob_uop(core, i);
 				fprintf(f, "   %c%c ",
 					i == THREAD.rob_head ? 'H' : ' ',
 					i == THREAD.rob_tail ? 'T' : ' ');
@@ -405,7 +405,7 @@ void rob_dump(int core, FILE *f)
 	case rob_kind_shared:
 		rob_trim(core);
 		for (i = 0; i < total_rob_size; i++) {
-			uop = list_get(CORE.rob, i);
+			uop = rob_uop(core, i);
 			fprintf(f, " %c%c ",
 				i == CORE.rob_head ? 'H' : ' ',
 				i == CORE.rob_tail ? 'T' : ' ');
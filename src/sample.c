@@ -0,0 +1,766 @@
+/*
+ *  Multi2Sim
+ *  Copyright (C) 2007  Rafael Ubal Tena (raurte@gap.upv.es)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <m2s.h>
+#include <math.h>
+
+
+/* Sampling parameters */
+char *sample_profile_file = "";
+char *sample_bbv_file = "";
+char *sample_report_file = "";
+uint64_t sample_interval = 10000000;  /* Instructions per interval */
+uint64_t sample_warmup = 1000000;  /* Detailed instructions before each interval */
+uint32_t sample_clusters = 10;  /* Maximum number of clusters */
+uint32_t sample_points = 2;  /* Intervals simulated per cluster */
+
+
+/* Basic block vectors are projected to this number of dimensions before
+ * clustering, as in SimPoint */
+#define SAMPLE_DIM  15
+#define SAMPLE_ITER_MAX  100
+#define SAMPLE_BB_BUCKETS  65536
+
+/* Basic block seen while profiling */
+struct sample_bb_t {
+	int mid;
+	uint32_t eip;
+	int id;  /* From 1, in order of first execution */
+	uint64_t count;  /* Instructions run in the current interval */
+	struct sample_bb_t *next;
+};
+
+/* Simulated interval. Statistics are differences between the start and
+ * the end of the interval. */
+struct sample_point_t {
+	int interval;
+	int cluster;
+	int done;
+	uint64_t cycles, inst;
+	uint64_t branches, mispred;
+	uint64_t *accesses, *hits;  /* Per cache */
+};
+
+/* Instructions executed by the guest, in either mode */
+static uint64_t sample_pos;
+
+/* Profile */
+static FILE *sample_profile_f;
+static struct sample_bb_t **sample_bb_table;
+static struct sample_bb_t **sample_bb_touched;
+static int sample_bb_touched_count, sample_bb_touched_size;
+static int sample_bb_count;
+static uint64_t sample_interval_end;
+static int sample_intervals;
+
+/* Clustering */
+static double *sample_vec;  /* 'sample_intervals' vectors */
+static double *sample_center;  /* 'sample_clusters' vectors */
+static int *sample_cluster;  /* Cluster of each interval */
+static int *sample_cluster_size;
+static uint64_t sample_total_inst;
+static uint32_t sample_seed = 1;
+
+/* Simulated intervals, sorted by position */
+static struct sample_point_t *sample_point;
+static int sample_point_count;
+static uint64_t sample_detailed_inst, sample_detailed_cycles;
+
+
+void sample_reg_options(void)
+{
+	opt_reg_string("-sample:profile", "Write basic block vectors of a functional run to file",
+		&sample_profile_file);
+	opt_reg_string("-sample:bbv", "Basic block vectors to choose the simulated intervals from",
+		&sample_bbv_file);
+	opt_reg_uint64("-sample:interval", "Instructions per interval", &sample_interval);
+	opt_reg_uint64("-sample:warmup", "Detailed instructions before each simulated interval",
+		&sample_warmup);
+	opt_reg_uint32("-sample:clusters", "Maximum number of clusters of intervals", &sample_clusters);
+	opt_reg_uint32("-sample:points", "Simulated intervals per cluster", &sample_points);
+	opt_reg_string("-report:sample", "Report for sampled simulation", &sample_report_file);
+}
+
+
+
+
+/* Profile */
+
+static struct sample_bb_t *sample_bb_get(int mid, uint32_t eip)
+{
+	struct sample_bb_t *bb;
+	int index = (eip ^ (eip >> 16) ^ mid) % SAMPLE_BB_BUCKETS;
+
+	for (bb = sample_bb_table[index]; bb; bb = bb->next)
+		if (bb->eip == eip && bb->mid == mid)
+			return bb;
+	bb = calloc(1, sizeof(struct sample_bb_t));
+	if (!bb)
+		fatal("sample: out of memory");
+	bb->mid = mid;
+	bb->eip = eip;
+	bb->id = ++sample_bb_count;
+	bb->next = sample_bb_table[index];
+	sample_bb_table[index] = bb;
+	return bb;
+}
+
+
+/* Write the vector of the current interval in SimPoint format */
+static void sample_bbv_flush(void)
+{
+	struct sample_bb_t *bb;
+	int i;
+
+	if (!sample_bb_touched_count)
+		return;
+	fprintf(sample_profile_f, "T");
+	for (i = 0; i < sample_bb_touched_count; i++) {
+		bb = sample_bb_touched[i];
+		fprintf(sample_profile_f, ":%d:%lld ", bb->id, (long long) bb->count);
+		bb->count = 0;
+	}
+	fprintf(sample_profile_f, "\n");
+	sample_bb_touched_count = 0;
+	sample_intervals++;
+}
+
+
+static void sample_profile_hook(struct ctx_t *ctx, uint32_t eip, int count)
+{
+	struct sample_bb_t *bb;
+
+	bb = sample_bb_get(ctx->mid, eip);
+	if (!bb->count) {
+		if (sample_bb_touched_count == sample_bb_touched_size) {
+			sample_bb_touched_size = sample_bb_touched_size ? sample_bb_touched_size * 2 : 256;
+			sample_bb_touched = realloc(sample_bb_touched,
+				sample_bb_touched_size * sizeof(struct sample_bb_t *));
+			if (!sample_bb_touched)
+				fatal("sample: out of memory");
+		}
+		sample_bb_touched[sample_bb_touched_count++] = bb;
+	}
+	bb->count += count;
+	sample_pos += count;
+	if (sample_pos >= sample_interval_end) {
+		sample_bbv_flush();
+		sample_interval_end = (sample_pos / sample_interval + 1) * sample_interval;
+	}
+}
+
+
+/* Run the programs to the end functionally, writing one basic block vector
+ * per interval */
+static void sample_profile(void)
+{
+	struct sample_bb_t *bb, *next;
+	int i;
+
+	sample_profile_f = fopen(sample_profile_file, "wt");
+	if (!sample_profile_f)
+		fatal("%s: cannot write basic block vectors", sample_profile_file);
+	sample_bb_table = calloc(SAMPLE_BB_BUCKETS, sizeof(struct sample_bb_t *));
+	if (!sample_bb_table)
+		fatal("sample: out of memory");
+	sample_interval_end = sample_interval;
+	ke_block_hook = sample_profile_hook;
+	isa_block_dispatch = 1;
+	while (ke->context_list_head)
+		ke_run();
+	sample_bbv_flush();
+	ke_block_hook = NULL;
+	fclose(sample_profile_f);
+
+	fprintf(stderr, "sample.intervals  %d  # Intervals written to '%s'\n",
+		sample_intervals, sample_profile_file);
+	fprintf(stderr, "sample.blocks  %d  # Distinct basic blocks\n", sample_bb_count);
+	fprintf(stderr, "sample.inst  %lld  # Executed instructions\n", (long long) sample_pos);
+
+	for (i = 0; i < SAMPLE_BB_BUCKETS; i++) {
+		for (bb = sample_bb_table[i]; bb; bb = next) {
+			next = bb->next;
+			free(bb);
+		}
+	}
+	free(sample_bb_table);
+	free(sample_bb_touched);
+}
+
+
+
+
+/* Clustering */
+
+/* Fixed random value in [-1, 1] for a basic block and a dimension */
+static double sample_proj(int id, int dim)
+{
+	uint32_t x = id * 0x9e3779b1 + dim * 0x85ebca6b;
+
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return (double) x / 0xffffffffU * 2.0 - 1.0;
+}
+
+
+static double sample_random(void)
+{
+	sample_seed = sample_seed * 1103515245 + 12345;
+	return (double) (sample_seed >> 8) / (1 << 24);
+}
+
+
+static double sample_dist(double *a, double *b)
+{
+	double d, sum = 0.0;
+	int i;
+
+	for (i = 0; i < SAMPLE_DIM; i++) {
+		d = a[i] - b[i];
+		sum += d * d;
+	}
+	return sum;
+}
+
+
+/* Read the basic block vectors, normalized and projected */
+static void sample_bbv_read(void)
+{
+	FILE *f;
+	double vec[SAMPLE_DIM];
+	long long count, total;
+	int c, id, size = 0, i;
+
+	f = fopen(sample_bbv_file, "rt");
+	if (!f)
+		fatal("%s: cannot read basic block vectors", sample_bbv_file);
+	while ((c = fgetc(f)) != EOF) {
+		if (c != 'T') {
+			while (c != '\n' && c != EOF)
+				c = fgetc(f);
+			continue;
+		}
+		memset(vec, 0, sizeof(vec));
+		total = 0;
+		while (fscanf(f, " :%d:%lld", &id, &count) == 2) {
+			for (i = 0; i < SAMPLE_DIM; i++)
+				vec[i] += count * sample_proj(id, i);
+			total += count;
+		}
+		if (sample_intervals == size) {
+			size = size ? size * 2 : 256;
+			sample_vec = realloc(sample_vec, size * SAMPLE_DIM * sizeof(double));
+			if (!sample_vec)
+				fatal("sample: out of memory");
+		}
+		for (i = 0; i < SAMPLE_DIM; i++)
+			sample_vec[sample_intervals * SAMPLE_DIM + i] = total ? vec[i] / total : 0.0;
+		sample_total_inst += total;
+		sample_intervals++;
+	}
+	fclose(f);
+	if (!sample_intervals)
+		fatal("%s: no basic block vectors", sample_bbv_file);
+}
+
+
+/* k-means, seeded with k-means++ and a fixed seed so that the same vectors
+ * always give the same clusters. Fewer clusters are used if there are fewer
+ * distinct vectors. */
+static void sample_kmeans(void)
+{
+	double *vec, *center, *dist, sum, r;
+	int n = sample_intervals, k, i, j, c, best, changed, iter, count;
+
+	sample_center = calloc(MAX(sample_clusters, 1) * SAMPLE_DIM, sizeof(double));
+	sample_cluster = calloc(n, sizeof(int));
+	dist = calloc(n, sizeof(double));
+	if (!sample_center || !sample_cluster || !dist)
+		fatal("sample: out of memory");
+
+	/* Seeding */
+	memcpy(sample_center, &sample_vec[(int) (sample_random() * n) * SAMPLE_DIM],
+		SAMPLE_DIM * sizeof(double));
+	for (k = 1; k < sample_clusters; k++) {
+		sum = 0.0;
+		for (i = 0; i < n; i++) {
+			dist[i] = sample_dist(&sample_vec[i * SAMPLE_DIM], sample_center);
+			for (c = 1; c < k; c++)
+				dist[i] = MIN(dist[i], sample_dist(&sample_vec[i * SAMPLE_DIM],
+					&sample_center[c * SAMPLE_DIM]));
+			sum += dist[i];
+		}
+		if (sum <= 0.0)
+			break;
+		r = sample_random() * sum;
+		for (i = 0; i < n - 1 && r >= dist[i]; i++)
+			r -= dist[i];
+		memcpy(&sample_center[k * SAMPLE_DIM], &sample_vec[i * SAMPLE_DIM],
+			SAMPLE_DIM * sizeof(double));
+	}
+	sample_clusters = k;
+
+	/* Iterations */
+	for (iter = 0, changed = 1; changed && iter < SAMPLE_ITER_MAX; iter++) {
+		changed = 0;
+		for (i = 0; i < n; i++) {
+			vec = &sample_vec[i * SAMPLE_DIM];
+			best = 0;
+			for (c = 1; c < k; c++)
+				if (sample_dist(vec, &sample_center[c * SAMPLE_DIM]) <
+					sample_dist(vec, &sample_center[best * SAMPLE_DIM]))
+					best = c;
+			if (!iter || sample_cluster[i] != best)
+				changed = 1;
+			sample_cluster[i] = best;
+		}
+		for (c = 0; c < k; c++) {
+			center = &sample_center[c * SAMPLE_DIM];
+			for (i = 0, count = 0; i < n; i++) {
+				if (sample_cluster[i] != c)
+					continue;
+				if (!count++)
+					memset(center, 0, SAMPLE_DIM * sizeof(double));
+				for (j = 0; j < SAMPLE_DIM; j++)
+					center[j] += sample_vec[i * SAMPLE_DIM + j];
+			}
+			for (j = 0; count && j < SAMPLE_DIM; j++)
+				center[j] /= count;
+		}
+	}
+
+	sample_cluster_size = calloc(k, sizeof(int));
+	if (!sample_cluster_size)
+		fatal("sample: out of memory");
+	for (i = 0; i < n; i++)
+		sample_cluster_size[sample_cluster[i]]++;
+	free(dist);
+}
+
+
+static int sample_point_compare(const void *a, const void *b)
+{
+	return ((struct sample_point_t *) a)->interval - ((struct sample_point_t *) b)->interval;
+}
+
+
+/* Choose the intervals closest to the center of each cluster */
+static void sample_choose(void)
+{
+	struct sample_point_t *point;
+	char *chosen;
+	double d, best_dist;
+	int c, i, best, count;
+
+	sample_point = calloc(sample_clusters * MAX(sample_points, 1), sizeof(struct sample_point_t));
+	chosen = calloc(sample_intervals, 1);
+	if (!sample_point || !chosen)
+		fatal("sample: out of memory");
+	for (c = 0; c < sample_clusters; c++) {
+		for (count = 0; count < sample_points; count++) {
+			best = -1;
+			best_dist = 0.0;
+			for (i = 0; i < sample_intervals; i++) {
+				if (sample_cluster[i] != c || chosen[i])
+					continue;
+				d = sample_dist(&sample_vec[i * SAMPLE_DIM], &sample_center[c * SAMPLE_DIM]);
+				if (best < 0 || d < best_dist) {
+					best = i;
+					best_dist = d;
+				}
+			}
+			if (best < 0)
+				break;
+			chosen[best] = 1;
+			point = &sample_point[sample_point_count++];
+			point->interval = best;
+			point->cluster = c;
+			point->accesses = calloc(ccache_count, sizeof(uint64_t));
+			point->hits = calloc(ccache_count, sizeof(uint64_t));
+			if (!point->accesses || !point->hits)
+				fatal("sample: out of memory");
+		}
+	}
+	qsort(sample_point, sample_point_count, sizeof(struct sample_point_t), sample_point_compare);
+	free(chosen);
+}
+
+
+
+
+/* Simulation */
+
+static void sample_count_hook(struct ctx_t *ctx, uint32_t eip, int count)
+{
+	sample_pos += count;
+	if (p_warm)
+		p_warm_inst(ctx, eip);
+}
+
+
+static void sample_fast_forward(uint64_t target)
+{
+	while (ke->context_list_head && sample_pos < target)
+		ke_run();
+}
+
+
+/* Detailed simulation until 'target' instructions, counted when they run
+ * at fetch. The kernel clock does not advance in the pipeline, so it is
+ * moved forward by these instructions, as if they had run functionally. */
+static void sample_detailed(uint64_t target)
+{
+	uint64_t executed = p->executed, cycle = sim_cycle;
+
+	ke->context_reschedule = 1;
+	while (ke->finished_count < ke->context_count && sample_pos + p->executed - executed < target) {
+		sim_cycle++;
+		p_stages();
+		ke_process_events();
+		esim_process_events();
+		p_skip_cycles(0);
+	}
+	sample_pos += p->executed - executed;
+	instr_num += p->executed - executed;
+	sample_detailed_inst += p->executed - executed;
+	sample_detailed_cycles += sim_cycle - cycle;
+}
+
+
+/* Stop fetching and let the pipelines empty, so that contexts can go back
+ * to functional simulation. Contexts are not mapped again meanwhile, since
+ * the dynamic scheduler waits for pending evictions, and the pipeline stops
+ * as soon as the last one is unmapped. Instructions that still run at fetch
+ * count as detailed ones. Warming also needs the cache accesses in flight
+ * to finish, which only advances the cache system. */
+static void sample_drain(void)
+{
+	struct ctx_t *ctx, *next;
+	uint64_t executed = p->executed, cycle = sim_cycle;
+	int context_switch = p_context_switch;
+
+	p_context_switch = 1;
+	for (ctx = ke->alloc_list_head; ctx; ctx = next) {
+		next = ctx->alloc_next;
+		if (!ctx->dealloc_signal)
+			p_unmap_context_signal(ctx);
+	}
+	while (ke->alloc_count) {
+		sim_cycle++;
+		p_stages();
+		ke_process_events();
+		esim_process_events();
+		p_skip_cycles(0);
+	}
+	while (p_warm && esim_pending()) {
+		sim_cycle++;
+		esim_process_events();
+	}
+	p_context_switch = context_switch;
+	sample_pos += p->executed - executed;
+	instr_num += p->executed - executed;
+	sample_detailed_inst += p->executed - executed;
+	sample_detailed_cycles += sim_cycle - cycle;
+}
+
+
+/* Take statistics at the start of an interval, and replace them with
+ * their difference at its end */
+static void sample_stats(struct sample_point_t *point, int end)
+{
+	int i;
+
+	p_sum_stats();
+	if (!end) {
+		point->cycles = sim_cycle;
+		point->inst = p->executed;
+		point->branches = p->branches;
+		point->mispred = p->mispred;
+		for (i = 0; i < ccache_count; i++) {
+			point->accesses[i] = ccache_array[i]->accesses;
+			point->hits[i] = ccache_array[i]->hits;
+		}
+		return;
+	}
+	point->cycles = sim_cycle - point->cycles;
+	point->inst = p->executed - point->inst;
+	point->branches = p->branches - point->branches;
+	point->mispred = p->mispred - point->mispred;
+	for (i = 0; i < ccache_count; i++) {
+		point->accesses[i] = ccache_array[i]->accesses - point->accesses[i];
+		point->hits[i] = ccache_array[i]->hits - point->hits[i];
+	}
+}
+
+
+
+
+/* Estimates */
+
+#define SAMPLE_METRIC_CPI  0
+#define SAMPLE_METRIC_MPKI  1
+#define SAMPLE_METRIC_MISPRED  2
+#define SAMPLE_METRIC_CACHE  3  /* Miss rate of cache 'metric - 3' */
+
+/* Metrics are ratios of two quantities, each given per instruction of the
+ * interval, so that intervals can be weighted by their cluster */
+static void sample_metric(struct sample_point_t *point, int metric, double *num, double *den)
+{
+	double inst = point->inst ? point->inst : 1;
+	int i;
+
+	switch (metric) {
+	case SAMPLE_METRIC_CPI:
+		*num = point->cycles / inst;
+		*den = 1.0;
+		return;
+	case SAMPLE_METRIC_MPKI:
+		*num = point->mispred * 1000 / inst;
+		*den = 1.0;
+		return;
+	case SAMPLE_METRIC_MISPRED:
+		*num = point->mispred / inst;
+		*den = point->branches / inst;
+		return;
+	}
+	i = metric - SAMPLE_METRIC_CACHE;
+	*num = (point->accesses[i] - point->hits[i]) / inst;
+	*den = point->accesses[i] / inst;
+}
+
+
+/* Stratified mean of 'value' for each point, with clusters as strata
+ * weighted by their number of intervals. Return the half width of the 95%
+ * confidence interval in '*ci', or -1 if no cluster has two simulated
+ * intervals. The variance of a cluster with a single simulated interval is
+ * taken from the pooled variance of the others. */
+static double sample_stratify(double *value, double *ci)
+{
+	double *sum, *sum2, x, mean, var;
+	double est = 0.0, weight = 0.0, pooled = 0.0, err = 0.0;
+	int *n, c, i, df = 0;
+
+	sum = calloc(sample_clusters, sizeof(double));
+	sum2 = calloc(sample_clusters, sizeof(double));
+	n = calloc(sample_clusters, sizeof(int));
+	if (!sum || !sum2 || !n)
+		fatal("sample: out of memory");
+	for (i = 0; i < sample_point_count; i++) {
+		if (!sample_point[i].done)
+			continue;
+		c = sample_point[i].cluster;
+		sum[c] += value[i];
+		sum2[c] += value[i] * value[i];
+		n[c]++;
+	}
+	for (c = 0; c < sample_clusters; c++) {
+		if (n[c] < 2)
+			continue;
+		mean = sum[c] / n[c];
+		pooled += MAX(sum2[c] - n[c] * mean * mean, 0.0);
+		df += n[c] - 1;
+	}
+	pooled = df ? pooled / df : 0.0;
+	for (c = 0; c < sample_clusters; c++) {
+		if (!n[c])
+			continue;
+		mean = sum[c] / n[c];
+		x = (double) sample_cluster_size[c] / sample_intervals;
+		est += x * mean;
+		weight += x;
+		var = n[c] > 1 ? MAX(sum2[c] - n[c] * mean * mean, 0.0) / (n[c] - 1) : pooled;
+		err += x * x * var / n[c] * (1.0 - (double) n[c] / sample_cluster_size[c]);
+	}
+	if (weight > 0.0) {
+		est /= weight;
+		err /= weight * weight;
+	}
+	*ci = df ? 1.96 * sqrt(err) : -1.0;
+	free(sum);
+	free(sum2);
+	free(n);
+	return est;
+}
+
+
+/* Ratio estimate of a metric over the whole program. The confidence
+ * interval comes from the linearized residuals of each point. */
+static double sample_estimate(int metric, double *ci)
+{
+	double *num, *den, *res, ratio, x, y;
+	int i;
+
+	num = calloc(sample_point_count, sizeof(double));
+	den = calloc(sample_point_count, sizeof(double));
+	res = calloc(sample_point_count, sizeof(double));
+	if (!num || !den || !res)
+		fatal("sample: out of memory");
+	for (i = 0; i < sample_point_count; i++)
+		sample_metric(&sample_point[i], metric, &num[i], &den[i]);
+	y = sample_stratify(num, ci);
+	x = sample_stratify(den, ci);
+	ratio = x > 0.0 ? y / x : 0.0;
+	for (i = 0; i < sample_point_count; i++)
+		res[i] = x > 0.0 ? (num[i] - ratio * den[i]) / x : 0.0;
+	sample_stratify(res, ci);
+	free(num);
+	free(den);
+	free(res);
+	return ratio;
+}
+
+
+static void sample_dump(FILE *f)
+{
+	double cpi, cpi_ci, x, ci;
+	int i, done = 0;
+
+	for (i = 0; i < sample_point_count; i++)
+		done += sample_point[i].done;
+	cpi = sample_estimate(SAMPLE_METRIC_CPI, &cpi_ci);
+
+	fprintf(f, "\nSampling summary:\n");
+	fprintf(f, "sample.intervals  %d  # Intervals of %lld instructions in the profile\n",
+		sample_intervals, (long long) sample_interval);
+	fprintf(f, "sample.clusters  %d\n", sample_clusters);
+	fprintf(f, "sample.points  %d  # Simulated intervals\n", done);
+	fprintf(f, "sample.detailed_inst  %lld  # Instructions in detailed mode, with warm-up\n",
+		(long long) sample_detailed_inst);
+	fprintf(f, "sample.detailed_cycles  %lld\n", (long long) sample_detailed_cycles);
+	fprintf(f, "sample.inst  %lld  # Instructions of the whole program\n",
+		(long long) sample_total_inst);
+	fprintf(f, "sample.cycles  %.0f  # Estimated cycles of the whole program\n",
+		cpi * sample_total_inst);
+	fprintf(f, "sample.cpi  %.4f  # Estimated cycles per instruction\n", cpi);
+	fprintf(f, "sample.cpi_ci  %.4f  # Half width of the 95%% confidence interval (-1=unknown)\n",
+		cpi_ci);
+	fprintf(f, "sample.ipc  %.4f\n", cpi > 0.0 ? 1.0 / cpi : 0.0);
+	if (cpi_ci >= 0.0) {
+		fprintf(f, "sample.ipc_low  %.4f\n", 1.0 / (cpi + cpi_ci));
+		fprintf(f, "sample.ipc_high  %.4f\n", cpi > cpi_ci ? 1.0 / (cpi - cpi_ci) : 0.0);
+	}
+	x = sample_estimate(SAMPLE_METRIC_MPKI, &ci);
+	fprintf(f, "sample.mpki  %.4f  # Branch mispredictions per 1000 instructions\n", x);
+	fprintf(f, "sample.mpki_ci  %.4f\n", ci);
+	fprintf(f, "sample.mispred  %.0f  # Estimated branch mispredictions\n",
+		x * sample_total_inst / 1000);
+	x = sample_estimate(SAMPLE_METRIC_MISPRED, &ci);
+	fprintf(f, "sample.mispred_rate  %.4f\n", x);
+	fprintf(f, "sample.mispred_rate_ci  %.4f\n", ci);
+	for (i = 0; i < ccache_count; i++) {
+		if (ccache_array[i] == main_memory)
+			continue;
+		x = sample_estimate(SAMPLE_METRIC_CACHE + i, &ci);
+		fprintf(f, "sample.%s.miss_rate  %.4f\n", ccache_array[i]->name, x);
+		fprintf(f, "sample.%s.miss_rate_ci  %.4f\n", ccache_array[i]->name, ci);
+	}
+}
+
+
+static void sample_dump_report(void)
+{
+	struct sample_point_t *point;
+	FILE *f;
+	int i;
+
+	f = open_write(sample_report_file);
+	if (!f)
+		return;
+	fprintf(f, "; Simulated intervals\n");
+	fprintf(f, ";    Interval - Position in the basic block vectors, from 0\n");
+	fprintf(f, ";    Cluster, Weight - Cluster and its fraction of all intervals\n");
+	fprintf(f, ";    Cycles, Inst, Branches, Mispred - Measured after warm-up\n");
+	for (i = 0; i < sample_point_count; i++) {
+		point = &sample_point[i];
+		if (!point->done)
+			continue;
+		fprintf(f, "\n[ interval %d ]\n", point->interval);
+		fprintf(f, "Cluster = %d\n", point->cluster);
+		fprintf(f, "Weight = %.4f\n", (double) sample_cluster_size[point->cluster] /
+			sample_intervals);
+		fprintf(f, "Cycles = %lld\n", (long long) point->cycles);
+		fprintf(f, "Inst = %lld\n", (long long) point->inst);
+		fprintf(f, "CPI = %.4f\n", point->inst ? (double) point->cycles / point->inst : 0.0);
+		fprintf(f, "Branches = %lld\n", (long long) point->branches);
+		fprintf(f, "Mispred = %lld\n", (long long) point->mispred);
+	}
+	fprintf(f, "\n");
+	sample_dump(f);
+	close_file(f);
+}
+
+
+/* Simulate the chosen intervals, each after a warm-up window in detailed
+ * mode, and run the rest functionally */
+static void sample_simulate(void)
+{
+	struct sample_point_t *point;
+	uint64_t start;
+	int i;
+
+	sample_bbv_read();
+	sample_kmeans();
+	sample_choose();
+
+	ke_block_hook = sample_count_hook;
+	isa_block_dispatch = !p_warm;
+	for (i = 0; i < sample_point_count && ke->context_list_head; i++) {
+		point = &sample_point[i];
+		start = point->interval * sample_interval;
+		sample_fast_forward(start > sample_warmup ? start - sample_warmup : 0);
+		sample_detailed(start);
+		sample_stats(point, 0);
+		sample_detailed(start + sample_interval);
+		sample_stats(point, 1);
+		sample_drain();
+		point->done = point->inst > 0;
+	}
+	sample_fast_forward((uint64_t) -1);
+	ke_block_hook = NULL;
+
+	sample_dump(stderr);
+	sample_dump_report();
+	for (i = 0; i < sample_point_count; i++) {
+		free(sample_point[i].accesses);
+		free(sample_point[i].hits);
+	}
+	free(sample_point);
+	free(sample_vec);
+	free(sample_center);
+	free(sample_cluster);
+	free(sample_cluster_size);
+}
+
+
+/* Sampled simulation. Both modes run the programs to the end, so the
+ * exhaustive simulation loop finds no context left. */
+void sample_run(void)
+{
+	if (*sample_profile_file && *sample_bbv_file)
+		fatal("options -sample:profile and -sample:bbv are exclusive");
+	if ((*sample_profile_file || *sample_bbv_file) && !sample_interval)
+		fatal("sample: interval must be greater than 0");
+	if (*sample_profile_file)
+		sample_profile();
+	else if (*sample_bbv_file)
+		sample_simulate();
+}
@@ -212,9 +212,9 @@ void tcache_new_uop(struct tcache_t *tcache, struct uop_t *uop)
 
 	/* If there is not enough space for macroinst, commit trace.
 	 * If macroinst does not fit in line, it cannot be included in the trace. */
-	assert(!uop->specmode);
+	assert(!UOP_HOT(uop, specmode));
 	assert(uop->eip);
-	assert(uop->seq == uop->mop_seq);
+	assert(UOP_HOT(uop, seq) == uop->mop_seq);
 	if (trace->uop_count + uop->mop_count > tcache_trace_size)
 		tcache_flush_trace(tcache);
 	if (uop->mop_count > tcache_trace_size)
@@ -233,7 +233,7 @@ void tcache_new_uop(struct tcache_t *tcache, struct uop_t *uop)
 
 	/* Instruction is branch. If maximum number of branches is reached,
 	 * commit trace. */
-	if (uop->flags & FCTRL) {
+	if (UOP_HOT(uop, flags) & FCTRL) {
 		taken = uop->neip != uop->eip + uop->mop_size;
 		trace->branch_mask |= 1 << trace->branch_count;
 		trace->branch_flags |= taken << trace->branch_count;
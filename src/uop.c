@@ -93,9 +93,6 @@ struct uop_table_entry_t {
 static struct uop_table_entry_t *uop_table[x86_opcode_count];
 
 
-static struct repos_t *uop_repos;
-
-
 static void uop_table_entry_add(x86_opcode_t opcode,
 	struct uop_table_entry_t *entry)
 {
@@ -117,8 +114,6 @@ void uop_init()
 	struct uop_table_entry_t *entry;
 	int i, j;
 
-	uop_repos = repos_create(sizeof(struct uop_t), "uop_repos");
-
 #define X86_INST(_opcode) opcode = op_##_opcode;
 #define UOP(_uop, _idep0, _idep1, _idep2, _odep0, _odep1, _odep2, _odep3) \
 	entry = calloc(1, sizeof(struct uop_table_entry_t)); \
@@ -158,6 +153,7 @@ void uop_done()
 {
 	x86_opcode_t opcode;
 	struct uop_table_entry_t *entry;
+
 	for (opcode = 0; opcode < x86_opcode_count; opcode++) {
 		while (uop_table[opcode]) {
 			entry = uop_table[opcode]->next;
@@ -165,8 +161,142 @@ void uop_done()
 			uop_table[opcode] = entry;
 		}
 	}
+}
+
+
+/* Resize an array of the uop ring with 'old' elements to 'size' elements,
+ * and clear the new ones */
+static void *uop_ring_realloc(void *array, uint32_t old, uint32_t size, int elem_size)
+{
+	array = realloc(array, (size_t) size * elem_size);
+	if (!array)
+		fatal("uop ring: out of memory");
+	memset((char *) array + (size_t) old * elem_size, 0, (size_t) (size - old) * elem_size);
+	return array;
+}
+
+
+/* Grow a uop ring to 'size' slots. Uops already allocated keep their
+ * chunks, and new slots are searched first. */
+static void uop_ring_grow(struct uop_ring_t *ring, uint32_t size)
+{
+	uint32_t old = ring->size;
+	uint32_t chunk;
+
+	ring->uop = uop_ring_realloc(ring->uop, old / UOP_RING_CHUNK,
+		size / UOP_RING_CHUNK, sizeof(struct uop_t *));
+#define UOP_RING_GROW(field, count) \
+	ring->field = uop_ring_realloc(ring->field, old * (count), \
+		size * (count), sizeof(*ring->field))
+	UOP_RING_GROW(busy, 1);
+	UOP_RING_GROW(seq, 1);
+	UOP_RING_GROW(di_seq, 1);
+	UOP_RING_GROW(when, 1);
+	UOP_RING_GROW(flags, 1);
+	UOP_RING_GROW(ready, 1);
+	UOP_RING_GROW(specmode, 1);
+	UOP_RING_GROW(wait, 1);
+	UOP_RING_GROW(iq_prev, 1);
+	UOP_RING_GROW(iq_next, 1);
+	UOP_RING_GROW(ready_prev, 1);
+	UOP_RING_GROW(ready_next, 1);
+	UOP_RING_GROW(eventq_next, 1);
+	UOP_RING_GROW(age_prev[0], 1);
+	UOP_RING_GROW(age_prev[1], 1);
+	UOP_RING_GROW(age_next[0], 1);
+	UOP_RING_GROW(age_next[1], 1);
+	UOP_RING_GROW(wakeup_prev, IDEP_COUNT);
+	UOP_RING_GROW(wakeup_next, IDEP_COUNT);
+#undef UOP_RING_GROW
+
+	for (chunk = old / UOP_RING_CHUNK; chunk < size / UOP_RING_CHUNK; chunk++) {
+		ring->uop[chunk] = calloc(UOP_RING_CHUNK, sizeof(struct uop_t));
+		if (!ring->uop[chunk])
+			fatal("uop ring: out of memory");
+	}
+	ring->size = size;
+	ring->next = old;
+}
+
+
+/* Create the uop ring of a core. Its initial size holds the uops in the
+ * queues of all threads of the core in most cases. */
+struct uop_ring_t *uop_ring_create(void)
+{
+	struct uop_ring_t *ring;
+	uint32_t size = UOP_RING_CHUNK;
+
+	while (size < p_threads * (fetchq_size + uopq_size + rob_size + lsq_size))
+		size <<= 1;
+	ring = calloc(1, sizeof(struct uop_ring_t));
+	uop_ring_grow(ring, size);
+
+	/* Slot 0 is not used */
+	ring->busy[0] = 1;
+	ring->count = 1;
+	ring->next = 1;
+	return ring;
+}
 
-	repos_free(uop_repos);
+
+void uop_ring_free(struct uop_ring_t *ring)
+{
+	uint32_t chunk;
+
+	for (chunk = 0; chunk < ring->size / UOP_RING_CHUNK; chunk++)
+		free(ring->uop[chunk]);
+	free(ring->uop);
+	free(ring->busy);
+	free(ring->seq);
+	free(ring->di_seq);
+	free(ring->when);
+	free(ring->flags);
+	free(ring->ready);
+	free(ring->specmode);
+	free(ring->wait);
+	free(ring->iq_prev);
+	free(ring->iq_next);
+	free(ring->ready_prev);
+	free(ring->ready_next);
+	free(ring->eventq_next);
+	free(ring->age_prev[0]);
+	free(ring->age_prev[1]);
+	free(ring->age_next[0]);
+	free(ring->age_next[1]);
+	free(ring->wakeup_prev);
+	free(ring->wakeup_next);
+	free(ring);
+}
+
+
+/* Allocate the first free slot of the ring from 'next' on. Since uops are
+ * mostly freed in the order they are created, it is usually 'next' itself. */
+static struct uop_t *uop_create(int core)
+{
+	struct uop_ring_t *ring = CORE.uop_ring;
+	struct uop_t *uop;
+	uint32_t index;
+
+	if (ring->count == ring->size)
+		uop_ring_grow(ring, ring->size * 2);
+	for (index = ring->next; ring->busy[index]; index = (index + 1) & (ring->size - 1));
+	ring->next = (index + 1) & (ring->size - 1);
+	ring->busy[index] = 1;
+	ring->count++;
+
+	uop = UOP_GET(ring, index);
+	memset(uop, 0, sizeof(struct uop_t));
+	uop->core = core;
+	uop->index = index;
+	uop->mop_opcode = isa_inst.opcode;
+	ring->seq[index] = 0;
+	ring->di_seq[index] = 0;
+	ring->when[index] = 0;
+	ring->flags[index] = 0;
+	ring->ready[index] = 0;
+	ring->specmode[index] = 0;
+	ring->wait[index] = 0;
+	return uop;
 }
 
 
@@ -219,7 +349,7 @@ static int uop_dep_parse(struct list_t *uop_list, int dep)
 }
 
 
-static int uop_idep_parse(struct list_t *uop_list, int dep)
+static int uop_idep_parse(struct list_t *uop_list, int dep, int core)
 {
 	struct uop_t *uop;
 
@@ -231,23 +361,23 @@ static int uop_idep_parse(struct list_t *uop_list, int dep)
 	{
 		
 		/* Compute effective address */
-		uop = repos_create_object(uop_repos);
+		uop = uop_create(core);
 		uop->uop = uop_effaddr;
 		uop->idep[0] = isa_inst.segment ? isa_inst.segment - reg_es + DES : DNONE;
 		uop->idep[1] = isa_inst.ea_base ? isa_inst.ea_base - reg_eax + DEAX : DNONE;
 		uop->idep[2] = isa_inst.ea_index ? isa_inst.ea_index - reg_eax + DEAX : DNONE;
 		uop->odep[0] = DEA;
 		uop->fu_class = uop_bank[uop->uop].fu_class;
-		uop->flags = uop_bank[uop->uop].flags;
+		UOP_HOT(uop, flags) = uop_bank[uop->uop].flags;
 		list_add(uop_list, uop);
 
 		/* Load */
-		uop = repos_create_object(uop_repos);
+		uop = uop_create(core);
 		uop->uop = uop_load;
 		uop->idep[0] = DEA;
 		uop->odep[0] = DDATA;
 		uop->fu_class = uop_bank[uop->uop].fu_class;
-		uop->flags = uop_bank[uop->uop].flags;
+		UOP_HOT(uop, flags) = uop_bank[uop->uop].flags;
 		list_add(uop_list, uop);
 
 		/* Input dependence of instruction is converted into DDATA */
@@ -267,7 +397,7 @@ static int uop_idep_parse(struct list_t *uop_list, int dep)
 }
 
 
-static int uop_odep_parse(struct list_t *uop_list, int dep)
+static int uop_odep_parse(struct list_t *uop_list, int dep, int core)
 {
 	struct uop_t *uop;
 
@@ -279,23 +409,23 @@ static int uop_odep_parse(struct list_t *uop_list, int dep)
 		 * FIXME: The address computation should be removed if there was a
 		 * previous load with the same effective address (e.g. DRM32
 		 * as source and destination dependence. */
-		uop = repos_create_object(uop_repos);
+		uop = uop_create(core);
 		uop->uop = uop_effaddr;
 		uop->idep[0] = isa_inst.segment ? isa_inst.segment - reg_es + DES : DNONE;
 		uop->idep[1] = isa_inst.ea_base ? isa_inst.ea_base - reg_eax + DEAX : DNONE;
 		uop->idep[2] = isa_inst.ea_index ? isa_inst.ea_index - reg_eax + DEAX : DNONE;
 		uop->odep[0] = DEA;
 		uop->fu_class = uop_bank[uop->uop].fu_class;
-		uop->flags = uop_bank[uop->uop].flags;
+		UOP_HOT(uop, flags) = uop_bank[uop->uop].flags;
 		list_add(uop_list, uop);
 
 		/* Store */
-		uop = repos_create_object(uop_repos);
+		uop = uop_create(core);
 		uop->uop = uop_store;
 		uop->idep[0] = DEA;
 		uop->idep[1] = DDATA;
 		uop->fu_class = uop_bank[uop->uop].fu_class;
-		uop->flags = uop_bank[uop->uop].flags;
+		UOP_HOT(uop, flags) = uop_bank[uop->uop].flags;
 		list_add(uop_list, uop);
 
 		/* Output dependence of instruction is DDATA */
@@ -309,17 +439,27 @@ static int uop_odep_parse(struct list_t *uop_list, int dep)
 
 void uop_free_if_not_queued(struct uop_t *uop)
 {
+	struct uop_ring_t *ring = UOP_RING(uop);
+
 	if (uop->in_fetchq || uop->in_uopq || uop->in_iq ||
 		uop->in_lq || uop->in_sq ||
 		uop->in_rob || uop->in_eventq)
 		return;
-	repos_free_object(uop_repos, uop);
+	assert(uop_exists(uop));
+	ring->busy[uop->index] = 0;
+	ring->count--;
 }
 
 
 int uop_exists(struct uop_t *uop)
 {
-	return repos_allocated_object(uop_repos, uop);
+	struct uop_ring_t *ring;
+
+	if (!uop)
+		return 0;
+	ring = UOP_RING(uop);
+	return uop->index && uop->index < ring->size &&
+		ring->busy[uop->index] && UOP_GET(ring, uop->index) == uop;
 }
 
 
@@ -401,29 +541,10 @@ void uop_lnlist_dump(struct lnlist_t *uop_list, FILE *f)
 }
 
 
-/* Update 'uop->ready' field of all instructions in a list as per the result
- * obtained by 'rf_ready'. The 'uop->ready' field is redundant and should always
- * match the return value of 'rf_ready' while an uop is in the ROB.
- * A debug message is dumped when the uop transitions to ready. */
-void uop_lnlist_check_if_ready(struct lnlist_t *uop_list)
-{
-	struct uop_t *uop;
-	lnlist_head(uop_list);
-	for (lnlist_head(uop_list); !lnlist_eol(uop_list); lnlist_next(uop_list)) {
-		uop = lnlist_get(uop_list);
-		if (uop->ready || !rf_ready(uop))
-			continue;
-		uop->ready = 1;
-		esim_debug("uop action=\"update\", core=%d, seq=%lld, ready=1\n",
-			uop->core, (long long) uop->di_seq);
-	}
-}
-
-
 /* Decode the macroinstruction currently stored in 'isa_inst', and insert
- * uops into 'list'. If any decoded microinstruction is a control instruction,
- * return it, otherwise return the first decoded uop. */
-struct uop_t *uop_decode(struct list_t *list)
+ * uops for 'core' into 'list'. If any decoded microinstruction is a control
+ * instruction, return it, otherwise return the first decoded uop. */
+struct uop_t *uop_decode(struct list_t *list, int core)
 {
 	struct uop_table_entry_t *entry;
 	struct uop_t *uop, *ret = NULL;
@@ -435,24 +556,24 @@ struct uop_t *uop_decode(struct list_t *list)
 		/* Create uop. No more uops allowed if a control uop was found. */
 		if (ret)
 			panic("uop_decode: no uop allowed after control uop");
-		uop = repos_create_object(uop_repos);
+		uop = uop_create(core);
 
 		/* Input dependencies, maybe add 'load' uops to the list */
 		for (i = 0; i < IDEP_COUNT; i++)
-			uop->idep[i] = uop_idep_parse(list, entry->idep[i]);
+			uop->idep[i] = uop_idep_parse(list, entry->idep[i], core);
 
 		/* Insert uop */
 		list_add(list, uop);
 
 		/* Output dependencies, maybe add 'store' uops to the list */
 		for (i = 0; i < ODEP_COUNT; i++)
-			uop->odep[i] = uop_odep_parse(list, entry->odep[i]);
+			uop->odep[i] = uop_odep_parse(list, entry->odep[i], core);
 
 		/* Rest */
 		uop->uop = entry->uop;
 		uop->fu_class = uop_bank[entry->uop].fu_class;
-		uop->flags = uop_bank[entry->uop].flags;
-		if (uop->flags & FCTRL)
+		UOP_HOT(uop, flags) = uop_bank[entry->uop].flags;
+		if (UOP_HOT(uop, flags) & FCTRL)
 			ret = uop;
 	}
 
@@ -28,42 +28,31 @@ void writeback_core(int core)
 
 	for (;;) {
 	
-		/* Peek element from the head of the event queue */
-		lnlist_head(CORE.eventq);
-		uop = lnlist_get(CORE.eventq);
-		if (lnlist_error(CORE.eventq))
-			break;
-
-		/* A memory uop placed in the event queue is always complete.
-		 * Other uops are complete when uop->when is equals to sim_cycle. */
-		if (uop->flags & FMEM)
-			uop->when = sim_cycle;
-		if (uop->when > sim_cycle)
+		/* Extract the next uop completing in this cycle from the event
+		 * queue. Memory uops with a completed access come first. */
+		uop = eventq_extract(core);
+		if (!uop)
 			break;
 		
 		/* Check element integrity */
 		assert(uop_exists(uop));
-		assert(uop->when == sim_cycle);
+		assert(UOP_HOT(uop, when) == sim_cycle);
 		assert(uop->core == core);
-		assert(uop->ready);
+		assert(UOP_HOT(uop, ready));
 		assert(!uop->completed);
-		
-		/* Extract element from event queue. */
-		lnlist_remove(CORE.eventq);
-		uop->in_eventq = 0;
 		thread = uop->thread;
 		
 		/* If a mispredicted branch is solved and recovery is configured to be
 		 * performed at writeback, schedule it for the end of the iteration. */
 		if (p_recover_kind == p_recover_kind_writeback &&
-			(uop->flags & FCTRL) && !uop->specmode &&
+			(UOP_HOT(uop, flags) & FCTRL) && !UOP_HOT(uop, specmode) &&
 			uop->neip != uop->pred_neip)
 			recover = 1;
 
 		/* Debug */
 		esim_debug("uop action=\"update\", core=%d, seq=%llu,"
 			" stg_writeback=1, completed=1\n",
-			uop->core, (long long unsigned) uop->di_seq);
+			uop->core, (long long unsigned) UOP_HOT(uop, di_seq));
 
 		/* Writeback */
 		uop->completed = 1;